@@ -0,0 +1,370 @@
+#!/bin/bash
+#
+# End-to-end benchmarks of LANScanner: runs the real scanner against
+# reproducible setups in network namespaces, checks what it found against
+# what was set up, and appends one JSON object per scenario to BENCH_OUTPUT
+# (a summary of each is printed as it finishes).
+#
+# Usage: bench.sh <LANScanner> <bench_listen>
+#
+# Scenarios:
+#   loopback  127.0.0.0/16 over loopback, with BENCH_PORTS listening
+#   loopback-uring  loopback scanned by the io_uring connect backend
+#   netns     a /16 behind a veth pair, with BENCH_HOSTS hosts up
+#   delay     netns with BENCH_DELAY of netem delay each way
+#   loss      netns with BENCH_LOSS of netem loss each way
+#   icmp      netns swept with ICMP echo requests, sent in batches of
+#             BENCH_SEND_BATCH per system call
+#   icmp-single  icmp with one request per system call, for comparison
+#
+# Settings (from the environment):
+#   BENCH_SCENARIOS  scenarios to run (loopback loopback-uring netns delay
+#                    loss icmp icmp-single)
+#   BENCH_PORTS      ports probed in the loopback scenarios (8000-8003)
+#   BENCH_HOSTS      hosts up in the netns scenarios (256)
+#   BENCH_DELAY      delay of the delay scenario (20ms 5ms)
+#   BENCH_LOSS       loss of the loss scenario (2%)
+#   BENCH_TIMEOUT    probe timeout in milliseconds (500)
+#   BENCH_SEND_BATCH probes per system call in the icmp scenario (32)
+#   BENCH_ARGS       further scanner options (-m 4096)
+#   BENCH_OUTPUT     file results are appended to (bench.jsonl)
+#
+# Needs root and iproute2; delay and loss also need the netem qdisc. A
+# scenario that can't be set up is recorded as skipped.
+
+SCANNER=$1
+LISTENER=$2
+
+SCENARIOS=${BENCH_SCENARIOS:-loopback loopback-uring netns delay loss icmp
+icmp-single}
+PORTS=${BENCH_PORTS:-8000-8003}
+HOSTS=${BENCH_HOSTS:-256}
+DELAY=${BENCH_DELAY:-20ms 5ms}
+LOSS=${BENCH_LOSS:-2%}
+TIMEOUT=${BENCH_TIMEOUT:-500}
+SEND_BATCH=${BENCH_SEND_BATCH:-32}
+ARGS=${BENCH_ARGS:--m 4096}
+OUTPUT=${BENCH_OUTPUT:-bench.jsonl}
+
+SCAN_NS=lsbench-scan
+PEER_NS=lsbench-peer
+WORK=$(mktemp -d)
+LISTENER_PID=
+
+if [ $# -ne 2 ] || [ ! -x "$SCANNER" ] || [ ! -x "$LISTENER" ]
+then
+    echo "Usage: $0 <LANScanner> <bench_listen>" >&2
+    exit 1
+fi
+
+cleanup()
+{
+    if [ -n "$LISTENER_PID" ]
+    then
+        kill "$LISTENER_PID" 2>/dev/null
+        wait "$LISTENER_PID" 2>/dev/null
+        LISTENER_PID=
+    fi
+
+    ip netns del "$SCAN_NS" 2>/dev/null
+    ip netns del "$PEER_NS" 2>/dev/null
+}
+
+trap 'cleanup; rm -rf "$WORK"' EXIT
+
+#
+# Records a scenario that could not be run
+#
+skip()
+{
+    echo "[*] $1: skipped ($2)" >&2
+    printf '{"scenario":"%s","skipped":"%s"}\n' "$1" "$2" >> "$OUTPUT"
+}
+
+#
+# Prints the number of ports in a list such as 22,80,8000-8100
+#
+count_ports()
+{
+    echo "$1" | tr ',' '\n' | awk -F- '
+        { n += NF == 2 ? $2 - $1 + 1 : 1 }
+        END { print n }'
+}
+
+#
+# Prints the address at the given offset from 10.202.0.0
+#
+host_at()
+{
+    echo "10.202.$(($1 / 256)).$(($1 % 256))"
+}
+
+#
+# Sets up the loopback scenario: a namespace with loopback up and a veth
+# pair for the scanner to use as its device, with BENCH_PORTS listening on
+# every address. Every address of 127.0.0.0/16 is up, with every port open.
+#
+setup_loopback()
+{
+    ip netns add "$SCAN_NS" || return 1
+    ip -n "$SCAN_NS" link set lo up || return 1
+    ip -n "$SCAN_NS" link add lsb0 type veth peer name lsb1 || return 1
+    ip -n "$SCAN_NS" addr add 10.203.0.1/30 dev lsb0 || return 1
+    ip -n "$SCAN_NS" link set lsb0 up || return 1
+    ip -n "$SCAN_NS" link set lsb1 up || return 1
+
+    ip netns exec "$SCAN_NS" "$LISTENER" "$PORTS" > "$WORK/listener" &
+    LISTENER_PID=$!
+
+    for i in $(seq 50)
+    do
+        grep -q ready "$WORK/listener" && break
+        sleep 0.1
+    done
+
+    grep -q ready "$WORK/listener" || return 1
+
+    awk 'BEGIN {
+        for (i = 0; i < 65536; i++)
+        {
+            printf "127.0.%d.%d\n", i / 256, i % 256
+        }
+    }' > "$WORK/truth"
+
+    DEVICE=lsb0
+    TARGETS=127.0.0.0/16
+    SCAN_PORTS=$PORTS
+    OPEN=$((65536 * $(count_ports "$PORTS")))
+}
+
+#
+# Sets up the netns scenarios: the scanner's namespace reaches a /16 through
+# a veth pair to a peer namespace, which holds BENCH_HOSTS of its addresses
+# (spread over it) and drops probes of the rest. The scanner's own address
+# and the broadcast address count as up, as they are reported.
+#
+setup_netns()
+{
+    local i=1 n=0 offset=0
+
+    ip netns add "$SCAN_NS" || return 1
+    ip netns add "$PEER_NS" || return 1
+    ip -n "$SCAN_NS" link add lsbs type veth peer name lsbp \
+        netns "$PEER_NS" || return 1
+    ip -n "$SCAN_NS" addr add 10.202.0.1/16 brd + dev lsbs || return 1
+    ip -n "$SCAN_NS" addr add 10.200.0.1/30 dev lsbs || return 1
+    ip -n "$SCAN_NS" link set lsbs up || return 1
+    ip -n "$SCAN_NS" route replace 10.202.0.0/16 via 10.200.0.2 \
+        dev lsbs || return 1
+    ip -n "$PEER_NS" addr add 10.200.0.2/30 dev lsbp || return 1
+    ip -n "$PEER_NS" link set lsbp up || return 1
+    ip -n "$PEER_NS" link set lo up || return 1
+
+    printf '10.202.0.1\n10.202.255.255\n' > "$WORK/truth"
+
+    #
+    # Multiplying by an odd number permutes the offsets of a /16, spreading
+    # the hosts without repeating any
+    #
+    while [ "$n" -lt "$HOSTS" ]
+    do
+        offset=$((i * 40503 % 65536))
+        i=$((i + 1))
+
+        if [ "$offset" -le 1 ] || [ "$offset" -eq 65535 ]
+        then
+            continue
+        fi
+
+        host_at "$offset" >> "$WORK/truth"
+        echo "addr add $(host_at "$offset")/32 dev lo"
+        n=$((n + 1))
+    done | ip -n "$PEER_NS" -batch - || return 1
+
+    DEVICE=lsbs
+    TARGETS=
+    SCAN_PORTS=
+    OPEN=
+}
+
+#
+# Adds a netem qdisc with the given parameters to both ends of the veth pair
+#
+add_netem()
+{
+    ip netns exec "$SCAN_NS" tc qdisc add dev lsbs root netem $1 \
+        2>/dev/null \
+        && ip netns exec "$PEER_NS" tc qdisc add dev lsbp root netem $1 \
+        2>/dev/null
+}
+
+#
+# Scans the scenario set up last, and appends its results to BENCH_OUTPUT
+#
+run_scenario()
+{
+    local name=$1 times=
+
+    TIMEFORMAT='%R %U %S'
+    times=$( { time ip netns exec "$SCAN_NS" "$SCANNER" -d "$DEVICE" \
+               $SCAN_TYPE -t "$TIMEOUT" ${SCAN_PORTS:+-p "$SCAN_PORTS"} \
+               -o jsonl $ARGS $TARGETS > "$WORK/results" \
+               2> "$WORK/errors" ; } 2>&1 )
+
+    if [ -s "$WORK/errors" ]
+    then
+        sed "s/^/[$name] /" "$WORK/errors" >&2
+    fi
+
+    grep -o '"rtt_us":[0-9.]*' "$WORK/results" | cut -d: -f2 | sort -n \
+        > "$WORK/rtts"
+
+    awk -v name="$name" -v times="$times" -v open_expected="$OPEN" \
+        -v rtts="$WORK/rtts" '
+        function field(name,    s)
+        {
+            if (!match($0, "\"" name "\":\"?[^\",}]*"))
+            {
+                return ""
+            }
+
+            s = substr($0, RSTART + length(name) + 3,
+                       RLENGTH - length(name) - 3)
+            sub(/^"/, "", s)
+
+            return s
+        }
+
+        function percentile(p)
+        {
+            return n ? rtt[int((n * p + 99) / 100)] : 0
+        }
+
+        FNR == NR {
+            truth[$1] = 1
+            expected++
+            next
+        }
+
+        {
+            addr = field("addr")
+            targets[addr] = 1
+            probes++
+
+            if (field("state") == "up")
+            {
+                up[addr] = 1
+            }
+
+            if (field("port_state") == "open")
+            {
+                open++
+            }
+        }
+
+        END {
+            while ((getline v < rtts) > 0)
+            {
+                rtt[++n] = v
+            }
+
+            for (addr in up)
+            {
+                if (addr in truth)
+                {
+                    found++
+                }
+                else
+                {
+                    spurious++
+                }
+            }
+
+            for (addr in targets)
+            {
+                hosts++
+            }
+
+            split(times, t, " ")
+            printf "{\"scenario\":\"%s\",\"hosts\":%d,\"probes\":%d,", name,
+                   hosts, probes
+            printf "\"wall_s\":%.3f,\"hosts_per_sec\":%.1f,", t[1],
+                   (t[1] > 0 ? hosts / t[1] : 0)
+            printf "\"probes_per_sec\":%.1f,", (t[1] > 0 ? probes / t[1] : 0)
+            printf "\"cpu_user_s\":%.3f,\"cpu_sys_s\":%.3f,", t[2], t[3]
+            printf "\"rtt_us\":{\"count\":%d,\"p50\":%.3f,\"p90\":%.3f,", n,
+                   percentile(50), percentile(90)
+            printf "\"p99\":%.3f,\"max\":%.3f},", percentile(99),
+                   n ? rtt[n] : 0
+            printf "\"expected_up\":%d,\"found_up\":%d,\"missed\":%d,",
+                   expected, found, expected - found
+            printf "\"spurious\":%d", spurious
+
+            if (open_expected != "")
+            {
+                printf ",\"expected_open\":%d,\"found_open\":%d",
+                       open_expected, open
+            }
+
+            printf "}\n"
+
+            printf "[*] %s: %d hosts in %.3fs (%.1f hosts/s), %d/%d up " \
+                   "found, %d spurious, rtt p50/p99 %.3f/%.3f us\n", name,
+                   hosts, t[1], (t[1] > 0 ? hosts / t[1] : 0), found,
+                   expected, spurious, percentile(50),
+                   percentile(99) > "/dev/stderr"
+        }' "$WORK/truth" "$WORK/results" >> "$OUTPUT"
+}
+
+if [ "$(id -u)" -ne 0 ] || ! command -v ip > /dev/null
+then
+    for name in $SCENARIOS
+    do
+        skip "$name" "needs root and iproute2"
+    done
+
+    exit 0
+fi
+
+for name in $SCENARIOS
+do
+    cleanup
+    SCAN_TYPE=-sC
+
+    case $name in
+        loopback)
+            setup_loopback || { skip "$name" "setup failed"; continue; }
+            ;;
+        loopback-uring)
+            setup_loopback || { skip "$name" "setup failed"; continue; }
+            SCAN_TYPE="-sC -b uring"
+            ;;
+        netns)
+            setup_netns || { skip "$name" "setup failed"; continue; }
+            ;;
+        delay)
+            setup_netns || { skip "$name" "setup failed"; continue; }
+            add_netem "delay $DELAY" \
+                || { skip "$name" "netem unavailable"; continue; }
+            ;;
+        loss)
+            setup_netns || { skip "$name" "setup failed"; continue; }
+            add_netem "loss $LOSS" \
+                || { skip "$name" "netem unavailable"; continue; }
+            ;;
+        icmp)
+            setup_netns || { skip "$name" "setup failed"; continue; }
+            SCAN_TYPE="-sI --send-batch $SEND_BATCH"
+            ;;
+        icmp-single)
+            setup_netns || { skip "$name" "setup failed"; continue; }
+            SCAN_TYPE="-sI --send-batch 1"
+            ;;
+        *)
+            skip "$name" "unknown scenario"
+            continue
+            ;;
+    esac
+
+    run_scenario "$name"
+done
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packets.h"
+#include "util.h"
+
+/*
+ * Measures the throughput of every implementation of ip_checksum this CPU
+ * runs over a range of payload sizes, printing one JSON object per
+ * implementation and size to stdout and a summary of each to stderr.
+ *
+ * Usage: bench_checksum [milliseconds per measurement]
+ */
+
+/*
+ * Time spent on each implementation and size unless given on the command line
+ */
+#define BENCH_MS        200
+
+/*
+ * Payload sizes measured: headers, small and full-sized packets, jumbo frames
+ * and batches of packets
+ */
+static const size_t sizes[] = {20, 40, 64, 576, 1500, 9000, 65536, 1048576};
+
+int
+main(int argc, char *argv[])
+{
+    const struct checksum_impl *impls = NULL;
+    size_t count = checksum_impls(&impls), i = 0, j = 0, max = 0;
+    uint64_t budget = BENCH_MS * 1000000ULL, start = 0, elapsed = 0;
+    uint64_t rounds = 0, batch = 0, r = 0;
+    unsigned char *buf = NULL;
+    volatile uint16_t sink = 0;
+    double gbps = 0;
+
+    if (argc > 2 || (argc == 2 && !(budget = strtoull(argv[1], NULL, 10)
+                                               * 1000000ULL)))
+    {
+        fprintf(stderr, "Usage: %s [milliseconds per measurement]\n",
+                argv[0]);
+        return 1;
+    }
+
+    max = sizes[sizeof(sizes) / sizeof(*sizes) - 1];
+    buf = malloc(max);
+
+    if (!buf)
+    {
+        perror("[!] Failed to allocate buffer");
+        return 1;
+    }
+
+    for (i = 0; i < max; i++)
+    {
+        buf[i] = (unsigned char) rand();
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+    {
+        for (j = 0; j < count; j++)
+        {
+            /*
+             * Run in batches of about 64 KiB between clock reads, so that
+             * reading the clock doesn't dominate the small sizes
+             */
+            batch = 65536 / sizes[i] + 1;
+            rounds = 0;
+            start = monotonic_ns();
+
+            do
+            {
+                for (r = 0; r < batch; r++)
+                {
+                    sink += impls[j].sum(buf, sizes[i]);
+                }
+
+                rounds += batch;
+                elapsed = monotonic_ns() - start;
+            } while (elapsed < budget);
+
+            gbps = (double) (rounds * sizes[i]) / (double) elapsed;
+
+            printf("{\"benchmark\":\"checksum\",\"impl\":\"%s\","
+                   "\"bytes\":%zu,\"ns_per_call\":%.2f,\"gb_per_sec\":%.3f}\n",
+                   impls[j].name, sizes[i], (double) elapsed / rounds, gbps);
+            fprintf(stderr, "[*] checksum %-9s %8zu bytes: %7.3f GB/s\n",
+                    impls[j].name, sizes[i], gbps);
+        }
+    }
+
+    free(buf);
+
+    return 0;
+}
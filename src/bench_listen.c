@@ -0,0 +1,100 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ports.h"
+#include "socket_util.h"
+
+/*
+ * Listens on a list of TCP ports (on every address) for the benchmarks,
+ * accepting and closing every connection, until it is killed. Prints "ready"
+ * once every port is listening.
+ *
+ * Usage: bench_listen <ports>
+ */
+
+/*
+ * Connections queued on each port before the kernel starts dropping them; the
+ * benchmarks connect far faster than one accept at a time drains them
+ */
+#define LISTEN_BACKLOG  4096
+
+int
+main(int argc, char *argv[])
+{
+    int fd = -1, one = 1;
+    uint16_t *ports = NULL;
+    uint32_t nports = 0, i = 0;
+    struct pollfd *pfds = NULL;
+    struct sockaddr_in addr = {0};
+
+    if (argc != 2 || parse_ports(argv[1], &ports, &nports))
+    {
+        fprintf(stderr, "Usage: %s <ports>\n", argv[0]);
+        return 1;
+    }
+
+    pfds = calloc(nports, sizeof(*pfds));
+
+    if (!pfds)
+    {
+        perror("[!] Failed to allocate listeners");
+        return 1;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    for (i = 0; i < nports; i++)
+    {
+        pfds[i].fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+        pfds[i].events = POLLIN;
+        addr.sin_port = htons(ports[i]);
+
+        if (pfds[i].fd == -1
+            || setsockopt(pfds[i].fd, SOL_SOCKET, SO_REUSEADDR, &one,
+                          sizeof(one))
+            || bind(pfds[i].fd, (struct sockaddr *) &addr, sizeof(addr))
+            || listen(pfds[i].fd, LISTEN_BACKLOG))
+        {
+            fprintf(stderr, "[!] Failed to listen on port %u: %s\n",
+                    ports[i], strerror(errno));
+            return 1;
+        }
+    }
+
+    puts("ready");
+    fflush(stdout);
+
+    for (;;)
+    {
+        if (poll(pfds, nports, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            perror("[!] Failed to wait for connections");
+            return 1;
+        }
+
+        for (i = 0; i < nports; i++)
+        {
+            if (!(pfds[i].revents & POLLIN))
+            {
+                continue;
+            }
+
+            while ((fd = accept(pfds[i].fd, NULL, NULL)) != -1)
+            {
+                close_sock(fd);
+            }
+        }
+    }
+}
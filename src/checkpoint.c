@@ -0,0 +1,434 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "results.h"
+#include "util.h"
+
+/*
+ * FNV-1a parameters, for fingerprinting scans
+ */
+#define FNV_OFFSET_BASIS    0xcbf29ce484222325ULL
+#define FNV_PRIME           0x100000001b3ULL
+
+/*
+ * Folds len bytes of data into the hash h
+ */
+static uint64_t
+fnv1a(uint64_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    while (len--)
+    {
+        h = (h ^ *p++) * FNV_PRIME;
+    }
+
+    return h;
+}
+
+/*
+ * Returns a fingerprint of the targets and ports of the scan sc is set up for
+ */
+static uint64_t
+fingerprint(const struct scanner *sc)
+{
+    uint64_t h = FNV_OFFSET_BASIS;
+    uint32_t start = ntohl(sc->start), end = ntohl(sc->end), ports = 0;
+    size_t i = 0;
+
+    ports = port_count(sc);
+    h = fnv1a(h, &sc->scan_type, sizeof(sc->scan_type));
+    h = fnv1a(h, &ports, sizeof(ports));
+
+    if (ports > 1)
+    {
+        h = fnv1a(h, sc->ports, ports * sizeof(*sc->ports));
+    }
+    else
+    {
+        h = fnv1a(h, &sc->port, sizeof(sc->port));
+    }
+
+    if (!sc->targets)
+    {
+        h = fnv1a(h, &start, sizeof(start));
+        return fnv1a(h, &end, sizeof(end));
+    }
+
+    for (i = 0; i < sc->targets->count; i++)
+    {
+        h = fnv1a(h, &sc->targets->intervals[i].first,
+                  sizeof(sc->targets->intervals[i].first));
+        h = fnv1a(h, &sc->targets->intervals[i].last,
+                  sizeof(sc->targets->intervals[i].last));
+    }
+
+    return h;
+}
+
+/*
+ * Appends the words of results that changed since they were last written.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+static int
+append_changes(struct checkpoint *cp)
+{
+    struct checkpoint_entry batch[CHECKPOINT_BATCH];
+    size_t n = 0;
+    uint64_t w = 0, word = 0;
+
+    for (w = 0; w < cp->words; w++)
+    {
+        word = __atomic_load_n(&cp->results[w], __ATOMIC_RELAXED);
+
+        if (word == cp->written[w])
+        {
+            continue;
+        }
+
+        batch[n].index = w;
+        batch[n].word = word;
+        cp->written[w] = word;
+
+        if (++n == CHECKPOINT_BATCH)
+        {
+            if (write_all(cp->fd, batch, sizeof(batch)))
+            {
+                return -1;
+            }
+
+            n = 0;
+        }
+    }
+
+    return n ? write_all(cp->fd, batch, n * sizeof(*batch)) : 0;
+}
+
+/*
+ * Writer thread: appends new results every CHECKPOINT_INTERVAL_MS until
+ * checkpointing stops
+ */
+static void *
+write_checkpoints(void *arg)
+{
+    struct checkpoint *cp = arg;
+    struct timespec deadline = {0};
+    int failed = 0;
+
+    pthread_mutex_lock(&cp->lock);
+
+    while (!cp->stopping)
+    {
+        cond_deadline(&deadline, CHECKPOINT_INTERVAL_MS);
+
+        if (pthread_cond_timedwait(&cp->wake, &cp->lock, &deadline)
+            != ETIMEDOUT || cp->err)
+        {
+            continue;
+        }
+
+        pthread_mutex_unlock(&cp->lock);
+        failed = append_changes(cp) ? errno : 0;
+        pthread_mutex_lock(&cp->lock);
+
+        if (failed)
+        {
+            cp->err = failed;
+        }
+    }
+
+    pthread_mutex_unlock(&cp->lock);
+
+    return NULL;
+}
+
+/*
+ * Loads the results in the checkpoint file at path into cp.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+static int
+load(struct checkpoint *cp, const char *path, uint64_t print)
+{
+    int fd = -1, err = 0;
+    ssize_t ret = 0;
+    size_t i = 0, n = 0;
+    struct checkpoint_header header = {{0}};
+    struct checkpoint_entry batch[CHECKPOINT_BATCH];
+
+    fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    ret = read(fd, &header, sizeof(header));
+
+    if (ret != (ssize_t) sizeof(header)
+        || memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic))
+        || header.byte_order != CHECKPOINT_BYTE_ORDER
+        || header.count != cp->count || header.fingerprint != print)
+    {
+        err = ret == -1 ? errno : EINVAL;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    /*
+     * A partial entry at the end was cut short by a crash and is ignored
+     */
+    while ((ret = read(fd, batch, sizeof(batch))) > 0)
+    {
+        n = (size_t) ret / sizeof(*batch);
+
+        for (i = 0; i < n; i++)
+        {
+            if (batch[i].index < cp->words)
+            {
+                cp->results[batch[i].index] = batch[i].word;
+            }
+        }
+
+        if ((size_t) ret % sizeof(*batch))
+        {
+            break;
+        }
+    }
+
+    err = errno;
+    close(fd);
+
+    if (ret == -1)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Starts a new checkpoint file at path holding the results in cp (so that a
+ * resumed checkpoint is compacted), replacing any file there atomically, and
+ * leaves it open for appending.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+static int
+start_file(struct checkpoint *cp, const char *path, uint64_t print)
+{
+    int err = 0, failed = 0;
+    char *tmp = NULL;
+    struct checkpoint_header header = {{0}};
+
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.byte_order = CHECKPOINT_BYTE_ORDER;
+    header.count = cp->count;
+    header.fingerprint = print;
+
+    cp->fd = open_tmpfile(path, O_APPEND, &tmp);
+
+    if (cp->fd == -1)
+    {
+        return -1;
+    }
+
+    failed = write_all(cp->fd, &header, sizeof(header)) || append_changes(cp)
+             || fdatasync(cp->fd);
+
+    if (finish_tmpfile(tmp, path, failed))
+    {
+        err = errno;
+        close(cp->fd);
+        cp->fd = -1;
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Frees everything checkpoint_open allocated
+ */
+static void
+release(struct checkpoint *cp)
+{
+    if (cp->fd != -1)
+    {
+        close(cp->fd);
+    }
+
+    free(cp->path);
+    free(cp->results);
+    free(cp->written);
+    free(cp->skip);
+    memset(cp, 0, sizeof(*cp));
+    cp->fd = -1;
+}
+
+int
+checkpoint_open(struct checkpoint *cp, struct scanner *sc, const char *path,
+                int resume)
+{
+    int err = 0;
+    uint64_t i = 0, print = fingerprint(sc);
+
+    memset(cp, 0, sizeof(*cp));
+    cp->fd = -1;
+    cp->count = target_count(sc);
+    cp->words = (cp->count + CHECKPOINT_PER_WORD - 1) / CHECKPOINT_PER_WORD;
+    cp->path = malloc(strlen(path) + 1);
+    cp->results = zmalloc(cp->words * sizeof(*cp->results));
+    cp->written = zmalloc(cp->words * sizeof(*cp->written));
+
+    if (!cp->path || !cp->results || !cp->written)
+    {
+        err = errno;
+        release(cp);
+        errno = err;
+        return -1;
+    }
+
+    strcpy(cp->path, path);
+
+    if (resume)
+    {
+        cp->skip = zmalloc((cp->count + 63) / 64 * sizeof(*cp->skip));
+
+        if (!cp->skip || load(cp, path, print))
+        {
+            err = errno;
+            release(cp);
+            errno = err;
+            return -1;
+        }
+
+        for (i = 0; i < cp->count; i++)
+        {
+            if (cp->results[i / CHECKPOINT_PER_WORD]
+                >> 4 * (i % CHECKPOINT_PER_WORD) & 0xf)
+            {
+                cp->skip[i / 64] |= 1ULL << i % 64;
+            }
+        }
+    }
+
+    if (start_file(cp, path, print))
+    {
+        err = errno;
+        release(cp);
+        errno = err;
+        return -1;
+    }
+
+    pthread_mutex_init(&cp->lock, NULL);
+
+    /*
+     * The writer's deadlines are on the monotonic clock, where available
+     */
+    cond_init(&cp->wake);
+
+    err = pthread_create(&cp->writer, NULL, write_checkpoints, cp);
+
+    if (err)
+    {
+        pthread_cond_destroy(&cp->wake);
+        pthread_mutex_destroy(&cp->lock);
+        release(cp);
+        errno = err;
+        return -1;
+    }
+
+    sc->skip = cp->skip;
+
+    return 0;
+}
+
+void
+checkpoint_record(struct checkpoint *cp, const struct scanner *sc,
+                  uint8_t state)
+{
+    uint64_t offset = 0, entry = (uint64_t) (state | sc->port_state << 2);
+
+    if (!target_offset(sc, sc->target.sin_addr.s_addr, sc->target.sin_port,
+                       &offset))
+    {
+        return;
+    }
+
+    __atomic_fetch_or(&cp->results[offset / CHECKPOINT_PER_WORD],
+                      entry << 4 * (offset % CHECKPOINT_PER_WORD),
+                      __ATOMIC_RELAXED);
+}
+
+void
+checkpoint_replay(const struct checkpoint *cp, struct scanner *sc,
+                  probe_callback_t up_callback, probe_callback_t down_callback)
+{
+    uint64_t i = 0, entry = 0;
+    in_addr_t addr = 0;
+    in_port_t port = 0;
+
+    for (i = 0; i < cp->count; i++)
+    {
+        entry = cp->results[i / CHECKPOINT_PER_WORD]
+                >> 4 * (i % CHECKPOINT_PER_WORD) & 0xf;
+
+        if (!entry)
+        {
+            continue;
+        }
+
+        target_at(sc, i, &addr, &port);
+        report_probe(sc, (entry & 3) == RESULT_UP ? up_callback
+                                                  : down_callback,
+                     addr, port, (uint8_t) (entry >> 2), 0);
+    }
+}
+
+int
+checkpoint_close(struct checkpoint *cp, int finished)
+{
+    int err = 0;
+
+    pthread_mutex_lock(&cp->lock);
+    cp->stopping = 1;
+    pthread_cond_signal(&cp->wake);
+    pthread_mutex_unlock(&cp->lock);
+
+    pthread_join(cp->writer, NULL);
+    pthread_cond_destroy(&cp->wake);
+    pthread_mutex_destroy(&cp->lock);
+
+    err = cp->err;
+
+    if (finished)
+    {
+        unlink(cp->path);
+    }
+    else if (!err && (append_changes(cp) || fdatasync(cp->fd)))
+    {
+        err = errno;
+    }
+
+    release(cp);
+
+    if (err)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
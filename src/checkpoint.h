@@ -0,0 +1,132 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "scanner.h"
+
+/*
+ * How often (in milliseconds) new results are appended to a checkpoint file
+ */
+#define CHECKPOINT_INTERVAL_MS  1000
+
+/*
+ * Number of entries appended to a checkpoint file at a time
+ */
+#define CHECKPOINT_BATCH        4096
+
+/*
+ * Identifies a checkpoint file, and the byte order it was written in
+ */
+#define CHECKPOINT_MAGIC        "LSCHKPNT"
+#define CHECKPOINT_BYTE_ORDER   0x01020304U
+
+/*
+ * Number of targets whose results are held by each word of a checkpoint
+ */
+#define CHECKPOINT_PER_WORD     16
+
+/*
+ * Header of a checkpoint file.
+ *
+ * The file is the header followed by entries, each giving the value of a
+ * word of results at the time it was appended; later entries for a word
+ * supersede earlier ones. Everything is in the byte order of the machine that
+ * wrote it. count is the number of targets in the scan and fingerprint
+ * identifies the targets and ports, so that a checkpoint is only resumed by
+ * the same scan.
+ */
+struct checkpoint_header
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t fingerprint;
+};
+
+struct checkpoint_entry
+{
+    uint64_t index;
+    uint64_t word;
+};
+
+/*
+ * Periodic checkpoint of a scan, from which an interrupted scan can be
+ * resumed.
+ *
+ * results holds four bits for every target in the scan (by offset, see
+ * target_at): the RESULT_* state of the host in the low two bits and the
+ * PORT_* state of the port in the high two, or 0 while the target has no
+ * result. A thread appends the words that changed since the last time
+ * (written holds them as they were then) to the file every
+ * CHECKPOINT_INTERVAL_MS, so recording a result never waits on the disk.
+ * Targets that are still outstanding when the scan is interrupted have no
+ * result yet and are probed again on resume.
+ *
+ * skip marks (a bit per offset) the targets that had results when the
+ * checkpoint was resumed, for the scanner's skip map. err is the errno of the
+ * first append that failed.
+ */
+struct checkpoint
+{
+    int fd;
+    char *path;
+    uint64_t count;
+    uint64_t words;
+    uint64_t *results;
+    uint64_t *written;
+    uint64_t *skip;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t writer;
+    int stopping;
+    int err;
+};
+
+/*
+ * Starts checkpointing the scan sc is set up for to a file at path. If resume
+ * is set, the results in the file are loaded first (and the file compacted),
+ * and sc->skip is pointed at the targets that have them; otherwise, the file
+ * is started over.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error (EINVAL if the
+ * file to resume is not a checkpoint of the same scan).
+ */
+int
+checkpoint_open(struct checkpoint *cp, struct scanner *sc, const char *path,
+                int resume);
+
+/*
+ * Records the result of the probe sc is reporting: the host in the given
+ * RESULT_* state and its port in sc->port_state. Safe to call from several
+ * threads at once.
+ */
+void
+checkpoint_record(struct checkpoint *cp, const struct scanner *sc,
+                  uint8_t state);
+
+/*
+ * Reports the results loaded from a resumed checkpoint again, calling
+ * up_callback for every target that was up and down_callback for every one
+ * that was down (either may be NULL).
+ */
+void
+checkpoint_replay(const struct checkpoint *cp, struct scanner *sc,
+                  probe_callback_t up_callback,
+                  probe_callback_t down_callback);
+
+/*
+ * Appends any results not yet in the file and stops checkpointing. If the
+ * scan is finished, the file is removed, since there is nothing left to
+ * resume. The scanner's skip map must be cleared first if it was set by
+ * checkpoint_open.
+ *
+ * Returns 0 on success; returns -1 and sets errno if appending to the file
+ * failed at any point.
+ */
+int
+checkpoint_close(struct checkpoint *cp, int finished);
+
+#endif /* CHECKPOINT_H */
@@ -8,6 +8,71 @@
 #include "device.h"
 #include "util.h"
 
+/*
+ * Returns 1 if ifap is a running, non-loopback IPv4 interface address (of
+ * the interface named dev_name, if it is not NULL), or 0 otherwise
+ */
+static int
+is_live(const struct ifaddrs *ifap, const char *dev_name)
+{
+    /*
+     * Interface needs to have a local address and netmask
+     */
+    if (!ifap->ifa_addr || !ifap->ifa_netmask)
+    {
+        return 0;
+    }
+
+    /*
+     * If device name has been specified, make sure the suitable interface has
+     * the desired name.
+     */
+    return ifap->ifa_flags & IFF_UP && ifap->ifa_flags & IFF_RUNNING
+           && !(ifap->ifa_flags & IFF_LOOPBACK)
+           && ifap->ifa_addr->sa_family == AF_INET
+           && (!dev_name || !strcmp(ifap->ifa_name, dev_name));
+}
+
+/*
+ * Returns a dynamically allocated device for the interface address ifap, or
+ * NULL (with errno set) upon error
+ */
+static struct device *
+new_device(const struct ifaddrs *ifap)
+{
+    struct device *dev = NULL;
+
+    dev = zmalloc(sizeof(*dev));
+    
+    if (!dev)
+    {
+        return NULL;
+    }
+
+    strncpy(dev->name, ifap->ifa_name, IFNAMSIZ - 1);
+    dev->index = if_nametoindex(ifap->ifa_name);
+    memcpy(&dev->local, ifap->ifa_addr, sizeof(dev->local));
+    memcpy(&dev->netmask, ifap->ifa_netmask, sizeof(dev->netmask));
+
+    /*
+     * Allocate and store broadcast address if interface has one
+     */
+    if (ifap->ifa_dstaddr && ifap->ifa_flags & IFF_BROADCAST)
+    {
+        dev->bcast = zmalloc(sizeof(*dev->bcast));
+
+        if (!dev->bcast)
+        {
+            free(dev);
+            return NULL;
+        }
+
+        memcpy(dev->bcast, ifap->ifa_dstaddr, sizeof(*dev->bcast));
+    }
+
+    return dev;
+}
+
 struct device *
 get_live_device(const char *dev_name)
 {
@@ -19,34 +84,14 @@ get_live_device(const char *dev_name)
         return NULL;
     }
 
+    /*
+     * Find a suitable interface
+     */
     for (ifap = ifa; ifap; ifap = ifap->ifa_next)
     {
-        /*
-         * Interface needs to have a local address and netmask
-         */
-        if (ifap->ifa_addr && ifap->ifa_netmask)
+        if (is_live(ifap, dev_name))
         {
-            /*
-             * Find a suitable interface
-             */
-            if (ifap->ifa_flags & IFF_UP && ifap->ifa_flags & IFF_RUNNING
-                && !(ifap->ifa_flags & IFF_LOOPBACK)
-                && ifap->ifa_addr->sa_family == AF_INET)
-            {
-                /*
-                 * If device name has been specified, make sure the suitable
-                 * interface has the desired name.
-                 */
-                if (dev_name)
-                {
-                    if (strcmp(ifap->ifa_name, dev_name))
-                    {
-                        continue;
-                    }
-                }
-
-                break;
-            }
+            break;
         }
     }
 
@@ -64,38 +109,78 @@ get_live_device(const char *dev_name)
         return NULL;
     }
 
-    dev = zmalloc(sizeof(*dev));
-    
-    if (!dev)
+    dev = new_device(ifap);
+    freeifaddrs(ifa);
+
+    return dev;
+}
+
+int
+get_live_devices(const char *dev_name, struct device ***devs, size_t *ndevs)
+{
+    int err = 0;
+    size_t n = 0, i = 0;
+    struct ifaddrs *ifa = NULL, *ifap = NULL;
+
+    *devs = NULL;
+    *ndevs = 0;
+
+    if (getifaddrs(&ifa))
+    {
+        return -1;
+    }
+
+    for (ifap = ifa; ifap; ifap = ifap->ifa_next)
+    {
+        n += (size_t) is_live(ifap, dev_name);
+    }
+
+    if (!n)
     {
         freeifaddrs(ifa);
-        return NULL;
+        return 0;
     }
 
-    strncpy(dev->name, ifap->ifa_name, IFNAMSIZ);
-    memcpy(&dev->local, ifap->ifa_addr, sizeof(dev->local));
-    memcpy(&dev->netmask, ifap->ifa_netmask, sizeof(dev->netmask));
+    *devs = zmalloc(n * sizeof(**devs));
 
-    /*
-     * Allocate and store broadcast address if interface has one
-     */
-    if (ifap->ifa_dstaddr && ifap->ifa_flags & IFF_BROADCAST)
+    if (!*devs)
     {
-        dev->bcast = zmalloc(sizeof(*dev->bcast));
+        freeifaddrs(ifa);
+        return -1;
+    }
 
-        if (!dev->bcast)
+    for (ifap = ifa; ifap; ifap = ifap->ifa_next)
+    {
+        if (!is_live(ifap, dev_name))
         {
-            free(dev);
+            continue;
+        }
+
+        (*devs)[*ndevs] = new_device(ifap);
+
+        if (!(*devs)[*ndevs])
+        {
+            err = errno;
+
+            for (i = 0; i < *ndevs; i++)
+            {
+                free_device((*devs)[i]);
+            }
+
+            free(*devs);
+            *devs = NULL;
+            *ndevs = 0;
             freeifaddrs(ifa);
-            return NULL;
+            errno = err;
+            return -1;
         }
 
-        memcpy(dev->bcast, ifap->ifa_dstaddr, sizeof(*dev->bcast));
+        (*ndevs)++;
     }
 
     freeifaddrs(ifa);
 
-    return dev;
+    return 0;
 }
 
 void
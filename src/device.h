@@ -3,15 +3,18 @@
 
 #include <net/if.h>
 #include <netinet/in.h>
+#include <stddef.h>
 
 /*
  * Stores the necessary information from an IPv4 network interface.
  *
- * bcast will be NULL if the interface does not have a broadcast address.
+ * index is the interface's index (0 if it could not be looked up). bcast will
+ * be NULL if the interface does not have a broadcast address.
  */
 struct device
 {
     char name[IFNAMSIZ];
+    unsigned int index;
     struct sockaddr_in local;
     struct sockaddr_in netmask;
     struct sockaddr_in *bcast;
@@ -32,6 +35,18 @@ struct device
 struct device *
 get_live_device(const char *dev_name);
 
+/*
+ * Finds every IPv4 address of the running, non-loopback network interfaces
+ * (or only of the interface named dev_name, if it is not NULL), as a device
+ * each, in the order the system lists them.
+ *
+ * On success, returns 0 and stores an array of *ndevs dynamically allocated
+ * devices in *devs, which is NULL if none were found; the array and each of
+ * the devices must be freed. Upon error, returns -1 and sets errno.
+ */
+int
+get_live_devices(const char *dev_name, struct device ***devs, size_t *ndevs);
+
 /*
  * Frees all resources associated with a struct device obtained from
  * get_live_device.
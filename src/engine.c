@@ -0,0 +1,464 @@
+#include <errno.h>
+#include <sys/resource.h>
+
+#include "engine.h"
+
+/*
+ * File descriptors kept in reserve for stdio, the epoll instance, etc. when
+ * sizing the window to the process's file descriptor limit
+ */
+#define ENGINE_RESERVED_FDS 16
+
+uint32_t
+fit_window(uint32_t window)
+{
+    struct rlimit rl = {0};
+    rlim_t wanted = (rlim_t) window + ENGINE_RESERVED_FDS;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl))
+    {
+        return window;
+    }
+
+    if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < wanted)
+    {
+        rl.rlim_cur = rl.rlim_max == RLIM_INFINITY || rl.rlim_max > wanted
+                      ? wanted : rl.rlim_max;
+
+        /*
+         * Not fatal; just work with whatever limit is in place
+         */
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < wanted)
+    {
+        window = rl.rlim_cur > 2 * ENGINE_RESERVED_FDS
+                 ? (uint32_t) (rl.rlim_cur - ENGINE_RESERVED_FDS) : 1;
+    }
+
+    return window;
+}
+
+int
+connect_result(int err)
+{
+    return !err || err == ECONNREFUSED || err == ECONNRESET ? 1 : 0;
+}
+
+uint8_t
+connect_state(int err)
+{
+    if (!err)
+    {
+        return PORT_OPEN;
+    }
+
+    return err == ECONNREFUSED || err == ECONNRESET ? PORT_CLOSED
+                                                    : PORT_FILTERED;
+}
+
+int
+out_of_resources(int err)
+{
+    return err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM
+           || err == EADDRNOTAVAIL || err == EAGAIN;
+}
+
+#ifdef __linux__
+
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "handle_signals.h"
+#include "inflight.h"
+#include "metrics.h"
+#include "rtt.h"
+#include "socket_util.h"
+#include "util.h"
+
+/*
+ * Maximum number of events reaped by a single call to epoll_wait
+ */
+#define ENGINE_MAX_EVENTS   1024
+
+/*
+ * Waits up to wait_ns nanoseconds for events on the epoll instance. Without
+ * epoll_pwait2, or once the kernel turns out not to support it (clearing
+ * *precise), the wait is rounded up to whole milliseconds.
+ */
+static int
+wait_events(int epfd, struct epoll_event *events, uint64_t wait_ns,
+            int *precise)
+{
+#ifdef HAVE_EPOLL_PWAIT2
+    int ret = 0;
+    struct timespec ts = {0};
+
+    if (*precise)
+    {
+        ts.tv_sec = (time_t) (wait_ns / 1000000000ULL);
+        ts.tv_nsec = (long) (wait_ns % 1000000000ULL);
+        ret = epoll_pwait2(epfd, events, ENGINE_MAX_EVENTS, &ts, NULL);
+
+        if (ret != -1 || errno != ENOSYS)
+        {
+            return ret;
+        }
+
+        *precise = 0;
+    }
+#endif
+
+    return epoll_wait(epfd, events, ENGINE_MAX_EVENTS,
+                      (int) ((wait_ns + 999999ULL) / 1000000ULL));
+}
+
+/*
+ * Starts a nonblocking connect to addr:port and adds it to the table and the
+ * epoll instance.
+ *
+ * Returns INFLIGHT_NONE if the probe was not left outstanding, in which case
+ * *result holds the probe result (with errno set if it is -1) and *state the
+ * state of the port. A connect that fails for lack of local ports is an error
+ * rather than a down host.
+ */
+static uint32_t
+launch(struct scanner *sc, int epfd, struct inflight *tbl, in_addr_t addr,
+       in_port_t port, int *result, uint8_t *state)
+{
+    int fd = -1, ret = 0;
+    uint32_t slot = INFLIGHT_NONE;
+    uint64_t start = 0;
+    struct sockaddr_in remote = sc->target;
+    struct epoll_event ev = {0};
+
+    *state = PORT_STATE_NONE;
+
+    /*
+     * Host is up for local address or broadcast address
+     */
+    if (is_self_or_bcast(sc, addr))
+    {
+        *result = 1;
+        return INFLIGHT_NONE;
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+
+    if (fd == -1)
+    {
+        *result = -1;
+        return INFLIGHT_NONE;
+    }
+
+    remote.sin_addr.s_addr = addr;
+    remote.sin_port = port;
+
+    start = monotonic_ns();
+    ret = connect(fd, (struct sockaddr *) &remote, sizeof(remote));
+    metrics_syscall(start);
+
+    if (ret && (errno == EADDRNOTAVAIL || errno == EAGAIN))
+    {
+        *result = -1;
+        close_sock(fd);
+        return INFLIGHT_NONE;
+    }
+
+    metrics_sent();
+
+    if (!ret || errno != EINPROGRESS)
+    {
+        /*
+         * Connect finished (or failed) immediately, as it can for local
+         * addresses
+         */
+        *result = connect_result(ret ? errno : 0);
+        *state = connect_state(ret ? errno : 0);
+        close_sock(fd);
+        return INFLIGHT_NONE;
+    }
+
+    slot = inflight_add(tbl, addr, port, monotonic_ns());
+    tbl->slots[slot].fd = fd;
+
+    ev.events = EPOLLOUT;
+    ev.data.u32 = slot;
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+    {
+        inflight_remove(tbl, slot);
+        close_sock(fd);
+        *result = -1;
+        return INFLIGHT_NONE;
+    }
+
+    return slot;
+}
+
+/*
+ * Closes the socket of an outstanding probe and releases its slot. Closing
+ * the socket also removes it from the epoll instance.
+ */
+static void
+retire(struct inflight *tbl, uint32_t slot)
+{
+    close_sock(tbl->slots[slot].fd);
+    inflight_remove(tbl, slot);
+}
+
+int
+run_connect_engine(struct scanner *sc, probe_callback_t up_callback,
+                   probe_callback_t down_callback,
+                   probe_callback_t error_callback)
+{
+    int epfd = -1, n = 0, i = 0, err = 0, result = 0;
+    int exhausted = 0, pending = 0, starved = 0, precise = 1, paid = 0;
+    socklen_t len = sizeof(err);
+    uint32_t slot = 0;
+    uint8_t state = 0;
+    uint64_t now = 0, age = 0, wait_ns = 0, delay = 0;
+    in_addr_t addr = 0, done_addr = 0;
+    in_port_t port = 0, done_port = 0;
+    struct inflight tbl = {0};
+    struct rtt_estimator rtt;
+    struct window_ctl wc;
+    struct epoll_event events[ENGINE_MAX_EVENTS];
+    probe_callback_t callbacks[] = {down_callback, up_callback};
+
+    if (!sc || !sc->max_inflight || sc->max_inflight > MAX_INFLIGHT)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rtt_init(&rtt, timeval_ns(&sc->timeout), sc->adaptive_timeout);
+
+    if (inflight_init(&tbl, fit_window(sc->max_inflight)))
+    {
+        return -1;
+    }
+
+    window_init(&wc, tbl.size, sc->adaptive_window);
+
+    epfd = epoll_create1(0);
+
+    if (epfd == -1)
+    {
+        inflight_free(&tbl);
+        return -1;
+    }
+
+    while (!signal_flag)
+    {
+        /*
+         * Fill the window with new probes. If the process runs out of sockets
+         * or local ports, the next host already has as many probes
+         * outstanding as it may, or the pacer has no token left, stop filling
+         * for this pass and keep the current probe for the next one instead
+         * of reporting it as an error.
+         */
+        starved = 0;
+        delay = 0;
+
+        while (!exhausted && tbl.count < wc.window)
+        {
+            if (!pending && !next_target(sc, &addr, &port))
+            {
+                exhausted = 1;
+                break;
+            }
+
+            pending = 0;
+
+            if (sc->max_per_host
+                && inflight_host_load(&tbl, addr) >= sc->max_per_host)
+            {
+                pending = 1;
+                break;
+            }
+
+            /*
+             * A probe held back for lack of sockets or ports has already
+             * taken its token
+             */
+            if (sc->pacer && !paid && (delay = pacer_take(sc->pacer)))
+            {
+                pending = 1;
+                break;
+            }
+
+            paid = 0;
+
+            if (launch(sc, epfd, &tbl, addr, port, &result, &state)
+                != INFLIGHT_NONE)
+            {
+                continue;
+            }
+
+            if (result == -1)
+            {
+                metrics_error(errno);
+            }
+
+            if (result == -1 && out_of_resources(errno))
+            {
+                /*
+                 * Running out of buffers is a sign of congestion; running
+                 * out of sockets or ports just means waiting
+                 */
+                if (errno == ENOBUFS)
+                {
+                    window_loss(&wc);
+                }
+
+                pending = 1;
+                starved = 1;
+                paid = 1;
+                break;
+            }
+
+            report_probe(sc, result == -1 ? error_callback
+                                          : callbacks[result],
+                         addr, port, state, errno);
+        }
+
+        if (!tbl.count && exhausted)
+        {
+            break;
+        }
+
+        /*
+         * Sleep no longer than it takes for the oldest probe to time out, so
+         * that it has expired when the wait returns, or for the pacer to have
+         * a token again. With nothing outstanding, only sleep to back off
+         * from a starved pass or to wait for a token.
+         */
+        if (tbl.count)
+        {
+            now = monotonic_ns();
+            age = now - tbl.slots[tbl.head].sent;
+            wait_ns = age >= rtt.timeout ? 0 : rtt.timeout - age;
+        }
+        else
+        {
+            wait_ns = starved ? ENGINE_BACKOFF_MS * 1000000ULL : delay;
+        }
+
+        if (delay && pacer_sleep_time(delay) < wait_ns)
+        {
+            wait_ns = pacer_sleep_time(delay);
+        }
+
+        n = wait_events(epfd, events, wait_ns, &precise);
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                n = 0;
+                continue;
+            }
+
+            break;
+        }
+
+        now = monotonic_ns();
+
+        for (i = 0; i < n; i++)
+        {
+            slot = events[i].data.u32;
+            done_addr = tbl.slots[slot].addr;
+            done_port = tbl.slots[slot].port;
+
+            if (getsockopt(tbl.slots[slot].fd, SOL_SOCKET, SO_ERROR, &err,
+                           &len))
+            {
+                err = errno;
+                metrics_error(err);
+                retire(&tbl, slot);
+                report_probe(sc, error_callback, done_addr, done_port,
+                             PORT_STATE_NONE, err);
+                continue;
+            }
+
+            /*
+             * Shut down socket if connection was successful
+             */
+            if (!err)
+            {
+                shutdown_sock(tbl.slots[slot].fd);
+            }
+
+            sc->rtt = now - tbl.slots[slot].sent;
+            metrics_reply(sc->rtt);
+
+            if (connect_result(err))
+            {
+                rtt_sample(&rtt, sc->rtt);
+            }
+
+            window_reply(&wc);
+            retire(&tbl, slot);
+            report_probe(sc, callbacks[connect_result(err)], done_addr,
+                         done_port, connect_state(err), 0);
+        }
+
+        /*
+         * Expire probes that have been outstanding for the full timeout, oldest
+         * first. Every probe gets the current timeout, so the oldest is always
+         * the first to expire even as the timeout adapts.
+         */
+        now = monotonic_ns();
+
+        while (tbl.head != INFLIGHT_NONE
+               && now - tbl.slots[tbl.head].sent >= rtt.timeout)
+        {
+            done_addr = tbl.slots[tbl.head].addr;
+            done_port = tbl.slots[tbl.head].port;
+            window_timeout(&wc);
+            retire(&tbl, tbl.head);
+            report_timeout(sc, down_callback, done_addr, done_port,
+                           PORT_FILTERED);
+        }
+    }
+
+    /*
+     * Abandon any probes still outstanding after an interruption or error
+     */
+    err = errno;
+
+    while (tbl.head != INFLIGHT_NONE)
+    {
+        retire(&tbl, tbl.head);
+    }
+
+    close_sock(epfd);
+    inflight_free(&tbl);
+    record_window(sc, &wc);
+
+    if (n == -1)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+#else
+
+int
+run_connect_engine(struct scanner *sc, probe_callback_t up_callback,
+                   probe_callback_t down_callback,
+                   probe_callback_t error_callback)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* __linux__ */
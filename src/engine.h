@@ -0,0 +1,62 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "scanner.h"
+
+/*
+ * How long to back off (in milliseconds) when the process is out of sockets
+ * or ephemeral ports and no probe is outstanding whose completion could free
+ * some up
+ */
+#define ENGINE_BACKOFF_MS   10
+
+/*
+ * Runs a TCP connect scan that keeps up to sc->max_inflight nonblocking
+ * connects outstanding at once.
+ *
+ * Completed connects are reaped with epoll as they happen, and any connect
+ * that has been outstanding for longer than sc->timeout is counted as a down
+ * host. Callbacks are called as described for run_scan.
+ *
+ * Returns 0 once every host has been probed or a signal has been caught;
+ * returns -1 and sets errno if the engine could not be set up.
+ *
+ * Only available on Linux; elsewhere, returns -1 and sets errno to ENOSYS.
+ */
+int
+run_connect_engine(struct scanner *sc, probe_callback_t up_callback,
+                   probe_callback_t down_callback,
+                   probe_callback_t error_callback);
+
+/*
+ * Raises the soft file descriptor limit as far as needed (and allowed) to keep
+ * window sockets open at once, and returns the largest window that fits under
+ * the resulting limit.
+ */
+uint32_t
+fit_window(uint32_t window);
+
+/*
+ * Returns 1 if err means the process or system is temporarily out of sockets
+ * or local ports rather than that the probe itself failed, or 0 otherwise.
+ */
+int
+out_of_resources(int err);
+
+/*
+ * Maps the result of a connect attempt to a probe result, as in
+ * connect_probe: returns 1 if the connection succeeded or was refused or
+ * reset by the host (err is 0, ECONNREFUSED or ECONNRESET), or 0 otherwise.
+ */
+int
+connect_result(int err);
+
+/*
+ * Maps the result of a connect attempt to the state of the port: open if the
+ * connection succeeded, closed if it was refused or reset by the host, or
+ * filtered otherwise.
+ */
+uint8_t
+connect_state(int err);
+
+#endif /* ENGINE_H */
@@ -0,0 +1,292 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "group.h"
+#include "threads.h"
+#include "util.h"
+
+/*
+ * The scan of one scanner of a group, on a thread of its own
+ */
+struct member
+{
+    struct scanner *sc;
+    pthread_t thread;
+    int ret;
+    int err;
+};
+
+/*
+ * Callbacks of the group being run, and the same callbacks serialized
+ */
+static struct serial_callbacks group_serial = {PTHREAD_MUTEX_INITIALIZER};
+static probe_callback_t group_up = NULL;
+static probe_callback_t group_down = NULL;
+static probe_callback_t group_error = NULL;
+static probe_callback_t serial_up = NULL;
+static probe_callback_t serial_down = NULL;
+static probe_callback_t serial_error = NULL;
+
+/*
+ * Sets up a scanner like tmpl for dev, covering the addresses in part.
+ *
+ * Returns the scanner, which takes ownership of dev and part, or NULL (with
+ * errno set) upon error.
+ */
+static struct scanner *
+new_member(const struct scanner *tmpl, struct device *dev,
+           struct interval_set *part)
+{
+    struct scanner *sc = NULL;
+
+    sc = zmalloc(sizeof(*sc));
+
+    if (!sc)
+    {
+        return NULL;
+    }
+
+    *sc = *tmpl;
+    sc->dev = NULL;
+    sc->ports = NULL;
+    sc->sim = NULL;
+    sc->targets = malloc(sizeof(*sc->targets));
+
+    if (tmpl->nports)
+    {
+        sc->ports = malloc(tmpl->nports * sizeof(*sc->ports));
+    }
+
+    if (!sc->targets || (tmpl->nports && !sc->ports))
+    {
+        free(sc->targets);
+        sc->targets = NULL;
+        free_scanner(sc);
+        return NULL;
+    }
+
+    if (tmpl->nports)
+    {
+        memcpy(sc->ports, tmpl->ports, tmpl->nports * sizeof(*sc->ports));
+    }
+
+    sc->dev = dev;
+    *sc->targets = *part;
+    sc->target_hint = 0;
+    sc->start = dev->local.sin_addr.s_addr & dev->netmask.sin_addr.s_addr;
+    sc->end = sc->start | ~dev->netmask.sin_addr.s_addr;
+    sc->fd = -1;
+
+    return sc;
+}
+
+int
+scan_group_init(struct scan_group *group, const struct scanner *tmpl,
+                const char *dev_name, const struct interval_set *targets,
+                const struct interval_set *exclude)
+{
+    int ret = 0, err = 0;
+    size_t ndevs = 0;
+    struct device **devs = NULL;
+
+    memset(group, 0, sizeof(*group));
+
+    if (get_live_devices(dev_name, &devs, &ndevs))
+    {
+        return -1;
+    }
+
+    ret = scan_group_init_devices(group, tmpl, devs, ndevs, targets, exclude);
+    err = errno;
+    free(devs);
+    errno = err;
+
+    return ret;
+}
+
+int
+scan_group_init_devices(struct scan_group *group, const struct scanner *tmpl,
+                        struct device **devs, size_t ndevs,
+                        const struct interval_set *targets,
+                        const struct interval_set *exclude)
+{
+    int ret = 0, err = 0;
+    size_t i = 0;
+    uint32_t first = 0, last = 0;
+    struct interval_set covered = {0}, part = {0}, rest = {0};
+
+    memset(group, 0, sizeof(*group));
+
+    group->scanners = ndevs ? zmalloc(ndevs * sizeof(*group->scanners))
+                            : NULL;
+    ret = ndevs && !group->scanners ? -1 : 0;
+
+    for (i = 0; i < ndevs && !ret; i++)
+    {
+        first = ntohl(devs[i]->local.sin_addr.s_addr
+                      & devs[i]->netmask.sin_addr.s_addr);
+        last = first | ~ntohl(devs[i]->netmask.sin_addr.s_addr);
+
+        /*
+         * The subnet, less what is not a target (its part outside the
+         * targets), the exclusions and what earlier devices cover
+         */
+        ret = interval_set_add(&part, first, last)
+              || interval_set_finish(&part)
+              || (targets && (interval_set_add(&rest, first, last)
+                              || interval_set_finish(&rest)
+                              || interval_set_subtract(&rest, targets)
+                              || interval_set_subtract(&part, &rest)))
+              || (exclude && interval_set_subtract(&part, exclude))
+              || interval_set_subtract(&part, &covered)
+              || interval_set_add(&covered, first, last)
+              || interval_set_finish(&covered) ? -1 : 0;
+
+        interval_set_free(&rest);
+
+        if (ret || !part.total)
+        {
+            interval_set_free(&part);
+            continue;
+        }
+
+        group->scanners[group->count] = new_member(tmpl, devs[i], &part);
+
+        if (!group->scanners[group->count])
+        {
+            ret = -1;
+            interval_set_free(&part);
+            continue;
+        }
+
+        devs[i] = NULL;
+        memset(&part, 0, sizeof(part));
+        group->count++;
+    }
+
+    err = errno;
+
+    for (i = 0; i < ndevs; i++)
+    {
+        free_device(devs[i]);
+        devs[i] = NULL;
+    }
+
+    interval_set_free(&covered);
+
+    if (ret)
+    {
+        scan_group_free(group);
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+scan_group_free(struct scan_group *group)
+{
+    size_t i = 0;
+
+    for (i = 0; i < group->count; i++)
+    {
+        free_scanner(group->scanners[i]);
+    }
+
+    free(group->scanners);
+    memset(group, 0, sizeof(*group));
+}
+
+static void *
+run_member(void *arg)
+{
+    struct member *m = arg;
+
+    if (m->sc->serialize_callbacks)
+    {
+        m->sc->serial = &group_serial;
+        m->ret = run_scan(m->sc, serial_up, serial_down, serial_error);
+        m->sc->serial = NULL;
+    }
+    else
+    {
+        m->ret = run_scan(m->sc, group_up, group_down, group_error);
+    }
+
+    m->err = errno;
+
+    return NULL;
+}
+
+int
+run_scan_group(struct scan_group *group, probe_callback_t up_callback,
+               probe_callback_t down_callback,
+               probe_callback_t error_callback)
+{
+    int ret = 0, err = 0;
+    size_t i = 0, started = 0;
+    struct member *members = NULL;
+    struct scan_stats *stats = &group->stats;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (!group->count)
+    {
+        return 0;
+    }
+
+    members = zmalloc(group->count * sizeof(*members));
+
+    if (!members)
+    {
+        return -1;
+    }
+
+    group_up = serial_up = up_callback;
+    group_down = serial_down = down_callback;
+    group_error = serial_error = error_callback;
+    wrap_serial_callbacks(&group_serial, &serial_up, &serial_down,
+                          &serial_error);
+
+    for (started = 0; started < group->count; started++)
+    {
+        members[started].sc = group->scanners[started];
+        ret = pthread_create(&members[started].thread, NULL, run_member,
+                             &members[started]);
+
+        if (ret)
+        {
+            err = ret;
+            break;
+        }
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(members[i].thread, NULL);
+
+        if (members[i].ret && !err)
+        {
+            err = members[i].err;
+        }
+
+        stats->window_raises += members[i].sc->stats.window_raises;
+        stats->window_cuts += members[i].sc->stats.window_cuts;
+        stats->window_peak += members[i].sc->stats.window_peak;
+        stats->window_final += members[i].sc->stats.window_final;
+    }
+
+    free(members);
+
+    if (err)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include <stddef.h>
+
+#include "intervals.h"
+#include "scanner.h"
+
+/*
+ * Scanners for several interface addresses, run at the same time.
+ *
+ * Each scanner covers the targets in the subnet of its device that no earlier
+ * scanner covers, so that no address is probed (or reported) twice; devices
+ * whose subnets hold nothing left to scan get no scanner. stats sums the
+ * statistics of every scanner over the last run.
+ */
+struct scan_group
+{
+    struct scanner **scanners;
+    size_t count;
+    struct scan_stats stats;
+};
+
+/*
+ * Sets up a scanner for every IPv4 address of the running, non-loopback
+ * interfaces (or only of the interface named dev_name, if it is not NULL),
+ * with the settings of tmpl (whose device, targets and simulated network are
+ * ignored), covering the addresses of the device's subnet that are in targets
+ * (unless targets is NULL) and not in exclude (unless exclude is NULL). Both
+ * sets must be finished.
+ *
+ * Returns 0 on success, with group->count set to 0 if no device had anything
+ * to scan; returns -1 and sets errno upon error.
+ */
+int
+scan_group_init(struct scan_group *group, const struct scanner *tmpl,
+                const char *dev_name, const struct interval_set *targets,
+                const struct interval_set *exclude);
+
+/*
+ * Same as scan_group_init, but with the ndevs devices in devs instead of the
+ * system's live ones. The group takes ownership of the devices, and sets every
+ * element of devs to NULL; the array itself is left to the caller.
+ */
+int
+scan_group_init_devices(struct scan_group *group, const struct scanner *tmpl,
+                        struct device **devs, size_t ndevs,
+                        const struct interval_set *targets,
+                        const struct interval_set *exclude);
+
+/*
+ * Frees every scanner of the group.
+ */
+void
+scan_group_free(struct scan_group *group);
+
+/*
+ * Runs the scans of every scanner in the group at once, each with run_scan on
+ * a thread of its own, so that the group takes about as long as its longest
+ * scan. Callbacks are called as described for run_scan, with the scanner of
+ * the device the target was scanned through; if the scanners serialize
+ * callbacks, no two callbacks run at the same time. Only one group may be run
+ * at a time.
+ *
+ * Returns 0 once every scan has finished or been interrupted by a signal;
+ * returns -1 and sets errno if a scan could not be started or run.
+ */
+int
+run_scan_group(struct scan_group *group, probe_callback_t up_callback,
+               probe_callback_t down_callback,
+               probe_callback_t error_callback);
+
+#endif /* GROUP_H */
@@ -0,0 +1,217 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "inflight.h"
+#include "util.h"
+
+/*
+ * Returns the hash bucket of addr
+ */
+static uint32_t
+bucket_of(const struct inflight *tbl, in_addr_t addr)
+{
+    /*
+     * Multiplicative hashing spreads consecutive addresses across buckets;
+     * the top bits of the product are the well-mixed ones
+     */
+    return (uint32_t) (ntohl(addr) * 2654435761U) >> tbl->shift;
+}
+
+int
+inflight_init(struct inflight *tbl, uint32_t size)
+{
+    uint32_t i = 0, nbuckets = 2, bits = 1;
+
+    if (!tbl || !size || size > INFLIGHT_NONE / 4)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*
+     * Keep at least two buckets per slot so that chains stay short
+     */
+    while (nbuckets < 2 * size)
+    {
+        nbuckets <<= 1;
+        bits++;
+    }
+
+    tbl->slots = zmalloc(size * sizeof(*tbl->slots));
+
+    if (!tbl->slots)
+    {
+        return -1;
+    }
+
+    tbl->buckets = malloc(nbuckets * sizeof(*tbl->buckets));
+
+    if (!tbl->buckets)
+    {
+        free(tbl->slots);
+        tbl->slots = NULL;
+        return -1;
+    }
+
+    for (i = 0; i < nbuckets; i++)
+    {
+        tbl->buckets[i] = INFLIGHT_NONE;
+    }
+
+    /*
+     * Chain every slot onto the free list
+     */
+    for (i = 0; i < size; i++)
+    {
+        tbl->slots[i].fd = -1;
+        tbl->slots[i].next = i + 1 < size ? i + 1 : INFLIGHT_NONE;
+    }
+
+    tbl->size = size;
+    tbl->count = 0;
+    tbl->head = INFLIGHT_NONE;
+    tbl->tail = INFLIGHT_NONE;
+    tbl->free = 0;
+    tbl->shift = 32 - bits;
+
+    return 0;
+}
+
+void
+inflight_free(struct inflight *tbl)
+{
+    if (tbl)
+    {
+        free(tbl->slots);
+        free(tbl->buckets);
+        tbl->slots = NULL;
+        tbl->buckets = NULL;
+        tbl->size = 0;
+        tbl->count = 0;
+    }
+}
+
+uint32_t
+inflight_add(struct inflight *tbl, in_addr_t addr, in_port_t port,
+             uint64_t sent)
+{
+    uint32_t slot = tbl->free, *link = NULL;
+    struct inflight_slot *s = NULL;
+
+    if (slot == INFLIGHT_NONE)
+    {
+        return INFLIGHT_NONE;
+    }
+
+    s = &tbl->slots[slot];
+    tbl->free = s->next;
+
+    s->addr = addr;
+    s->port = port;
+    s->fd = -1;
+    s->sent = sent;
+    s->prev = tbl->tail;
+    s->next = INFLIGHT_NONE;
+
+    if (tbl->tail != INFLIGHT_NONE)
+    {
+        tbl->slots[tbl->tail].next = slot;
+    }
+    else
+    {
+        tbl->head = slot;
+    }
+
+    tbl->tail = slot;
+    tbl->count++;
+
+    /*
+     * Each address and port is only outstanding once at a time, so the
+     * bucket's chain needs no particular order
+     */
+    link = &tbl->buckets[bucket_of(tbl, addr)];
+    s->hprev = INFLIGHT_NONE;
+    s->hnext = *link;
+
+    if (*link != INFLIGHT_NONE)
+    {
+        tbl->slots[*link].hprev = slot;
+    }
+
+    *link = slot;
+
+    return slot;
+}
+
+uint32_t
+inflight_find(const struct inflight *tbl, in_addr_t addr, in_port_t port)
+{
+    uint32_t slot = tbl->buckets[bucket_of(tbl, addr)];
+
+    while (slot != INFLIGHT_NONE && (tbl->slots[slot].addr != addr
+                                     || tbl->slots[slot].port != port))
+    {
+        slot = tbl->slots[slot].hnext;
+    }
+
+    return slot;
+}
+
+uint32_t
+inflight_host_load(const struct inflight *tbl, in_addr_t addr)
+{
+    uint32_t slot = tbl->buckets[bucket_of(tbl, addr)], load = 0;
+
+    while (slot != INFLIGHT_NONE)
+    {
+        load += tbl->slots[slot].addr == addr;
+        slot = tbl->slots[slot].hnext;
+    }
+
+    return load;
+}
+
+void
+inflight_remove(struct inflight *tbl, uint32_t slot)
+{
+    struct inflight_slot *s = &tbl->slots[slot];
+
+    if (s->hprev != INFLIGHT_NONE)
+    {
+        tbl->slots[s->hprev].hnext = s->hnext;
+    }
+    else
+    {
+        tbl->buckets[bucket_of(tbl, s->addr)] = s->hnext;
+    }
+
+    if (s->hnext != INFLIGHT_NONE)
+    {
+        tbl->slots[s->hnext].hprev = s->hprev;
+    }
+
+    if (s->prev != INFLIGHT_NONE)
+    {
+        tbl->slots[s->prev].next = s->next;
+    }
+    else
+    {
+        tbl->head = s->next;
+    }
+
+    if (s->next != INFLIGHT_NONE)
+    {
+        tbl->slots[s->next].prev = s->prev;
+    }
+    else
+    {
+        tbl->tail = s->prev;
+    }
+
+    s->fd = -1;
+    s->prev = INFLIGHT_NONE;
+    s->next = tbl->free;
+    tbl->free = slot;
+    tbl->count--;
+}
@@ -0,0 +1,99 @@
+#ifndef INFLIGHT_H
+#define INFLIGHT_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+/*
+ * Slot index used to mark the end of a list or a full table
+ */
+#define INFLIGHT_NONE   UINT32_MAX
+
+/*
+ * A single outstanding probe.
+ *
+ * Active slots are kept on a doubly linked list in the order they were sent,
+ * so the oldest outstanding probe (the next one to time out) is always at the
+ * head of the list. Free slots are chained through next.
+ *
+ * Active slots are also chained through hprev and hnext into hash buckets by
+ * address, so that a reply can be matched to its probe without searching the
+ * table. Probes of different ports of the same host share a bucket, so a
+ * bucket's chain is about as long as the number of probes outstanding to
+ * that host.
+ *
+ * port is the probed port in network byte order, or 0 for probes that don't
+ * have one.
+ */
+struct inflight_slot
+{
+    in_addr_t addr;
+    in_port_t port;
+    int fd;
+    uint64_t sent;
+    uint32_t prev;
+    uint32_t next;
+    uint32_t hprev;
+    uint32_t hnext;
+};
+
+/*
+ * Fixed-size table of outstanding probes
+ */
+struct inflight
+{
+    struct inflight_slot *slots;
+    uint32_t size;
+    uint32_t count;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t free;
+    uint32_t *buckets;
+    uint32_t shift;
+};
+
+/*
+ * Allocates a table with room for size outstanding probes.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+inflight_init(struct inflight *tbl, uint32_t size);
+
+/*
+ * Frees all resources associated with a table initialized by inflight_init.
+ */
+void
+inflight_free(struct inflight *tbl);
+
+/*
+ * Takes a free slot for a probe of addr:port sent at time sent (in
+ * nanoseconds) and appends it to the end of the send-order list.
+ *
+ * Returns the slot index, or INFLIGHT_NONE if the table is full.
+ */
+uint32_t
+inflight_add(struct inflight *tbl, in_addr_t addr, in_port_t port,
+             uint64_t sent);
+
+/*
+ * Returns the index of the active slot for a probe of addr:port, or
+ * INFLIGHT_NONE if there is none.
+ */
+uint32_t
+inflight_find(const struct inflight *tbl, in_addr_t addr, in_port_t port);
+
+/*
+ * Returns the number of probes of addr (on any port) that are outstanding.
+ */
+uint32_t
+inflight_host_load(const struct inflight *tbl, in_addr_t addr);
+
+/*
+ * Unlinks an active slot from the send-order list and returns it to the free
+ * list.
+ */
+void
+inflight_remove(struct inflight *tbl, uint32_t slot);
+
+#endif /* INFLIGHT_H */
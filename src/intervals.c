@@ -0,0 +1,469 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intervals.h"
+
+/*
+ * Number of addresses in an interval
+ */
+static uint64_t
+interval_len(const struct interval *iv)
+{
+    return (uint64_t) iv->last - iv->first + 1;
+}
+
+/*
+ * Orders intervals by their first address
+ */
+static int
+compare_intervals(const void *a, const void *b)
+{
+    const struct interval *x = a, *y = b;
+
+    return (x->first > y->first) - (x->first < y->first);
+}
+
+void
+interval_set_free(struct interval_set *set)
+{
+    if (set)
+    {
+        free(set->intervals);
+        free(set->before);
+        memset(set, 0, sizeof(*set));
+    }
+}
+
+int
+interval_set_add(struct interval_set *set, uint32_t first, uint32_t last)
+{
+    size_t size = 0;
+    struct interval *grown = NULL;
+
+    if (!set || first > last)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (set->count == set->size)
+    {
+        size = set->size ? 2 * set->size : 16;
+        grown = realloc(set->intervals, size * sizeof(*grown));
+
+        if (!grown)
+        {
+            return -1;
+        }
+
+        set->intervals = grown;
+        set->size = size;
+    }
+
+    set->intervals[set->count].first = first;
+    set->intervals[set->count].last = last;
+    set->count++;
+
+    return 0;
+}
+
+/*
+ * Parses a dotted-quad address into *addr (host byte order).
+ *
+ * Returns 0 on success or -1 if str is not a valid address.
+ */
+static int
+parse_addr(const char *str, uint32_t *addr)
+{
+    struct in_addr in = {0};
+
+    if (inet_pton(AF_INET, str, &in) != 1)
+    {
+        return -1;
+    }
+
+    *addr = ntohl(in.s_addr);
+
+    return 0;
+}
+
+int
+interval_set_parse(struct interval_set *set, const char *spec)
+{
+    char buf[INET_ADDRSTRLEN + 4] = {0};
+    char *sep = NULL, *endptr = NULL;
+    long bits = 0;
+    uint32_t first = 0, last = 0, mask = 0;
+
+    /*
+     * Longest valid spec is a CIDR block; ranges are split below
+     */
+    if (!set || !spec || strlen(spec) >= 2 * INET_ADDRSTRLEN)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((sep = strchr(spec, '-')))
+    {
+        if ((size_t) (sep - spec) >= sizeof(buf))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        memcpy(buf, spec, (size_t) (sep - spec));
+
+        if (parse_addr(buf, &first) || parse_addr(sep + 1, &last)
+            || first > last)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        return interval_set_add(set, first, last);
+    }
+
+    if ((sep = strchr(spec, '/')))
+    {
+        if ((size_t) (sep - spec) >= sizeof(buf) || sep[1] < '0'
+            || sep[1] > '9')
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        memcpy(buf, spec, (size_t) (sep - spec));
+
+        errno = 0;
+        bits = strtol(sep + 1, &endptr, 10);
+
+        if (errno || *endptr || bits < 0 || bits > 32
+            || parse_addr(buf, &first))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        /*
+         * Shifting a 32-bit value by 32 is undefined
+         */
+        mask = bits ? ~0U << (32 - bits) : 0;
+
+        return interval_set_add(set, first & mask, (first & mask) | ~mask);
+    }
+
+    if (parse_addr(spec, &first))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return interval_set_add(set, first, first);
+}
+
+int
+interval_set_parse_list(struct interval_set *set, const char *list)
+{
+    int ret = 0;
+    char *copy = NULL, *token = NULL, *saveptr = NULL;
+
+    if (!set || !list)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    copy = strdup(list);
+
+    if (!copy)
+    {
+        return -1;
+    }
+
+    for (token = strtok_r(copy, " \t\r\n,", &saveptr); token && !ret;
+         token = strtok_r(NULL, " \t\r\n,", &saveptr))
+    {
+        ret = interval_set_parse(set, token);
+    }
+
+    free(copy);
+
+    return ret;
+}
+
+int
+interval_set_load(struct interval_set *set, const char *path, size_t *line)
+{
+    int ret = 0, err = 0;
+    char *buf = NULL, *comment = NULL;
+    size_t len = 0, lineno = 0;
+    FILE *file = NULL;
+
+    if (!set || !path)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    file = fopen(path, "r");
+
+    if (!file)
+    {
+        return -1;
+    }
+
+    while (!ret && getline(&buf, &len, file) != -1)
+    {
+        lineno++;
+
+        if ((comment = strchr(buf, '#')))
+        {
+            *comment = '\0';
+        }
+
+        ret = interval_set_parse_list(set, buf);
+    }
+
+    err = errno;
+
+    if (!ret && ferror(file))
+    {
+        ret = -1;
+    }
+
+    if (ret && err == EINVAL && line)
+    {
+        *line = lineno;
+    }
+
+    free(buf);
+    fclose(file);
+
+    errno = err;
+
+    return ret;
+}
+
+int
+interval_set_finish(struct interval_set *set)
+{
+    size_t i = 0, merged = 0;
+    uint64_t *before = NULL;
+    struct interval *last = NULL;
+
+    if (!set)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    qsort(set->intervals, set->count, sizeof(*set->intervals),
+          compare_intervals);
+
+    /*
+     * Fold every interval that overlaps or touches the last merged one into
+     * it, taking care not to overflow past 255.255.255.255
+     */
+    for (i = 0; i < set->count; i++)
+    {
+        last = merged ? &set->intervals[merged - 1] : NULL;
+
+        if (last
+            && (uint64_t) set->intervals[i].first <= (uint64_t) last->last + 1)
+        {
+            if (set->intervals[i].last > last->last)
+            {
+                last->last = set->intervals[i].last;
+            }
+        }
+        else
+        {
+            set->intervals[merged++] = set->intervals[i];
+        }
+    }
+
+    set->count = merged;
+
+    before = realloc(set->before, (merged ? merged : 1) * sizeof(*before));
+
+    if (!before)
+    {
+        return -1;
+    }
+
+    set->before = before;
+    set->total = 0;
+
+    for (i = 0; i < merged; i++)
+    {
+        set->before[i] = set->total;
+        set->total += interval_len(&set->intervals[i]);
+    }
+
+    return 0;
+}
+
+int
+interval_set_subtract(struct interval_set *set,
+                      const struct interval_set *exclude)
+{
+    size_t i = 0, j = 0, count = 0;
+    uint32_t first = 0, last = 0;
+    struct interval *out = NULL;
+    const struct interval *ex = NULL;
+
+    if (!set || !exclude)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*
+     * Each exclusion can split at most one interval in two
+     */
+    out = malloc((set->count + exclude->count + 1) * sizeof(*out));
+
+    if (!out)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < set->count; i++)
+    {
+        first = set->intervals[i].first;
+        last = set->intervals[i].last;
+
+        /*
+         * Skip exclusions that end before this interval; they can't affect
+         * any later interval either
+         */
+        while (j < exclude->count && exclude->intervals[j].last < first)
+        {
+            j++;
+        }
+
+        /*
+         * Carve out every exclusion that starts within the interval. The last
+         * one may reach into the next interval, so it is not skipped.
+         */
+        for (ex = &exclude->intervals[j];
+             ex < exclude->intervals + exclude->count && ex->first <= last;
+             ex++)
+        {
+            if (ex->first > first)
+            {
+                out[count].first = first;
+                out[count].last = ex->first - 1;
+                count++;
+            }
+
+            if (ex->last >= last)
+            {
+                break;
+            }
+
+            first = ex->last + 1;
+        }
+
+        if (ex == exclude->intervals + exclude->count || ex->first > last)
+        {
+            out[count].first = first;
+            out[count].last = last;
+            count++;
+        }
+    }
+
+    free(set->intervals);
+    set->intervals = out;
+    set->count = count;
+    set->size = set->count + exclude->count + 1;
+
+    return interval_set_finish(set);
+}
+
+uint32_t
+interval_set_nth(const struct interval_set *set, uint64_t i, size_t *hint)
+{
+    size_t lo = 0, hi = set->count, mid = 0;
+
+    /*
+     * Walking in order, the address is almost always in the interval of the
+     * last lookup or the one after it
+     */
+    if (hint)
+    {
+        for (mid = *hint; mid < set->count && mid <= *hint + 1; mid++)
+        {
+            if (i >= set->before[mid]
+                && i - set->before[mid] < interval_len(&set->intervals[mid]))
+            {
+                *hint = mid;
+                return set->intervals[mid].first
+                       + (uint32_t) (i - set->before[mid]);
+            }
+        }
+    }
+
+    /*
+     * Find the last interval with no more than i addresses before it
+     */
+    while (hi - lo > 1)
+    {
+        mid = lo + (hi - lo) / 2;
+
+        if (set->before[mid] <= i)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if (hint)
+    {
+        *hint = lo;
+    }
+
+    return set->intervals[lo].first + (uint32_t) (i - set->before[lo]);
+}
+
+int
+interval_set_contains(const struct interval_set *set, uint32_t addr)
+{
+    uint64_t i = 0;
+
+    return interval_set_rank(set, addr, &i);
+}
+
+int
+interval_set_rank(const struct interval_set *set, uint32_t addr, uint64_t *i)
+{
+    size_t lo = 0, hi = set->count, mid = 0;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+
+        if (set->intervals[mid].last < addr)
+        {
+            lo = mid + 1;
+        }
+        else if (set->intervals[mid].first > addr)
+        {
+            hi = mid;
+        }
+        else
+        {
+            *i = set->before[mid] + (addr - set->intervals[mid].first);
+            return 1;
+        }
+    }
+
+    return 0;
+}
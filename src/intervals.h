@@ -0,0 +1,130 @@
+#ifndef INTERVALS_H
+#define INTERVALS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Inclusive range of IPv4 addresses in host byte order
+ */
+struct interval
+{
+    uint32_t first;
+    uint32_t last;
+};
+
+/*
+ * Set of IPv4 addresses kept as a sorted array of disjoint, non-adjacent
+ * intervals.
+ *
+ * Intervals are appended in any order by interval_set_add (and the parsing
+ * functions built on it), then interval_set_finish sorts and merges them and
+ * counts the addresses before each interval, so that the nth address of the
+ * set can be found by binary search. A zeroed struct is an empty set.
+ */
+struct interval_set
+{
+    struct interval *intervals;
+    uint64_t *before;
+    size_t count;
+    size_t size;
+    uint64_t total;
+};
+
+/*
+ * Frees all resources associated with a set and empties it.
+ */
+void
+interval_set_free(struct interval_set *set);
+
+/*
+ * Appends the addresses first through last (host byte order) to the set. The
+ * set must be finished again before it is used.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+interval_set_add(struct interval_set *set, uint32_t first, uint32_t last);
+
+/*
+ * Appends the addresses described by spec to the set: a single address
+ * ("10.0.0.1"), a CIDR block ("10.0.0.0/8") or an inclusive range
+ * ("10.0.0.1-10.0.0.99").
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error, with errno set
+ * to EINVAL if spec is malformed.
+ */
+int
+interval_set_parse(struct interval_set *set, const char *spec);
+
+/*
+ * Appends the addresses described by every entry of list to the set. Entries
+ * take any form accepted by interval_set_parse and are separated by
+ * whitespace or commas.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error, with errno set
+ * to EINVAL if an entry is malformed.
+ */
+int
+interval_set_parse_list(struct interval_set *set, const char *list);
+
+/*
+ * Appends every address listed in the file at path to the set. Lines are
+ * lists as accepted by interval_set_parse_list; anything after a '#' on a
+ * line is a comment.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error. If an entry is
+ * malformed, errno is set to EINVAL and its line number is stored in *line.
+ */
+int
+interval_set_load(struct interval_set *set, const char *path, size_t *line);
+
+/*
+ * Sorts the intervals of the set, merges the ones that overlap or touch, and
+ * indexes the result.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+interval_set_finish(struct interval_set *set);
+
+/*
+ * Removes every address in exclude from the set. Both sets must be finished;
+ * the set is finished afterwards.
+ *
+ * Takes time linear in the number of intervals of both sets.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+interval_set_subtract(struct interval_set *set,
+                      const struct interval_set *exclude);
+
+/*
+ * Returns the address (host byte order) at position i (which must be less
+ * than set->total) of a finished set, in ascending order.
+ *
+ * hint, if not NULL, caches the interval found by the last lookup so that
+ * walking the set in order takes constant time per address; lookups that
+ * miss it take time logarithmic in the number of intervals.
+ */
+uint32_t
+interval_set_nth(const struct interval_set *set, uint64_t i, size_t *hint);
+
+/*
+ * Returns 1 if the finished set holds addr (host byte order), or 0 otherwise.
+ */
+int
+interval_set_contains(const struct interval_set *set, uint32_t addr);
+
+/*
+ * Looks up the position of addr (host byte order) in a finished set, the
+ * inverse of interval_set_nth.
+ *
+ * Returns 1 and stores the position in *i if the set holds addr; returns 0
+ * otherwise.
+ */
+int
+interval_set_rank(const struct interval_set *set, uint32_t addr, uint64_t *i);
+
+#endif /* INTERVALS_H */
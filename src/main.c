@@ -1,3 +1,4 @@
+#include <arpa/inet.h>
 #include <ctype.h>
 #include <errno.h>
 #include <getopt.h>
@@ -5,9 +6,41 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "main_callbacks.h"
+#include "group.h"
+#include "intervals.h"
 #include "main.h"
+#include "metrics.h"
+#include "ports.h"
+#include "sim.h"
+#include "sweep.h"
+#include "threads.h"
+#include "util.h"
+
+/*
+ * Values returned by getopt_long for options without a short form
+ */
+#define OPT_PER_THREAD      256
+#define OPT_MAX_PER_HOST    257
+#define OPT_SEED            258
+#define OPT_EXCLUDE         259
+#define OPT_EXCLUDE_FILE    260
+#define OPT_RATE            261
+#define OPT_BURST           262
+#define OPT_RETRIES         263
+#define OPT_RESULT_MAP      264
+#define OPT_STATE_FILE      265
+#define OPT_CHECKPOINT      266
+#define OPT_RESUME          267
+#define OPT_DAEMON          268
+#define OPT_INTERVAL        269
+#define OPT_ALL_INTERFACES  270
+#define OPT_SIMULATE        271
+#define OPT_STATS           272
+#define OPT_SEND_BATCH      273
 
 void
 print_version(void)
@@ -31,18 +64,52 @@ void
 print_usage(const char *binary_name)
 {
     printf("%s %s\n\n"
-           "Usage: %s [OPTIONS]\n\n", PROGRAM_NAME, VERSION_STRING,
+           "Usage: %s [OPTIONS] [TARGETS]\n\n", PROGRAM_NAME, VERSION_STRING,
            binary_name); 
     puts("OPTIONS:\n"
          "\t-d, --device_name <device>\n"
-         "\t-p, --port <port (1-65535)>\n"
+         "\t    --all-interfaces (scan every interface, or every address\n"
+         "\t    of -d, at once)\n"
+         "\t-p, --port <port (1-65535) or list (e.g. 22,80,8000-8100)>\n"
          "\t-t, --timeout <timeout in milliseconds>\n"
+         "\t-a, --adaptive-timeout (fit timeout to round trips, up to -t)\n"
+         "\t    --retries <times to probe unanswered targets again>\n"
          "\t-s, --scan-type <single character scan type>\n"
+         "\t-i, --input-file <file of targets>\n"
+         "\t    --exclude <targets not to scan>\n"
+         "\t    --exclude-file <file of targets not to scan>\n"
+         "\t-m, --max-inflight <concurrent probes (0 to probe one at a time)>\n"
+         "\t-w, --adaptive-window (grow toward -m while no loss is seen)\n"
+         "\t    --max-per-host <concurrent probes per host (0 for no limit)>\n"
+         "\t    --rate <probes per second (default: no limit)>\n"
+         "\t    --burst <probes sent back to back at most under --rate>\n"
+         "\t-r, --randomize (probe hosts in pseudo-random order)\n"
+         "\t    --seed <seed for --randomize (implies --randomize)>\n"
+         "\t-b, --backend <epoll|uring (TCP connect engine backend)>\n"
+         "\t    --send-batch <probes a sweep sends per system call>\n"
+         "\t-T, --threads <worker threads>\n"
+         "\t    --per-thread-callbacks (report hosts without serializing)\n"
+         "\t    --result-map <file to save host states to as a bitmap>\n"
+         "\t    --state-file <file of host states to report changes from>\n"
+         "\t    --checkpoint <file to save progress to every second>\n"
+         "\t    --resume <checkpoint file of an interrupted scan>\n"
+         "\t    --daemon (scan continuously, reporting changes as they occur)\n"
+         "\t    --interval <milliseconds between --daemon checks of up hosts>\n"
+         "\t    --simulate <spec file of a network to scan in virtual time>\n"
+         "\t    --stats (print probe counters and timings once done; they are\n"
+         "\t    also printed whenever SIGUSR1 is received)\n"
+         "\t-o, --output-format <text|jsonl|csv|bin (format of results)>\n"
          "\t-v, --version\n"
          "\t-h, --help\n\n"
          "SCAN TYPES:\n"
          "\t-sC, --scan-type=C\t\tTCP connect scan\n"
-         "\t-sI, --scan-type=I\t\tICMP echo scan\n\n");
+         "\t-sI, --scan-type=I\t\tICMP echo scan\n"
+         "\t-sA, --scan-type=A\t\tARP scan (Linux only)\n"
+         "\t-sS, --scan-type=S\t\tTCP SYN scan\n\n"
+         "TARGETS:\n"
+         "\tAddresses (10.0.0.1), CIDR blocks (10.0.0.0/8) and ranges\n"
+         "\t(10.0.0.1-10.0.0.99), separated by spaces or commas. Without\n"
+         "\ttargets, the subnet of the scanning device is scanned.\n\n");
     printf("Report bugs to: %s\n"
            "%s home page: <%s>\n", BUG_REPORT_EMAIL, PROGRAM_NAME,
            PROGRAM_URL);
@@ -68,6 +135,12 @@ parse_scan_type(const char *scan_type_str)
                 case 'I':
                     scan_type = SCAN_TYPE_ICMP;
                     break;
+                case 'A':
+                    scan_type = SCAN_TYPE_ARP;
+                    break;
+                case 'S':
+                    scan_type = SCAN_TYPE_SYN;
+                    break;
                 default:
                     /*
                      * Unrecognized scan type. Do nothing since scan_type is
@@ -81,39 +154,249 @@ parse_scan_type(const char *scan_type_str)
     return scan_type;
 }
 
+/*
+ * Reports the changes between the hosts in map and those in the state file at
+ * path (if there is one) from an earlier scan, then updates the state file.
+ * Hosts the scan didn't get to keep their earlier state.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+report_changes(struct result_map *map, const char *path, uint8_t scan_type)
+{
+    struct result_map prev = {0};
+
+    if (result_map_load(&prev, path) && errno != ENOENT)
+    {
+        return -1;
+    }
+
+    result_map_merge(map, &prev);
+    print_changes(map, &prev, scan_type);
+    result_map_free(&prev);
+
+    return result_map_update(map, path);
+}
+
+/*
+ * Scans continuously until a signal is caught, in rounds probing the targets
+ * mon has due, and reports the changes in the states of hosts after every
+ * round (starting from the states in the state file at state_path, if there
+ * is one). The callbacks record states in map, which is reset for every
+ * round. After every round, the state file and the result map at result_path
+ * are brought up to date, if they are not NULL. A sweep's socket is opened
+ * once and kept open for every round.
+ *
+ * Returns 0 once a signal is caught; returns -1 and sets errno upon error.
+ */
+int
+run_daemon(struct scanner *sc, struct monitor *mon, struct result_map *map,
+           probe_callback_t up_callback, probe_callback_t down_callback,
+           probe_callback_t error_callback, const char *state_path,
+           const char *result_path)
+{
+    int ret = 0;
+    uint32_t first = map->first;
+    uint32_t last = map->first + (uint32_t) (map->count - 1);
+    uint64_t wake = 0;
+    struct result_map known = {0}, done = {0};
+
+    /*
+     * Without an earlier state, every host that is up is news
+     */
+    if (!state_path || result_map_load(&known, state_path))
+    {
+        if ((state_path && errno != ENOENT)
+            || result_map_init(&known, first, last))
+        {
+            return -1;
+        }
+    }
+
+    /*
+     * Keep the sweep's socket open from one round to the next
+     */
+    if (sweep_attach(sc))
+    {
+        result_map_free(&known);
+        return -1;
+    }
+
+    while (!signal_flag)
+    {
+        /*
+         * Sleep until a target is due, or a signal is caught
+         */
+        if (!monitor_schedule(mon, monotonic_ns(), &wake))
+        {
+            sleep_until_ns(wake);
+            continue;
+        }
+
+        sc->skip = mon->skip;
+        ret = run_scan(sc, up_callback, down_callback, error_callback);
+        sc->skip = NULL;
+
+        if (ret)
+        {
+            break;
+        }
+
+        /*
+         * Hosts left out of the round keep their state
+         */
+        result_map_merge(map, &known);
+        print_changes(map, &known, sc->scan_type);
+        fflush(stdout);
+
+        done = known;
+        known = *map;
+        *map = done;
+        result_map_free(map);
+        ret = result_map_init(map, first, last);
+
+        if (ret)
+        {
+            break;
+        }
+
+        if (state_path && result_map_update(&known, state_path))
+        {
+            perror("[!] Failed to update state file");
+        }
+
+        if (result_path && result_map_save(&known, result_path))
+        {
+            perror("[!] Failed to save result map");
+        }
+    }
+
+    sweep_detach(sc);
+    result_map_free(&known);
+
+    return ret;
+}
+
 int
 main(int argc, char *argv[])
 {
     struct option options[] = {
-        {"device",    required_argument, NULL, 'd'},
-        {"port",      required_argument, NULL, 'p'},
-        {"timeout",   required_argument, NULL, 't'}, 
-        {"scan-type", required_argument, NULL, 's'},
-        {"version",   no_argument,       NULL, 'v'},
-        {"help",      no_argument,       NULL, 'h'},
-        {NULL,        0,                 NULL,   0}
+        {"device",               required_argument, NULL, 'd'},
+        {"all-interfaces",       no_argument,       NULL, OPT_ALL_INTERFACES},
+        {"port",                 required_argument, NULL, 'p'},
+        {"timeout",              required_argument, NULL, 't'},
+        {"adaptive-timeout",     no_argument,       NULL, 'a'},
+        {"retries",              required_argument, NULL, OPT_RETRIES},
+        {"scan-type",            required_argument, NULL, 's'},
+        {"input-file",           required_argument, NULL, 'i'},
+        {"exclude",              required_argument, NULL, OPT_EXCLUDE},
+        {"exclude-file",         required_argument, NULL, OPT_EXCLUDE_FILE},
+        {"max-inflight",         required_argument, NULL, 'm'},
+        {"adaptive-window",      no_argument,       NULL, 'w'},
+        {"max-per-host",         required_argument, NULL, OPT_MAX_PER_HOST},
+        {"rate",                 required_argument, NULL, OPT_RATE},
+        {"burst",                required_argument, NULL, OPT_BURST},
+        {"randomize",            no_argument,       NULL, 'r'},
+        {"seed",                 required_argument, NULL, OPT_SEED},
+        {"backend",              required_argument, NULL, 'b'},
+        {"send-batch",           required_argument, NULL, OPT_SEND_BATCH},
+        {"threads",              required_argument, NULL, 'T'},
+        {"per-thread-callbacks", no_argument,       NULL, OPT_PER_THREAD},
+        {"result-map",           required_argument, NULL, OPT_RESULT_MAP},
+        {"state-file",           required_argument, NULL, OPT_STATE_FILE},
+        {"checkpoint",           required_argument, NULL, OPT_CHECKPOINT},
+        {"resume",               required_argument, NULL, OPT_RESUME},
+        {"daemon",               no_argument,       NULL, OPT_DAEMON},
+        {"interval",             required_argument, NULL, OPT_INTERVAL},
+        {"simulate",             required_argument, NULL, OPT_SIMULATE},
+        {"stats",                no_argument,       NULL, OPT_STATS},
+        {"output-format",        required_argument, NULL, 'o'},
+        {"version",              no_argument,       NULL, 'v'},
+        {"help",                 no_argument,       NULL, 'h'},
+        {NULL,                   0,                 NULL,   0}
     };
 
-    int opt = 0, scan_type = DEFAULT_SCAN_TYPE;
+    int opt = 0, err = 0, scan_type = DEFAULT_SCAN_TYPE;
+    size_t i = 0;
     long ret = 0;
-    char *device_name = NULL, *endptr = NULL;
+    char *device_name = NULL, *endptr = NULL, *result_path = NULL;
+    char *state_path = NULL, *checkpoint_path = NULL;
     struct scanner *sc = NULL;
     uint16_t port = DEFAULT_PORT;
     struct timeval timeout = {DEFAULT_TIMEOUT_SEC, DEFAULT_TIMEOUT_USEC};
+    unsigned int max_inflight = DEFAULT_MAX_INFLIGHT;
+    unsigned int threads = DEFAULT_THREADS;
+    uint8_t backend = DEFAULT_BACKEND;
+    unsigned int send_batch = DEFAULT_SEND_BATCH;
+    unsigned int max_per_host = DEFAULT_MAX_PER_HOST;
+    unsigned int retries = DEFAULT_RETRIES;
+    uint16_t *ports = NULL;
+    uint32_t nports = 0;
+    int randomize = 0, has_seed = 0, adaptive_timeout = 0;
+    int adaptive_window = 0;
+    unsigned long long seed = 0, rate = 0, burst = 0;
+    size_t line = 0;
+    struct interval_set targets = {0}, exclude = {0};
+    struct result_map result_map = {0};
+    int output_format = OUTPUT_TEXT;
+    struct output *output = NULL;
+    struct checkpoint checkpoint;
+    int resume = 0, monitoring = 0;
+    unsigned long interval = DEFAULT_INTERVAL_MS;
+    struct monitor monitor;
+    int all_interfaces = 0;
+    struct scan_group group = {0};
+    probe_callback_t up_callback = NULL, down_callback = NULL;
+    probe_callback_t error_callback = NULL;
+    int serialize_callbacks = 1;
+    struct sim_spec *sim = NULL;
+    int show_stats = 0;
+    struct metrics metrics;
 
     /*
      * Disable automatic error messages
      */
     opterr = 0;
 
-    while ((opt = getopt_long(argc, argv, ":d:p:t:s:vh", options, NULL)) != -1)
+    while ((opt = getopt_long(argc, argv, ":d:p:t:as:i:m:wrb:T:o:vh", options,
+                              NULL)) != -1)
     {
         switch (opt)
         {
             case 'd':
                 device_name = optarg;
                 break;
+            case OPT_ALL_INTERFACES:
+                all_interfaces = 1;
+                break;
             case 'p':
+                /*
+                 * A list or range of ports
+                 */
+                if (strpbrk(optarg, ",-"))
+                {
+                    free(ports);
+                    ports = NULL;
+                    nports = 0;
+
+                    if (parse_ports(optarg, &ports, &nports))
+                    {
+                        fprintf(stderr, "[!] Invalid port list: \"%s\"\n",
+                                optarg);
+                        fprintf(stderr, "[*] Using default port: %d\n\n",
+                                DEFAULT_PORT);
+                    }
+                    else if (nports == 1)
+                    {
+                        port = ports[0];
+                        free(ports);
+                        ports = NULL;
+                        nports = 0;
+                    }
+
+                    break;
+                }
+
                 /*
                  * Must use errno to check for overflow/underflow in strtol
                  */
@@ -149,6 +432,24 @@ main(int argc, char *argv[])
                     timeout.tv_usec = (ret % 1000) * 1000;
                 }
                 break;
+            case 'a':
+                adaptive_timeout = 1;
+                break;
+            case OPT_RETRIES:
+                errno = 0;
+                ret = strtol(optarg, &endptr, 10);
+                if (errno || *endptr || ret < 0 || ret > MAX_RETRIES)
+                {
+                    fprintf(stderr, "[!] Invalid retries: \"%s\"\n", optarg);
+                    fprintf(stderr, "[*] Using default retries: %d\n\n",
+                            DEFAULT_RETRIES);
+                    endptr = NULL;
+                }
+                else
+                {
+                    retries = (unsigned int) ret;
+                }
+                break;
             case 's':
                 scan_type = parse_scan_type(optarg);
                 if (scan_type == SCAN_TYPE_INVALID)
@@ -159,6 +460,242 @@ main(int argc, char *argv[])
                     scan_type = DEFAULT_SCAN_TYPE;
                 }
                 break;
+            case 'i':
+                if (interval_set_load(&targets, optarg, &line))
+                {
+                    if (errno == EINVAL)
+                    {
+                        fprintf(stderr, "[!] Invalid target in \"%s\" on "
+                                "line %zu\n", optarg, line);
+                    }
+                    else
+                    {
+                        perror("[!] Failed to read targets");
+                    }
+
+                    return 1;
+                }
+                break;
+            case OPT_EXCLUDE:
+                if (interval_set_parse_list(&exclude, optarg))
+                {
+                    fprintf(stderr, "[!] Invalid exclusion: \"%s\"\n",
+                            optarg);
+                    return 1;
+                }
+                break;
+            case OPT_EXCLUDE_FILE:
+                if (interval_set_load(&exclude, optarg, &line))
+                {
+                    if (errno == EINVAL)
+                    {
+                        fprintf(stderr, "[!] Invalid exclusion in \"%s\" on "
+                                "line %zu\n", optarg, line);
+                    }
+                    else
+                    {
+                        perror("[!] Failed to read exclusions");
+                    }
+
+                    return 1;
+                }
+                break;
+            case 'm':
+                errno = 0;
+                ret = strtol(optarg, &endptr, 10);
+                if (errno || *endptr || ret < 0 || ret > MAX_INFLIGHT)
+                {
+                    fprintf(stderr, "[!] Invalid maximum in-flight probes: "
+                            "\"%s\"\n", optarg);
+                    fprintf(stderr, "[*] Using default maximum in-flight "
+                            "probes: %d\n\n", DEFAULT_MAX_INFLIGHT);
+                    endptr = NULL;
+                }
+                else
+                {
+                    max_inflight = (unsigned int) ret;
+                }
+                break;
+            case 'w':
+                adaptive_window = 1;
+                break;
+            case 'r':
+                randomize = 1;
+                break;
+            case OPT_SEED:
+                errno = 0;
+                seed = strtoull(optarg, &endptr, 0);
+                if (errno || *endptr || !*optarg || *optarg == '-')
+                {
+                    fprintf(stderr, "[!] Invalid seed: \"%s\"\n", optarg);
+                    fputs("[*] Using a random seed\n\n", stderr);
+                    endptr = NULL;
+                }
+                else
+                {
+                    has_seed = 1;
+                }
+                randomize = 1;
+                break;
+            case 'b':
+                if (!strcmp(optarg, "epoll"))
+                {
+                    backend = BACKEND_EPOLL;
+                }
+                else if (!strcmp(optarg, "uring"))
+                {
+                    backend = BACKEND_URING;
+                }
+                else
+                {
+                    fprintf(stderr, "[!] Invalid backend: \"%s\"\n", optarg);
+                    fputs("[*] Using default backend: epoll\n\n", stderr);
+                }
+                break;
+            case 'T':
+                errno = 0;
+                ret = strtol(optarg, &endptr, 10);
+                if (errno || *endptr || ret < 1 || ret > MAX_THREADS)
+                {
+                    fprintf(stderr, "[!] Invalid number of threads: \"%s\"\n",
+                            optarg);
+                    fprintf(stderr, "[*] Using default number of threads: "
+                            "%d\n\n", DEFAULT_THREADS);
+                    endptr = NULL;
+                }
+                else
+                {
+                    threads = (unsigned int) ret;
+                }
+                break;
+            case OPT_SEND_BATCH:
+                errno = 0;
+                ret = strtol(optarg, &endptr, 10);
+                if (errno || *endptr || ret < 1 || ret > MAX_SEND_BATCH)
+                {
+                    fprintf(stderr, "[!] Invalid send batch: \"%s\"\n",
+                            optarg);
+                    fprintf(stderr, "[*] Using default send batch: %d\n\n",
+                            DEFAULT_SEND_BATCH);
+                    endptr = NULL;
+                }
+                else
+                {
+                    send_batch = (unsigned int) ret;
+                }
+                break;
+            case OPT_MAX_PER_HOST:
+                errno = 0;
+                ret = strtol(optarg, &endptr, 10);
+                if (errno || *endptr || ret < 0 || ret > MAX_INFLIGHT)
+                {
+                    fprintf(stderr, "[!] Invalid maximum probes per host: "
+                            "\"%s\"\n", optarg);
+                    fprintf(stderr, "[*] Using default maximum probes per "
+                            "host: %d\n\n", DEFAULT_MAX_PER_HOST);
+                    endptr = NULL;
+                }
+                else
+                {
+                    max_per_host = (unsigned int) ret;
+                }
+                break;
+            case OPT_RATE:
+                errno = 0;
+                rate = strtoull(optarg, &endptr, 10);
+                if (errno || *endptr || !isdigit((unsigned char) *optarg)
+                    || !rate || rate > PACER_MAX_RATE)
+                {
+                    /*
+                     * Scanning faster than asked could break the rules the
+                     * limit is there for, so don't fall back on no limit
+                     */
+                    fprintf(stderr, "[!] Invalid rate: \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_BURST:
+                errno = 0;
+                burst = strtoull(optarg, &endptr, 10);
+                if (errno || *endptr || !isdigit((unsigned char) *optarg)
+                    || !burst || burst > PACER_MAX_BURST)
+                {
+                    fprintf(stderr, "[!] Invalid burst: \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_RESULT_MAP:
+                result_path = optarg;
+                break;
+            case OPT_STATE_FILE:
+                state_path = optarg;
+                break;
+            case OPT_CHECKPOINT:
+                checkpoint_path = optarg;
+                break;
+            case OPT_RESUME:
+                checkpoint_path = optarg;
+                resume = 1;
+                break;
+            case OPT_DAEMON:
+                monitoring = 1;
+                break;
+            case OPT_STATS:
+                show_stats = 1;
+                break;
+            case OPT_SIMULATE:
+                sim_free(sim);
+                sim = sim_load(optarg, &line);
+                if (!sim)
+                {
+                    if (errno == EINVAL && line)
+                    {
+                        fprintf(stderr, "[!] Invalid directive in \"%s\" on "
+                                "line %zu\n", optarg, line);
+                    }
+                    else if (errno == EINVAL)
+                    {
+                        fprintf(stderr, "[!] No local address in \"%s\"\n",
+                                optarg);
+                    }
+                    else
+                    {
+                        perror("[!] Failed to read network spec");
+                    }
+
+                    return 1;
+                }
+                break;
+            case OPT_INTERVAL:
+                errno = 0;
+                ret = strtol(optarg, &endptr, 10);
+                if (errno || *endptr || ret < 1
+                    || ret > MONITOR_MAX_INTERVAL_MS)
+                {
+                    fprintf(stderr, "[!] Invalid interval: \"%s\"\n", optarg);
+                    fprintf(stderr, "[*] Using default interval: %d msec\n\n",
+                            DEFAULT_INTERVAL_MS);
+                    endptr = NULL;
+                }
+                else
+                {
+                    interval = (unsigned long) ret;
+                }
+                break;
+            case 'o':
+                output_format = parse_output_format(optarg);
+                if (output_format == -1)
+                {
+                    fprintf(stderr, "[!] Invalid output format: \"%s\"\n",
+                            optarg);
+                    fputs("[*] Using default output format: text\n\n",
+                          stderr);
+                    output_format = OUTPUT_TEXT;
+                }
+                break;
+            case OPT_PER_THREAD:
+                serialize_callbacks = 0;
+                break;
             case 'v':
                 print_version();
                 return 0;
@@ -181,7 +718,83 @@ main(int argc, char *argv[])
         }
     }
 
-    sc = init_scanner(scan_type, device_name, &timeout, port);
+    /*
+     * Remaining arguments are targets
+     */
+    for (; optind < argc; optind++)
+    {
+        if (interval_set_parse_list(&targets, argv[optind]))
+        {
+            fprintf(stderr, "[!] Invalid target: \"%s\"\n", argv[optind]);
+            return 1;
+        }
+    }
+
+    /*
+     * Print the counters on SIGUSR1 from a thread of their own, started
+     * before any other so that they all leave the signal to it
+     */
+    if (metrics_watch())
+    {
+        perror("[!] Failed to watch for SIGUSR1");
+    }
+
+    /*
+     * A scan that never finishes has nothing to checkpoint
+     */
+    if (monitoring && checkpoint_path)
+    {
+        fputs("[!] --daemon can't be used with --checkpoint or --resume\n",
+              stderr);
+        sim_free(sim);
+        interval_set_free(&targets);
+        interval_set_free(&exclude);
+        free(ports);
+        return 1;
+    }
+
+    /*
+     * Scans of several interfaces have no single range for a result map or
+     * checkpoint to cover
+     */
+    if (all_interfaces && (result_path || state_path || checkpoint_path
+                           || monitoring))
+    {
+        fputs("[!] --all-interfaces can't be used with --result-map, "
+              "--state-file, --checkpoint, --resume or --daemon\n", stderr);
+        sim_free(sim);
+        interval_set_free(&targets);
+        interval_set_free(&exclude);
+        free(ports);
+        return 1;
+    }
+
+    /*
+     * A simulated network has no interfaces to scan, and the pacer only keeps
+     * real time
+     */
+    if (sim && (all_interfaces || rate))
+    {
+        fputs("[!] --simulate can't be used with --all-interfaces or --rate\n",
+              stderr);
+        sim_free(sim);
+        interval_set_free(&targets);
+        interval_set_free(&exclude);
+        free(ports);
+        return 1;
+    }
+
+    /*
+     * A simulated network is scanned from the local address of its spec
+     */
+    if (sim)
+    {
+        sc = init_device_scanner(scan_type, sim_device(sim), &timeout, port);
+    }
+    else
+    {
+        sc = init_scanner(scan_type, device_name, &timeout, port);
+    }
 
     if (!sc)
     {
@@ -194,10 +807,301 @@ main(int argc, char *argv[])
             fputs("[!] Failed to find suitable network device\n", stderr);
         }
 
+        sim_free(sim);
+        free(ports);
+
+        return 1;
+    }
+
+    sc->sim = sim;
+
+    /*
+     * Scan the device's subnet unless targets were given, minus any
+     * exclusions. With every interface, that is done for each of them once
+     * the scanner is set up.
+     */
+    if (all_interfaces)
+    {
+        if (interval_set_finish(&targets) || interval_set_finish(&exclude))
+        {
+            perror("[!] Failed to set up targets");
+            interval_set_free(&targets);
+            interval_set_free(&exclude);
+            free(ports);
+            free_scanner(sc);
+            return 1;
+        }
+    }
+    else if (targets.count || exclude.count)
+    {
+        if ((!targets.count && interval_set_add(&targets, ntohl(sc->start),
+                                                ntohl(sc->end)))
+            || interval_set_finish(&targets) || interval_set_finish(&exclude)
+            || interval_set_subtract(&targets, &exclude)
+            || !(sc->targets = malloc(sizeof(*sc->targets))))
+        {
+            perror("[!] Failed to set up targets");
+            interval_set_free(&targets);
+            interval_set_free(&exclude);
+            free(ports);
+            free_scanner(sc);
+            return 1;
+        }
+
+        *sc->targets = targets;
+        interval_set_free(&exclude);
+
+        if (!sc->targets->total)
+        {
+            fputs("[!] No targets left to scan\n", stderr);
+            free(ports);
+            free_scanner(sc);
+            return 1;
+        }
+    }
+
+    sc->ports = ports;
+    sc->nports = nports;
+    sc->max_per_host = max_per_host;
+    sc->adaptive_timeout = adaptive_timeout;
+    sc->retries = retries;
+    sc->randomize = randomize;
+    sc->seed = has_seed ? (uint64_t) seed : random_key();
+    sc->rate = (uint64_t) rate;
+    sc->burst = (uint64_t) burst;
+    sc->max_inflight = max_inflight;
+    sc->adaptive_window = adaptive_window;
+    sc->backend = backend;
+    sc->send_batch = send_batch;
+    sc->threads = threads;
+    sc->serialize_callbacks = serialize_callbacks;
+
+    /*
+     * Every interface address gets a scanner of its own, set up like sc
+     */
+    if (all_interfaces)
+    {
+        ret = scan_group_init(&group, sc, device_name,
+                              targets.count ? &targets : NULL, &exclude);
+        err = errno;
+        interval_set_free(&targets);
+        interval_set_free(&exclude);
+
+        if (ret || !group.count)
+        {
+            errno = err;
+
+            if (ret)
+            {
+                perror("[!] Failed to set up interfaces");
+            }
+            else
+            {
+                fputs("[!] No targets left to scan\n", stderr);
+            }
+
+            free_scanner(sc);
+            return 1;
+        }
+
+        use_interface_tags(1);
+    }
+
+    /*
+     * Keep the state of every host scanned, from the first target to the last
+     */
+    if (result_path || state_path || monitoring)
+    {
+        if (sc->targets ? result_map_init(&result_map,
+                                          sc->targets->intervals[0].first,
+                                          sc->targets->intervals[
+                                              sc->targets->count - 1].last)
+                        : result_map_init(&result_map, ntohl(sc->start),
+                                          ntohl(sc->end)))
+        {
+            perror("[!] Failed to set up result map");
+            free_scanner(sc);
+            return 1;
+        }
+
+        use_result_map(&result_map);
+    }
+
+    /*
+     * Structured output goes to standard output through a buffered sink
+     */
+    if (output_format != OUTPUT_TEXT)
+    {
+        output = output_new(STDOUT_FILENO, (uint8_t) output_format);
+
+        if (!output)
+        {
+            perror("[!] Failed to set up output");
+            result_map_free(&result_map);
+            scan_group_free(&group);
+            free_scanner(sc);
+            return 1;
+        }
+
+        use_output(output);
+    }
+
+    /*
+     * With a state file, only the changes are reported, once the scan is
+     * over (or after every round, in daemon mode). With several ports per
+     * host, hosts are reported along with their ports once the scan is over.
+     * Down hosts only matter to the result map, structured output and
+     * checkpoints.
+     */
+    if (state_path || monitoring)
+    {
+        up_callback = record_up_host;
+        down_callback = record_down_host;
+        error_callback = record_probe_error;
+    }
+    else
+    {
+        up_callback = port_count(sc) > 1 ? record_port : print_up_host;
+        down_callback = result_path || output || checkpoint_path
+                        ? print_down_host : NULL;
+        error_callback = print_probe_error;
+    }
+
+    /*
+     * Targets done before the scan was interrupted are reported again and
+     * skipped by the scan
+     */
+    if (checkpoint_path)
+    {
+        if (checkpoint_open(&checkpoint, sc, checkpoint_path, resume))
+        {
+            perror("[!] Failed to set up checkpoint");
+            use_output(NULL);
+            use_result_map(NULL);
+            result_map_free(&result_map);
+
+            if (output)
+            {
+                output_close(output);
+            }
+
+            free_scanner(sc);
+            return 1;
+        }
+
+        use_checkpoint(&checkpoint);
+
+        if (resume)
+        {
+            checkpoint_replay(&checkpoint, sc, up_callback, down_callback);
+        }
+    }
+
+    if (monitoring)
+    {
+        ret = monitor_init(&monitor, sc, interval * 1000000ULL);
+
+        if (!ret)
+        {
+            use_monitor(&monitor);
+            ret = run_daemon(sc, &monitor, &result_map, up_callback,
+                             down_callback, error_callback, state_path,
+                             result_path);
+            use_monitor(NULL);
+            monitor_free(&monitor);
+        }
+    }
+    else if (all_interfaces)
+    {
+        ret = run_scan_group(&group, up_callback, down_callback,
+                             error_callback);
+        sc->stats = group.stats;
+    }
+    else
+    {
+        ret = run_scan(sc, up_callback, down_callback, error_callback);
+    }
+
+    err = errno;
+    metrics_unwatch();
+
+    if (show_stats)
+    {
+        metrics_snapshot(&metrics);
+        metrics_print(stderr, &metrics);
+    }
+
+    if (!state_path && !monitoring && port_count(sc) > 1)
+    {
+        for (i = 0; i < group.count; i++)
+        {
+            print_port_report(group.scanners[i]);
+        }
+
+        if (!all_interfaces)
+        {
+            print_port_report(sc);
+        }
+    }
+
+    use_interface_tags(0);
+    scan_group_free(&group);
+
+    if (checkpoint_path)
+    {
+        sc->skip = NULL;
+        use_checkpoint(NULL);
+
+        if (checkpoint_close(&checkpoint, !ret && !signal_flag))
+        {
+            perror("[!] Failed to write checkpoint");
+        }
+        else if (!ret && signal_flag)
+        {
+            fprintf(stderr, "[*] Scan interrupted; continue it with "
+                    "--resume %s\n", checkpoint_path);
+        }
+    }
+
+    errno = err;
+
+    if (!ret && result_path && !monitoring
+        && result_map_save(&result_map, result_path))
+    {
+        perror("[!] Failed to save result map");
+        errno = err;
+    }
+
+    if (!ret && state_path && !monitoring
+        && report_changes(&result_map, state_path, sc->scan_type))
+    {
+        perror("[!] Failed to update state file");
+        errno = err;
+    }
+
+    use_result_map(NULL);
+    use_output(NULL);
+    result_map_free(&result_map);
+
+    if (output && output_close(output))
+    {
+        perror("[!] Failed to write output");
+    }
+
+    errno = err;
+
+    if (ret)
+    {
+        perror("[!] Failed to run scan");
+        free_scanner(sc);
         return 1;
     }
 
-    run_scan(sc, print_up_host, NULL, print_probe_error);
+    if (adaptive_window || sc->sim)
+    {
+        print_scan_stats(sc);
+    }
+
     free_scanner(sc);
 
     return 0;
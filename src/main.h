@@ -36,6 +36,13 @@
 #define DEFAULT_TIMEOUT_SEC     0
 #define DEFAULT_TIMEOUT_USEC    10000
 #define DEFAULT_SCAN_TYPE       SCAN_TYPE_CONNECT
+#define DEFAULT_MAX_INFLIGHT    0
+#define DEFAULT_THREADS         1
+#define DEFAULT_BACKEND         BACKEND_EPOLL
+#define DEFAULT_SEND_BATCH      32
+#define DEFAULT_MAX_PER_HOST    32
+#define DEFAULT_RETRIES         0
+#define DEFAULT_INTERVAL_MS     5000
 
 #endif /* MAIN_H */
 
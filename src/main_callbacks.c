@@ -1,22 +1,161 @@
 #include "main_callbacks.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
-void
-print_up_host(struct scanner *sc)
+#include "util.h"
+
+/*
+ * Open and closed ports found by a multi-port scan, kept until the scan is
+ * over so that they can be reported host by host. Hosts that are up without
+ * being probed (the local and broadcast addresses) are kept with state
+ * PORT_STATE_NONE.
+ */
+struct port_result
 {
-    char addrbuf[INET_ADDRSTRLEN] = {0};
-    in_addr_t bcast = 0;
+    in_addr_t addr;
+    uint16_t port;
+    uint8_t state;
+};
 
-    if (!sc)
+/*
+ * Map the callbacks record the state of each host in, if any
+ */
+static struct result_map *result_map = NULL;
+
+/*
+ * Sink the callbacks write results to instead of printing them, if any
+ */
+static struct output *output = NULL;
+
+/*
+ * Checkpoint the callbacks record results in, if any
+ */
+static struct checkpoint *checkpoint = NULL;
+
+/*
+ * Schedule the callbacks reschedule probed targets in, if any
+ */
+static struct monitor *monitor = NULL;
+
+/*
+ * Whether results are tagged with the interface they were scanned through
+ */
+static int tag_interfaces = 0;
+
+static struct port_result *results = NULL;
+static size_t nresults = 0;
+static size_t results_size = 0;
+
+/*
+ * Callbacks may be called from several threads at once
+ */
+static pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Orders results by address, then by port
+ */
+static int
+compare_results(const void *a, const void *b)
+{
+    const struct port_result *x = a, *y = b;
+    uint32_t xa = ntohl(x->addr), ya = ntohl(y->addr);
+
+    if (xa != ya)
     {
-        return;
+        return xa < ya ? -1 : 1;
+    }
+
+    return (x->port > y->port) - (x->port < y->port);
+}
+
+/*
+ * Returns 1 if addr (network byte order) is one of the scanner's targets, or
+ * 0 otherwise
+ */
+static int
+in_scan(const struct scanner *sc, in_addr_t addr)
+{
+    if (sc->targets)
+    {
+        return interval_set_contains(sc->targets, ntohl(addr));
+    }
+
+    return ntohl(addr) >= ntohl(sc->start) && ntohl(addr) <= ntohl(sc->end);
+}
+
+/*
+ * Writes the result of the probe the scanner is reporting to the output sink,
+ * with the host in the given state
+ */
+static void
+write_result(struct scanner *sc, uint8_t state)
+{
+    struct output_record rec = {0};
+
+    rec.err = state == RESULT_ERROR ? (uint16_t) errno : 0;
+    rec.time = realtime_ns();
+    rec.rtt = sc->rtt;
+    rec.addr = sc->target.sin_addr.s_addr;
+    rec.port = ntohs(sc->target.sin_port);
+    rec.scan_type = sc->scan_type;
+    rec.state = state;
+    rec.port_state = sc->port_state;
+    rec.ifindex = tag_interfaces ? sc->dev->index : 0;
+
+    if (sc->has_hwaddr)
+    {
+        rec.has_hwaddr = 1;
+        memcpy(rec.hwaddr, sc->hwaddr, sizeof(rec.hwaddr));
+    }
+
+    /*
+     * A failed write is reported when the sink is closed
+     */
+    output_write(output, &rec);
+}
+
+/*
+ * Records the result of the probe the scanner is reporting in the result map,
+ * the checkpoint and the monitor's schedule, if they are in use. Failed
+ * probes are left out of the checkpoint, so that they are tried again if the
+ * scan is resumed.
+ */
+static void
+note_result(struct scanner *sc, uint8_t state)
+{
+    if (result_map)
+    {
+        result_map_set(result_map, ntohl(sc->target.sin_addr.s_addr), state);
     }
 
+    if (checkpoint && state != RESULT_ERROR)
+    {
+        checkpoint_record(checkpoint, sc, state);
+    }
+
+    if (monitor)
+    {
+        monitor_record(monitor, sc, state);
+    }
+}
+
+/*
+ * Prints the host the scanner is reporting as a line of text
+ */
+static void
+print_host(struct scanner *sc)
+{
+    char addrbuf[INET_ADDRSTRLEN] = {0};
+    in_addr_t bcast = 0;
+
     if (sc->dev->bcast)
     {
         bcast = sc->dev->bcast->sin_addr.s_addr;
@@ -32,11 +171,27 @@ print_up_host(struct scanner *sc)
         printf("%s", addrbuf);
     }
     
+    /*
+     * Show the host's hardware address if the probe learned it
+     */
+    if (sc->has_hwaddr)
+    {
+        printf(" (%02x:%02x:%02x:%02x:%02x:%02x)", sc->hwaddr[0],
+               sc->hwaddr[1], sc->hwaddr[2], sc->hwaddr[3], sc->hwaddr[4],
+               sc->hwaddr[5]);
+    }
+
+    if (tag_interfaces)
+    {
+        printf(" on %s", sc->dev->name);
+    }
+
     if (sc->target.sin_addr.s_addr == sc->dev->local.sin_addr.s_addr
         || sc->target.sin_addr.s_addr == bcast)
     {
-        printf(" [%s]\n", sc->target.sin_addr.s_addr == bcast ? "BROADCAST"
-                                                              : "YOU");
+        printf(" [%s]\n", sc->target.sin_addr.s_addr
+                          == sc->dev->local.sin_addr.s_addr ? "YOU"
+                                                            : "BROADCAST");
     }
     else
     {
@@ -44,9 +199,287 @@ print_up_host(struct scanner *sc)
     }
 }
 
+void
+print_up_host(struct scanner *sc)
+{
+    if (!sc)
+    {
+        return;
+    }
+
+    note_result(sc, RESULT_UP);
+
+    if (output)
+    {
+        write_result(sc, RESULT_UP);
+        return;
+    }
+
+    print_host(sc);
+}
+
 void
 print_probe_error(struct scanner *sc)
 {
+    if (sc)
+    {
+        note_result(sc, RESULT_ERROR);
+    }
+
+    if (output && sc)
+    {
+        write_result(sc, RESULT_ERROR);
+        return;
+    }
+
     perror("[!] Probe of remote host failed");
 }
 
+void
+print_down_host(struct scanner *sc)
+{
+    if (sc)
+    {
+        note_result(sc, RESULT_DOWN);
+    }
+
+    if (output && sc)
+    {
+        write_result(sc, RESULT_DOWN);
+    }
+}
+
+void
+record_up_host(struct scanner *sc)
+{
+    if (sc)
+    {
+        note_result(sc, RESULT_UP);
+    }
+}
+
+void
+record_down_host(struct scanner *sc)
+{
+    if (sc)
+    {
+        note_result(sc, RESULT_DOWN);
+    }
+}
+
+void
+record_probe_error(struct scanner *sc)
+{
+    if (sc)
+    {
+        note_result(sc, RESULT_ERROR);
+    }
+}
+
+void
+use_result_map(struct result_map *map)
+{
+    result_map = map;
+}
+
+void
+use_output(struct output *out)
+{
+    output = out;
+}
+
+void
+use_checkpoint(struct checkpoint *cp)
+{
+    checkpoint = cp;
+}
+
+void
+use_monitor(struct monitor *mon)
+{
+    monitor = mon;
+}
+
+void
+use_interface_tags(int tag)
+{
+    tag_interfaces = tag;
+}
+
+void
+record_port(struct scanner *sc)
+{
+    struct port_result *grown = NULL;
+
+    if (!sc)
+    {
+        return;
+    }
+
+    note_result(sc, RESULT_UP);
+
+    /*
+     * Structured output is written port by port as it comes in
+     */
+    if (output)
+    {
+        write_result(sc, RESULT_UP);
+        return;
+    }
+
+    pthread_mutex_lock(&results_lock);
+
+    if (nresults == results_size)
+    {
+        grown = realloc(results, (results_size ? 2 * results_size : 64)
+                                 * sizeof(*results));
+
+        if (!grown)
+        {
+            pthread_mutex_unlock(&results_lock);
+            perror("[!] Failed to record port");
+            return;
+        }
+
+        results = grown;
+        results_size = results_size ? 2 * results_size : 64;
+    }
+
+    results[nresults].addr = sc->target.sin_addr.s_addr;
+    results[nresults].port = ntohs(sc->target.sin_port);
+    results[nresults].state = sc->port_state;
+    nresults++;
+
+    pthread_mutex_unlock(&results_lock);
+}
+
+void
+print_port_report(struct scanner *sc)
+{
+    size_t i = 0, j = 0, kept = 0;
+    uint32_t answered = 0;
+
+    if (!sc)
+    {
+        return;
+    }
+
+    qsort(results, nresults, sizeof(*results), compare_results);
+
+    for (i = 0; i < nresults; i = j)
+    {
+        /*
+         * Hosts of other scans (of a group) are kept for their own reports
+         */
+        if (!in_scan(sc, results[i].addr))
+        {
+            for (j = i; j < nresults && results[j].addr == results[i].addr;
+                 j++)
+            {
+                results[kept++] = results[j];
+            }
+
+            continue;
+        }
+
+        sc->target.sin_addr.s_addr = results[i].addr;
+        print_host(sc);
+
+        answered = 0;
+
+        for (j = i; j < nresults && results[j].addr == results[i].addr; j++)
+        {
+            if (results[j].state == PORT_STATE_NONE)
+            {
+                continue;
+            }
+
+            printf("    %5u/tcp  %s\n", results[j].port,
+                   results[j].state == PORT_OPEN ? "open" : "closed");
+            answered++;
+        }
+
+        /*
+         * Every port that didn't answer timed out
+         */
+        if (answered && answered < sc->nports)
+        {
+            printf("    %u filtered\n", sc->nports - answered);
+        }
+    }
+
+    nresults = kept;
+
+    if (nresults)
+    {
+        return;
+    }
+
+    free(results);
+    results = NULL;
+    nresults = 0;
+    results_size = 0;
+}
+
+void
+print_scan_stats(const struct scanner *sc)
+{
+    if (sc->adaptive_window)
+    {
+        fprintf(stderr, "[*] Probe window: %u at the end (peak %u), grown "
+                "%llu times, cut %llu times\n", sc->stats.window_final,
+                sc->stats.window_peak,
+                (unsigned long long) sc->stats.window_raises,
+                (unsigned long long) sc->stats.window_cuts);
+    }
+
+    if (sc->sim)
+    {
+        fprintf(stderr, "[*] Simulated network time: %llu.%03llu sec\n",
+                (unsigned long long) (sc->stats.sim_ns / 1000000000ULL),
+                (unsigned long long) (sc->stats.sim_ns % 1000000000ULL
+                                      / 1000000ULL));
+    }
+}
+
+void
+print_changes(const struct result_map *map, const struct result_map *prev,
+              uint8_t scan_type)
+{
+    char addrbuf[INET_ADDRSTRLEN] = {0};
+    uint64_t i = 0;
+    uint8_t state = 0, old = 0;
+    struct output_record rec = {0};
+
+    rec.scan_type = scan_type;
+    rec.changed = 1;
+
+    for (i = 0; result_map_next_change(map, prev, &i); i++)
+    {
+        rec.addr = htonl(map->first + (uint32_t) i);
+        state = result_map_get(map, map->first + (uint32_t) i);
+        old = result_map_get(prev, map->first + (uint32_t) i);
+
+        /*
+         * A host never seen before that is down is no news
+         */
+        if (old == RESULT_UNKNOWN && state == RESULT_DOWN)
+        {
+            continue;
+        }
+
+        if (output)
+        {
+            rec.time = realtime_ns();
+            rec.state = state;
+            rec.prev_state = old;
+            output_write(output, &rec);
+            continue;
+        }
+
+        format_ipv4(rec.addr, addrbuf);
+        printf("%c %s (%s -> %s)\n", state == RESULT_UP ? '+'
+                                     : old == RESULT_UP ? '-' : '~', addrbuf,
+               result_state_name(old), result_state_name(state));
+    }
+}
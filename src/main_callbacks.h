@@ -1,6 +1,10 @@
 #ifndef MAIN_CALLBACKS_H
 #define MAIN_CALLBACKS_H
 
+#include "checkpoint.h"
+#include "monitor.h"
+#include "output.h"
+#include "results.h"
 #include "scanner.h"
 
 /*
@@ -13,5 +17,95 @@ print_up_host(struct scanner *sc);
 void
 print_probe_error(struct scanner *sc);
 
+/*
+ * Records a host that is down in the result map and writes it to the output
+ * sink, if they are in use. Meant to be used as the down callback.
+ */
+void
+print_down_host(struct scanner *sc);
+
+/*
+ * Record the state of a host in the result map without printing anything,
+ * for scans that only report changes. Meant to be used as the up, down and
+ * error callbacks.
+ */
+void
+record_up_host(struct scanner *sc);
+
+void
+record_down_host(struct scanner *sc);
+
+void
+record_probe_error(struct scanner *sc);
+
+/*
+ * Has the callbacks record the state of every host they are called for in
+ * map (or in no map, if map is NULL).
+ */
+void
+use_result_map(struct result_map *map);
+
+/*
+ * Has the callbacks write results to out instead of printing them as text (or
+ * print them again, if out is NULL).
+ */
+void
+use_output(struct output *out);
+
+/*
+ * Has the callbacks record every result other than failed probes in cp (or
+ * in no checkpoint, if cp is NULL).
+ */
+void
+use_checkpoint(struct checkpoint *cp);
+
+/*
+ * Has the callbacks reschedule every target they are called for in mon (or
+ * in no schedule, if mon is NULL).
+ */
+void
+use_monitor(struct monitor *mon);
+
+/*
+ * Has the callbacks tag every result with the interface it was scanned
+ * through, for scans of several interfaces at once (or stop, if tag is 0).
+ */
+void
+use_interface_tags(int tag);
+
+/*
+ * Records an open or closed port (or an up host that was not probed) found by
+ * a multi-port scan, for print_port_report. Meant to be used as the up
+ * callback.
+ */
+void
+record_port(struct scanner *sc);
+
+/*
+ * Prints every host of the scanner's scan recorded by record_port along with
+ * its open and closed ports and the number of ports that never answered, then
+ * forgets them.
+ */
+void
+print_port_report(struct scanner *sc);
+
+/*
+ * Prints the statistics gathered over a scan to stderr: the decisions of the
+ * adaptive window, and the virtual time a simulated scan took.
+ */
+void
+print_scan_stats(const struct scanner *sc);
+
+/*
+ * Reports every host whose state in map differs from its state in prev (from
+ * an earlier scan), other than hosts not seen before that are down: as
+ * records marked as changes if the callbacks write to an output sink, or
+ * otherwise as lines of text prefixed with "+" for hosts that came up, "-" for
+ * hosts that went down and "~" for other changes.
+ */
+void
+print_changes(const struct result_map *map, const struct result_map *prev,
+              uint8_t scan_type);
+
 #endif /* MAIN_CALLBACKS_H */
 
@@ -0,0 +1,418 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "util.h"
+
+/*
+ * Number of counters in struct metrics, which starts with nothing but them
+ */
+#define COUNTERS    (offsetof(struct metrics, prev) / sizeof(uint64_t))
+
+/*
+ * Counters of the live threads, the sum of those of the threads that exited,
+ * and the lock guarding both (never taken on the hot path)
+ */
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct metrics *registry = NULL;
+static struct metrics retired = {0};
+
+/*
+ * Key whose destructor retires a thread's counters when it exits
+ */
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static int has_key = 0;
+
+/*
+ * The calling thread's counters, and whether setting them up failed
+ */
+static __thread struct metrics *local = NULL;
+static __thread int unavailable = 0;
+
+/*
+ * The thread printing snapshots on SIGUSR1, and whether it should keep going
+ */
+static pthread_t watcher;
+static int watching = 0;
+
+/*
+ * Adds n to a counter only the calling thread writes
+ */
+static void
+bump(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+/*
+ * Adds every counter of from to those of to
+ */
+static void
+add(struct metrics *to, const struct metrics *from)
+{
+    size_t i = 0;
+    uint64_t *dst = (uint64_t *) to;
+    const uint64_t *src = (const uint64_t *) from;
+
+    for (i = 0; i < COUNTERS; i++)
+    {
+        dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Folds the counters of a thread that exited into the retired ones
+ */
+static void
+retire(void *arg)
+{
+    struct metrics *m = arg;
+
+    pthread_mutex_lock(&registry_lock);
+
+    add(&retired, m);
+
+    if (m->prev)
+    {
+        m->prev->next = m->next;
+    }
+    else
+    {
+        registry = m->next;
+    }
+
+    if (m->next)
+    {
+        m->next->prev = m->prev;
+    }
+
+    pthread_mutex_unlock(&registry_lock);
+    free(m);
+}
+
+static void
+make_key(void)
+{
+    has_key = !pthread_key_create(&key, retire);
+}
+
+/*
+ * Returns the calling thread's counters, setting them up on the first call,
+ * or NULL if they could not be
+ */
+static struct metrics *
+counters(void)
+{
+    int err = 0;
+    struct metrics *m = NULL;
+
+    if (local || unavailable)
+    {
+        return local;
+    }
+
+    err = errno;
+    pthread_once(&key_once, make_key);
+    m = zmalloc(sizeof(*m));
+
+    if (!m || !has_key || pthread_setspecific(key, m))
+    {
+        free(m);
+        unavailable = 1;
+        errno = err;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&registry_lock);
+    m->next = registry;
+
+    if (registry)
+    {
+        registry->prev = m;
+    }
+
+    registry = m;
+    pthread_mutex_unlock(&registry_lock);
+
+    local = m;
+    errno = err;
+
+    return m;
+}
+
+/*
+ * Returns the histogram bucket of a time in nanoseconds: the position of its
+ * highest set bit
+ */
+static unsigned int
+bucket(uint64_t ns)
+{
+    unsigned int i = 0;
+
+    if (!ns)
+    {
+        return 0;
+    }
+
+    i = 63 - (unsigned int) __builtin_clzll(ns);
+
+    return i < METRICS_BUCKETS ? i : METRICS_BUCKETS - 1;
+}
+
+void
+metrics_sent(void)
+{
+    struct metrics *m = counters();
+
+    if (m)
+    {
+        bump(&m->sent, 1);
+    }
+}
+
+void
+metrics_reply(uint64_t rtt)
+{
+    struct metrics *m = counters();
+
+    if (m)
+    {
+        bump(&m->replies, 1);
+        bump(&m->rtt[bucket(rtt)], 1);
+    }
+}
+
+void
+metrics_timeout(void)
+{
+    struct metrics *m = counters();
+
+    if (m)
+    {
+        bump(&m->timeouts, 1);
+    }
+}
+
+void
+metrics_error(int err)
+{
+    struct metrics *m = counters();
+
+    if (m)
+    {
+        bump(&m->errors[err >= 0 && err < METRICS_ERRNOS ? err
+                                                         : METRICS_ERRNOS - 1],
+             1);
+    }
+}
+
+void
+metrics_syscall(uint64_t start)
+{
+    int err = errno;
+    struct metrics *m = counters();
+
+    if (m)
+    {
+        bump(&m->syscalls[bucket(monotonic_ns() - start)], 1);
+    }
+
+    errno = err;
+}
+
+void
+metrics_snapshot(struct metrics *total)
+{
+    struct metrics *m = NULL;
+
+    memset(total, 0, sizeof(*total));
+
+    pthread_mutex_lock(&registry_lock);
+
+    add(total, &retired);
+
+    for (m = registry; m; m = m->next)
+    {
+        add(total, m);
+    }
+
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/*
+ * Formats a time in nanoseconds with a unit that keeps it short
+ */
+static void
+format_time(char *buf, size_t len, uint64_t ns)
+{
+    if (ns < 1000ULL)
+    {
+        snprintf(buf, len, "%lluns", (unsigned long long) ns);
+    }
+    else if (ns < 1000000ULL)
+    {
+        snprintf(buf, len, "%.1fus", (double) ns / 1e3);
+    }
+    else if (ns < 1000000000ULL)
+    {
+        snprintf(buf, len, "%.1fms", (double) ns / 1e6);
+    }
+    else
+    {
+        snprintf(buf, len, "%.1fs", (double) ns / 1e9);
+    }
+}
+
+/*
+ * Prints the buckets of a histogram that aren't empty, under a title
+ */
+static void
+print_histogram(FILE *out, const char *title, const uint64_t *hist)
+{
+    unsigned int i = 0, first = METRICS_BUCKETS, last = 0;
+    char lo[16] = {0}, hi[16] = {0};
+
+    for (i = 0; i < METRICS_BUCKETS; i++)
+    {
+        if (hist[i])
+        {
+            first = first < i ? first : i;
+            last = i;
+        }
+    }
+
+    if (first == METRICS_BUCKETS)
+    {
+        return;
+    }
+
+    fprintf(out, "[*] %s:\n", title);
+
+    for (i = first; i <= last; i++)
+    {
+        format_time(lo, sizeof(lo), i ? 1ULL << i : 0);
+
+        if (i + 1 < METRICS_BUCKETS)
+        {
+            format_time(hi, sizeof(hi), 1ULL << (i + 1));
+            fprintf(out, "    %8s - %-8s %llu\n", lo, hi,
+                    (unsigned long long) hist[i]);
+        }
+        else
+        {
+            fprintf(out, "    %8s and up  %llu\n", lo,
+                    (unsigned long long) hist[i]);
+        }
+    }
+}
+
+void
+metrics_print(FILE *out, const struct metrics *m)
+{
+    int i = 0;
+    uint64_t errors = 0;
+
+    for (i = 0; i < METRICS_ERRNOS; i++)
+    {
+        errors += m->errors[i];
+    }
+
+    fprintf(out, "[*] Probes: %llu sent, %llu replies, %llu timeouts, %llu "
+            "errors\n", (unsigned long long) m->sent,
+            (unsigned long long) m->replies,
+            (unsigned long long) m->timeouts, (unsigned long long) errors);
+
+    if (errors)
+    {
+        fputs("[*] Errors:\n", out);
+
+        for (i = 0; i < METRICS_ERRNOS; i++)
+        {
+            if (m->errors[i])
+            {
+                fprintf(out, "    %s: %llu\n", i < METRICS_ERRNOS - 1
+                                               ? strerror(i) : "Other",
+                        (unsigned long long) m->errors[i]);
+            }
+        }
+    }
+
+    print_histogram(out, "Round-trip times", m->rtt);
+    print_histogram(out, "System call times", m->syscalls);
+    fflush(out);
+}
+
+/*
+ * Prints a snapshot every time SIGUSR1 comes in, until told to stop
+ */
+static void *
+watch(void *arg)
+{
+    int sig = 0;
+    sigset_t set;
+    struct metrics total;
+
+    (void) arg;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+
+    while (!sigwait(&set, &sig)
+           && __atomic_load_n(&watching, __ATOMIC_ACQUIRE))
+    {
+        metrics_snapshot(&total);
+        metrics_print(stderr, &total);
+    }
+
+    return NULL;
+}
+
+int
+metrics_watch(void)
+{
+    int ret = 0;
+    sigset_t set;
+
+    if (watching)
+    {
+        return 0;
+    }
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    ret = pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    if (!ret)
+    {
+        __atomic_store_n(&watching, 1, __ATOMIC_RELEASE);
+        ret = pthread_create(&watcher, NULL, watch, NULL);
+    }
+
+    if (ret)
+    {
+        __atomic_store_n(&watching, 0, __ATOMIC_RELEASE);
+        errno = ret;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+metrics_unwatch(void)
+{
+    if (!watching)
+    {
+        return;
+    }
+
+    __atomic_store_n(&watching, 0, __ATOMIC_RELEASE);
+    pthread_kill(watcher, SIGUSR1);
+    pthread_join(watcher, NULL);
+}
@@ -0,0 +1,104 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Number of buckets in a histogram of times: bucket i counts times of 2^i up
+ * to (but not including) 2^(i + 1) nanoseconds, bucket 0 also counts times of
+ * 0, and the last bucket also counts every longer time
+ */
+#define METRICS_BUCKETS     40
+
+/*
+ * Errors are counted by errno value below this; errors with larger values
+ * share the last counter
+ */
+#define METRICS_ERRNOS      160
+
+/*
+ * Counters of what the engines did, kept by every thread that probes.
+ *
+ * sent counts probes sent, replies those answered over the network (whose
+ * round-trip times are counted in rtt), timeouts those that went unanswered
+ * (including those probed again on a retry pass) and errors those that failed,
+ * by errno. syscalls counts the time taken by the system calls that send
+ * probes and read replies: the sends and reads of the sweeps and the connects
+ * of the epoll engine (the io_uring engine submits its probes along with its
+ * waits, so they aren't timed).
+ *
+ * Each thread only ever writes its own counters, with relaxed atomic stores
+ * and no locks, so that counting costs next to nothing on the hot path.
+ * Readers sum every thread's counters with relaxed atomic loads, which gives
+ * a snapshot that may be slightly out of date but is never torn. prev and next
+ * link the counters of the live threads together.
+ */
+struct metrics
+{
+    uint64_t sent;
+    uint64_t replies;
+    uint64_t timeouts;
+    uint64_t errors[METRICS_ERRNOS];
+    uint64_t rtt[METRICS_BUCKETS];
+    uint64_t syscalls[METRICS_BUCKETS];
+    struct metrics *prev;
+    struct metrics *next;
+};
+
+/*
+ * Count a probe sent, a reply that took rtt nanoseconds, a probe that timed
+ * out and a probe that failed with errno err, for the calling thread. The
+ * first call on a thread sets up its counters; if they can't be allocated,
+ * nothing is counted for that thread. errno is left alone.
+ */
+void
+metrics_sent(void);
+
+void
+metrics_reply(uint64_t rtt);
+
+void
+metrics_timeout(void);
+
+void
+metrics_error(int err);
+
+/*
+ * Counts a system call that started at start (a monotonic_ns time) and just
+ * returned, for the calling thread. errno is left alone.
+ */
+void
+metrics_syscall(uint64_t start);
+
+/*
+ * Stores the sum of the counters of every thread, past and present, in total.
+ */
+void
+metrics_snapshot(struct metrics *total);
+
+/*
+ * Prints the counters in m to out: the number of probes sent, answered, timed
+ * out and failed, the errors by errno, and the histograms that aren't empty.
+ */
+void
+metrics_print(FILE *out, const struct metrics *m);
+
+/*
+ * Starts a thread that prints a snapshot of the counters to stderr whenever
+ * the process gets SIGUSR1, without interrupting the scan. SIGUSR1 is blocked
+ * on the calling thread, so this must be called before any other thread is
+ * started, for the threads started after it to inherit the block.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+metrics_watch(void);
+
+/*
+ * Stops the thread started by metrics_watch, if it is running.
+ */
+void
+metrics_unwatch(void);
+
+#endif /* METRICS_H */
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "monitor.h"
+#include "results.h"
+#include "util.h"
+
+int
+monitor_init(struct monitor *mon, const struct scanner *sc, uint64_t interval)
+{
+    memset(mon, 0, sizeof(*mon));
+    mon->count = target_count(sc);
+    mon->interval = interval;
+    mon->due = zmalloc(mon->count * sizeof(*mon->due));
+    mon->state = zmalloc(mon->count * sizeof(*mon->state));
+    mon->skip = zmalloc((mon->count + 63) / 64 * sizeof(*mon->skip));
+
+    if (!mon->due || !mon->state || !mon->skip)
+    {
+        monitor_free(mon);
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+monitor_free(struct monitor *mon)
+{
+    free(mon->due);
+    free(mon->state);
+    free(mon->skip);
+    memset(mon, 0, sizeof(*mon));
+}
+
+uint64_t
+monitor_schedule(struct monitor *mon, uint64_t now, uint64_t *wake)
+{
+    uint64_t i = 0, n = 0, next = UINT64_MAX;
+    uint64_t later = now + (mon->interval << MONITOR_MAX_BACKOFF);
+
+    mon->now = now;
+    memset(mon->skip, 0, (mon->count + 63) / 64 * sizeof(*mon->skip));
+
+    for (i = 0; i < mon->count; i++)
+    {
+        if (mon->due[i] > now)
+        {
+            mon->skip[i / 64] |= 1ULL << i % 64;
+            next = mon->due[i] < next ? mon->due[i] : next;
+            continue;
+        }
+
+        mon->due[i] = later;
+        n++;
+    }
+
+    if (!n)
+    {
+        *wake = next;
+    }
+
+    return n;
+}
+
+void
+monitor_record(struct monitor *mon, const struct scanner *sc, uint8_t state)
+{
+    uint64_t offset = 0;
+    uint8_t level = 0;
+
+    if (!target_offset(sc, sc->target.sin_addr.s_addr, sc->target.sin_port,
+                       &offset))
+    {
+        return;
+    }
+
+    level = mon->state[offset] & MONITOR_LEVEL_MASK;
+
+    if (state == RESULT_UP)
+    {
+        mon->state[offset] = MONITOR_WAS_UP;
+        mon->due[offset] = mon->now + mon->interval;
+        return;
+    }
+
+    /*
+     * A host that just went down is checked again as soon as one that is up
+     */
+    if (mon->state[offset] & MONITOR_WAS_UP)
+    {
+        level = 0;
+    }
+    else if (level < MONITOR_MAX_BACKOFF)
+    {
+        level++;
+    }
+
+    mon->state[offset] = level;
+    mon->due[offset] = mon->now + (mon->interval << level);
+}
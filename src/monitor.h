@@ -0,0 +1,89 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdint.h>
+
+#include "scanner.h"
+
+/*
+ * Largest backoff level of a target that keeps not answering: it is probed
+ * again after the interval times 2 to this power at the most
+ */
+#define MONITOR_MAX_BACKOFF     6
+
+/*
+ * Upper bound on the interval (in milliseconds) between probes of targets
+ * that answer
+ */
+#define MONITOR_MAX_INTERVAL_MS 86400000
+
+/*
+ * Bits of a target's entry in a monitor: its backoff level and whether it was
+ * up when last probed
+ */
+#define MONITOR_LEVEL_MASK      0x0f
+#define MONITOR_WAS_UP          0x10
+
+/*
+ * Schedule of a scan that is repeated continuously, deciding which targets
+ * are probed on each round.
+ *
+ * Every target (by offset, see target_at) has a time at which it is due in
+ * due (monotonic nanoseconds) and an entry in state. Targets that answer are
+ * due again interval after the round they were probed in. Those that don't
+ * back off, being due interval << level after it, with level going up by one
+ * each time up to MONITOR_MAX_BACKOFF, so that long-dead address space is
+ * rarely probed. A target that was up and stops answering starts over at
+ * level 0, so that a host that went down (or is flapping) is watched as
+ * closely as the hosts that are up.
+ *
+ * skip marks (a bit per offset) the targets that are not due on the current
+ * round, for the scanner's skip map; now is when the round started.
+ */
+struct monitor
+{
+    uint64_t count;
+    uint64_t interval;
+    uint64_t now;
+    uint64_t *due;
+    uint8_t *state;
+    uint64_t *skip;
+};
+
+/*
+ * Sets up a schedule for repeating the scan sc is set up for, with targets
+ * that answer probed every interval nanoseconds. Every target is due right
+ * away.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+monitor_init(struct monitor *mon, const struct scanner *sc, uint64_t interval);
+
+/*
+ * Frees everything allocated by monitor_init.
+ */
+void
+monitor_free(struct monitor *mon);
+
+/*
+ * Starts a round at time now: marks the targets that are not due in
+ * mon->skip, and puts off the ones that are as if they wouldn't answer, in
+ * case they are never reported (the results recorded by monitor_record
+ * reschedule them).
+ *
+ * Returns the number of targets due. If there are none, stores the time at
+ * which the next one is due in *wake.
+ */
+uint64_t
+monitor_schedule(struct monitor *mon, uint64_t now, uint64_t *wake);
+
+/*
+ * Reschedules the target of the probe sc is reporting, with the host in the
+ * given RESULT_* state. Safe to call from several threads at once, as long
+ * as they report different targets.
+ */
+void
+monitor_record(struct monitor *mon, const struct scanner *sc, uint8_t state);
+
+#endif /* MONITOR_H */
@@ -0,0 +1,672 @@
+#include <errno.h>
+#include <net/if.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "results.h"
+#include "scanner.h"
+#include "util.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/*
+ * Copies the string s to p and returns the position after it
+ */
+static char *
+put_str(char *p, const char *s)
+{
+    size_t len = strlen(s);
+
+    memcpy(p, s, len);
+
+    return p + len;
+}
+
+/*
+ * Writes v in decimal to p and returns the position after it
+ */
+static char *
+put_uint(char *p, uint64_t v)
+{
+    char digits[20];
+    size_t n = 0;
+
+    do
+    {
+        digits[n++] = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v);
+
+    while (n)
+    {
+        *p++ = digits[--n];
+    }
+
+    return p;
+}
+
+/*
+ * Copies the name of the interface with the given index to p and returns the
+ * position after it; the index itself is written if the interface is gone.
+ * The last name looked up is kept for each thread, since a thread mostly
+ * writes the results of a single interface.
+ */
+static char *
+put_interface(char *p, uint32_t index)
+{
+    static __thread uint32_t cached = 0;
+    static __thread char name[IF_NAMESIZE] = {0};
+
+    if (index != cached)
+    {
+        if (!if_indextoname(index, name))
+        {
+            cached = 0;
+            return put_uint(p, index);
+        }
+
+        cached = index;
+    }
+
+    return put_str(p, name);
+}
+
+/*
+ * Writes v / 10^places in decimal, with exactly places digits after the
+ * decimal point, to p and returns the position after it
+ */
+static char *
+put_fixed(char *p, uint64_t v, unsigned int places)
+{
+    uint64_t scale = 1;
+    unsigned int i = 0;
+
+    for (i = 0; i < places; i++)
+    {
+        scale *= 10;
+    }
+
+    p = put_uint(p, v / scale);
+    *p++ = '.';
+
+    for (v %= scale; scale > 1; scale /= 10)
+    {
+        *p++ = (char) ('0' + v / (scale / 10));
+        v %= scale / 10;
+    }
+
+    return p;
+}
+
+/*
+ * Writes a hardware address in colon-separated hex to p and returns the
+ * position after it
+ */
+static char *
+put_hwaddr(char *p, const uint8_t *hwaddr)
+{
+    int i = 0;
+
+    for (i = 0; i < 6; i++)
+    {
+        if (i)
+        {
+            *p++ = ':';
+        }
+
+        *p++ = hex_digits[hwaddr[i] >> 4];
+        *p++ = hex_digits[hwaddr[i] & 0xf];
+    }
+
+    return p;
+}
+
+/*
+ * Returns the name of a port state, or NULL for PORT_STATE_NONE
+ */
+static const char *
+port_state_name(uint8_t port_state)
+{
+    switch (port_state)
+    {
+        case PORT_OPEN:
+            return "open";
+        case PORT_CLOSED:
+            return "closed";
+        case PORT_FILTERED:
+            return "filtered";
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns the name of a scan type
+ */
+static const char *
+scan_type_name(uint8_t scan_type)
+{
+    switch (scan_type)
+    {
+        case SCAN_TYPE_CONNECT:
+            return "connect";
+        case SCAN_TYPE_ICMP:
+            return "icmp";
+        case SCAN_TYPE_ARP:
+            return "arp";
+        case SCAN_TYPE_SYN:
+            return "syn";
+    }
+
+    return "unknown";
+}
+
+int
+parse_output_format(const char *name)
+{
+    if (!strcmp(name, "text"))
+    {
+        return OUTPUT_TEXT;
+    }
+
+    if (!strcmp(name, "jsonl"))
+    {
+        return OUTPUT_JSONL;
+    }
+
+    if (!strcmp(name, "csv"))
+    {
+        return OUTPUT_CSV;
+    }
+
+    if (!strcmp(name, "bin"))
+    {
+        return OUTPUT_BINARY;
+    }
+
+    return -1;
+}
+
+size_t
+format_ipv4(in_addr_t addr, char *buf)
+{
+    const uint8_t *octets = (const uint8_t *) &addr;
+    char *p = buf;
+    unsigned int v = 0;
+    int i = 0;
+
+    for (i = 0; i < 4; i++)
+    {
+        v = octets[i];
+
+        if (i)
+        {
+            *p++ = '.';
+        }
+
+        if (v >= 100)
+        {
+            *p++ = (char) ('0' + v / 100);
+            v %= 100;
+            *p++ = (char) ('0' + v / 10);
+            v %= 10;
+        }
+        else if (v >= 10)
+        {
+            *p++ = (char) ('0' + v / 10);
+            v %= 10;
+        }
+
+        *p++ = (char) ('0' + v);
+    }
+
+    *p = '\0';
+
+    return (size_t) (p - buf);
+}
+
+size_t
+format_record(uint8_t format, const struct output_record *rec, char *buf)
+{
+    char *p = buf;
+
+    if (format == OUTPUT_BINARY)
+    {
+        memcpy(buf, rec, sizeof(*rec));
+        return sizeof(*rec);
+    }
+
+    if (format == OUTPUT_CSV)
+    {
+        /*
+         * addr,state,port_state,scan,port,rtt_us,time,hwaddr,errno,previous,
+         * interface with unknown fields left empty
+         */
+        p += format_ipv4(rec->addr, p);
+        *p++ = ',';
+        p = put_str(p, result_state_name(rec->state));
+        *p++ = ',';
+
+        if (port_state_name(rec->port_state))
+        {
+            p = put_str(p, port_state_name(rec->port_state));
+        }
+
+        *p++ = ',';
+        p = put_str(p, scan_type_name(rec->scan_type));
+        *p++ = ',';
+
+        if (rec->port)
+        {
+            p = put_uint(p, rec->port);
+        }
+
+        *p++ = ',';
+
+        if (rec->rtt)
+        {
+            p = put_fixed(p, rec->rtt, 3);
+        }
+
+        *p++ = ',';
+        p = put_fixed(p, rec->time / 1000, 6);
+        *p++ = ',';
+
+        if (rec->has_hwaddr)
+        {
+            p = put_hwaddr(p, rec->hwaddr);
+        }
+
+        *p++ = ',';
+
+        if (rec->err)
+        {
+            p = put_uint(p, rec->err);
+        }
+
+        *p++ = ',';
+
+        if (rec->changed)
+        {
+            p = put_str(p, result_state_name(rec->prev_state));
+        }
+
+        *p++ = ',';
+
+        if (rec->ifindex)
+        {
+            p = put_interface(p, rec->ifindex);
+        }
+
+        *p++ = '\n';
+
+        return (size_t) (p - buf);
+    }
+
+    p = put_str(p, "{\"addr\":\"");
+    p += format_ipv4(rec->addr, p);
+    p = put_str(p, "\",\"state\":\"");
+    p = put_str(p, result_state_name(rec->state));
+
+    if (port_state_name(rec->port_state))
+    {
+        p = put_str(p, "\",\"port_state\":\"");
+        p = put_str(p, port_state_name(rec->port_state));
+    }
+
+    p = put_str(p, "\",\"scan\":\"");
+    p = put_str(p, scan_type_name(rec->scan_type));
+    *p++ = '"';
+
+    if (rec->port)
+    {
+        p = put_str(p, ",\"port\":");
+        p = put_uint(p, rec->port);
+    }
+
+    if (rec->rtt)
+    {
+        p = put_str(p, ",\"rtt_us\":");
+        p = put_fixed(p, rec->rtt, 3);
+    }
+
+    p = put_str(p, ",\"time\":");
+    p = put_fixed(p, rec->time / 1000, 6);
+
+    if (rec->has_hwaddr)
+    {
+        p = put_str(p, ",\"hwaddr\":\"");
+        p = put_hwaddr(p, rec->hwaddr);
+        *p++ = '"';
+    }
+
+    if (rec->err)
+    {
+        p = put_str(p, ",\"errno\":");
+        p = put_uint(p, rec->err);
+    }
+
+    if (rec->changed)
+    {
+        p = put_str(p, ",\"previous\":\"");
+        p = put_str(p, result_state_name(rec->prev_state));
+        *p++ = '"';
+    }
+
+    if (rec->ifindex)
+    {
+        p = put_str(p, ",\"interface\":\"");
+        p = put_interface(p, rec->ifindex);
+        *p++ = '"';
+    }
+
+    p = put_str(p, "}\n");
+
+    return (size_t) (p - buf);
+}
+
+/*
+ * Returns an empty block: a spare one, or a new one if the sink has fewer
+ * than OUTPUT_MAX_BLOCKS. Returns NULL if there is none to be had. Must be
+ * called with the sink locked.
+ */
+static struct output_block *
+take_block(struct output *out)
+{
+    struct output_block *block = out->spare;
+
+    if (block)
+    {
+        out->spare = block->next;
+    }
+    else if (out->blocks < OUTPUT_MAX_BLOCKS)
+    {
+        block = malloc(sizeof(*block));
+
+        if (block)
+        {
+            out->blocks++;
+        }
+    }
+
+    if (block)
+    {
+        block->next = NULL;
+        block->used = 0;
+    }
+
+    return block;
+}
+
+/*
+ * Queues the current block for the writer if it holds anything and replaces
+ * it with an empty one, if there is one. Must be called with the sink locked.
+ */
+static void
+queue_current(struct output *out)
+{
+    if (!out->current || !out->current->used)
+    {
+        return;
+    }
+
+    if (out->queue_tail)
+    {
+        out->queue_tail->next = out->current;
+    }
+    else
+    {
+        out->queue_head = out->current;
+    }
+
+    out->queue_tail = out->current;
+    out->current = take_block(out);
+    pthread_cond_signal(&out->ready);
+}
+
+/*
+ * Appends len bytes of data to the current block, waiting for an empty block
+ * if it is full and the sink has none to spare. Must be called with the sink
+ * locked.
+ */
+static void
+append(struct output *out, const char *data, size_t len)
+{
+    for (;;)
+    {
+        if (!out->current)
+        {
+            out->current = take_block(out);
+        }
+
+        if (out->current && OUTPUT_BLOCK_SIZE - out->current->used >= len)
+        {
+            break;
+        }
+
+        if (out->current)
+        {
+            queue_current(out);
+            continue;
+        }
+
+        pthread_cond_wait(&out->space, &out->lock);
+    }
+
+    memcpy(out->current->data + out->current->used, data, len);
+    out->current->used += len;
+}
+
+/*
+ * Writer thread: writes out queued blocks in order, and the current block
+ * once it has held results for OUTPUT_FLUSH_MS, until the sink is closed
+ */
+static void *
+write_blocks(void *arg)
+{
+    struct output *out = arg;
+    struct output_block *block = NULL;
+    struct timespec deadline = {0};
+    int failed = 0;
+
+    pthread_mutex_lock(&out->lock);
+
+    for (;;)
+    {
+        while (!out->queue_head && !out->closing)
+        {
+            cond_deadline(&deadline, OUTPUT_FLUSH_MS);
+
+            if (pthread_cond_timedwait(&out->ready, &out->lock, &deadline)
+                == ETIMEDOUT)
+            {
+                queue_current(out);
+            }
+        }
+
+        if (!out->queue_head)
+        {
+            break;
+        }
+
+        block = out->queue_head;
+        out->queue_head = block->next;
+
+        if (!out->queue_head)
+        {
+            out->queue_tail = NULL;
+        }
+
+        failed = out->err;
+        pthread_mutex_unlock(&out->lock);
+
+        /*
+         * After a failed write, the rest is discarded
+         */
+        if (!failed && write_all(out->fd, block->data, block->used))
+        {
+            failed = errno;
+        }
+
+        pthread_mutex_lock(&out->lock);
+
+        if (failed && !out->err)
+        {
+            out->err = failed;
+        }
+
+        block->next = out->spare;
+        out->spare = block;
+        pthread_cond_broadcast(&out->space);
+    }
+
+    pthread_mutex_unlock(&out->lock);
+
+    return NULL;
+}
+
+/*
+ * Frees every block of a sink whose writer has stopped
+ */
+static void
+free_blocks(struct output *out)
+{
+    struct output_block *block = NULL;
+
+    free(out->current);
+
+    while (out->spare)
+    {
+        block = out->spare;
+        out->spare = block->next;
+        free(block);
+    }
+}
+
+struct output *
+output_new(int fd, uint8_t format)
+{
+    int err = 0;
+    struct output *out = NULL;
+    struct output_header header = {{0}};
+    static const char csv_header[] = "addr,state,port_state,scan,port,"
+                                     "rtt_us,time,hwaddr,errno,previous,"
+                                     "interface\n";
+
+    if (format != OUTPUT_JSONL && format != OUTPUT_CSV
+        && format != OUTPUT_BINARY)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    out = calloc(1, sizeof(*out));
+
+    if (!out)
+    {
+        return NULL;
+    }
+
+    out->fd = fd;
+    out->format = format;
+    out->current = take_block(out);
+
+    if (!out->current)
+    {
+        free(out);
+        return NULL;
+    }
+
+    /*
+     * The writer's flush deadline is on the monotonic clock, where available
+     */
+    pthread_mutex_init(&out->lock, NULL);
+    cond_init(&out->ready);
+    pthread_cond_init(&out->space, NULL);
+
+    if (format == OUTPUT_CSV)
+    {
+        append(out, csv_header, sizeof(csv_header) - 1);
+    }
+    else if (format == OUTPUT_BINARY)
+    {
+        memcpy(header.magic, OUTPUT_MAGIC, sizeof(header.magic));
+        header.byte_order = OUTPUT_BYTE_ORDER;
+        header.record_size = sizeof(struct output_record);
+        append(out, (const char *) &header, sizeof(header));
+    }
+
+    err = pthread_create(&out->writer, NULL, write_blocks, out);
+
+    if (err)
+    {
+        free_blocks(out);
+        pthread_cond_destroy(&out->space);
+        pthread_cond_destroy(&out->ready);
+        pthread_mutex_destroy(&out->lock);
+        free(out);
+        errno = err;
+        return NULL;
+    }
+
+    return out;
+}
+
+int
+output_write(struct output *out, const struct output_record *rec)
+{
+    char buf[OUTPUT_RECORD_MAX];
+    size_t len = format_record(out->format, rec, buf);
+    int err = 0;
+
+    pthread_mutex_lock(&out->lock);
+
+    err = out->err;
+
+    if (!err)
+    {
+        append(out, buf, len);
+    }
+
+    pthread_mutex_unlock(&out->lock);
+
+    if (err)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+output_close(struct output *out)
+{
+    int err = 0;
+
+    pthread_mutex_lock(&out->lock);
+    queue_current(out);
+    out->closing = 1;
+    pthread_cond_signal(&out->ready);
+    pthread_mutex_unlock(&out->lock);
+
+    pthread_join(out->writer, NULL);
+
+    err = out->err;
+    free_blocks(out);
+    pthread_cond_destroy(&out->space);
+    pthread_cond_destroy(&out->ready);
+    pthread_mutex_destroy(&out->lock);
+    free(out);
+
+    if (err)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
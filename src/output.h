@@ -0,0 +1,178 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Formats results can be written in. Text output is printed by the callbacks
+ * themselves; the others go through an output sink.
+ */
+#define OUTPUT_TEXT         0x00
+#define OUTPUT_JSONL        0x01
+#define OUTPUT_CSV          0x02
+#define OUTPUT_BINARY       0x03
+
+/*
+ * Size of the blocks results are buffered in, and the most blocks a sink
+ * holds at once
+ */
+#define OUTPUT_BLOCK_SIZE   (1U << 20)
+#define OUTPUT_MAX_BLOCKS   16
+
+/*
+ * A block holding any results is written out after at most this long (in
+ * milliseconds), so that a slow scan still shows up as it goes
+ */
+#define OUTPUT_FLUSH_MS     200
+
+/*
+ * Upper bound on the length of a result formatted as text
+ */
+#define OUTPUT_RECORD_MAX   256
+
+/*
+ * Identifies a stream of binary records, and the byte order it was written in
+ */
+#define OUTPUT_MAGIC        "LSRECORD"
+#define OUTPUT_BYTE_ORDER   0x01020304U
+
+/*
+ * A single result.
+ *
+ * time is when the result came in (nanoseconds since the Epoch) and rtt the
+ * round-trip time of the probe in nanoseconds (0 if it wasn't measured). addr
+ * is in network byte order and port in host byte order (0 for scan types that
+ * don't probe a port). state is a RESULT_* state of the host (see results.h);
+ * port_state is the PORT_* state of the port for port scans (PORT_STATE_NONE
+ * otherwise). err is the errno of a failed probe. hwaddr holds the host's
+ * hardware address if has_hwaddr is set. If changed is set, the record
+ * reports a change in the host's state since an earlier scan, from
+ * prev_state (a RESULT_* state). ifindex is the index of the interface the
+ * host was scanned through, when results from several are written together
+ * (0 otherwise).
+ *
+ * Binary output is a struct output_header followed by these records, as they
+ * are laid out in memory on the machine that wrote them.
+ */
+struct output_record
+{
+    uint64_t time;
+    uint64_t rtt;
+    uint32_t addr;
+    uint16_t port;
+    uint16_t err;
+    uint8_t scan_type;
+    uint8_t state;
+    uint8_t port_state;
+    uint8_t has_hwaddr;
+    uint8_t hwaddr[6];
+    uint8_t changed;
+    uint8_t prev_state;
+    uint32_t ifindex;
+};
+
+/*
+ * Header of a stream of binary records
+ */
+struct output_header
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t record_size;
+};
+
+/*
+ * A block of buffered output
+ */
+struct output_block
+{
+    struct output_block *next;
+    size_t used;
+    char data[OUTPUT_BLOCK_SIZE];
+};
+
+/*
+ * Sink writing results to a file descriptor in one of the structured formats.
+ *
+ * Results are formatted on the calling thread into the current block, and
+ * filled blocks are queued for a writer thread, so that callers only ever
+ * wait on a slow file descriptor once OUTPUT_MAX_BLOCKS blocks are backed up.
+ * The writer also takes the current block once it has held results for
+ * OUTPUT_FLUSH_MS. err is the errno of the first write that failed, after
+ * which results are discarded.
+ */
+struct output
+{
+    int fd;
+    uint8_t format;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+    pthread_t writer;
+    struct output_block *current;
+    struct output_block *queue_head;
+    struct output_block *queue_tail;
+    struct output_block *spare;
+    unsigned int blocks;
+    int closing;
+    int err;
+};
+
+/*
+ * Parses the name of an output format (text, jsonl, csv or bin).
+ *
+ * Returns the format, or -1 if the name is not recognized.
+ */
+int
+parse_output_format(const char *name);
+
+/*
+ * Writes addr (network byte order) in dotted-decimal notation to buf, which
+ * must hold at least INET_ADDRSTRLEN bytes.
+ *
+ * Returns the length of the string, not counting its terminating null byte.
+ */
+size_t
+format_ipv4(in_addr_t addr, char *buf);
+
+/*
+ * Writes rec to buf in the given format, which must hold at least
+ * OUTPUT_RECORD_MAX bytes. The text formats end with a newline and are not
+ * null-terminated.
+ *
+ * Returns the number of bytes written.
+ */
+size_t
+format_record(uint8_t format, const struct output_record *rec, char *buf);
+
+/*
+ * Returns a new sink writing results to fd in the given format, starting with
+ * the format's header (if it has one), and starts its writer thread.
+ *
+ * Returns NULL and sets errno upon error.
+ */
+struct output *
+output_new(int fd, uint8_t format);
+
+/*
+ * Adds a result to the sink. Safe to call from several threads at once.
+ *
+ * Returns 0 on success; returns -1 and sets errno if writing to the sink has
+ * failed.
+ */
+int
+output_write(struct output *out, const struct output_record *rec);
+
+/*
+ * Writes out any buffered results, stops the writer thread and frees the sink.
+ *
+ * Returns 0 on success; returns -1 and sets errno if writing to the sink
+ * failed at any point.
+ */
+int
+output_close(struct output *out);
+
+#endif /* OUTPUT_H */
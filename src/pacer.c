@@ -0,0 +1,166 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pacer.h"
+#include "util.h"
+
+/*
+ * How far behind (in nanoseconds) a sender kept waiting for a token may fall
+ * and still catch up, so that being woken late, or a stall of the host, costs
+ * no tokens
+ */
+#define PACER_CATCHUP_NS    50000000ULL
+
+/*
+ * Bit of next set while a sender is waiting for a token
+ */
+#define PACER_WAITING       (1ULL << 63)
+
+/*
+ * Nanoseconds in a second
+ */
+#define PACER_SECOND        1000000000ULL
+
+/*
+ * Returns how many tokens have accrued elapsed nanoseconds after the pacer
+ * started, without overflowing however long it has run
+ */
+static uint64_t
+tokens_at(const struct pacer *pc, uint64_t elapsed)
+{
+    return elapsed / PACER_SECOND * pc->rate
+           + elapsed % PACER_SECOND * pc->rate / PACER_SECOND;
+}
+
+/*
+ * Returns the first time (in nanoseconds after the pacer started) at which
+ * tokens tokens have accrued, the inverse of tokens_at
+ */
+static uint64_t
+token_time(const struct pacer *pc, uint64_t tokens)
+{
+    return tokens / pc->rate * PACER_SECOND
+           + (tokens % pc->rate * PACER_SECOND + pc->rate - 1) / pc->rate;
+}
+
+struct pacer *
+pacer_new(uint64_t rate, uint64_t burst)
+{
+    struct pacer *pc = NULL;
+
+    if (!burst)
+    {
+        burst = rate / 1000 ? rate / 1000 : 1;
+    }
+
+    if (!rate || rate > PACER_MAX_RATE || burst > PACER_MAX_BURST)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pc = zmalloc(sizeof(*pc));
+
+    if (!pc)
+    {
+        return NULL;
+    }
+
+    pc->rate = rate;
+    pc->burst = burst;
+    pc->catchup = tokens_at(pc, PACER_CATCHUP_NS);
+    pc->catchup = pc->catchup ? pc->catchup : 1;
+    pc->start = monotonic_ns();
+
+    return pc;
+}
+
+void
+pacer_free(struct pacer *pc)
+{
+    free(pc);
+}
+
+uint64_t
+pacer_take(struct pacer *pc)
+{
+    uint64_t elapsed = monotonic_ns() - pc->start, accrued = 0, old = 0;
+    uint64_t next = 0, lag = 0, new = 0, delay = 0;
+
+    accrued = tokens_at(pc, elapsed);
+    old = __atomic_load_n(&pc->next, __ATOMIC_RELAXED);
+
+    do
+    {
+        /*
+         * Tokens that accrued while the bucket was full and no sender was
+         * waiting are lost, so skip past them. A sender that was waiting
+         * keeps the tokens it missed, up to a limit, until it has caught up.
+         */
+        next = old & ~PACER_WAITING;
+        lag = old & PACER_WAITING ? pc->catchup : 0;
+
+        if (next + lag < accrued)
+        {
+            next = accrued - lag;
+        }
+
+        if (next < accrued + pc->burst)
+        {
+            new = next + 1 < accrued ? (next + 1) | (old & PACER_WAITING)
+                                     : next + 1;
+            delay = 0;
+        }
+        else
+        {
+            new = next | PACER_WAITING;
+            delay = token_time(pc, next - pc->burst + 1) - elapsed;
+        }
+    } while (new != old
+             && !__atomic_compare_exchange_n(&pc->next, &old, new, 1,
+                                             __ATOMIC_RELAXED,
+                                             __ATOMIC_RELAXED));
+
+    return delay;
+}
+
+void
+pacer_refund(struct pacer *pc)
+{
+    uint64_t old = __atomic_load_n(&pc->next, __ATOMIC_RELAXED);
+
+    do
+    {
+        if (!(old & ~PACER_WAITING))
+        {
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&pc->next, &old, old - 1, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+uint64_t
+pacer_sleep_time(uint64_t delay)
+{
+    return delay > PACER_SPIN_NS ? delay - PACER_SPIN_NS : 0;
+}
+
+void
+pacer_wait(struct pacer *pc)
+{
+    uint64_t delay = 0, sleep = 0;
+    struct timespec ts = {0};
+
+    while ((delay = pacer_take(pc)))
+    {
+        sleep = pacer_sleep_time(delay);
+
+        if (sleep)
+        {
+            ts.tv_sec = (time_t) (sleep / 1000000000ULL);
+            ts.tv_nsec = (long) (sleep % 1000000000ULL);
+            nanosleep(&ts, NULL);
+        }
+    }
+}
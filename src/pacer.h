@@ -0,0 +1,89 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+
+/*
+ * Largest rate (in probes per second) a pacer can be set to
+ */
+#define PACER_MAX_RATE      100000000ULL
+
+/*
+ * Largest burst (in probes) a pacer can be set to
+ */
+#define PACER_MAX_BURST     1000000ULL
+
+/*
+ * Waits for a token shorter than this (in nanoseconds) are spun rather than
+ * slept, since sleeping that briefly overshoots by about as much again
+ */
+#define PACER_SPIN_NS       50000ULL
+
+/*
+ * Token bucket limiting the rate at which probes are sent.
+ *
+ * Tokens accrue at rate per second up to burst, and each probe takes one.
+ * Rather than a count of tokens, the bucket keeps the number of the next token
+ * to hand out: token k is due once rate * (now - start) + burst exceeds k.
+ * Every token is due at a fixed time, so one taken late doesn't push back the
+ * ones after it. After an idle spell, next is moved up so that no more than
+ * burst tokens are waiting, but a sender that was kept waiting for a token
+ * (flagged in the top bit of next) may catch up on up to catchup tokens that
+ * it missed by waking late. A pacer is shared by every worker of a threaded
+ * scan, which advance next with a compare-and-swap rather than a lock.
+ */
+struct pacer
+{
+    uint64_t rate;
+    uint64_t burst;
+    uint64_t catchup;
+    uint64_t start;
+    uint64_t next;
+};
+
+/*
+ * Returns a new pacer sending at most rate probes per second in bursts of at
+ * most burst, starting with a full bucket. If burst is 0, it is set to a
+ * millisecond's worth of tokens (at least one).
+ *
+ * Returns NULL and sets errno if rate or burst is out of range or memory
+ * could not be allocated.
+ */
+struct pacer *
+pacer_new(uint64_t rate, uint64_t burst);
+
+/*
+ * Frees a pacer returned by pacer_new.
+ */
+void
+pacer_free(struct pacer *pc);
+
+/*
+ * Takes a token if one is available.
+ *
+ * Returns 0 if a token was taken; otherwise, returns how long (in
+ * nanoseconds) it will be until one is available.
+ */
+uint64_t
+pacer_take(struct pacer *pc);
+
+/*
+ * Gives back a token taken for a probe that never went out.
+ */
+void
+pacer_refund(struct pacer *pc);
+
+/*
+ * Returns how much of a wait of delay nanoseconds for a token may be slept,
+ * leaving the rest to be spun.
+ */
+uint64_t
+pacer_sleep_time(uint64_t delay);
+
+/*
+ * Blocks until a token is available and takes it.
+ */
+void
+pacer_wait(struct pacer *pc);
+
+#endif /* PACER_H */
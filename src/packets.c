@@ -1,91 +1,455 @@
+#include <arpa/inet.h>
 #include <errno.h>
+#include <netinet/in.h>
 #include <string.h>
 
 #include "packets.h"
-#include "util.h"
 
-uint16_t
-ip_checksum(const void *data, size_t dlen)
+/*
+ * Inputs shorter than this are summed by the scalar code whatever the CPU
+ * supports; setting up and reducing the vector accumulators would cost more
+ * than it saves
+ */
+#define CHECKSUM_VECTOR_MIN     64
+
+/*
+ * Bytes summed into the 32-bit lanes of the vector accumulators before they
+ * are widened into a 64-bit sum: each lane gains at most 2 * 0xffff every 16
+ * bytes, so this keeps every lane well clear of overflowing
+ */
+#define CHECKSUM_BLOCK          (64 * 1024)
+
+/*
+ * Folds a sum of 16-bit words (in any width) into 16 bits with end-around
+ * carries and returns its complement. Since 2^16 is 1 modulo 0xffff, sums
+ * taken 32 bits or a vector at a time fold to the same checksum as sums taken
+ * 16 bits at a time.
+ */
+static uint16_t
+fold(uint64_t sum)
 {
-    unsigned long sum = 0;
-    uint16_t *ptr = (uint16_t *) data;
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return (uint16_t) ~sum;
+}
+
+/*
+ * Adds the len bytes at p to sum, 32 bits at a time, the way the reference
+ * adds them 16 bits at a time, and returns the new sum
+ */
+static uint64_t
+sum_words(const unsigned char *p, size_t len, uint64_t sum)
+{
+    uint32_t word = 0;
+    uint16_t half = 0;
+
+    for (; len >= 4; len -= 4, p += 4)
+    {
+        memcpy(&word, p, 4);
+        sum += word;
+    }
+
+    if (len >= 2)
+    {
+        memcpy(&half, p, 2);
+        sum += half;
+        p += 2;
+        len -= 2;
+    }
 
     /*
-     * Just return 0 for the checksum if no data was provided or the data
-     * length was not specified
+     * A trailing odd byte is summed as if padded with a zero byte; reading a
+     * full word here would read past the end of the data
      */
+    if (len)
+    {
+        half = 0;
+        memcpy(&half, p, 1);
+        sum += half;
+    }
+
+    return sum;
+}
+
+static uint16_t
+checksum_reference(const void *data, size_t dlen)
+{
+    unsigned long sum = 0;
+    const unsigned char *ptr = data;
+    uint16_t word = 0;
+
     if (!ptr || !dlen)
     {
         return 0;
     }
 
-    while (dlen > 1)
+    for (; dlen > 1; dlen -= 2, ptr += 2)
     {
-        sum += *ptr++;
-        dlen -= 2;
+        memcpy(&word, ptr, 2);
+        sum += word;
     }
 
     if (dlen > 0)
     {
-        sum += *ptr;
+        word = 0;
+        memcpy(&word, ptr, 1);
+        sum += word;
     }
 
-    while (sum >> 16)
+    return fold(sum);
+}
+
+static uint16_t
+checksum_scalar(const void *data, size_t dlen)
+{
+    return data && dlen ? fold(sum_words(data, dlen, 0)) : 0;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#include <immintrin.h>
+
+/*
+ * SSE2 is part of x86-64, so this needs no check at runtime. Every 16-bit
+ * word is widened into a 32-bit lane and summed there; the lanes are added
+ * together (and to the tail) at the end of each block.
+ */
+static uint16_t
+checksum_sse2(const void *data, size_t dlen)
+{
+    const unsigned char *p = data;
+    uint64_t sum = 0;
+    uint32_t lanes[4];
+    size_t block = 0, i = 0;
+    __m128i zero = _mm_setzero_si128(), acc0, acc1, v0, v1;
+
+    if (!p || !dlen)
     {
-        sum = (sum & 0xffff) + (sum >> 16);
+        return 0;
     }
 
-    return ~sum;
+    while (dlen >= 32)
+    {
+        block = dlen < CHECKSUM_BLOCK ? dlen & ~(size_t) 31 : CHECKSUM_BLOCK;
+        acc0 = _mm_setzero_si128();
+        acc1 = _mm_setzero_si128();
+
+        for (i = 0; i < block; i += 32)
+        {
+            v0 = _mm_loadu_si128((const __m128i *) (p + i));
+            v1 = _mm_loadu_si128((const __m128i *) (p + i + 16));
+            acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v0, zero));
+            acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v0, zero));
+            acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(v1, zero));
+            acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(v1, zero));
+        }
+
+        _mm_storeu_si128((__m128i *) lanes, _mm_add_epi32(acc0, acc1));
+        sum += (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        p += block;
+        dlen -= block;
+    }
+
+    return fold(sum_words(p, dlen, sum));
 }
 
-void *
-build_icmp_echo(const void *data, size_t dlen)
+/*
+ * As checksum_sse2, 64 bytes at a time with 256-bit vectors; only used if
+ * the CPU supports AVX2
+ */
+__attribute__((target("avx2")))
+static uint16_t
+checksum_avx2(const void *data, size_t dlen)
 {
-    unsigned char *dgram = NULL;
-    struct icmp_echo_header header = {0}; 
+    const unsigned char *p = data;
+    uint64_t sum = 0;
+    uint32_t lanes[8];
+    size_t block = 0, i = 0;
+    __m256i zero = _mm256_setzero_si256(), acc0, acc1, v0, v1;
+
+    if (!p || !dlen)
+    {
+        return 0;
+    }
+
+    while (dlen >= 64)
+    {
+        block = dlen < CHECKSUM_BLOCK ? dlen & ~(size_t) 63 : CHECKSUM_BLOCK;
+        acc0 = _mm256_setzero_si256();
+        acc1 = _mm256_setzero_si256();
+
+        for (i = 0; i < block; i += 64)
+        {
+            v0 = _mm256_loadu_si256((const __m256i *) (p + i));
+            v1 = _mm256_loadu_si256((const __m256i *) (p + i + 32));
+            acc0 = _mm256_add_epi32(acc0, _mm256_unpacklo_epi16(v0, zero));
+            acc1 = _mm256_add_epi32(acc1, _mm256_unpackhi_epi16(v0, zero));
+            acc0 = _mm256_add_epi32(acc0, _mm256_unpacklo_epi16(v1, zero));
+            acc1 = _mm256_add_epi32(acc1, _mm256_unpackhi_epi16(v1, zero));
+        }
+
+        _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi32(acc0, acc1));
+
+        for (i = 0; i < 8; i++)
+        {
+            sum += lanes[i];
+        }
+
+        p += block;
+        dlen -= block;
+    }
+
+    return fold(sum_words(p, dlen, sum));
+}
+
+static const struct checksum_impl impls[] = {
+    {"reference", checksum_reference},
+    {"scalar", checksum_scalar},
+    {"sse2", checksum_sse2},
+    {"avx2", checksum_avx2}
+};
+
+static size_t
+supported_impls(void)
+{
+    return __builtin_cpu_supports("avx2") ? 4 : 3;
+}
+
+#else
+
+static const struct checksum_impl impls[] = {
+    {"reference", checksum_reference},
+    {"scalar", checksum_scalar}
+};
+
+static size_t
+supported_impls(void)
+{
+    return 2;
+}
+
+#endif /* __x86_64__ && __GNUC__ */
+
+/*
+ * The implementation ip_checksum uses for longer inputs, chosen on first use
+ */
+static uint16_t (*checksum_vector)(const void *, size_t) = NULL;
+
+size_t
+checksum_impls(const struct checksum_impl **list)
+{
+    *list = impls;
+
+    return supported_impls();
+}
+
+uint16_t
+ip_checksum(const void *data, size_t dlen)
+{
+    uint16_t (*sum)(const void *, size_t) = NULL;
+
+    if (dlen < CHECKSUM_VECTOR_MIN)
+    {
+        return checksum_scalar(data, dlen);
+    }
 
     /*
-     * If packet has no data, make sure dlen matches
+     * Threads racing to choose store the same function
      */
-    if ((data && !dlen) || (!data && dlen))
+    sum = __atomic_load_n(&checksum_vector, __ATOMIC_RELAXED);
+
+    if (!sum)
     {
-        errno = EINVAL;
-        return NULL;
+        sum = impls[supported_impls() - 1].sum;
+        __atomic_store_n(&checksum_vector, sum, __ATOMIC_RELAXED);
     }
 
+    return sum(data, dlen);
+}
+
+uint16_t
+checksum_adjust(uint16_t check, const void *old, const void *new, size_t len)
+{
+    unsigned long sum = (uint16_t) ~check;
+    const unsigned char *from = old, *to = new;
+    uint16_t m = 0, m_new = 0;
+
     /*
-     * ICMP Echo type
+     * HC' = ~(~HC + ~m + m'), summed a word at a time; adding ~m rather than
+     * subtracting m keeps a result of 0xffff from turning into 0
      */
-    header.type = 8; 
+    for (; len > 1; len -= 2, from += 2, to += 2)
+    {
+        memcpy(&m, from, 2);
+        memcpy(&m_new, to, 2);
+        sum += (uint16_t) ~m;
+        sum += m_new;
+    }
 
-    dgram = zmalloc(sizeof(header) + dlen);
-    
-    if (!dgram)
+    while (sum >> 16)
     {
-        return NULL;
+        sum = (sum & 0xffff) + (sum >> 16);
     }
 
+    return ~sum;
+}
+
+size_t
+write_icmp_echo(void *buf, uint16_t id, uint16_t seq, const void *data,
+                size_t dlen)
+{
+    struct icmp_echo_header header = {0};
+    unsigned char *dgram = buf;
+
+    header.type = ICMP_TYPE_ECHO_REQUEST;
+    header.id = htons(id);
+    header.seq = htons(seq);
+
+    /*
+     * Checksum is computed over the datagram with the checksum field zeroed,
+     * then filled in
+     */
     memcpy(dgram, &header, sizeof(header));
 
-    if (data)
+    if (data && dlen)
     {
         memcpy(dgram + sizeof(header), data, dlen);
     }
 
     header.checksum = ip_checksum(dgram, sizeof(header) + dlen);
-
-    /*
-     * Perhaps not the most efficient approach, but have to clear datagram and
-     * re-copy header + data now that checksum has been calculated
-     */
-    memset(dgram, 0, sizeof(header) + dlen);
     memcpy(dgram, &header, sizeof(header));
 
-    if (data)
+    return sizeof(header) + dlen;
+}
+
+int
+icmp_echo_template(struct icmp_echo_template *tmpl, const void *data,
+                   size_t dlen)
+{
+    if ((data && !dlen) || (!data && dlen) || dlen > sizeof(tmpl->data))
     {
-        memcpy(dgram + sizeof(header), data, dlen);
+        errno = EINVAL;
+        return -1;
     }
 
-    return dgram;
+    memset(tmpl, 0, sizeof(*tmpl));
+    tmpl->len = write_icmp_echo(&tmpl->header, 0, 0, data, dlen);
+
+    return 0;
+}
+
+void
+icmp_echo_stamp(struct icmp_echo_template *tmpl, uint16_t id, uint16_t seq)
+{
+    uint16_t fields[2];
+
+    fields[0] = htons(id);
+    fields[1] = htons(seq);
+
+    tmpl->header.checksum = checksum_adjust(tmpl->header.checksum,
+                                            &tmpl->header.id, fields,
+                                            sizeof(fields));
+    tmpl->header.id = fields[0];
+    tmpl->header.seq = fields[1];
+}
+
+void
+build_arp_request(struct arp_frame *frame, const uint8_t *sha, uint32_t spa,
+                  uint32_t tpa)
+{
+    memset(frame, 0, sizeof(*frame));
+    memset(frame->dst, 0xff, sizeof(frame->dst));
+    memcpy(frame->src, sha, sizeof(frame->src));
+    frame->ethertype = htons(ETHERTYPE_ARP_FRAME);
+
+    /*
+     * Ethernet hardware type, IPv4 protocol type
+     */
+    frame->arp.htype = htons(1);
+    frame->arp.ptype = htons(0x0800);
+    frame->arp.hlen = sizeof(frame->arp.sha);
+    frame->arp.plen = sizeof(frame->arp.spa);
+    frame->arp.op = htons(ARP_OP_REQUEST);
+
+    memcpy(frame->arp.sha, sha, sizeof(frame->arp.sha));
+    memcpy(frame->arp.spa, &spa, sizeof(frame->arp.spa));
+    memcpy(frame->arp.tpa, &tpa, sizeof(frame->arp.tpa));
+}
+
+size_t
+build_tcp_syn(void *buf, uint32_t saddr, uint32_t daddr, uint16_t sport,
+              uint16_t dport, uint32_t seq)
+{
+    unsigned char pseudo[12 + sizeof(struct tcp_header)];
+    unsigned char *dgram = buf;
+    uint16_t tcp_len = htons(sizeof(struct tcp_header));
+    struct ipv4_header ip = {0};
+    struct tcp_header tcp = {0};
+
+    ip.ver_ihl = 0x45;
+    ip.len = htons(TCP_SYN_LEN);
+    ip.ttl = 64;
+    ip.proto = IPPROTO_TCP;
+    ip.saddr = saddr;
+    ip.daddr = daddr;
+    ip.checksum = ip_checksum(&ip, sizeof(ip));
+
+    tcp.sport = htons(sport);
+    tcp.dport = htons(dport);
+    tcp.seq = htonl(seq);
+    tcp.off = (sizeof(tcp) / 4) << 4;
+    tcp.flags = TCP_FLAG_SYN;
+    tcp.window = htons(1024);
+
+    /*
+     * TCP checksum covers a pseudo-header of the addresses, protocol and TCP
+     * length followed by the TCP header itself
+     */
+    memset(pseudo, 0, sizeof(pseudo));
+    memcpy(pseudo, &saddr, 4);
+    memcpy(pseudo + 4, &daddr, 4);
+    pseudo[9] = IPPROTO_TCP;
+    memcpy(pseudo + 10, &tcp_len, 2);
+    memcpy(pseudo + 12, &tcp, sizeof(tcp));
+    tcp.checksum = ip_checksum(pseudo, sizeof(pseudo));
+
+    memcpy(dgram, &ip, sizeof(ip));
+    memcpy(dgram + sizeof(ip), &tcp, sizeof(tcp));
+
+    return TCP_SYN_LEN;
 }
 
+void
+tcp_syn_template(struct tcp_syn_template *tmpl, uint32_t saddr,
+                 uint16_t sport)
+{
+    build_tcp_syn(tmpl, saddr, 0, sport, 0, 0);
+}
+
+void
+tcp_syn_stamp(struct tcp_syn_template *tmpl, uint32_t daddr, uint16_t dport,
+              uint32_t seq)
+{
+    uint16_t port = htons(dport);
+    uint32_t nseq = htonl(seq);
+
+    /*
+     * The destination is covered by the IP checksum and, through the
+     * pseudo-header, by the TCP checksum as well
+     */
+    tmpl->ip.checksum = checksum_adjust(tmpl->ip.checksum, &tmpl->ip.daddr,
+                                        &daddr, sizeof(daddr));
+    tmpl->tcp.checksum = checksum_adjust(tmpl->tcp.checksum, &tmpl->ip.daddr,
+                                         &daddr, sizeof(daddr));
+    tmpl->tcp.checksum = checksum_adjust(tmpl->tcp.checksum, &tmpl->tcp.dport,
+                                         &port, sizeof(port));
+    tmpl->tcp.checksum = checksum_adjust(tmpl->tcp.checksum, &tmpl->tcp.seq,
+                                         &nseq, sizeof(nseq));
+
+    tmpl->ip.daddr = daddr;
+    tmpl->tcp.dport = port;
+    tmpl->tcp.seq = nseq;
+}
@@ -4,6 +4,13 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/*
+ * ICMP message types
+ */
+#define ICMP_TYPE_ECHO_REPLY    0
+#define ICMP_TYPE_UNREACHABLE   3
+#define ICMP_TYPE_ECHO_REQUEST  8
+
 /*
  * ICMP echo request header
  */
@@ -16,22 +23,217 @@ struct icmp_echo_header
     uint16_t seq;
 };
 
+/*
+ * ARP operation codes and the EtherType of ARP frames
+ */
+#define ARP_OP_REQUEST          1
+#define ARP_OP_REPLY            2
+#define ETHERTYPE_ARP_FRAME     0x0806
+
+/*
+ * ARP packet for IPv4 over Ethernet (RFC 826). Every field is naturally
+ * aligned, so the struct has no padding and matches the wire format.
+ */
+struct arp_ether_ipv4
+{
+    uint16_t htype;
+    uint16_t ptype;
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t op;
+    uint8_t sha[6];
+    uint8_t spa[4];
+    uint8_t tha[6];
+    uint8_t tpa[4];
+};
+
+/*
+ * Ethernet frame carrying an ARP packet
+ */
+struct arp_frame
+{
+    uint8_t dst[6];
+    uint8_t src[6];
+    uint16_t ethertype;
+    struct arp_ether_ipv4 arp;
+};
+
+/*
+ * IPv4 header without options. Fields are kept in network byte order.
+ */
+struct ipv4_header
+{
+    uint8_t ver_ihl;
+    uint8_t tos;
+    uint16_t len;
+    uint16_t id;
+    uint16_t frag;
+    uint8_t ttl;
+    uint8_t proto;
+    uint16_t checksum;
+    uint32_t saddr;
+    uint32_t daddr;
+};
+
+/*
+ * TCP header without options. Fields are kept in network byte order.
+ */
+struct tcp_header
+{
+    uint16_t sport;
+    uint16_t dport;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t off;
+    uint8_t flags;
+    uint16_t window;
+    uint16_t checksum;
+    uint16_t urgent;
+};
+
+/*
+ * TCP flags
+ */
+#define TCP_FLAG_FIN            0x01
+#define TCP_FLAG_SYN            0x02
+#define TCP_FLAG_RST            0x04
+#define TCP_FLAG_ACK            0x10
+
+/*
+ * Length of a TCP SYN built by build_tcp_syn
+ */
+#define TCP_SYN_LEN     (sizeof(struct ipv4_header) + sizeof(struct tcp_header))
+
 /*
  * Calculates and returns the host byte order IP checksum (RFC 791) of the
- * provided data of length dlen.
+ * provided data of length dlen. Longer data is summed with the fastest vector
+ * instructions the CPU supports, picked on first use.
  */
 uint16_t
 ip_checksum(const void *data, size_t dlen);
 
 /*
- * Builds and returns an ICMP echo request, containing the ICMP echo request
- * header and the provided data of length dlen (if any).
+ * An implementation of ip_checksum, by name
+ */
+struct checksum_impl
+{
+    const char *name;
+    uint16_t (*sum)(const void *data, size_t dlen);
+};
+
+/*
+ * Points list at the implementations of ip_checksum this CPU can run and
+ * returns how many there are. The first is the reference, summing 16 bits at
+ * a time; the last is the one ip_checksum uses on longer data. All of them
+ * give the same checksum for the same data.
+ */
+size_t
+checksum_impls(const struct checksum_impl **list);
+
+/*
+ * Returns the checksum check (as stored in a header) updated for len bytes of
+ * the checksummed data changing from old to new, without summing the rest of
+ * the data again (RFC 1624, eqn. 3). len must be even, and the bytes must sit
+ * at an even offset in the checksummed data.
+ */
+uint16_t
+checksum_adjust(uint16_t check, const void *old, const void *new, size_t len);
+
+/*
+ * Writes an ICMP echo request with the provided identifier and sequence
+ * number (host byte order) and the provided data of length dlen (if any) into
+ * buf, which must have room for sizeof(struct icmp_echo_header) + dlen bytes.
+ *
+ * Returns the length of the datagram.
+ */
+size_t
+write_icmp_echo(void *buf, uint16_t id, uint16_t seq, const void *data,
+                size_t dlen);
+
+/*
+ * Most data an ICMP echo template can carry
+ */
+#define ICMP_TEMPLATE_DLEN      56
+
+/*
+ * An ICMP echo request built once and stamped with the identifier and
+ * sequence number of each probe, its checksum adjusted rather than summed
+ * again. header and data are contiguous, so the datagram is the len bytes
+ * starting at header.
+ */
+struct icmp_echo_template
+{
+    struct icmp_echo_header header;
+    unsigned char data[ICMP_TEMPLATE_DLEN];
+    size_t len;
+};
+
+/*
+ * Builds tmpl, an ICMP echo request carrying the provided data of length dlen
+ * (if any), with an identifier and sequence number of 0.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+icmp_echo_template(struct icmp_echo_template *tmpl, const void *data,
+                   size_t dlen);
+
+/*
+ * Stamps the request in tmpl with the provided identifier and sequence number
+ * (host byte order).
+ */
+void
+icmp_echo_stamp(struct icmp_echo_template *tmpl, uint16_t id, uint16_t seq);
+
+/*
+ * Fills frame with a broadcast ARP request from the host with hardware
+ * address sha and IPv4 address spa, asking for the hardware address of tpa
+ * (both addresses in network byte order).
+ */
+void
+build_arp_request(struct arp_frame *frame, const uint8_t *sha, uint32_t spa,
+                  uint32_t tpa);
+
+/*
+ * Writes an IPv4 datagram carrying a TCP SYN from saddr:sport to daddr:dport
+ * with sequence number seq into buf, which must have room for TCP_SYN_LEN
+ * bytes. Addresses are in network byte order; ports and seq are in host byte
+ * order. Both the IP and TCP checksums are filled in.
  *
- * Returns a pointer to the dynamically allocated datagram upon success;
- * returns NULL and sets errno upon error.
+ * Returns the length of the datagram.
+ */
+size_t
+build_tcp_syn(void *buf, uint32_t saddr, uint32_t daddr, uint16_t sport,
+              uint16_t dport, uint32_t seq);
+
+/*
+ * A TCP SYN built once by tcp_syn_template and stamped by tcp_syn_stamp with
+ * the destination, destination port and sequence number of each probe, both
+ * checksums adjusted rather than summed again. The struct has no padding, so
+ * the datagram is its first TCP_SYN_LEN bytes.
+ */
+struct tcp_syn_template
+{
+    struct ipv4_header ip;
+    struct tcp_header tcp;
+};
+
+/*
+ * Builds tmpl, a SYN from saddr (network byte order) and sport (host byte
+ * order), as build_tcp_syn would, to a destination, port and sequence number
+ * of 0.
+ */
+void
+tcp_syn_template(struct tcp_syn_template *tmpl, uint32_t saddr,
+                 uint16_t sport);
+
+/*
+ * Stamps the SYN in tmpl with the provided destination (network byte order),
+ * destination port and sequence number (host byte order).
  */
-void *
-build_icmp_echo(const void *data, size_t dlen);
+void
+tcp_syn_stamp(struct tcp_syn_template *tmpl, uint32_t daddr, uint16_t dport,
+              uint32_t seq);
 
 #endif /* PACKETS_H */
 
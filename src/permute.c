@@ -0,0 +1,80 @@
+#include "permute.h"
+#include "util.h"
+
+void
+permutation_init(struct permutation *perm, uint64_t n, uint64_t seed)
+{
+    unsigned int bits = 2, round = 0;
+
+    /*
+     * The domain has an even number of bits so that the two halves of the
+     * network are the same size, and is less than four times n so that
+     * cycle walking takes few steps
+     */
+    while (bits < 64 && (1ULL << bits) < n)
+    {
+        bits += 2;
+    }
+
+    perm->n = n;
+
+    /*
+     * Derive the round keys once, so each round is a single multiplication
+     */
+    for (round = 0; round < PERMUTE_ROUNDS; round++)
+    {
+        perm->keys[round] = (uint64_t) keyed_hash(seed, round, 0) << 32
+                            | keyed_hash(seed, round, 1);
+    }
+
+    perm->half_bits = bits / 2;
+    perm->half_mask = (1ULL << perm->half_bits) - 1;
+}
+
+/*
+ * Round function of the network: mixes half of the input with a round key
+ */
+static inline uint64_t
+mix(uint64_t half, uint64_t key)
+{
+    uint64_t x = (half ^ key) * 0x9e3779b97f4a7c15ULL;
+
+    return x ^ x >> 29;
+}
+
+/*
+ * Applies the Feistel network to x, which must be within its domain
+ */
+static uint64_t
+feistel(const struct permutation *perm, uint64_t x)
+{
+    unsigned int round = 0;
+    uint64_t left = x >> perm->half_bits, right = x & perm->half_mask, tmp = 0;
+
+    for (round = 0; round < PERMUTE_ROUNDS; round++)
+    {
+        tmp = right;
+        right = left ^ (mix(right, perm->keys[round]) >> 32 & perm->half_mask);
+        left = tmp;
+    }
+
+    return left << perm->half_bits | right;
+}
+
+uint64_t
+permutation_apply(const struct permutation *perm, uint64_t i)
+{
+    uint64_t x = i;
+
+    /*
+     * The network permutes the whole domain, so walking its cycle from i
+     * always comes back into [0, n), and each element of [0, n) is reached
+     * from exactly one position
+     */
+    do
+    {
+        x = feistel(perm, x);
+    } while (x >= perm->n);
+
+    return x;
+}
@@ -0,0 +1,42 @@
+#ifndef PERMUTE_H
+#define PERMUTE_H
+
+#include <stdint.h>
+
+/*
+ * Number of Feistel rounds; four rounds with a good round function are enough
+ * for the output to look random
+ */
+#define PERMUTE_ROUNDS  4
+
+/*
+ * A pseudo-random permutation of the integers [0, n), determined by a seed.
+ *
+ * The permutation is a balanced Feistel network over the smallest domain of
+ * 4^k integers that holds n, with values outside [0, n) walked back into it
+ * (so it costs a few multiplications per step and no memory however large n
+ * is).
+ */
+struct permutation
+{
+    uint64_t n;
+    uint64_t keys[PERMUTE_ROUNDS];
+    unsigned int half_bits;
+    uint64_t half_mask;
+};
+
+/*
+ * Sets up a permutation of [0, n) from seed. The same n and seed always give
+ * the same permutation.
+ */
+void
+permutation_init(struct permutation *perm, uint64_t n, uint64_t seed);
+
+/*
+ * Returns the element at position i (which must be less than n) of the
+ * permutation.
+ */
+uint64_t
+permutation_apply(const struct permutation *perm, uint64_t i);
+
+#endif /* PERMUTE_H */
@@ -0,0 +1,121 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include "ports.h"
+#include "util.h"
+
+/*
+ * Number of bytes in a bitmap with one bit for each port
+ */
+#define PORT_BITMAP_LEN     (65536 / 8)
+
+/*
+ * Parses a single port (1-65535) at the start of str, storing it in *port and
+ * the position just past it in *end.
+ *
+ * Returns 0 on success or -1 if str does not start with a valid port.
+ */
+static int
+parse_port(const char *str, uint16_t *port, const char **end)
+{
+    long value = 0;
+    char *endptr = NULL;
+
+    /*
+     * strtol would accept leading whitespace and signs
+     */
+    if (*str < '0' || *str > '9')
+    {
+        return -1;
+    }
+
+    errno = 0;
+    value = strtol(str, &endptr, 10);
+
+    if (errno || value < 1 || value > 65535)
+    {
+        return -1;
+    }
+
+    *port = (uint16_t) value;
+    *end = endptr;
+
+    return 0;
+}
+
+int
+parse_ports(const char *spec, uint16_t **ports, uint32_t *nports)
+{
+    uint8_t *bitmap = NULL;
+    uint16_t first = 0, last = 0;
+    uint32_t port = 0, count = 0;
+    const char *pos = spec;
+
+    if (!spec || !ports || !nports)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*
+     * Mark every listed port in a bitmap, which takes care of sorting and
+     * removing duplicates
+     */
+    bitmap = zmalloc(PORT_BITMAP_LEN);
+
+    if (!bitmap)
+    {
+        return -1;
+    }
+
+    do
+    {
+        if (parse_port(pos, &first, &pos))
+        {
+            goto invalid;
+        }
+
+        last = first;
+
+        if (*pos == '-' && (parse_port(pos + 1, &last, &pos) || last < first))
+        {
+            goto invalid;
+        }
+
+        for (port = first; port <= last; port++)
+        {
+            count += !(bitmap[port / 8] & (1 << (port % 8)));
+            bitmap[port / 8] |= (uint8_t) (1 << (port % 8));
+        }
+    } while (*pos++ == ',');
+
+    if (pos[-1])
+    {
+        goto invalid;
+    }
+
+    *ports = malloc(count * sizeof(**ports));
+
+    if (!*ports)
+    {
+        free(bitmap);
+        return -1;
+    }
+
+    for (port = 1, *nports = 0; port <= 65535; port++)
+    {
+        if (bitmap[port / 8] & (1 << (port % 8)))
+        {
+            (*ports)[(*nports)++] = (uint16_t) port;
+        }
+    }
+
+    free(bitmap);
+
+    return 0;
+
+invalid:
+    free(bitmap);
+    errno = EINVAL;
+    return -1;
+}
@@ -0,0 +1,20 @@
+#ifndef PORTS_H
+#define PORTS_H
+
+#include <stdint.h>
+
+/*
+ * Parses a list of ports such as "22,80,443,8000-8100": comma-separated
+ * ports (1-65535) and inclusive ranges of ports.
+ *
+ * On success, stores a newly allocated array of the listed ports in *ports
+ * (in ascending order, without duplicates) and its length in *nports, and
+ * returns 0. The caller must free the array.
+ *
+ * Upon error, returns -1 and sets errno to EINVAL if the list is malformed or
+ * to ENOMEM if the array could not be allocated.
+ */
+int
+parse_ports(const char *spec, uint16_t **ports, uint32_t *nports);
+
+#endif /* PORTS_H */
@@ -70,6 +70,11 @@ connect_probe(struct scanner *sc)
     {
         close_sock(sc->fd);
 
+        if (!ret)
+        {
+            sc->port_state = PORT_FILTERED;
+        }
+
         /*
          * Either ret is -1 and error occurred or ret is 0 and connection timed
          * out, meaning host should be considered down.
@@ -97,7 +102,15 @@ connect_probe(struct scanner *sc)
      * If connection was successful or if remote host refused or reset the
      * connection, host is up; otherwise, host is not up.
      */
-    return ret == ECONNREFUSED || ret == ECONNRESET || !ret ? 1 : 0;
+    if (ret == ECONNREFUSED || ret == ECONNRESET || !ret)
+    {
+        sc->port_state = ret ? PORT_CLOSED : PORT_OPEN;
+        return 1;
+    }
+
+    sc->port_state = PORT_FILTERED;
+
+    return 0;
 }
 
 int
@@ -107,13 +120,13 @@ icmp_probe(struct scanner *sc)
     socklen_t len = sizeof(ret);
     fd_set fds;
     in_addr_t bcast = 0;
-    void *dgram = NULL;
     struct sockaddr_in remote_host = {0};
-    
+
     /*
      * Sending just 1 byte of data
      */
-    size_t dgram_len = sizeof(struct icmp_echo_header) + 1;
+    unsigned char dgram[sizeof(struct icmp_echo_header) + 1];
+    size_t dgram_len = 0;
 
     if (!sc)
     {
@@ -157,18 +170,11 @@ icmp_probe(struct scanner *sc)
     /*
      * Might as well just send a character
      */
-    dgram = build_icmp_echo("A", 1);
-
-    if (!dgram)
-    {
-        close_sock(sc->fd);
-        return -1;
-    }
+    dgram_len = write_icmp_echo(dgram, 0, 0, "A", 1);
 
     if (sendto(sc->fd, dgram, dgram_len, 0, (struct sockaddr *) &sc->target,
                sizeof(sc->target)) == -1)
     {
-        free(dgram);
         close_sock(sc->fd);
         return -1;
     }
@@ -180,21 +186,18 @@ icmp_probe(struct scanner *sc)
 
     if (ret <= 0)
     {
-        free(dgram);
         close_sock(sc->fd);
         return ret;
     }
 
     if (getsockopt(sc->fd, SOL_SOCKET, SO_ERROR, &ret, &len))
     {
-        free(dgram);
         close_sock(sc->fd);
         return -1;
     }
 
     if (ret)
     {
-        free(dgram);
         close_sock(sc->fd);
         errno = ret;
         return -1;
@@ -206,12 +209,10 @@ icmp_probe(struct scanner *sc)
     if (recvfrom(sc->fd, dgram, dgram_len, 0, (struct sockaddr *) &remote_host,
                  &len) == -1)
     {
-        free(dgram);
         close_sock(sc->fd);
         return -1;
     }
 
-    free(dgram);
     close_sock(sc->fd);
 
     /*
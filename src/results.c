@@ -0,0 +1,468 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "results.h"
+#include "util.h"
+
+/*
+ * Low bit of every two-bit field of a word
+ */
+#define RESULT_LOW_BITS     0x5555555555555555ULL
+
+/*
+ * Returns the number of words in a map of count addresses.
+ */
+static uint64_t
+word_count(uint64_t count)
+{
+    return (count + RESULT_PER_WORD - 1) / RESULT_PER_WORD;
+}
+
+/*
+ * Returns word w of the map, or 0 (every state unknown) past its end.
+ */
+static uint64_t
+word_at(const struct result_map *map, uint64_t w)
+{
+    return w < word_count(map->count) ? map->words[w] : 0;
+}
+
+/*
+ * Returns a mask of the bits of word w that hold addresses of the map.
+ */
+static uint64_t
+used_bits(const struct result_map *map, uint64_t w)
+{
+    uint64_t tail = map->count % RESULT_PER_WORD;
+
+    return tail && w == word_count(map->count) - 1 ? (1ULL << 2 * tail) - 1
+                                                   : ~0ULL;
+}
+
+/*
+ * Returns the low bits of the fields of word w that hold state, leaving out
+ * fields past the end of the map.
+ */
+static uint64_t
+match(const struct result_map *map, uint64_t w, uint64_t word, uint8_t state)
+{
+    uint64_t lo = word & RESULT_LOW_BITS, hi = word >> 1 & RESULT_LOW_BITS;
+    uint64_t bits = 0;
+
+    switch (state)
+    {
+        case RESULT_UP:
+            bits = lo & ~hi;
+            break;
+        case RESULT_DOWN:
+            bits = hi & ~lo;
+            break;
+        case RESULT_ERROR:
+            bits = lo & hi;
+            break;
+        default:    // RESULT_UNKNOWN
+            bits = ~(lo | hi) & RESULT_LOW_BITS;
+            break;
+    }
+
+    return bits & used_bits(map, w);
+}
+
+int
+result_map_init(struct result_map *map, uint32_t first, uint32_t last)
+{
+    if (last < first)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    map->first = first;
+    map->count = (uint64_t) last - first + 1;
+    map->mapping = NULL;
+    map->length = 0;
+
+    /*
+     * calloc rather than zmalloc, so that the pages of a large map are only
+     * touched as it is filled in
+     */
+    map->words = calloc(word_count(map->count), sizeof(*map->words));
+
+    return map->words ? 0 : -1;
+}
+
+void
+result_map_free(struct result_map *map)
+{
+    if (map->mapping)
+    {
+        munmap(map->mapping, map->length);
+    }
+    else
+    {
+        free(map->words);
+    }
+
+    map->words = NULL;
+    map->mapping = NULL;
+    map->count = 0;
+}
+
+void
+result_map_set(struct result_map *map, uint32_t addr, uint8_t state)
+{
+    uint64_t i = (uint64_t) addr - map->first, old = 0, new = 0;
+    unsigned int shift = 0;
+    uint8_t current = 0;
+
+    if (addr < map->first || i >= map->count)
+    {
+        return;
+    }
+
+    shift = 2 * (unsigned int) (i % RESULT_PER_WORD);
+    old = __atomic_load_n(&map->words[i / RESULT_PER_WORD], __ATOMIC_RELAXED);
+
+    do
+    {
+        current = old >> shift & 3;
+
+        if (current == state
+            || (current != RESULT_UNKNOWN && state != RESULT_UP))
+        {
+            return;
+        }
+
+        new = (old & ~(3ULL << shift)) | (uint64_t) state << shift;
+    } while (!__atomic_compare_exchange_n(&map->words[i / RESULT_PER_WORD],
+                                          &old, new, 1, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+}
+
+uint8_t
+result_map_get(const struct result_map *map, uint32_t addr)
+{
+    uint64_t i = (uint64_t) addr - map->first;
+
+    if (addr < map->first || i >= map->count)
+    {
+        return RESULT_UNKNOWN;
+    }
+
+    return map->words[i / RESULT_PER_WORD] >> 2 * (i % RESULT_PER_WORD) & 3;
+}
+
+uint64_t
+result_map_count(const struct result_map *map, uint8_t state)
+{
+    uint64_t w = 0, words = word_count(map->count), total = 0;
+
+    for (w = 0; w < words; w++)
+    {
+        total += (uint64_t) __builtin_popcountll(match(map, w, map->words[w],
+                                                       state));
+    }
+
+    return total;
+}
+
+int
+result_map_next(const struct result_map *map, uint8_t state, uint64_t *i)
+{
+    uint64_t w = *i / RESULT_PER_WORD, words = word_count(map->count);
+    uint64_t bits = 0;
+
+    if (*i >= map->count)
+    {
+        return 0;
+    }
+
+    bits = match(map, w, map->words[w], state)
+           & ~0ULL << 2 * (*i % RESULT_PER_WORD);
+
+    while (!bits)
+    {
+        if (++w == words)
+        {
+            return 0;
+        }
+
+        bits = match(map, w, map->words[w], state);
+    }
+
+    *i = w * RESULT_PER_WORD + (uint64_t) __builtin_ctzll(bits) / 2;
+
+    return 1;
+}
+
+void
+result_map_merge(struct result_map *map, const struct result_map *prev)
+{
+    uint64_t w = 0, i = 0, words = word_count(map->count), unknown = 0;
+    uint8_t state = RESULT_UNKNOWN;
+
+    /*
+     * When the maps start at the same address, their words line up and the
+     * unknown fields of a word can be filled in at once
+     */
+    if (map->first == prev->first)
+    {
+        for (w = 0; w < words; w++)
+        {
+            unknown = match(map, w, map->words[w], RESULT_UNKNOWN);
+            map->words[w] |= word_at(prev, w) & (unknown | unknown << 1);
+        }
+
+        return;
+    }
+
+    for (i = 0; result_map_next(map, RESULT_UNKNOWN, &i); i++)
+    {
+        state = result_map_get(prev, map->first + (uint32_t) i);
+
+        if (state != RESULT_UNKNOWN)
+        {
+            result_map_set(map, map->first + (uint32_t) i, state);
+        }
+    }
+}
+
+int
+result_map_next_change(const struct result_map *map,
+                       const struct result_map *prev, uint64_t *i)
+{
+    uint64_t w = *i / RESULT_PER_WORD, words = word_count(map->count);
+    uint64_t bits = 0;
+
+    if (*i >= map->count)
+    {
+        return 0;
+    }
+
+    if (map->first != prev->first)
+    {
+        for (; *i < map->count; (*i)++)
+        {
+            if (result_map_get(map, map->first + (uint32_t) *i)
+                != result_map_get(prev, map->first + (uint32_t) *i))
+            {
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    /*
+     * Words that are the same in both maps are skipped whole
+     */
+    bits = (map->words[w] ^ word_at(prev, w)) & used_bits(map, w)
+           & ~0ULL << 2 * (*i % RESULT_PER_WORD);
+
+    while (!bits)
+    {
+        if (++w == words)
+        {
+            return 0;
+        }
+
+        bits = (map->words[w] ^ word_at(prev, w)) & used_bits(map, w);
+    }
+
+    *i = w * RESULT_PER_WORD + (uint64_t) __builtin_ctzll(bits) / 2;
+
+    return 1;
+}
+
+const char *
+result_state_name(uint8_t state)
+{
+    switch (state)
+    {
+        case RESULT_UP:
+            return "up";
+        case RESULT_DOWN:
+            return "down";
+        case RESULT_ERROR:
+            return "error";
+    }
+
+    return "unknown";
+}
+
+int
+result_map_save(const struct result_map *map, const char *path)
+{
+    int fd = -1, err = 0, failed = 0;
+    char *tmp = NULL;
+    uint8_t header[RESULT_HEADER_SIZE] = {0};
+    struct result_header *hdr = (struct result_header *) header;
+
+    memcpy(hdr->magic, RESULT_MAGIC, sizeof(hdr->magic));
+    hdr->byte_order = RESULT_BYTE_ORDER;
+    hdr->first = map->first;
+    hdr->count = map->count;
+
+    fd = open_tmpfile(path, 0, &tmp);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (write_all(fd, header, sizeof(header))
+        || write_all(fd, map->words,
+                     word_count(map->count) * sizeof(*map->words)))
+    {
+        err = errno;
+        close(fd);
+        errno = err;
+        failed = 1;
+    }
+    else
+    {
+        failed = close(fd);
+    }
+
+    return finish_tmpfile(tmp, path, failed);
+}
+
+int
+result_map_load(struct result_map *map, const char *path)
+{
+    int fd = -1, err = 0;
+    void *mapping = NULL;
+    struct stat st = {0};
+    const struct result_header *hdr = NULL;
+
+    fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (fstat(fd, &st))
+    {
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    if (st.st_size < RESULT_HEADER_SIZE)
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    mapping = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    err = errno;
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        errno = err;
+        return -1;
+    }
+
+    hdr = mapping;
+
+    if (memcmp(hdr->magic, RESULT_MAGIC, sizeof(hdr->magic))
+        || hdr->byte_order != RESULT_BYTE_ORDER || !hdr->count
+        || hdr->count - 1 > UINT32_MAX - hdr->first
+        || (uint64_t) st.st_size != RESULT_HEADER_SIZE
+                                    + word_count(hdr->count) * sizeof(uint64_t))
+    {
+        munmap(mapping, (size_t) st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    map->first = hdr->first;
+    map->count = hdr->count;
+    map->words = (uint64_t *) ((char *) mapping + RESULT_HEADER_SIZE);
+    map->mapping = mapping;
+    map->length = (size_t) st.st_size;
+
+    return 0;
+}
+
+int
+result_map_update(const struct result_map *map, const char *path)
+{
+    int fd = -1, ret = 0, err = 0;
+    uint64_t w = 0, words = word_count(map->count), *dst = NULL;
+    size_t length = RESULT_HEADER_SIZE + words * sizeof(uint64_t);
+    void *mapping = NULL;
+    struct stat st = {0};
+    const struct result_header *hdr = NULL;
+
+    fd = open(path, O_RDWR);
+
+    if (fd == -1)
+    {
+        return errno == ENOENT ? result_map_save(map, path) : -1;
+    }
+
+    if (fstat(fd, &st))
+    {
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    if ((uint64_t) st.st_size != length)
+    {
+        close(fd);
+        return result_map_save(map, path);
+    }
+
+    mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    err = errno;
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        errno = err;
+        return -1;
+    }
+
+    hdr = mapping;
+
+    if (memcmp(hdr->magic, RESULT_MAGIC, sizeof(hdr->magic))
+        || hdr->byte_order != RESULT_BYTE_ORDER || hdr->first != map->first
+        || hdr->count != map->count)
+    {
+        munmap(mapping, length);
+        return result_map_save(map, path);
+    }
+
+    /*
+     * Only write the words that changed, so that only pages with changes are
+     * dirtied
+     */
+    dst = (uint64_t *) ((char *) mapping + RESULT_HEADER_SIZE);
+
+    for (w = 0; w < words; w++)
+    {
+        if (dst[w] != map->words[w])
+        {
+            dst[w] = map->words[w];
+        }
+    }
+
+    ret = msync(mapping, length, MS_SYNC);
+    err = errno;
+    munmap(mapping, length);
+    errno = err;
+
+    return ret;
+}
@@ -0,0 +1,170 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * States of an address in a result map
+ */
+#define RESULT_UNKNOWN      0
+#define RESULT_UP           1
+#define RESULT_DOWN         2
+#define RESULT_ERROR        3
+
+/*
+ * Number of addresses held by each word of a result map
+ */
+#define RESULT_PER_WORD     32
+
+/*
+ * Identifies a result map file, and the byte order it was written in
+ */
+#define RESULT_MAGIC        "LSRESMAP"
+#define RESULT_BYTE_ORDER   0x01020304U
+
+/*
+ * Size of the header of a result map file; the words follow it, so that a
+ * mapped file can be used as it is
+ */
+#define RESULT_HEADER_SIZE  64
+
+/*
+ * Header of a result map file.
+ *
+ * The file is the header (padded to RESULT_HEADER_SIZE bytes) followed by the
+ * map's words, all in the byte order of the machine that wrote it (which
+ * byte_order identifies). Address first + i is held by bits 2 * (i % 32) and
+ * up of word i / 32.
+ */
+struct result_header
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t first;
+    uint64_t count;
+};
+
+/*
+ * States (RESULT_*) of the addresses from first to first + count - 1 (host
+ * byte order), two bits each, in a dense bitmap.
+ *
+ * A map is either allocated by result_map_init or mapped read-only from a
+ * file by result_map_load, in which case mapping and length describe the
+ * mapping (and nothing may be recorded in it).
+ */
+struct result_map
+{
+    uint32_t first;
+    uint64_t count;
+    uint64_t *words;
+    void *mapping;
+    size_t length;
+};
+
+/*
+ * Sets up a map of the addresses from first to last (host byte order) with
+ * every state unknown.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+result_map_init(struct result_map *map, uint32_t first, uint32_t last);
+
+/*
+ * Releases a map set up by result_map_init or result_map_load.
+ */
+void
+result_map_free(struct result_map *map);
+
+/*
+ * Records state for addr (host byte order), which is ignored if it is outside
+ * the map. An address keeps the first state recorded for it, except that up
+ * overrides the others, so that a host probed several times is up if any of
+ * its probes was answered. Safe to call from several threads at once.
+ */
+void
+result_map_set(struct result_map *map, uint32_t addr, uint8_t state);
+
+/*
+ * Returns the state of addr (host byte order), or RESULT_UNKNOWN if it is
+ * outside the map.
+ */
+uint8_t
+result_map_get(const struct result_map *map, uint32_t addr);
+
+/*
+ * Returns the number of addresses in the given state.
+ */
+uint64_t
+result_map_count(const struct result_map *map, uint8_t state);
+
+/*
+ * Finds the first address in the given state at or after position *i of the
+ * map, for iterating over the addresses in a state:
+ *
+ *     for (i = 0; result_map_next(map, RESULT_UP, &i); i++)
+ *
+ * Returns 1 and stores its position in *i (the address is map->first + *i) if
+ * there is one; returns 0 otherwise.
+ */
+int
+result_map_next(const struct result_map *map, uint8_t state, uint64_t *i);
+
+/*
+ * Fills in the addresses of map whose state is unknown with their state in
+ * prev, which may cover a different range (or nothing at all, if it is
+ * zeroed). This carries the state of hosts a scan did not get to over from an
+ * earlier one.
+ */
+void
+result_map_merge(struct result_map *map, const struct result_map *prev);
+
+/*
+ * Finds the first address of map at or after position *i whose state differs
+ * from its state in prev, for iterating over the changes since an earlier
+ * scan like result_map_next. Maps that start at the same address are compared
+ * a word at a time, so that unchanged stretches are skipped quickly.
+ *
+ * Returns 1 and stores its position in *i if there is one; returns 0
+ * otherwise.
+ */
+int
+result_map_next_change(const struct result_map *map,
+                       const struct result_map *prev, uint64_t *i);
+
+/*
+ * Returns the name of a state ("up", "down", "error" or "unknown").
+ */
+const char *
+result_state_name(uint8_t state);
+
+/*
+ * Writes the map to a file at path, replacing it atomically.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+result_map_save(const struct result_map *map, const char *path);
+
+/*
+ * Maps a file written by result_map_save read-only into map.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error (EINVAL if the
+ * file is not a result map written on a machine of the same byte order).
+ */
+int
+result_map_load(struct result_map *map, const char *path);
+
+/*
+ * Writes the map over a file at path written by result_map_save, in place,
+ * if it covers the same addresses; otherwise, or if there is no such file,
+ * saves the map as result_map_save does. Only the words that changed are
+ * written, but unlike result_map_save, a reader may see a partly updated map.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+result_map_update(const struct result_map *map, const char *path);
+
+#endif /* RESULTS_H */
@@ -0,0 +1,49 @@
+#include "rtt.h"
+
+void
+rtt_init(struct rtt_estimator *est, uint64_t max, int adaptive)
+{
+    est->srtt = 0;
+    est->rttvar = 0;
+    est->timeout = max;
+    est->max = max;
+    est->min = adaptive && max > RTT_MIN_TIMEOUT_NS ? RTT_MIN_TIMEOUT_NS : max;
+    est->sampled = 0;
+}
+
+void
+rtt_sample(struct rtt_estimator *est, uint64_t rtt)
+{
+    uint64_t delta = 0, timeout = 0;
+
+    if (!est->sampled)
+    {
+        est->srtt = rtt;
+        est->rttvar = rtt / 2;
+        est->sampled = 1;
+    }
+    else
+    {
+        /*
+         * rttvar = 3/4 rttvar + 1/4 |srtt - rtt| and srtt = 7/8 srtt + 1/8 rtt,
+         * with the deviation updated from the old srtt
+         */
+        delta = est->srtt > rtt ? est->srtt - rtt : rtt - est->srtt;
+        est->rttvar = est->rttvar - est->rttvar / 4 + delta / 4;
+        est->srtt = est->srtt - est->srtt / 8 + rtt / 8;
+    }
+
+    timeout = est->srtt + (4 * est->rttvar > RTT_GRANULARITY_NS
+                           ? 4 * est->rttvar : RTT_GRANULARITY_NS);
+
+    if (timeout < est->min)
+    {
+        timeout = est->min;
+    }
+    else if (timeout > est->max)
+    {
+        timeout = est->max;
+    }
+
+    est->timeout = timeout;
+}
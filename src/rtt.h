@@ -0,0 +1,53 @@
+#ifndef RTT_H
+#define RTT_H
+
+#include <stdint.h>
+
+/*
+ * Lower bound on an adaptive timeout in nanoseconds, so that a run of fast
+ * replies does not leave a timeout too short for the odd slower one
+ */
+#define RTT_MIN_TIMEOUT_NS  1000000ULL
+
+/*
+ * Smallest variance term added to the smoothed round-trip time, standing in
+ * for the clock granularity of RFC 6298
+ */
+#define RTT_GRANULARITY_NS  100000ULL
+
+/*
+ * Round-trip time estimator in the style of TCP's retransmission timer (RFC
+ * 6298), used to size how long probes are given to be answered.
+ *
+ * srtt and rttvar are the smoothed round-trip time and its mean deviation,
+ * and timeout is srtt plus four deviations, kept between min and max (all in
+ * nanoseconds). Until the first sample, timeout is max.
+ *
+ * Only answered probes are sampled. Unlike TCP's timer, the timeout is not
+ * backed off when probes go unanswered, since on a scan that mostly means the
+ * target is not there rather than that the network is congested.
+ */
+struct rtt_estimator
+{
+    uint64_t srtt;
+    uint64_t rttvar;
+    uint64_t timeout;
+    uint64_t min;
+    uint64_t max;
+    int sampled;
+};
+
+/*
+ * Sets up an estimator whose timeout never exceeds max. If adaptive is not
+ * set, the timeout stays at max whatever is sampled.
+ */
+void
+rtt_init(struct rtt_estimator *est, uint64_t max, int adaptive);
+
+/*
+ * Updates the estimates with the round-trip time of an answered probe.
+ */
+void
+rtt_sample(struct rtt_estimator *est, uint64_t rtt);
+
+#endif /* RTT_H */
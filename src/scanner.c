@@ -1,12 +1,20 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 
 #include "device.h"
+#include "engine.h"
 #include "handle_signals.h"
+#include "metrics.h"
+#include "pacer.h"
 #include "probe.h"
+#include "rtt.h"
 #include "scanner.h"
+#include "sweep.h"
+#include "threads.h"
+#include "uring.h"
 #include "util.h"
 
 int
@@ -27,6 +35,13 @@ set_scan_type(struct scanner *sc, uint8_t scan_type, uint16_t port)
         case SCAN_TYPE_ICMP:
             sc->probe = icmp_probe;
             break;
+        case SCAN_TYPE_ARP:
+        case SCAN_TYPE_SYN:
+            /*
+             * ARP requests and crafted SYNs can only be sent as a sweep
+             */
+            sc->probe = NULL;
+            break;
         default:
             ret = -1;
             break;
@@ -41,9 +56,9 @@ set_scan_type(struct scanner *sc, uint8_t scan_type, uint16_t port)
     }
 
     /*
-     * This will be extended to check for all scan types where port is relevant
+     * Only TCP scan types probe a port
      */
-    if (scan_type == SCAN_TYPE_CONNECT)
+    if (scan_type == SCAN_TYPE_CONNECT || scan_type == SCAN_TYPE_SYN)
     {
         sc->port = port ? port : (uint16_t)(nanorand() % 65535);
         sc->target.sin_port = htons(sc->port);
@@ -58,6 +73,10 @@ free_scanner(struct scanner *sc)
     if (sc)
     {
         free_device(sc->dev);
+        free(sc->ports);
+        interval_set_free(sc->targets);
+        free(sc->targets);
+        sim_free(sc->sim);
         free(sc);
         sc = NULL;
     }
@@ -67,29 +86,44 @@ struct scanner *
 init_scanner(uint8_t scan_type, const char *dev_name, struct timeval *timeout,
              uint16_t port)
 {
-    struct scanner *sc = NULL;
-
     if (!timeout)
     {
         errno = EINVAL;
         return NULL;
     }
 
-    sc = zmalloc(sizeof(*sc));
+    return init_device_scanner(scan_type, get_live_device(dev_name), timeout,
+                               port);
+}
 
-    if (!sc)
+struct scanner *
+init_device_scanner(uint8_t scan_type, struct device *dev,
+                    struct timeval *timeout, uint16_t port)
+{
+    struct scanner *sc = NULL;
+
+    if (!dev)
+    {
+        return NULL;
+    }
+
+    if (!timeout)
     {
+        free_device(dev);
+        errno = EINVAL;
         return NULL;
     }
 
-    sc->dev = get_live_device(dev_name);
+    sc = zmalloc(sizeof(*sc));
 
-    if (!sc->dev)
+    if (!sc)
     {
-        free(sc);
+        free_device(dev);
         return NULL;
     }
 
+    sc->dev = dev;
+
     /*
      * Set the scan type as well as the probe method and the port
      */
@@ -122,43 +156,291 @@ init_scanner(uint8_t scan_type, const char *dev_name, struct timeval *timeout,
     return sc;
 }
 
-void
-run_scan(struct scanner *sc, probe_callback_t up_callback,
-         probe_callback_t down_callback, probe_callback_t error_callback)
+/*
+ * Returns the number of addresses in the scan range or target set
+ */
+static uint64_t
+host_count(const struct scanner *sc)
 {
-    int ret = 0;
+    if (sc->targets)
+    {
+        return sc->targets->total;
+    }
 
-    if (!sc)
+    /*
+     * Work with offsets in host byte order so that a range ending in
+     * 255.255.255.255 cannot wrap around
+     */
+    return (uint64_t) ntohl(sc->end) - ntohl(sc->start) + 1;
+}
+
+uint32_t
+port_count(const struct scanner *sc)
+{
+    if (sc->nports && (sc->scan_type == SCAN_TYPE_CONNECT
+                       || sc->scan_type == SCAN_TYPE_SYN))
     {
-        return;
+        return sc->nports;
     }
 
+    return 1;
+}
+
+uint64_t
+target_count(const struct scanner *sc)
+{
+    return host_count(sc) * port_count(sc);
+}
+
+void
+target_at(struct scanner *sc, uint64_t offset, in_addr_t *addr,
+          in_port_t *port)
+{
+    uint64_t hosts = host_count(sc), round = offset / hosts;
+
+    *addr = sc->targets
+            ? htonl(interval_set_nth(sc->targets, offset % hosts,
+                                     &sc->target_hint))
+            : htonl(ntohl(sc->start) + (uint32_t) (offset % hosts));
+    *port = htons(port_count(sc) > 1 ? sc->ports[round] : sc->port);
+}
+
+int
+next_target(struct scanner *sc, in_addr_t *addr, in_port_t *port)
+{
+    uint64_t count = target_count(sc), hosts = host_count(sc);
+    uint64_t offset = 0;
+
     /*
-     * Catch signals so that a marked signal sent to the process will terminate
-     * the loop below
+     * A scanner with a refill hook only owns the offsets up to stop; once it
+     * has handed those out, the hook decides whether it gets any more. On a
+     * retry pass, only the targets that timed out on the last pass are
+     * probed. Targets marked in the skip map are never probed.
      */
-    catch_signals();
+    for (;;)
+    {
+        while (sc->next >= count || (sc->refill && sc->next >= sc->stop))
+        {
+            if (!sc->refill || !sc->refill(sc))
+            {
+                return 0;
+            }
+        }
+
+        offset = sc->randomize ? permutation_apply(&sc->order, sc->next)
+                               : sc->next;
+        sc->next++;
+
+        if (sc->retry_map && !(sc->retry_map[offset / 64] >> offset % 64 & 1))
+        {
+            continue;
+        }
+
+        if (sc->skip && sc->skip[offset / 64] >> offset % 64 & 1)
+        {
+            continue;
+        }
+
+        target_at(sc, offset, addr, port);
+
+        if (offset < hosts || !is_self_or_bcast(sc, *addr))
+        {
+            return 1;
+        }
+    }
+}
+
+int
+is_self_or_bcast(const struct scanner *sc, in_addr_t addr)
+{
+    return addr == sc->dev->local.sin_addr.s_addr
+           || (sc->dev->bcast && addr == sc->dev->bcast->sin_addr.s_addr);
+}
+
+/*
+ * Compares two ports, for bsearch.
+ */
+static int
+compare_ports(const void *a, const void *b)
+{
+    return (int) *(const uint16_t *) a - (int) *(const uint16_t *) b;
+}
+
+int
+target_offset(const struct scanner *sc, in_addr_t addr, in_port_t port,
+              uint64_t *offset)
+{
+    uint64_t host = 0, round = 0;
+    uint16_t key = ntohs(port);
+    const uint16_t *found = NULL;
+
+    if (sc->targets)
+    {
+        if (!interval_set_rank(sc->targets, ntohl(addr), &host))
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        if (ntohl(addr) < ntohl(sc->start) || ntohl(addr) > ntohl(sc->end))
+        {
+            return 0;
+        }
+
+        host = ntohl(addr) - ntohl(sc->start);
+    }
+
+    if (port_count(sc) > 1)
+    {
+        found = bsearch(&key, sc->ports, sc->nports, sizeof(*sc->ports),
+                        compare_ports);
+
+        if (!found)
+        {
+            return 0;
+        }
+
+        round = (uint64_t) (found - sc->ports);
+    }
+
+    *offset = round * host_count(sc) + host;
+
+    return 1;
+}
+
+void
+report_timeout(struct scanner *sc, probe_callback_t callback, in_addr_t addr,
+               in_port_t port, uint8_t state)
+{
+    uint64_t offset = 0;
+
+    metrics_timeout();
+
+    if (sc->retry_next && sc->pass < sc->retries
+        && target_offset(sc, addr, port, &offset))
+    {
+        __atomic_fetch_or(&sc->retry_next[offset / 64], 1ULL << offset % 64,
+                          __ATOMIC_RELAXED);
+        return;
+    }
+
+    report_probe(sc, callback, addr, port, state, 0);
+}
+
+void
+record_window(struct scanner *sc, const struct window_ctl *wc)
+{
+    if (wc->adaptive)
+    {
+        sc->stats.window_raises += wc->raises;
+        sc->stats.window_cuts += wc->cuts;
+        sc->stats.window_peak += wc->peak;
+        sc->stats.window_final += wc->window;
+    }
+}
+
+void
+report_probe(struct scanner *sc, probe_callback_t callback, in_addr_t addr,
+             in_port_t port, uint8_t state, int err)
+{
+    if (callback)
+    {
+        sc->target.sin_addr.s_addr = addr;
+        sc->target.sin_port = port;
+        sc->port_state = state;
+        errno = err;
+        callback(sc);
+        sc->port_state = PORT_STATE_NONE;
+    }
+
+    sc->rtt = 0;
+}
+
+int
+scan_targets(struct scanner *sc, probe_callback_t up_callback,
+             probe_callback_t down_callback, probe_callback_t error_callback)
+{
+    int ret = 0;
+    uint64_t sent = 0;
+    struct timeval bound = sc->timeout;
+    struct rtt_estimator rtt;
+    const struct sweep_method *method = NULL;
+
+    method = sweep_method_for(sc);
+
+    if (method)
+    {
+        return run_sweep(sc, method, up_callback, down_callback,
+                         error_callback);
+    }
+
+    if (sc->max_inflight && sc->scan_type == SCAN_TYPE_CONNECT)
+    {
+        if (sc->backend == BACKEND_URING)
+        {
+            ret = run_uring_engine(sc, up_callback, down_callback,
+                                   error_callback);
+
+            /*
+             * Fall back to epoll if io_uring is unavailable
+             */
+            if (!ret || errno != ENOSYS)
+            {
+                return ret;
+            }
+        }
+
+        return run_connect_engine(sc, up_callback, down_callback,
+                                  error_callback);
+    }
+
+    rtt_init(&rtt, timeval_ns(&bound), sc->adaptive_timeout);
 
     /*
-     * Iterate through subnet, calling the appropriate callbacks.
-     *
-     * To increment target IP number, must convert from network byte order to
-     * host byte order, add one, and convert back.
+     * Iterate through subnet, calling the appropriate callbacks. The timeout
+     * is set before every probe, since probes may use up what they are given.
      */
-    for (sc->target.sin_addr.s_addr = sc->start;
-         sc->target.sin_addr.s_addr <= sc->end && !signal_flag;
-         sc->target.sin_addr.s_addr = htonl(ntohl(sc->target.sin_addr.s_addr)
-                                            + 1))
+    while (!signal_flag && next_target(sc, &sc->target.sin_addr.s_addr,
+                                       &sc->target.sin_port))
     {
+        sc->timeout.tv_sec = (time_t) (rtt.timeout / 1000000000ULL);
+        sc->timeout.tv_usec = (suseconds_t) (rtt.timeout % 1000000000ULL
+                                             / 1000ULL);
+        if (sc->pacer)
+        {
+            pacer_wait(sc->pacer);
+        }
+
+        sent = monotonic_ns();
+        metrics_sent();
         ret = sc->probe(sc);
 
+        if (ret == 1)
+        {
+            sc->rtt = monotonic_ns() - sent;
+            metrics_reply(sc->rtt);
+        }
+        else if (ret == -1 && errno != EINTR)
+        {
+            metrics_error(errno);
+        }
+
+        if (ret == 1 && sc->adaptive_timeout
+            && !is_self_or_bcast(sc, sc->target.sin_addr.s_addr))
+        {
+            rtt_sample(&rtt, sc->rtt);
+        }
+
         switch (ret)
         {
             case 0:
-                if (down_callback)
-                {
-                    down_callback(sc);
-                }
+                /*
+                 * A host that doesn't answer a single probe can't be told
+                 * from one whose answer was lost, so it may be retried
+                 */
+                report_timeout(sc, down_callback, sc->target.sin_addr.s_addr,
+                               sc->target.sin_port, sc->port_state);
                 break;
             case 1:
                 if (up_callback)
@@ -177,15 +459,144 @@ run_scan(struct scanner *sc, probe_callback_t up_callback,
                 }
         }
 
-        /*
-         * This is redundant, but the less-than-or-equal-to condition of the
-         * for loop will lead to an infinite loop if the end of the network's
-         * subnet range is 255.255.255.255
-         */
-        if (sc->target.sin_addr.s_addr == sc->end)
+        sc->port_state = PORT_STATE_NONE;
+        sc->rtt = 0;
+    }
+
+    sc->timeout = bound;
+
+    return 0;
+}
+
+/*
+ * Returns the number of words in a retry map of the scanner's targets.
+ */
+static uint64_t
+retry_words(const struct scanner *sc)
+{
+    return (target_count(sc) + 63) / 64;
+}
+
+/*
+ * Sets up the scanner for a pass over the targets that timed out on the last
+ * one.
+ *
+ * Returns 1 if there are any or 0 if there are none; returns -1 and sets
+ * errno upon error.
+ */
+static int
+next_retry_pass(struct scanner *sc)
+{
+    int any = 0;
+    uint64_t i = 0, words = retry_words(sc);
+    uint64_t *map = sc->retry_map;
+
+    if (!map)
+    {
+        map = zmalloc(words * sizeof(*map));
+
+        if (!map)
         {
-            break;
+            return -1;
         }
     }
+
+    sc->retry_map = sc->retry_next;
+    sc->retry_next = map;
+    memset(sc->retry_next, 0, words * sizeof(*sc->retry_next));
+
+    for (i = 0; i < words && !any; i++)
+    {
+        any = sc->retry_map[i] != 0;
+    }
+
+    sc->next = 0;
+
+    return any;
 }
 
+int
+run_scan(struct scanner *sc, probe_callback_t up_callback,
+         probe_callback_t down_callback, probe_callback_t error_callback)
+{
+    int ret = 0, err = 0;
+
+    if (!sc)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*
+     * Catch signals so that a marked signal sent to the process will terminate
+     * the scan
+     */
+    catch_signals();
+
+    sc->next = 0;
+    memset(&sc->stats, 0, sizeof(sc->stats));
+
+    if (sc->randomize)
+    {
+        permutation_init(&sc->order, target_count(sc), sc->seed);
+    }
+
+    if (sc->rate)
+    {
+        sc->pacer = pacer_new(sc->rate, sc->burst);
+
+        if (!sc->pacer)
+        {
+            return -1;
+        }
+    }
+
+    if (sc->retries)
+    {
+        sc->retry_next = zmalloc(retry_words(sc) * sizeof(*sc->retry_next));
+        ret = sc->retry_next ? 0 : -1;
+    }
+
+    /*
+     * Run the main pass and then, for as long as some targets timed out and
+     * retries are left, a pass over just those targets
+     */
+    for (sc->pass = 0; !ret; sc->pass++)
+    {
+        if (sc->threads > 1)
+        {
+            ret = run_threaded_scan(sc, up_callback, down_callback,
+                                    error_callback);
+        }
+        else
+        {
+            ret = scan_targets(sc, up_callback, down_callback, error_callback);
+        }
+
+        if (ret || signal_flag || sc->pass >= sc->retries)
+        {
+            break;
+        }
+
+        ret = next_retry_pass(sc);
+
+        if (ret < 1)
+        {
+            break;
+        }
+
+        ret = 0;
+    }
+
+    err = errno;
+    pacer_free(sc->pacer);
+    sc->pacer = NULL;
+    free(sc->retry_map);
+    free(sc->retry_next);
+    sc->retry_map = NULL;
+    sc->retry_next = NULL;
+    sc->pass = 0;
+    errno = err;
+
+    return ret;
+}
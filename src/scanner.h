@@ -6,10 +6,54 @@
 #include <sys/time.h>
 
 #include "device.h"
+#include "intervals.h"
+#include "pacer.h"
+#include "permute.h"
+#include "sim.h"
+#include "window.h"
 
 #define SCAN_TYPE_INVALID   0x00
 #define SCAN_TYPE_CONNECT   0x01
 #define SCAN_TYPE_ICMP      0x02
+#define SCAN_TYPE_ARP       0x03
+#define SCAN_TYPE_SYN       0x04
+
+/*
+ * State of a probed port, as reported to callbacks of port scans: open ports
+ * accepted the connection (or answered a SYN with a SYN-ACK), closed ports
+ * refused it, and filtered ports never answered
+ */
+#define PORT_STATE_NONE     0x00
+#define PORT_OPEN           0x01
+#define PORT_CLOSED         0x02
+#define PORT_FILTERED       0x03
+
+/*
+ * Backends for the concurrent TCP connect engine
+ */
+#define BACKEND_EPOLL       0x00
+#define BACKEND_URING       0x01
+
+/*
+ * Length of an Ethernet hardware address
+ */
+#define HWADDR_LEN          6
+
+/*
+ * Upper bound on the number of probes a scanner may have outstanding at once
+ */
+#define MAX_INFLIGHT        65536
+
+/*
+ * Upper bound on the number of probes a sweep sends with one system call (the
+ * most sendmmsg takes at once on Linux)
+ */
+#define MAX_SEND_BATCH      1024
+
+/*
+ * Upper bound on the number of times an unanswered target is probed again
+ */
+#define MAX_RETRIES         16
 
 /*
  * Flag for catching signals to terminate scan
@@ -21,6 +65,13 @@ extern int signal_flag;
  */
 struct scanner;
 
+/*
+ * Forward declare struct serial_callbacks (see threads.h) and struct sweep
+ * (see sweep.h) for use in struct scanner below.
+ */
+struct serial_callbacks;
+struct sweep;
+
 /*
  * All probes return 1 if host is up and 0 if not.
  * Upon error, they return -1 and set errno.
@@ -32,21 +83,155 @@ typedef int (*probe_method_t)(struct scanner *sc);
  */
 typedef void (*probe_callback_t)(struct scanner *sc);
 
+/*
+ * Hook called by next_target when a scanner has handed out every offset it
+ * owns. Returns 1 after moving next and stop to a new range of offsets, or 0
+ * if there is no work left.
+ */
+typedef int (*refill_t)(struct scanner *sc);
+
+/*
+ * Statistics gathered over a scan.
+ *
+ * The window figures describe the decisions of the adaptive window controller
+ * (see window.h): how many times it grew and cut the window, and the largest
+ * and last size of the window. For a threaded scan, they are summed over the
+ * workers. They are left at 0 if the window is not adaptive.
+ *
+ * sim_ns is how long the scan of a simulated network took on its virtual
+ * clock, in nanoseconds: the sum over the passes of the longest any worker
+ * took. It is left at 0 for scans of the real network.
+ */
+struct scan_stats
+{
+    uint64_t window_raises;
+    uint64_t window_cuts;
+    uint32_t window_peak;
+    uint32_t window_final;
+    uint64_t sim_ns;
+};
+
 /*
  * Definiton of struct scanner, below typedefs because it contains members of
  * those types
+ *
+ * If targets is not NULL, the scan covers the addresses in that (finished)
+ * set instead of the range from start to end; target_hint is private to
+ * next_target.
+ *
+ * next is the position in the scan of the next probe. If refill is not NULL,
+ * the scanner only owns positions up to (but not including) stop and calls
+ * refill for more once it reaches it; worker is private to the refill hook.
+ *
+ * If randomize is set, probes are handed out in the order of a pseudo-random
+ * permutation determined by seed instead of in address order; run_scan sets
+ * up order for the scan.
+ *
+ * threads is the number of worker threads (see threads.h); 0 or 1 scans on
+ * the calling thread. If serialize_callbacks is set, workers call callbacks
+ * one at a time; otherwise each worker calls them from its own thread. serial
+ * points at the callbacks that serialized ones wrap while they are in use
+ * (see threads.h).
+ *
+ * If adaptive_timeout is set, probes are given a timeout estimated from the
+ * round-trip times of the probes answered so far (see rtt.h) instead of the
+ * full timeout, which then only bounds it.
+ *
+ * If retries is nonzero, targets that don't answer are probed again, up to
+ * retries more times, in passes over just those targets after the main pass
+ * (pass counts them from 0), and the down callback is only called for them
+ * after the last. retry_map marks the targets to probe on a retry pass (it is
+ * NULL on the main pass) and retry_next those that timed out on the current
+ * one, a bit per offset in the scan; run_scan manages both. Targets that
+ * answer are never probed again, so the up callback is called just once for
+ * each.
+ *
+ * If skip is not NULL, the targets marked in it (a bit per offset) are left
+ * out of the scan, e.g. those done before an interrupted scan was
+ * checkpointed (see checkpoint.h).
+ *
+ * If rate is nonzero, probes are sent at no more than rate per second, in
+ * bursts of no more than burst (0 for a millisecond's worth); run_scan sets up
+ * pacer to enforce it for the scan, shared by every worker (see pacer.h).
+ *
+ * If max_inflight is 0, hosts are probed one at a time; otherwise, up to
+ * max_inflight probes are kept outstanding at once by the concurrent engines.
+ * If adaptive_window is set, the engines instead look for the largest number
+ * of outstanding probes the network handles without loss, up to max_inflight.
+ * backend selects how the TCP connect engine drives its probes; the io_uring
+ * backend falls back to epoll if io_uring is unavailable. If send_batch is
+ * more than 1, sweeps whose method supports it (see sweep.h) send their probes
+ * up to send_batch at a time with a single system call; otherwise, they send
+ * them one at a time. If sweep is not NULL, sweeps of the scanner run on it
+ * rather than on a sweep of their own (see sweep_attach).
+ *
+ * probe is NULL for scan types that only run as a sweep (see sweep.h).
+ *
+ * If sim is not NULL, the scanner owns it and scans the simulated network it
+ * describes (see sim.h) instead of the real one, as a sweep on a virtual
+ * clock, whatever the scan type. The pacer is not simulated, so rate should
+ * be 0.
+ *
+ * If nports is nonzero, TCP scan types probe every port in ports (host byte
+ * order) on every host instead of just port. Hosts are interleaved so that
+ * consecutive probes go to different hosts, and if max_per_host is nonzero,
+ * the concurrent engines keep no more than that many probes outstanding to
+ * any one host. port_state is set while a callback is called for a probe of a
+ * port (PORT_STATE_NONE otherwise).
+ *
+ * has_hwaddr is set while a callback is called for a host whose hardware
+ * address was learned by the probe (e.g. from an ARP reply), in which case
+ * hwaddr holds it.
+ *
+ * rtt is set while a callback is called for a probe that was answered to its
+ * round-trip time in nanoseconds (0 otherwise).
  */
 struct scanner
 {
     struct device *dev;
     uint8_t scan_type;
     probe_method_t probe;
+    struct sim_spec *sim;
     struct timeval timeout;
+    int adaptive_timeout;
     struct sockaddr_in target;
     in_addr_t start;
     in_addr_t end;
+    struct interval_set *targets;
+    size_t target_hint;
+    uint64_t next;
+    uint64_t stop;
+    int randomize;
+    uint64_t seed;
+    struct permutation order;
+    unsigned int retries;
+    unsigned int pass;
+    uint64_t *retry_map;
+    uint64_t *retry_next;
+    const uint64_t *skip;
+    refill_t refill;
+    void *worker;
     uint16_t port;
+    uint16_t *ports;
+    uint32_t nports;
+    unsigned int max_per_host;
+    uint8_t port_state;
     int fd;
+    struct sweep *sweep;
+    unsigned int max_inflight;
+    int adaptive_window;
+    uint64_t rate;
+    uint64_t burst;
+    struct pacer *pacer;
+    uint8_t backend;
+    unsigned int send_batch;
+    unsigned int threads;
+    int serialize_callbacks;
+    struct serial_callbacks *serial;
+    uint8_t hwaddr[HWADDR_LEN];
+    int has_hwaddr;
+    uint64_t rtt;
+    struct scan_stats stats;
 };
 
 
@@ -93,6 +278,113 @@ struct scanner *
 init_scanner(uint8_t scan_type, const char *dev_name, struct timeval *timeout,
              uint16_t port);
 
+/*
+ * Initializes a scanner for the specified scan type like init_scanner, on the
+ * provided device, which the scanner takes ownership of (it is freed if the
+ * scanner can't be initialized).
+ *
+ * On success, returns a pointer to an initialized struct scanner; on error,
+ * returns NULL and sets errno. If dev is NULL (e.g. because no device could
+ * be found), returns NULL and doesn't set errno.
+ */
+struct scanner *
+init_device_scanner(uint8_t scan_type, struct device *dev,
+                    struct timeval *timeout, uint16_t port);
+
+/*
+ * Returns the number of ports probed on each host: the number of ports in
+ * sc->ports for TCP scan types that have a port list, or 1 otherwise.
+ */
+uint32_t
+port_count(const struct scanner *sc);
+
+/*
+ * Returns the number of probes in the scan: the number of addresses in the
+ * scan range (or target set) times port_count.
+ */
+uint64_t
+target_count(const struct scanner *sc);
+
+/*
+ * Stores the address and port of the next probe (both in network byte order)
+ * in addr and port and advances the scanner past it. The port is 0 for scan
+ * types that don't probe a port.
+ *
+ * Unless the scanner is randomized, offsets are walked port by port, with
+ * every host in the range probed on one port before any host is probed on the
+ * next. The local and broadcast addresses are only handed out once, with the
+ * first port.
+ *
+ * Returns 1 if a probe was stored, or 0 once every probe in the scan has been
+ * handed out.
+ */
+int
+next_target(struct scanner *sc, in_addr_t *addr, in_port_t *port);
+
+/*
+ * Stores the address and port (both in network byte order) of the probe at
+ * offset in the scan, before randomization, in addr and port.
+ */
+void
+target_at(struct scanner *sc, uint64_t offset, in_addr_t *addr,
+          in_port_t *port);
+
+/*
+ * Looks up the offset in the scan of the probe of addr:port, the inverse of
+ * target_at.
+ *
+ * Returns 1 and stores the offset in *offset if addr:port is in the scan, or
+ * 0 otherwise.
+ */
+int
+target_offset(const struct scanner *sc, in_addr_t addr, in_port_t port,
+              uint64_t *offset);
+
+/*
+ * Returns 1 if addr is the scanner's local address or the broadcast address
+ * of its device, or 0 otherwise. Probes count such hosts as up without
+ * sending anything.
+ */
+int
+is_self_or_bcast(const struct scanner *sc, in_addr_t addr);
+
+/*
+ * Reports a probe of addr:port that went unanswered like report_probe, unless
+ * the target is to be retried on a later pass, in which case it is marked
+ * for that pass instead. Safe to call from several workers at once.
+ */
+void
+report_timeout(struct scanner *sc, probe_callback_t callback, in_addr_t addr,
+               in_port_t port, uint8_t state);
+
+/*
+ * Adds the decisions of an engine's window controller to the scanner's
+ * statistics.
+ */
+void
+record_window(struct scanner *sc, const struct window_ctl *wc);
+
+/*
+ * Points sc->target at addr:port, sets sc->port_state to state and calls
+ * callback (if it is not NULL) with errno set to err. Used by the concurrent
+ * engines, where the probed host is not the one in sc->target. Engines that
+ * measured the probe's round trip set sc->rtt beforehand; it is cleared after.
+ */
+void
+report_probe(struct scanner *sc, probe_callback_t callback, in_addr_t addr,
+             in_port_t port, uint8_t state, int err);
+
+/*
+ * Probes every address handed out by next_target with the scanner's probe
+ * method or engine, calling callbacks as described for run_scan.
+ *
+ * Unlike run_scan, does not set up signal handling or reset the scanner's
+ * position, so that worker threads can run it on their own scanners.
+ */
+int
+scan_targets(struct scanner *sc, probe_callback_t up_callback,
+             probe_callback_t down_callback, probe_callback_t error_callback);
+
 /*
  * Runs a scan of the entire subnet, using the specifications provided to
  * init_scanner.
@@ -101,8 +393,15 @@ init_scanner(uint8_t scan_type, const char *dev_name, struct timeval *timeout,
  * detects an up host, down_callback is called whenever a probe detects a host
  * that is not up, and error_callback is called whenever an error occurs in a
  * probe.
+ *
+ * When a callback is called, sc->target holds the address (and port) of the
+ * probe, sc->port_state holds the state of the port for port scans and, for
+ * error_callback, errno describes the error.
+ *
+ * Returns 0 once the scan has finished or been interrupted by a signal; if the
+ * scan could not be run, returns -1 and sets errno.
  */
-void
+int
 run_scan(struct scanner *sc, probe_callback_t up_callback,
          probe_callback_t down_callback, probe_callback_t error_callback);
 
@@ -0,0 +1,607 @@
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ports.h"
+#include "sim.h"
+#include "util.h"
+
+/*
+ * Salts telling apart the pseudo-random choices made for the same probe
+ */
+#define SALT_UP             1
+#define SALT_OPEN           2
+#define SALT_FILTERED       3
+#define SALT_UNREACHABLE    4
+#define SALT_LOSS           5
+#define SALT_BAND           6
+#define SALT_RTT            7
+
+/*
+ * Digits allowed after the decimal point of a share, which is as fine as
+ * parts per million go
+ */
+#define SHARE_DECIMALS      4
+
+/*
+ * Upper bound on the number of words in a directive, its name included
+ */
+#define MAX_WORDS           3
+
+/*
+ * Returns a 32-bit pseudo-random number for the choice identified by salt, a
+ * and b
+ */
+static uint32_t
+draw(const struct sim_spec *spec, uint32_t salt, uint32_t a, uint32_t b)
+{
+    return keyed_hash(spec->seed + salt * 0x9e3779b97f4a7c15ULL, a, b);
+}
+
+/*
+ * Returns 1 if the choice identified by salt, a and b falls within share
+ */
+static int
+chance(const struct sim_spec *spec, uint32_t share, uint32_t salt,
+       uint32_t a, uint32_t b)
+{
+    return ((uint64_t) draw(spec, salt, a, b) * SIM_SHARE_ALL >> 32) < share;
+}
+
+/*
+ * Parses a share such as "5%", "0.25%" or "100" into parts per million.
+ *
+ * Returns 0 on success or -1 if str is not a percentage from 0 to 100.
+ */
+static int
+parse_share(const char *str, uint32_t *share)
+{
+    uint64_t value = 0;
+    int digits = 0, decimals = -1;
+
+    for (; *str && *str != '%'; str++)
+    {
+        if (*str == '.' && decimals == -1 && digits)
+        {
+            decimals = 0;
+            continue;
+        }
+
+        if (!isdigit((unsigned char) *str) || decimals == SHARE_DECIMALS
+            || value > 100 * 10000)
+        {
+            return -1;
+        }
+
+        value = value * 10 + (uint64_t) (*str - '0');
+        digits++;
+        decimals += decimals == -1 ? 0 : 1;
+    }
+
+    if (!digits || (*str == '%' && str[1]))
+    {
+        return -1;
+    }
+
+    for (decimals = decimals == -1 ? 0 : decimals; decimals < SHARE_DECIMALS;
+         decimals++)
+    {
+        value *= 10;
+    }
+
+    if (value > SIM_SHARE_ALL)
+    {
+        return -1;
+    }
+
+    *share = (uint32_t) value;
+
+    return 0;
+}
+
+/*
+ * Parses a whole number of at most max into *value.
+ *
+ * Returns 0 on success or -1 if str is not such a number.
+ */
+static int
+parse_number(const char *str, uint64_t max, uint64_t *value)
+{
+    char *endptr = NULL;
+
+    if (!isdigit((unsigned char) *str))
+    {
+        return -1;
+    }
+
+    errno = 0;
+    *value = strtoull(str, &endptr, 10);
+
+    return errno || *endptr || *value > max ? -1 : 0;
+}
+
+/*
+ * Parses a local address such as "10.0.0.1/8" into the spec.
+ *
+ * Returns 0 on success or -1 if str is malformed.
+ */
+static int
+parse_local(struct sim_spec *spec, const char *str)
+{
+    char buf[INET_ADDRSTRLEN] = {0};
+    const char *slash = strchr(str, '/');
+    uint64_t prefix = 0;
+    struct in_addr addr = {0};
+
+    if (!slash || (size_t) (slash - str) >= sizeof(buf)
+        || parse_number(slash + 1, 32, &prefix) || !prefix)
+    {
+        return -1;
+    }
+
+    memcpy(buf, str, (size_t) (slash - str));
+
+    if (inet_pton(AF_INET, buf, &addr) != 1)
+    {
+        return -1;
+    }
+
+    spec->local = ntohl(addr.s_addr);
+    spec->netmask = 0xffffffffU << (32 - prefix);
+
+    return 0;
+}
+
+/*
+ * Parses a range of round-trip times such as "500-2000" (in microseconds)
+ * into band.
+ *
+ * Returns 0 on success or -1 if str is malformed.
+ */
+static int
+parse_band(struct sim_band *band, char *str)
+{
+    char *dash = strchr(str, '-');
+    uint64_t min = 0, max = 0;
+
+    if (!dash)
+    {
+        return -1;
+    }
+
+    *dash = '\0';
+
+    if (parse_number(str, SIM_MAX_RTT_US, &min)
+        || parse_number(dash + 1, SIM_MAX_RTT_US, &max) || min > max)
+    {
+        return -1;
+    }
+
+    band->min = min * 1000;
+    band->max = max * 1000;
+
+    return 0;
+}
+
+/*
+ * Applies the directive named by args[0] with nargs - 1 arguments
+ */
+static int
+apply(struct sim_spec *spec, char **args, int nargs)
+{
+    uint64_t value = 0;
+    uint32_t share = SIM_SHARE_ALL;
+    struct sim_rule *rule = NULL;
+    struct sim_band *band = NULL;
+
+    if (!strcmp(args[0], "local") && nargs == 2)
+    {
+        return parse_local(spec, args[1]);
+    }
+
+    if (!strcmp(args[0], "up") && (nargs == 2 || nargs == 3)
+        && spec->nup < SIM_MAX_RULES)
+    {
+        rule = &spec->up[spec->nup];
+
+        if ((nargs == 3 && parse_share(args[2], &share))
+            || interval_set_parse_list(&rule->set, args[1]))
+        {
+            interval_set_free(&rule->set);
+            return -1;
+        }
+
+        rule->share = share;
+        spec->nup++;
+
+        return 0;
+    }
+
+    if (!strcmp(args[0], "rtt") && (nargs == 2 || nargs == 3)
+        && spec->nrtt < SIM_MAX_BANDS)
+    {
+        band = &spec->rtt[spec->nrtt];
+
+        if ((nargs == 3 && parse_share(args[2], &share))
+            || parse_band(band, args[1]))
+        {
+            return -1;
+        }
+
+        band->share = share;
+        spec->nrtt++;
+
+        return 0;
+    }
+
+    if (!strcmp(args[0], "open") && (nargs == 2 || nargs == 3))
+    {
+        if (nargs == 3 && parse_share(args[2], &share))
+        {
+            return -1;
+        }
+
+        free(spec->open);
+        spec->open = NULL;
+        spec->nopen = 0;
+        spec->open_share = share;
+
+        return parse_ports(args[1], &spec->open, &spec->nopen);
+    }
+
+    if (nargs != 2)
+    {
+        return -1;
+    }
+
+    if (!strcmp(args[0], "loss"))
+    {
+        return parse_share(args[1], &spec->loss);
+    }
+
+    if (!strcmp(args[0], "filtered"))
+    {
+        return parse_share(args[1], &spec->filtered);
+    }
+
+    if (!strcmp(args[0], "unreachable"))
+    {
+        return parse_share(args[1], &spec->unreachable);
+    }
+
+    if (!strcmp(args[0], "send"))
+    {
+        if (parse_number(args[1], 1000000000ULL, &value))
+        {
+            return -1;
+        }
+
+        spec->send_ns = value;
+
+        return 0;
+    }
+
+    if (!strcmp(args[0], "seed"))
+    {
+        return parse_number(args[1], UINT64_MAX, &spec->seed);
+    }
+
+    return -1;
+}
+
+struct sim_spec *
+sim_new(void)
+{
+    struct sim_spec *spec = zmalloc(sizeof(*spec));
+
+    if (spec)
+    {
+        spec->send_ns = SIM_DEFAULT_SEND_NS;
+    }
+
+    return spec;
+}
+
+int
+sim_configure(struct sim_spec *spec, const char *directive)
+{
+    int ret = 0, nargs = 0;
+    char *buf = NULL, *save = NULL, *tok = NULL;
+    char *args[MAX_WORDS + 1] = {NULL};
+
+    if (!spec || !directive)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    buf = strdup(directive);
+
+    if (!buf)
+    {
+        return -1;
+    }
+
+    for (tok = strtok_r(buf, " \t\r\n", &save); tok && nargs <= MAX_WORDS;
+         tok = strtok_r(NULL, " \t\r\n", &save))
+    {
+        args[nargs++] = tok;
+    }
+
+    if (nargs && (tok || apply(spec, args, nargs)))
+    {
+        ret = -1;
+        errno = errno == ENOMEM ? ENOMEM : EINVAL;
+    }
+
+    free(buf);
+
+    return ret;
+}
+
+int
+sim_finish(struct sim_spec *spec)
+{
+    size_t i = 0;
+
+    if (!spec || !spec->netmask)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < spec->nup; i++)
+    {
+        if (interval_set_finish(&spec->up[i].set))
+        {
+            return -1;
+        }
+    }
+
+    if (!spec->nrtt)
+    {
+        spec->rtt[0].min = SIM_DEFAULT_RTT_MIN_US * 1000ULL;
+        spec->rtt[0].max = SIM_DEFAULT_RTT_MAX_US * 1000ULL;
+        spec->rtt[0].share = SIM_SHARE_ALL;
+        spec->nrtt = 1;
+    }
+
+    /*
+     * Bands that all have no share are picked evenly
+     */
+    for (spec->rtt_total = 0, i = 0; i < spec->nrtt; i++)
+    {
+        spec->rtt_total += spec->rtt[i].share;
+    }
+
+    if (!spec->rtt_total)
+    {
+        for (i = 0; i < spec->nrtt; i++)
+        {
+            spec->rtt[i].share = 1;
+        }
+
+        spec->rtt_total = spec->nrtt;
+    }
+
+    return 0;
+}
+
+struct sim_spec *
+sim_load(const char *path, size_t *line)
+{
+    int ret = 0, err = 0;
+    char *buf = NULL, *comment = NULL;
+    size_t len = 0, lineno = 0;
+    FILE *file = NULL;
+    struct sim_spec *spec = NULL;
+
+    if (!path)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    spec = sim_new();
+    file = spec ? fopen(path, "r") : NULL;
+
+    if (!file)
+    {
+        sim_free(spec);
+        return NULL;
+    }
+
+    while (!ret && getline(&buf, &len, file) != -1)
+    {
+        lineno++;
+
+        if ((comment = strchr(buf, '#')))
+        {
+            *comment = '\0';
+        }
+
+        ret = sim_configure(spec, buf);
+    }
+
+    if (!ret && ferror(file))
+    {
+        ret = -1;
+    }
+    else if (!ret && sim_finish(spec))
+    {
+        ret = -1;
+        lineno = 0;
+    }
+
+    err = errno;
+
+    if (ret && err == EINVAL && line)
+    {
+        *line = lineno;
+    }
+
+    free(buf);
+    fclose(file);
+
+    if (ret)
+    {
+        sim_free(spec);
+        errno = err;
+        return NULL;
+    }
+
+    return spec;
+}
+
+void
+sim_free(struct sim_spec *spec)
+{
+    size_t i = 0;
+
+    if (spec)
+    {
+        for (i = 0; i < spec->nup; i++)
+        {
+            interval_set_free(&spec->up[i].set);
+        }
+
+        free(spec->open);
+        free(spec);
+    }
+}
+
+struct device *
+sim_device(const struct sim_spec *spec)
+{
+    struct device *dev = zmalloc(sizeof(*dev));
+
+    if (!dev)
+    {
+        return NULL;
+    }
+
+    strncpy(dev->name, "sim", sizeof(dev->name) - 1);
+    dev->local.sin_family = AF_INET;
+    dev->local.sin_addr.s_addr = htonl(spec->local);
+    dev->netmask.sin_family = AF_INET;
+    dev->netmask.sin_addr.s_addr = htonl(spec->netmask);
+
+    /*
+     * Point-to-point subnets (/31 and /32) have no broadcast address
+     */
+    if (spec->netmask >= 0xfffffffeU)
+    {
+        return dev;
+    }
+
+    dev->bcast = zmalloc(sizeof(*dev->bcast));
+
+    if (!dev->bcast)
+    {
+        free_device(dev);
+        return NULL;
+    }
+
+    dev->bcast->sin_family = AF_INET;
+    dev->bcast->sin_addr.s_addr = htonl(spec->local | ~spec->netmask);
+
+    return dev;
+}
+
+int
+sim_host_up(const struct sim_spec *spec, uint32_t addr)
+{
+    size_t i = 0;
+
+    for (i = 0; i < spec->nup; i++)
+    {
+        if (interval_set_contains(&spec->up[i].set, addr)
+            && chance(spec, spec->up[i].share, SALT_UP, addr, 0))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int
+sim_port_open(const struct sim_spec *spec, uint32_t addr, uint16_t port)
+{
+    uint32_t lo = 0, hi = spec->nopen, mid = 0;
+
+    /*
+     * Ports are kept sorted by parse_ports
+     */
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+
+        if (spec->open[mid] < port)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo < spec->nopen && spec->open[lo] == port
+           && chance(spec, spec->open_share, SALT_OPEN, addr, port);
+}
+
+int
+sim_port_filtered(const struct sim_spec *spec, uint32_t addr, uint16_t port)
+{
+    return chance(spec, spec->filtered, SALT_FILTERED, addr, port);
+}
+
+int
+sim_unreachable(const struct sim_spec *spec, uint32_t addr)
+{
+    return chance(spec, spec->unreachable, SALT_UNREACHABLE, addr, 0);
+}
+
+int
+sim_lost(const struct sim_spec *spec, uint32_t addr, uint16_t port,
+         unsigned int pass)
+{
+    return chance(spec, spec->loss, SALT_LOSS, addr,
+                  (uint32_t) pass << 16 | port);
+}
+
+uint64_t
+sim_rtt(const struct sim_spec *spec, uint32_t addr, uint16_t port,
+        unsigned int pass)
+{
+    size_t i = 0;
+    uint64_t pick = 0, span = 0, h = 0;
+    const struct sim_band *band = &spec->rtt[0];
+
+    /*
+     * The host's band, then a point in it for this probe. The span is split
+     * so that multiplying it by the 32-bit draw can't overflow.
+     */
+    pick = (uint64_t) draw(spec, SALT_BAND, addr, 0) * spec->rtt_total >> 32;
+
+    for (i = 0; i < spec->nrtt; i++)
+    {
+        band = &spec->rtt[i];
+
+        if (pick < band->share)
+        {
+            break;
+        }
+
+        pick -= band->share;
+    }
+
+    span = band->max - band->min;
+    h = draw(spec, SALT_RTT, addr, (uint32_t) pass << 16 | port);
+
+    return band->min + (span >> 32) * h + ((span & 0xffffffffULL) * h >> 32);
+}
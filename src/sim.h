@@ -0,0 +1,196 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device.h"
+#include "intervals.h"
+
+/*
+ * Shares of hosts or probes (e.g. the share of probes lost) are kept in parts
+ * per million
+ */
+#define SIM_SHARE_ALL           1000000
+
+/*
+ * Upper bounds on the number of up and rtt directives in a spec
+ */
+#define SIM_MAX_RULES           16
+#define SIM_MAX_BANDS           16
+
+/*
+ * Upper bound on a simulated round-trip time, in microseconds
+ */
+#define SIM_MAX_RTT_US          60000000
+
+/*
+ * Round-trip times of hosts when a spec gives none, in microseconds, and the
+ * virtual time it takes to send a probe, in nanoseconds
+ */
+#define SIM_DEFAULT_RTT_MIN_US  100
+#define SIM_DEFAULT_RTT_MAX_US  1000
+#define SIM_DEFAULT_SEND_NS     1000
+
+/*
+ * Addresses that are up, or a share of them (picked by hash)
+ */
+struct sim_rule
+{
+    struct interval_set set;
+    uint32_t share;
+};
+
+/*
+ * Range of round-trip times (in nanoseconds) of a share of the hosts, relative
+ * to the shares of the other bands
+ */
+struct sim_band
+{
+    uint64_t min;
+    uint64_t max;
+    uint32_t share;
+};
+
+/*
+ * Description of a simulated network, scanned in virtual time by sim_sweep
+ * (see sweep.h) instead of the real network.
+ *
+ * A spec is a text file of directives, one per line, with anything after a
+ * '#' a comment. Shares are percentages such as "5%" or "0.25%":
+ *
+ *   local <address>/<prefix>   address and subnet of the scanning device
+ *   up <targets> [share]       targets (as on the command line, separated by
+ *                              commas) that are up, or a share of them
+ *   rtt <min>-<max> [share]    round-trip times of a share of the hosts, in
+ *                              microseconds, spread evenly over the range
+ *   loss <share>               share of probes lost on the way
+ *   open <ports> [share]       ports open on a share of the up hosts; their
+ *                              other ports are closed
+ *   filtered <share>           share of closed ports that never answer
+ *   unreachable <share>        share of down hosts answered for by an
+ *                              unreachable message
+ *   send <nanoseconds>         virtual time it takes to send a probe
+ *   seed <number>              seed of every pseudo-random choice
+ *
+ * local is required; without any up directive, every host is down. Each host
+ * gets one of the rtt bands (with a chance proportional to its share) and
+ * each of its probes a round-trip time within that band. Whether a host is up
+ * and which ports are open depend only on the seed, the address and the port,
+ * while losses and round-trip times are picked again on every retry pass, so
+ * the same scan of the same spec always gives the same results.
+ */
+struct sim_spec
+{
+    uint32_t local;
+    uint32_t netmask;
+    struct sim_rule up[SIM_MAX_RULES];
+    size_t nup;
+    struct sim_band rtt[SIM_MAX_BANDS];
+    size_t nrtt;
+    uint64_t rtt_total;
+    uint16_t *open;
+    uint32_t nopen;
+    uint32_t open_share;
+    uint32_t filtered;
+    uint32_t unreachable;
+    uint32_t loss;
+    uint64_t send_ns;
+    uint64_t seed;
+};
+
+/*
+ * Returns a newly allocated spec of an empty network, or NULL (with errno set)
+ * upon error.
+ */
+struct sim_spec *
+sim_new(void);
+
+/*
+ * Applies a single directive (a line of a spec, without its comment) to the
+ * spec. Blank lines are ignored.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error, with errno set
+ * to EINVAL if the directive is malformed.
+ */
+int
+sim_configure(struct sim_spec *spec, const char *directive);
+
+/*
+ * Readies a spec configured directive by directive for scanning, giving every
+ * host the default round-trip times if it has no rtt directive.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error, with errno set
+ * to EINVAL if the spec has no local directive.
+ */
+int
+sim_finish(struct sim_spec *spec);
+
+/*
+ * Reads the spec in the file at path (see struct sim_spec).
+ *
+ * Returns the finished spec, or NULL upon error, with errno set. If a
+ * directive is malformed (or local is missing), errno is set to EINVAL and its
+ * line number (or 0) is stored in *line.
+ */
+struct sim_spec *
+sim_load(const char *path, size_t *line);
+
+/*
+ * Frees a spec and everything it holds. Does nothing if spec is NULL.
+ */
+void
+sim_free(struct sim_spec *spec);
+
+/*
+ * Returns a newly allocated device for the local address of the spec, or NULL
+ * (with errno set) upon error.
+ */
+struct device *
+sim_device(const struct sim_spec *spec);
+
+/*
+ * Returns 1 if the host at addr (in host byte order) is up in the simulated
+ * network, or 0 otherwise.
+ */
+int
+sim_host_up(const struct sim_spec *spec, uint32_t addr);
+
+/*
+ * Returns 1 if port (in host byte order) is open on the host at addr (in host
+ * byte order), or 0 otherwise. Only meaningful for hosts that are up.
+ */
+int
+sim_port_open(const struct sim_spec *spec, uint32_t addr, uint16_t port);
+
+/*
+ * Returns 1 if the closed port (in host byte order) of the host at addr (in
+ * host byte order) never answers, or 0 otherwise.
+ */
+int
+sim_port_filtered(const struct sim_spec *spec, uint32_t addr, uint16_t port);
+
+/*
+ * Returns 1 if the down host at addr (in host byte order) is answered for by
+ * an unreachable message, or 0 otherwise.
+ */
+int
+sim_unreachable(const struct sim_spec *spec, uint32_t addr);
+
+/*
+ * Returns 1 if the probe of addr:port (in host byte order) on the given retry
+ * pass is lost, or 0 otherwise.
+ */
+int
+sim_lost(const struct sim_spec *spec, uint32_t addr, uint16_t port,
+         unsigned int pass);
+
+/*
+ * Returns the round-trip time (in nanoseconds) of the probe of addr:port (in
+ * host byte order) on the given retry pass.
+ */
+uint64_t
+sim_rtt(const struct sim_spec *spec, uint32_t addr, uint16_t port,
+        unsigned int pass);
+
+#endif /* SIM_H */
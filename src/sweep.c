@@ -0,0 +1,848 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "handle_signals.h"
+#include "metrics.h"
+#include "socket_util.h"
+#include "sweep.h"
+#include "util.h"
+
+/*
+ * Number of probes sent in a row before the sweep stops to read replies, so
+ * that a large window doesn't leave replies sitting in the receive buffer
+ */
+#define SWEEP_SENDS_PER_PASS    64
+
+void
+sweep_set_rcvbuf(int fd)
+{
+    int rcvbuf = SWEEP_RCVBUF;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+}
+
+int
+sweep_batch_init(struct sweep_batch *batch, uint32_t size, int addressed)
+{
+    uint32_t i = 0;
+
+    memset(batch, 0, sizeof(*batch));
+    batch->size = size;
+    batch->iovs = calloc(size, sizeof(*batch->iovs));
+
+    if (addressed)
+    {
+        batch->remotes = calloc(size, sizeof(*batch->remotes));
+    }
+
+#ifdef HAVE_SENDMMSG
+    batch->msgs = calloc(size, sizeof(*batch->msgs));
+#endif /* HAVE_SENDMMSG */
+
+    if (!batch->iovs || (addressed && !batch->remotes)
+#ifdef HAVE_SENDMMSG
+        || !batch->msgs
+#endif /* HAVE_SENDMMSG */
+        )
+    {
+        sweep_batch_free(batch);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        if (addressed)
+        {
+            batch->remotes[i].sin_family = AF_INET;
+        }
+
+#ifdef HAVE_SENDMMSG
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+
+        if (addressed)
+        {
+            batch->msgs[i].msg_hdr.msg_name = &batch->remotes[i];
+            batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->remotes[i]);
+        }
+#endif /* HAVE_SENDMMSG */
+    }
+
+    return 0;
+}
+
+void
+sweep_batch_free(struct sweep_batch *batch)
+{
+    free(batch->msgs);
+    free(batch->iovs);
+    free(batch->remotes);
+    memset(batch, 0, sizeof(*batch));
+}
+
+uint32_t
+sweep_batch_send(int fd, struct sweep_batch *batch, uint32_t count)
+{
+    uint32_t sent = 0;
+    int ret = 0;
+
+#ifdef HAVE_SENDMMSG
+    /*
+     * sendmmsg stops at the first message that fails, returning how many
+     * went out before it; the error itself is only returned by the next call
+     */
+    while (sent < count)
+    {
+        ret = sendmmsg(fd, batch->msgs + sent, count - sent, 0);
+
+        if (ret == -1)
+        {
+            break;
+        }
+
+        sent += (uint32_t) ret;
+    }
+#else
+    for (; sent < count; sent++)
+    {
+        ret = (int) sendto(fd, batch->iovs[sent].iov_base,
+                           batch->iovs[sent].iov_len, 0,
+                           (struct sockaddr *) (batch->remotes
+                                                ? &batch->remotes[sent]
+                                                : NULL),
+                           batch->remotes ? sizeof(*batch->remotes) : 0);
+
+        if (ret == -1)
+        {
+            break;
+        }
+    }
+#endif /* HAVE_SENDMMSG */
+
+    return sent;
+}
+
+/*
+ * Returns the current time on the sweep's clock, in nanoseconds
+ */
+static uint64_t
+sweep_now(struct sweep *sw)
+{
+    return sw->method->now ? sw->method->now(sw) : monotonic_ns();
+}
+
+/*
+ * Returns how long (in nanoseconds) the sweep may wait for replies before its
+ * oldest probe times out.
+ */
+static uint64_t
+wait_time(struct sweep *sw)
+{
+    uint64_t age = 0, timeout = sw->rtt.timeout;
+
+    if (sw->tbl.head == INFLIGHT_NONE)
+    {
+        return 0;
+    }
+
+    age = sweep_now(sw) - sw->tbl.slots[sw->tbl.head].sent;
+
+    return age >= timeout ? 0 : timeout - age;
+}
+
+/*
+ * Waits up to wait_ns nanoseconds for the sweep's socket to be readable.
+ * Without ppoll, the wait is rounded up to whole milliseconds.
+ */
+static int
+wait_reply(struct pollfd *pfd, uint64_t wait_ns)
+{
+#ifdef HAVE_PPOLL
+    struct timespec ts = {0};
+
+    ts.tv_sec = (time_t) (wait_ns / 1000000000ULL);
+    ts.tv_nsec = (long) (wait_ns % 1000000000ULL);
+
+    return ppoll(pfd, 1, &ts, NULL);
+#else
+    return poll(pfd, 1, (int) ((wait_ns + 999999ULL) / 1000000ULL));
+#endif
+}
+
+/*
+ * Returns the entry of sw->expired for a probe of addr:port
+ */
+static struct sweep_expiry *
+expiry(struct sweep *sw, in_addr_t addr, in_port_t port)
+{
+    return &sw->expired[keyed_hash(sw->key, addr, port) % SWEEP_EXPIRED];
+}
+
+/*
+ * Remembers that the probe of addr:port timed out at now
+ */
+static void
+remember_expiry(struct sweep *sw, in_addr_t addr, in_port_t port,
+                uint64_t now)
+{
+    struct sweep_expiry *e = expiry(sw, addr, port);
+
+    e->addr = addr;
+    e->port = port;
+    e->time = now;
+}
+
+/*
+ * Returns 1 if a reply from addr:port answers a probe that timed out no more
+ * than a timeout ago, forgetting the probe so that it only counts once, or 0
+ * otherwise
+ */
+static int
+late_reply(struct sweep *sw, in_addr_t addr, in_port_t port)
+{
+    struct sweep_expiry *e = expiry(sw, addr, port);
+
+    if (e->addr != addr || e->port != port || !e->time
+        || sweep_now(sw) - e->time > sw->rtt.timeout)
+    {
+        return 0;
+    }
+
+    memset(e, 0, sizeof(*e));
+
+    return 1;
+}
+
+/*
+ * Reads every reply waiting on the sweep's socket and reports the hosts whose
+ * probes they answer.
+ *
+ * Returns 0 once the socket has been drained; returns -1 and sets errno if
+ * reading from it failed.
+ */
+static int
+drain(struct sweep *sw, probe_callback_t up_callback,
+      probe_callback_t down_callback)
+{
+    int ret = 0;
+    uint32_t slot = 0;
+    uint64_t start = 0;
+    struct sweep_reply reply = {0};
+
+    for (;;)
+    {
+        memset(&reply, 0, sizeof(reply));
+        start = monotonic_ns();
+        ret = sw->method->recv(sw, &reply);
+        metrics_syscall(start);
+
+        if (ret == -1)
+        {
+            break;
+        }
+
+        if (!ret)
+        {
+            continue;
+        }
+
+        slot = inflight_find(&sw->tbl, reply.addr, reply.port);
+
+        /*
+         * A reply to a probe that recently timed out means replies are being
+         * held up, so the window is cut. Anything else left unmatched, such
+         * as a duplicate reply or one to a request the kernel made itself,
+         * says nothing about loss and is dropped.
+         */
+        if (slot == INFLIGHT_NONE)
+        {
+            if (late_reply(sw, reply.addr, reply.port))
+            {
+                window_loss(&sw->window);
+            }
+
+            continue;
+        }
+
+        sw->sc->rtt = sweep_now(sw) - sw->tbl.slots[slot].sent;
+        metrics_reply(sw->sc->rtt);
+        rtt_sample(&sw->rtt, sw->sc->rtt);
+        window_reply(&sw->window);
+        inflight_remove(&sw->tbl, slot);
+
+        if (reply.has_hwaddr)
+        {
+            memcpy(sw->sc->hwaddr, reply.hwaddr, sizeof(reply.hwaddr));
+            sw->sc->has_hwaddr = 1;
+        }
+
+        report_probe(sw->sc, reply.up ? up_callback : down_callback,
+                     reply.addr, reply.port, reply.state, 0);
+        sw->sc->has_hwaddr = 0;
+    }
+
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+}
+
+/*
+ * Returns the entry of sw->hosts holding addr, or the free entry it would go
+ * in
+ */
+static uint32_t
+host_entry(const struct sweep *sw, in_addr_t addr)
+{
+    uint32_t i = keyed_hash(sw->key, addr, 0) & sw->hosts_mask;
+
+    while (sw->hosts[i].count && sw->hosts[i].addr != addr)
+    {
+        i = (i + 1) & sw->hosts_mask;
+    }
+
+    return i;
+}
+
+/*
+ * Returns the number of queued probes of addr
+ */
+static uint32_t
+queued_load(const struct sweep *sw, in_addr_t addr)
+{
+    return sw->hosts ? sw->hosts[host_entry(sw, addr)].count : 0;
+}
+
+/*
+ * Counts a probe of addr added to the queue
+ */
+static void
+count_queued(struct sweep *sw, in_addr_t addr)
+{
+    uint32_t i = 0;
+
+    if (sw->hosts)
+    {
+        i = host_entry(sw, addr);
+        sw->hosts[i].addr = addr;
+        sw->hosts[i].count++;
+    }
+}
+
+/*
+ * Counts a probe of addr taken off the queue
+ */
+static void
+uncount_queued(struct sweep *sw, in_addr_t addr)
+{
+    uint32_t i = 0, j = 0, home = 0;
+
+    if (!sw->hosts)
+    {
+        return;
+    }
+
+    i = host_entry(sw, addr);
+
+    if (--sw->hosts[i].count)
+    {
+        return;
+    }
+
+    /*
+     * Move later entries of the same run back into the freed one when it
+     * lies between them and their home, so that lookups never stop short of
+     * them
+     */
+    for (j = (i + 1) & sw->hosts_mask; sw->hosts[j].count;
+         j = (j + 1) & sw->hosts_mask)
+    {
+        home = keyed_hash(sw->key, sw->hosts[j].addr, 0) & sw->hosts_mask;
+
+        if (((j - home) & sw->hosts_mask) >= ((j - i) & sw->hosts_mask))
+        {
+            sw->hosts[i] = sw->hosts[j];
+            sw->hosts[j].count = 0;
+            i = j;
+        }
+    }
+}
+
+/*
+ * Sends the probes queued on the sweep, adding those sent to the in-flight
+ * table. A probe that fails for lack of buffer space is kept at the front of
+ * the queue, along with those after it, for the next try; one that fails for
+ * any other reason is reported to the error callback.
+ *
+ * Returns 1 if probes are left queued for lack of buffer space, or 0 if
+ * every probe was sent or reported.
+ */
+static int
+flush(struct sweep *sw, probe_callback_t error_callback)
+{
+    uint32_t done = 0, n = 0, i = 0;
+    uint64_t start = 0, now = 0;
+    const struct sweep_probe *probe = NULL;
+
+    while (done < sw->queued)
+    {
+        start = monotonic_ns();
+        n = sw->method->send_batch(sw, sw->queue + done, sw->queued - done);
+        metrics_syscall(start);
+        now = sweep_now(sw);
+
+        for (i = done; i < done + n; i++)
+        {
+            metrics_sent();
+            inflight_add(&sw->tbl, sw->queue[i].addr, sw->queue[i].port, now);
+            uncount_queued(sw, sw->queue[i].addr);
+        }
+
+        done += n;
+
+        if (done == sw->queued)
+        {
+            break;
+        }
+
+        metrics_error(errno);
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+        {
+            window_loss(&sw->window);
+            memmove(sw->queue, sw->queue + done,
+                    (sw->queued - done) * sizeof(*sw->queue));
+            sw->queued -= done;
+            return 1;
+        }
+
+        probe = &sw->queue[done++];
+        uncount_queued(sw, probe->addr);
+        report_probe(sw->sc, error_callback, probe->addr, probe->port,
+                     PORT_STATE_NONE, errno);
+    }
+
+    sw->queued = 0;
+
+    return 0;
+}
+
+/*
+ * Frees everything sweep_open allocated
+ */
+static void
+release(struct sweep *sw)
+{
+    free(sw->queue);
+    free(sw->hosts);
+    free(sw->expired);
+    inflight_free(&sw->tbl);
+    sw->queue = NULL;
+    sw->hosts = NULL;
+    sw->expired = NULL;
+}
+
+int
+sweep_open(struct sweep *sw, struct scanner *sc,
+           const struct sweep_method *method)
+{
+    uint32_t hosts = 2;
+
+    if (!sc || !method || sc->max_inflight > MAX_INFLIGHT)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(sw, 0, sizeof(*sw));
+    sw->sc = sc;
+    sw->method = method;
+    sw->fd = -1;
+    sw->key = random_key();
+
+    if (inflight_init(&sw->tbl, sc->max_inflight ? sc->max_inflight : 1))
+    {
+        return -1;
+    }
+
+    sw->expired = calloc(SWEEP_EXPIRED, sizeof(*sw->expired));
+
+    if (!sw->expired)
+    {
+        release(sw);
+        return -1;
+    }
+
+    if (method->send_batch && sc->send_batch > 1)
+    {
+        sw->queue_size = sc->send_batch < MAX_SEND_BATCH ? sc->send_batch
+                                                         : MAX_SEND_BATCH;
+        sw->queue = malloc(sw->queue_size * sizeof(*sw->queue));
+
+        /*
+         * Room for at least twice as many hosts as probes fit in the queue,
+         * so that runs stay short
+         */
+        while (hosts < 2 * sw->queue_size)
+        {
+            hosts <<= 1;
+        }
+
+        sw->hosts = sc->max_per_host ? calloc(hosts, sizeof(*sw->hosts))
+                                     : NULL;
+        sw->hosts_mask = hosts - 1;
+
+        if (!sw->queue || (sc->max_per_host && !sw->hosts))
+        {
+            release(sw);
+            return -1;
+        }
+    }
+
+    if (method->open(sw))
+    {
+        release(sw);
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+sweep_close(struct sweep *sw)
+{
+    sw->method->close(sw);
+    release(sw);
+}
+
+int
+sweep_run(struct sweep *sw, probe_callback_t up_callback,
+          probe_callback_t down_callback, probe_callback_t error_callback)
+{
+    int ret = 0, err = 0;
+    int exhausted = 0, pending = 0, blocked = 0, capped = 0, sent = 0;
+    int paid = 0;
+    int failed = 0;
+    uint32_t limit = 0;
+    uint8_t expired = 0;
+    uint64_t now = 0, wait_ns = 0, delay = 0, start = 0;
+    in_addr_t addr = 0, done_addr = 0;
+    in_port_t port = 0, done_port = 0;
+    struct scanner *sc = sw->sc;
+    struct pollfd pfd = {0};
+
+    rtt_init(&sw->rtt, timeval_ns(&sc->timeout), sc->adaptive_timeout);
+    window_init(&sw->window, sw->tbl.size, sc->adaptive_window);
+
+    /*
+     * Probes left over from an earlier run that was cut short are forgotten
+     */
+    while (sw->tbl.head != INFLIGHT_NONE)
+    {
+        inflight_remove(&sw->tbl, sw->tbl.head);
+    }
+
+    sw->queued = 0;
+
+    if (sw->hosts)
+    {
+        memset(sw->hosts, 0, (sw->hosts_mask + 1) * sizeof(*sw->hosts));
+    }
+
+    limit = sw->queue_size > SWEEP_SENDS_PER_PASS ? sw->queue_size
+                                                  : SWEEP_SENDS_PER_PASS;
+
+    pfd.fd = sw->fd;
+    pfd.events = POLLIN;
+
+    /*
+     * Probes of ports that go unanswered are filtered
+     */
+    expired = sc->scan_type == SCAN_TYPE_SYN ? PORT_FILTERED : PORT_STATE_NONE;
+
+    while (!signal_flag)
+    {
+        /*
+         * Send a batch of probes, stopping early if the window is full, the
+         * socket's send buffer is, the next host already has as many probes
+         * outstanding as it may, or the pacer has no token left, in which
+         * case the current probe is kept for the next pass. Probes left
+         * queued when the send buffer filled up go first.
+         */
+        capped = 0;
+        delay = 0;
+        blocked = sw->queued && flush(sw, error_callback);
+
+        for (sent = 0; sent < limit && !exhausted && !blocked
+                       && sw->tbl.count + sw->queued < sw->window.window;
+             sent++)
+        {
+            if (!pending)
+            {
+                if (!next_target(sc, &addr, &port))
+                {
+                    exhausted = 1;
+                    break;
+                }
+
+                /*
+                 * Host is up for local address or broadcast address
+                 */
+                if (is_self_or_bcast(sc, addr))
+                {
+                    report_probe(sc, up_callback, addr, port, PORT_STATE_NONE,
+                                 0);
+                    continue;
+                }
+            }
+
+            if (sc->max_per_host
+                && inflight_host_load(&sw->tbl, addr)
+                   + queued_load(sw, addr) >= sc->max_per_host)
+            {
+                pending = 1;
+                capped = 1;
+                break;
+            }
+
+            /*
+             * A probe held back by a full send buffer has already taken its
+             * token
+             */
+            if (sc->pacer && !paid && (delay = pacer_take(sc->pacer)))
+            {
+                pending = 1;
+                break;
+            }
+
+            paid = 0;
+
+            if (sw->queue)
+            {
+                pending = 0;
+                sw->queue[sw->queued].addr = addr;
+                sw->queue[sw->queued].port = port;
+                count_queued(sw, addr);
+
+                if (++sw->queued == sw->queue_size)
+                {
+                    blocked = flush(sw, error_callback);
+                }
+
+                continue;
+            }
+
+            start = monotonic_ns();
+            failed = sw->method->send(sw, addr, port);
+            metrics_syscall(start);
+
+            if (failed)
+            {
+                metrics_error(errno);
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK
+                    || errno == ENOBUFS)
+                {
+                    window_loss(&sw->window);
+                    pending = 1;
+                    blocked = 1;
+                    paid = 1;
+                    break;
+                }
+
+                pending = 0;
+                report_probe(sc, error_callback, addr, port, PORT_STATE_NONE,
+                             errno);
+                continue;
+            }
+
+            pending = 0;
+            metrics_sent();
+            inflight_add(&sw->tbl, addr, port, sweep_now(sw));
+        }
+
+        if (sw->queued && !blocked)
+        {
+            blocked = flush(sw, error_callback);
+        }
+
+        if (exhausted && !sw->tbl.count && !sw->queued)
+        {
+            break;
+        }
+
+        /*
+         * Don't wait at all if the batch ended with room left to send;
+         * otherwise, wait for replies until the oldest probe times out. If
+         * the last send failed for lack of buffer space, back off for a
+         * millisecond at most before trying again, and if the pacer ran out
+         * of tokens, wait no longer than it takes to get one.
+         */
+        if (!exhausted && !blocked && !capped && !delay
+            && sw->tbl.count < sw->window.window)
+        {
+            wait_ns = 0;
+        }
+        else
+        {
+            wait_ns = wait_time(sw);
+
+            if (blocked && (wait_ns > 1000000ULL || !sw->tbl.count))
+            {
+                wait_ns = 1000000ULL;
+            }
+
+            if (delay && (pacer_sleep_time(delay) < wait_ns || !sw->tbl.count))
+            {
+                wait_ns = pacer_sleep_time(delay);
+            }
+        }
+
+        if (sw->method->wait)
+        {
+            ret = sw->method->wait(sw, wait_ns);
+            pfd.revents = ret > 0 ? POLLIN : 0;
+        }
+        else
+        {
+            ret = wait_reply(&pfd, wait_ns);
+        }
+
+        if (ret == -1 && errno != EINTR)
+        {
+            break;
+        }
+
+        if (ret > 0 && pfd.revents & POLLIN
+            && drain(sw, up_callback, down_callback))
+        {
+            ret = -1;
+            break;
+        }
+
+        /*
+         * Expire probes that have been outstanding for the full timeout, oldest
+         * first
+         */
+        now = sweep_now(sw);
+
+        while (sw->tbl.head != INFLIGHT_NONE
+               && now - sw->tbl.slots[sw->tbl.head].sent >= sw->rtt.timeout)
+        {
+            done_addr = sw->tbl.slots[sw->tbl.head].addr;
+            done_port = sw->tbl.slots[sw->tbl.head].port;
+            remember_expiry(sw, done_addr, done_port, now);
+            window_timeout(&sw->window);
+            inflight_remove(&sw->tbl, sw->tbl.head);
+            report_timeout(sc, down_callback, done_addr, done_port, expired);
+        }
+
+        ret = 0;
+    }
+
+    err = errno;
+
+    record_window(sc, &sw->window);
+
+    if (ret == -1)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+run_sweep(struct scanner *sc, const struct sweep_method *method,
+          probe_callback_t up_callback, probe_callback_t down_callback,
+          probe_callback_t error_callback)
+{
+    int ret = 0, err = 0;
+    struct sweep sw;
+
+    /*
+     * A sweep kept open for the scanner is only used by the scanner itself,
+     * not by copies of it such as those of worker threads
+     */
+    if (sc && sc->sweep && sc->sweep->sc == sc && sc->sweep->method == method)
+    {
+        return sweep_run(sc->sweep, up_callback, down_callback,
+                         error_callback);
+    }
+
+    if (sweep_open(&sw, sc, method))
+    {
+        return -1;
+    }
+
+    ret = sweep_run(&sw, up_callback, down_callback, error_callback);
+    err = errno;
+    sweep_close(&sw);
+    errno = err;
+
+    return ret;
+}
+
+const struct sweep_method *
+sweep_method_for(const struct scanner *sc)
+{
+    if (sc->sim)
+    {
+        return &sim_sweep;
+    }
+
+    switch (sc->scan_type)
+    {
+        case SCAN_TYPE_ICMP:
+            return sc->max_inflight ? &icmp_sweep : NULL;
+        case SCAN_TYPE_ARP:
+            return &arp_sweep;
+        case SCAN_TYPE_SYN:
+            return &syn_sweep;
+    }
+
+    return NULL;
+}
+
+int
+sweep_attach(struct scanner *sc)
+{
+    const struct sweep_method *method = sweep_method_for(sc);
+
+    if (!method || sc->sim || sc->threads > 1 || sc->sweep)
+    {
+        return 0;
+    }
+
+    sc->sweep = zmalloc(sizeof(*sc->sweep));
+
+    if (!sc->sweep)
+    {
+        return -1;
+    }
+
+    if (sweep_open(sc->sweep, sc, method))
+    {
+        free(sc->sweep);
+        sc->sweep = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+sweep_detach(struct scanner *sc)
+{
+    if (sc->sweep)
+    {
+        sweep_close(sc->sweep);
+        free(sc->sweep);
+        sc->sweep = NULL;
+    }
+}
@@ -0,0 +1,303 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "inflight.h"
+#include "rtt.h"
+#include "scanner.h"
+
+/*
+ * Forward declare struct sweep for use in struct sweep_method below.
+ */
+struct sweep;
+
+/*
+ * Forward declare the message headers of sendmmsg, which sys/socket.h only
+ * defines with _GNU_SOURCE, for use in struct sweep_batch below.
+ */
+struct mmsghdr;
+
+/*
+ * A probe queued to be sent in a batch: its target and port (network byte
+ * order, 0 for methods that don't probe ports).
+ */
+struct sweep_probe
+{
+    in_addr_t addr;
+    in_port_t port;
+};
+
+/*
+ * A reply read from a sweep's socket.
+ *
+ * up is 1 if the reply shows the host to be up, or 0 if it shows the host to
+ * be down (e.g. an unreachable message about the probe).
+ *
+ * port is the probed port (network byte order) and state the state the reply
+ * shows it to be in, for methods that probe ports; otherwise both are 0.
+ *
+ * has_hwaddr is set if the reply carried the host's hardware address, in
+ * which case hwaddr holds it.
+ *
+ * The reply is zeroed before each call to recv.
+ */
+struct sweep_reply
+{
+    in_addr_t addr;
+    in_port_t port;
+    uint8_t state;
+    int up;
+    uint8_t hwaddr[HWADDR_LEN];
+    int has_hwaddr;
+};
+
+/*
+ * Operations implementing one kind of probe for run_sweep.
+ *
+ * open creates the sweep's nonblocking socket and stores it in sw->fd, send
+ * transmits a probe of addr:port (port is 0 for methods that don't probe
+ * ports), recv reads and validates a single reply into
+ * *reply, and close releases everything acquired by open.
+ *
+ * open and send return 0 on success; upon error they return -1 and set errno.
+ * recv returns 1 if it stored a valid reply and 0 if it read something that
+ * is not a reply to this sweep; upon error (including EAGAIN once there is
+ * nothing left to read), it returns -1 and sets errno.
+ *
+ * now and wait may be NULL, in which case the sweep runs on the monotonic
+ * clock and waits for sw->fd to be readable. Methods that don't talk to a
+ * real network provide both to run the sweep on a clock of their own: now
+ * returns the current time in nanoseconds, and wait lets up to wait_ns
+ * nanoseconds pass, returning 1 as soon as replies are ready to be received
+ * or 0 if none are by then (upon error, it returns -1 and sets errno).
+ *
+ * send_batch may be NULL, in which case every probe is sent by send.
+ * Otherwise, if sw->queue_size is more than 1 when open is called, probes are
+ * queued and sent up to sw->queue_size at a time by send_batch, which sends
+ * count probes in as few system calls as it can. It returns how many of
+ * them it sent, in order from the first; if that is fewer than count, errno
+ * is set to the error the next one failed with.
+ */
+struct sweep_method
+{
+    int (*open)(struct sweep *sw);
+    int (*send)(struct sweep *sw, in_addr_t addr, in_port_t port);
+    int (*recv)(struct sweep *sw, struct sweep_reply *reply);
+    void (*close)(struct sweep *sw);
+    uint64_t (*now)(struct sweep *sw);
+    int (*wait)(struct sweep *sw, uint64_t wait_ns);
+    uint32_t (*send_batch)(struct sweep *sw, const struct sweep_probe *probes,
+                           uint32_t count);
+};
+
+/*
+ * Number of probes of a host queued on a sweep
+ */
+struct sweep_host
+{
+    in_addr_t addr;
+    uint32_t count;
+};
+
+/*
+ * Number of recently expired probes a sweep remembers
+ */
+#define SWEEP_EXPIRED       1024
+
+/*
+ * Probe that timed out, and when (on the sweep's clock)
+ */
+struct sweep_expiry
+{
+    in_addr_t addr;
+    in_port_t port;
+    uint64_t time;
+};
+
+/*
+ * State of a sweep, which may stay open across several runs (see
+ * sweep_attach).
+ *
+ * key is a random per-sweep key used to stamp probes so that replies can be
+ * told apart from unrelated traffic. rtt sizes the timeout of outstanding
+ * probes from the replies matched so far, and window the number of them.
+ * queue holds the queued probes of a sweep that sends them in batches (see
+ * struct sweep_method), queued of the queue_size it has room for; it only
+ * holds probes for as long as they haven't been sent. If hosts is not NULL
+ * (for a sweep that caps the probes outstanding per host), it counts the
+ * queued probes of each host, in an open-addressed table of hosts_mask + 1
+ * entries, so that the cap doesn't have to search the queue. expired
+ * remembers the probes that timed out most recently, indexed by a hash of
+ * their target, so that a late reply can be told apart from a duplicate or
+ * unrelated one. priv is private to the method.
+ */
+struct sweep
+{
+    struct scanner *sc;
+    const struct sweep_method *method;
+    int fd;
+    uint64_t key;
+    struct inflight tbl;
+    struct rtt_estimator rtt;
+    struct window_ctl window;
+    struct sweep_probe *queue;
+    uint32_t queue_size;
+    uint32_t queued;
+    struct sweep_host *hosts;
+    uint32_t hosts_mask;
+    struct sweep_expiry *expired;
+    void *priv;
+};
+
+/*
+ * Message headers for sending a batch of up to size packets with one system
+ * call, for the send_batch of a method: message i sends the packet in iovs[i]
+ * to remotes[i], or to wherever the socket is bound if remotes is NULL. The
+ * method points iovs at its packets, and fills in the addresses of remotes,
+ * whose family is set up already.
+ */
+struct sweep_batch
+{
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    struct sockaddr_in *remotes;
+    uint32_t size;
+};
+
+/*
+ * Receive buffer a method requests for its sweep's socket, so that a burst of
+ * replies isn't dropped between reads
+ */
+#define SWEEP_RCVBUF        (4 * 1024 * 1024)
+
+/*
+ * Requests a receive buffer of SWEEP_RCVBUF for fd, for the open of a method.
+ * Failing to get it is not fatal, as a smaller buffer only risks dropping
+ * replies under load, so nothing is returned.
+ */
+void
+sweep_set_rcvbuf(int fd);
+
+/*
+ * Sets up batch for up to size packets, with room for the address of each
+ * if addressed is set.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+sweep_batch_init(struct sweep_batch *batch, uint32_t size, int addressed);
+
+/*
+ * Frees all resources associated with a batch set up by sweep_batch_init.
+ */
+void
+sweep_batch_free(struct sweep_batch *batch);
+
+/*
+ * Sends the first count packets of batch from fd, with sendmmsg (calling it
+ * again after a partial send) where it is available, or one packet at a time
+ * otherwise.
+ *
+ * Returns the number of packets sent; if that is fewer than count, errno is
+ * set to the error the next one failed with.
+ */
+uint32_t
+sweep_batch_send(int fd, struct sweep_batch *batch, uint32_t count);
+
+/*
+ * ICMP echo sweep over a single raw socket
+ */
+extern const struct sweep_method icmp_sweep;
+
+/*
+ * ARP request sweep over a single packet socket bound to the scanner's
+ * device. Only available on Linux; elsewhere, opening it fails with ENOSYS.
+ */
+extern const struct sweep_method arp_sweep;
+
+/*
+ * Stateless TCP SYN sweep over a single raw socket. Each SYN's sequence
+ * number is a keyed hash of its target, so a SYN-ACK or RST is validated by
+ * its acknowledgment number alone.
+ */
+extern const struct sweep_method syn_sweep;
+
+/*
+ * Sweep of the simulated network described by the scanner's sim spec (see
+ * sim.h), on a virtual clock, for any scan type. Nothing is sent on the real
+ * network; waiting for replies takes no time at all.
+ */
+extern const struct sweep_method sim_sweep;
+
+/*
+ * Runs a scan that sends every probe from a single socket using the provided
+ * method, keeping up to sc->max_inflight probes (at least one) outstanding.
+ *
+ * Replies are matched back to their probes through the in-flight table as
+ * they arrive, and probes that have been outstanding for longer than
+ * sc->timeout are counted as down hosts (or filtered ports). Callbacks are
+ * called as described for run_scan.
+ *
+ * Returns 0 once every host has been probed or a signal has been caught;
+ * returns -1 and sets errno if the sweep could not be set up or its socket
+ * failed.
+ */
+int
+run_sweep(struct scanner *sc, const struct sweep_method *method,
+          probe_callback_t up_callback, probe_callback_t down_callback,
+          probe_callback_t error_callback);
+
+/*
+ * Sets up sw for sweeps of sc using the provided method, opening its socket.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+sweep_open(struct sweep *sw, struct scanner *sc,
+           const struct sweep_method *method);
+
+/*
+ * Runs a sweep of the targets of sw's scanner, from its current position, on
+ * sw, which must have been set up by sweep_open; otherwise the same as
+ * run_sweep. The sweep can be run again once this returns.
+ */
+int
+sweep_run(struct sweep *sw, probe_callback_t up_callback,
+          probe_callback_t down_callback, probe_callback_t error_callback);
+
+/*
+ * Closes the socket of a sweep set up by sweep_open and frees all resources
+ * associated with it.
+ */
+void
+sweep_close(struct sweep *sw);
+
+/*
+ * Returns the method run_scan sweeps the scanner's targets with, or NULL if
+ * it doesn't run a sweep for them.
+ */
+const struct sweep_method *
+sweep_method_for(const struct scanner *sc);
+
+/*
+ * Opens a sweep for the scanner that stays open across scans, in sc->sweep:
+ * until sweep_detach is called, run_scan runs its sweeps on it instead of
+ * setting up a sweep and opening a socket for every scan. Nothing is opened
+ * for scanners that don't sweep a real network or sweep on several threads,
+ * which keep setting up a sweep for every scan.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+sweep_attach(struct scanner *sc);
+
+/*
+ * Closes the sweep opened by sweep_attach, if any.
+ */
+void
+sweep_detach(struct scanner *sc);
+
+#endif /* SWEEP_H */
@@ -0,0 +1,266 @@
+#include <errno.h>
+#include <string.h>
+
+#include "packets.h"
+#include "sweep.h"
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netpacket/packet.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "socket_util.h"
+#include "util.h"
+
+/*
+ * Private state of an ARP sweep: the request sent to each target, with only
+ * its target address changing, and for a sweep that sends in batches, one
+ * per probe of a batch and the batch sending them
+ */
+struct arp_sweep_priv
+{
+    struct arp_frame frame;
+    struct arp_frame *frames;
+    struct sweep_batch batch;
+};
+
+/*
+ * Frees priv and everything it holds
+ */
+static void
+free_priv(struct arp_sweep_priv *priv)
+{
+    if (priv)
+    {
+        sweep_batch_free(&priv->batch);
+        free(priv->frames);
+        free(priv);
+    }
+}
+
+/*
+ * Sets up priv to send batches of up to size requests, through the socket's
+ * binding
+ */
+static int
+init_batch(struct arp_sweep_priv *priv, uint32_t size)
+{
+    uint32_t i = 0;
+
+    priv->frames = malloc(size * sizeof(*priv->frames));
+
+    if (!priv->frames || sweep_batch_init(&priv->batch, size, 0))
+    {
+        return -1;
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        priv->frames[i] = priv->frame;
+        priv->batch.iovs[i].iov_base = &priv->frames[i];
+        priv->batch.iovs[i].iov_len = sizeof(priv->frames[i]);
+    }
+
+    return 0;
+}
+
+static int
+arp_sweep_open(struct sweep *sw)
+{
+    struct arp_sweep_priv *priv = NULL;
+    struct sockaddr_ll local = {0};
+    struct ifreq ifr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    memcpy(ifr.ifr_name, sw->sc->dev->name, sizeof(ifr.ifr_name));
+
+    priv = zmalloc(sizeof(*priv));
+
+    if (!priv)
+    {
+        return -1;
+    }
+
+    sw->fd = socket(AF_PACKET, SOCK_RAW, htons(ETHERTYPE_ARP_FRAME));
+
+    if (sw->fd == -1)
+    {
+        free_priv(priv);
+        return -1;
+    }
+
+    /*
+     * Requests go out with the device's own hardware address as the sender
+     */
+    if (ioctl(sw->fd, SIOCGIFHWADDR, &ifr))
+    {
+        close_sock(sw->fd);
+        free_priv(priv);
+        return -1;
+    }
+
+    build_arp_request(&priv->frame, (const uint8_t *) ifr.ifr_hwaddr.sa_data,
+                      sw->sc->dev->local.sin_addr.s_addr, 0);
+
+    if (sw->queue_size && init_batch(priv, sw->queue_size))
+    {
+        close_sock(sw->fd);
+        free_priv(priv);
+        return -1;
+    }
+
+    /*
+     * Bind to the device so that only its ARP traffic is received and
+     * requests can be sent with plain send
+     */
+    local.sll_family = AF_PACKET;
+    local.sll_protocol = htons(ETHERTYPE_ARP_FRAME);
+    local.sll_ifindex = (int) if_nametoindex(sw->sc->dev->name);
+
+    if (!local.sll_ifindex
+        || bind(sw->fd, (struct sockaddr *) &local, sizeof(local))
+        || toggle_sock_nonblock(sw->fd))
+    {
+        close_sock(sw->fd);
+        free_priv(priv);
+        return -1;
+    }
+
+    sweep_set_rcvbuf(sw->fd);
+
+    sw->priv = priv;
+
+    return 0;
+}
+
+static int
+arp_sweep_send(struct sweep *sw, in_addr_t addr, in_port_t port)
+{
+    struct arp_sweep_priv *priv = sw->priv;
+
+    memcpy(priv->frame.arp.tpa, &addr, sizeof(priv->frame.arp.tpa));
+
+    return send(sw->fd, &priv->frame, sizeof(priv->frame), 0) == -1 ? -1 : 0;
+}
+
+static uint32_t
+arp_sweep_send_batch(struct sweep *sw, const struct sweep_probe *probes,
+                     uint32_t count)
+{
+    struct arp_sweep_priv *priv = sw->priv;
+    uint32_t i = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        memcpy(priv->frames[i].arp.tpa, &probes[i].addr,
+               sizeof(priv->frames[i].arp.tpa));
+    }
+
+    return sweep_batch_send(sw->fd, &priv->batch, count);
+}
+
+static int
+arp_sweep_recv(struct sweep *sw, struct sweep_reply *reply)
+{
+    ssize_t n = 0;
+    in_addr_t tpa = 0;
+    struct arp_frame frame;
+
+    /*
+     * Ethernet frames are padded to 60 bytes, so the buffer is larger than
+     * the frame we care about; anything past it is discarded
+     */
+    n = recv(sw->fd, &frame, sizeof(frame), MSG_TRUNC);
+
+    if (n == -1)
+    {
+        return -1;
+    }
+
+    if ((size_t) n < sizeof(frame)
+        || frame.ethertype != htons(ETHERTYPE_ARP_FRAME)
+        || frame.arp.op != htons(ARP_OP_REPLY)
+        || frame.arp.ptype != htons(0x0800)
+        || frame.arp.hlen != HWADDR_LEN || frame.arp.plen != 4)
+    {
+        return 0;
+    }
+
+    /*
+     * Only replies addressed to us answer our requests
+     */
+    memcpy(&tpa, frame.arp.tpa, sizeof(tpa));
+
+    if (tpa != sw->sc->dev->local.sin_addr.s_addr)
+    {
+        return 0;
+    }
+
+    memcpy(&reply->addr, frame.arp.spa, sizeof(reply->addr));
+    memcpy(reply->hwaddr, frame.arp.sha, sizeof(reply->hwaddr));
+    reply->up = 1;
+    reply->has_hwaddr = 1;
+
+    return 1;
+}
+
+static void
+arp_sweep_close(struct sweep *sw)
+{
+    close_sock(sw->fd);
+    free_priv(sw->priv);
+    sw->fd = -1;
+    sw->priv = NULL;
+}
+
+#else
+
+static int
+arp_sweep_open(struct sweep *sw)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static int
+arp_sweep_send(struct sweep *sw, in_addr_t addr, in_port_t port)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static uint32_t
+arp_sweep_send_batch(struct sweep *sw, const struct sweep_probe *probes,
+                     uint32_t count)
+{
+    errno = ENOSYS;
+    return 0;
+}
+
+static int
+arp_sweep_recv(struct sweep *sw, struct sweep_reply *reply)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static void
+arp_sweep_close(struct sweep *sw)
+{
+}
+
+#endif /* __linux__ */
+
+const struct sweep_method arp_sweep = {
+    arp_sweep_open,
+    arp_sweep_send,
+    arp_sweep_recv,
+    arp_sweep_close,
+    NULL,
+    NULL,
+    arp_sweep_send_batch
+};
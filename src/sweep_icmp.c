@@ -0,0 +1,297 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "packets.h"
+#include "socket_util.h"
+#include "sweep.h"
+#include "util.h"
+
+/*
+ * Data carried by each echo request
+ */
+#define ICMP_SWEEP_DATA     "A"
+#define ICMP_SWEEP_DLEN     1
+
+/*
+ * Large enough for any IP header plus an ICMP message quoting our probe
+ */
+#define ICMP_SWEEP_BUFLEN   576
+
+/*
+ * Private state of an ICMP sweep: the echo request stamped for each target,
+ * and for a sweep that sends in batches, one per probe of a batch and the
+ * batch sending them
+ */
+struct icmp_sweep_priv
+{
+    struct icmp_echo_template echo;
+    struct icmp_echo_template *echoes;
+    struct sweep_batch batch;
+};
+
+#ifdef __linux__
+/*
+ * Raw ICMP socket option from linux/icmp.h, which can't be included alongside
+ * net/if.h
+ */
+#define ICMP_SWEEP_FILTER   1
+#endif /* __linux__ */
+
+/*
+ * Returns the identifier (high 16 bits) and sequence number (low 16 bits)
+ * stamped on the echo request sent to addr
+ */
+static uint32_t
+stamp(const struct sweep *sw, in_addr_t addr)
+{
+    return keyed_hash(sw->key, ntohl(addr), 0);
+}
+
+/*
+ * Parses the IP header at the start of buf (of length len), storing it in ip.
+ *
+ * Returns the length of the header, or 0 if buf does not hold an IP header
+ * followed by at least an ICMP echo header.
+ */
+static size_t
+parse_ip(const unsigned char *buf, size_t len, struct ip *ip)
+{
+    size_t hlen = 0;
+
+    if (len < sizeof(*ip))
+    {
+        return 0;
+    }
+
+    memcpy(ip, buf, sizeof(*ip));
+    hlen = ip->ip_hl * 4;
+
+    return hlen < sizeof(*ip)
+           || len < hlen + sizeof(struct icmp_echo_header) ? 0 : hlen;
+}
+
+/*
+ * Frees priv and everything it holds
+ */
+static void
+free_priv(struct icmp_sweep_priv *priv)
+{
+    if (priv)
+    {
+        sweep_batch_free(&priv->batch);
+        free(priv->echoes);
+        free(priv);
+    }
+}
+
+/*
+ * Sets up priv to send batches of up to size echo requests
+ */
+static int
+init_batch(struct icmp_sweep_priv *priv, uint32_t size)
+{
+    uint32_t i = 0;
+
+    priv->echoes = malloc(size * sizeof(*priv->echoes));
+
+    if (!priv->echoes || sweep_batch_init(&priv->batch, size, 1))
+    {
+        return -1;
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        priv->echoes[i] = priv->echo;
+        priv->batch.iovs[i].iov_base = &priv->echoes[i].header;
+        priv->batch.iovs[i].iov_len = priv->echoes[i].len;
+    }
+
+    return 0;
+}
+
+static int
+icmp_sweep_open(struct sweep *sw)
+{
+    struct icmp_sweep_priv *priv = NULL;
+#ifdef ICMP_SWEEP_FILTER
+    uint32_t filter = 0;
+#endif /* ICMP_SWEEP_FILTER */
+
+    priv = zmalloc(sizeof(*priv));
+
+    if (!priv)
+    {
+        return -1;
+    }
+
+    if (icmp_echo_template(&priv->echo, ICMP_SWEEP_DATA, ICMP_SWEEP_DLEN)
+        || (sw->queue_size && init_batch(priv, sw->queue_size)))
+    {
+        free_priv(priv);
+        return -1;
+    }
+
+    /*
+     * ICMP datagram sockets (unprivileged) are only supported on MacOS
+     */
+#ifdef __APPLE__
+    sw->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
+#else
+    sw->fd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+#endif /* __APPLE__ */
+
+    if (sw->fd == -1)
+    {
+        free_priv(priv);
+        return -1;
+    }
+
+    if (toggle_sock_nonblock(sw->fd))
+    {
+        close_sock(sw->fd);
+        free_priv(priv);
+        return -1;
+    }
+
+    sweep_set_rcvbuf(sw->fd);
+
+#ifdef ICMP_SWEEP_FILTER
+    /*
+     * Not fatal either: without the filter, unrelated messages are discarded
+     * in icmp_sweep_recv instead of by the kernel
+     */
+    filter = ~((1U << ICMP_TYPE_ECHO_REPLY) | (1U << ICMP_TYPE_UNREACHABLE));
+    setsockopt(sw->fd, SOL_RAW, ICMP_SWEEP_FILTER, &filter, sizeof(filter));
+#endif /* ICMP_SWEEP_FILTER */
+
+    sw->priv = priv;
+
+    return 0;
+}
+
+static int
+icmp_sweep_send(struct sweep *sw, in_addr_t addr, in_port_t port)
+{
+    struct icmp_sweep_priv *priv = sw->priv;
+    uint32_t st = stamp(sw, addr);
+    struct sockaddr_in remote = {0};
+
+    remote.sin_family = AF_INET;
+    remote.sin_addr.s_addr = addr;
+
+    icmp_echo_stamp(&priv->echo, (uint16_t) (st >> 16), (uint16_t) st);
+
+    return sendto(sw->fd, &priv->echo.header, priv->echo.len, 0,
+                  (struct sockaddr *) &remote, sizeof(remote)) == -1 ? -1 : 0;
+}
+
+static uint32_t
+icmp_sweep_send_batch(struct sweep *sw, const struct sweep_probe *probes,
+                      uint32_t count)
+{
+    struct icmp_sweep_priv *priv = sw->priv;
+    uint32_t i = 0, st = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        st = stamp(sw, probes[i].addr);
+        icmp_echo_stamp(&priv->echoes[i], (uint16_t) (st >> 16),
+                        (uint16_t) st);
+        priv->batch.remotes[i].sin_addr.s_addr = probes[i].addr;
+    }
+
+    return sweep_batch_send(sw->fd, &priv->batch, count);
+}
+
+static int
+icmp_sweep_recv(struct sweep *sw, struct sweep_reply *reply)
+{
+    unsigned char buf[ICMP_SWEEP_BUFLEN];
+    ssize_t n = 0;
+    size_t hlen = 0, qlen = 0;
+    uint32_t st = 0;
+    struct ip ip, quoted;
+    struct icmp_echo_header header = {0};
+
+    n = recv(sw->fd, buf, sizeof(buf), 0);
+
+    if (n == -1)
+    {
+        return -1;
+    }
+
+    hlen = parse_ip(buf, (size_t) n, &ip);
+
+    if (!hlen)
+    {
+        return 0;
+    }
+
+    memcpy(&header, buf + hlen, sizeof(header));
+
+    if (header.type == ICMP_TYPE_UNREACHABLE)
+    {
+        /*
+         * An unreachable message quotes the IP header and the first 8 bytes
+         * of the probe that caused it, which is exactly the echo header
+         */
+        qlen = parse_ip(buf + hlen + sizeof(header),
+                        (size_t) n - hlen - sizeof(header), &quoted);
+
+        if (!qlen || quoted.ip_p != IPPROTO_ICMP)
+        {
+            return 0;
+        }
+
+        memcpy(&header, buf + hlen + sizeof(header) + qlen, sizeof(header));
+
+        if (header.type != ICMP_TYPE_ECHO_REQUEST)
+        {
+            return 0;
+        }
+
+        reply->addr = quoted.ip_dst.s_addr;
+        reply->up = 0;
+    }
+    else if (header.type == ICMP_TYPE_ECHO_REPLY && !header.code)
+    {
+        reply->addr = ip.ip_src.s_addr;
+        reply->up = 1;
+    }
+    else
+    {
+        return 0;
+    }
+
+    /*
+     * Anything not stamped for its address by this sweep is unrelated traffic
+     */
+    st = stamp(sw, reply->addr);
+
+    return ntohs(header.id) == (uint16_t) (st >> 16)
+           && ntohs(header.seq) == (uint16_t) st ? 1 : 0;
+}
+
+static void
+icmp_sweep_close(struct sweep *sw)
+{
+    close_sock(sw->fd);
+    free_priv(sw->priv);
+    sw->fd = -1;
+    sw->priv = NULL;
+}
+
+const struct sweep_method icmp_sweep = {
+    icmp_sweep_open,
+    icmp_sweep_send,
+    icmp_sweep_recv,
+    icmp_sweep_close,
+    NULL,
+    NULL,
+    icmp_sweep_send_batch
+};
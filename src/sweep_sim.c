@@ -0,0 +1,292 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "sweep.h"
+#include "util.h"
+
+/*
+ * Number of replies the queue of a simulated network has room for at first
+ */
+#define SIM_QUEUE_SIZE  1024
+
+/*
+ * A reply on its way back from the simulated network, due at time at
+ */
+struct sim_event
+{
+    uint64_t at;
+    in_addr_t addr;
+    in_port_t port;
+    uint8_t state;
+    uint8_t up;
+};
+
+/*
+ * State of a sweep of a simulated network: its virtual clock (in nanoseconds
+ * since the sweep started) and the replies still on their way, as a binary
+ * min-heap by the time they are due
+ */
+struct sim_net
+{
+    const struct sim_spec *spec;
+    uint64_t now;
+    struct sim_event *events;
+    size_t count;
+    size_t size;
+};
+
+/*
+ * Queues a reply, returning 0 on success or -1 (with errno set) upon error
+ */
+static int
+push(struct sim_net *net, const struct sim_event *ev)
+{
+    size_t i = net->count, parent = 0;
+    struct sim_event *events = NULL;
+
+    if (net->count == net->size)
+    {
+        events = realloc(net->events, 2 * net->size * sizeof(*events));
+
+        if (!events)
+        {
+            return -1;
+        }
+
+        net->events = events;
+        net->size *= 2;
+    }
+
+    /*
+     * Sift the hole at the end up to where the reply belongs
+     */
+    for (; i; i = parent)
+    {
+        parent = (i - 1) / 2;
+
+        if (net->events[parent].at <= ev->at)
+        {
+            break;
+        }
+
+        net->events[i] = net->events[parent];
+    }
+
+    net->events[i] = *ev;
+    net->count++;
+
+    return 0;
+}
+
+/*
+ * Takes the reply due first off the queue and stores it in ev
+ */
+static void
+pop(struct sim_net *net, struct sim_event *ev)
+{
+    size_t i = 0, child = 0;
+    struct sim_event *last = &net->events[--net->count];
+
+    *ev = net->events[0];
+
+    /*
+     * Sift the hole at the top down to where the last reply belongs
+     */
+    for (; (child = 2 * i + 1) < net->count; i = child)
+    {
+        if (child + 1 < net->count
+            && net->events[child + 1].at < net->events[child].at)
+        {
+            child++;
+        }
+
+        if (last->at <= net->events[child].at)
+        {
+            break;
+        }
+
+        net->events[i] = net->events[child];
+    }
+
+    net->events[i] = *last;
+}
+
+static int
+sim_sweep_open(struct sweep *sw)
+{
+    struct sim_net *net = NULL;
+
+    if (!sw->sc->sim)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    net = zmalloc(sizeof(*net));
+
+    if (!net)
+    {
+        return -1;
+    }
+
+    net->spec = sw->sc->sim;
+    net->size = SIM_QUEUE_SIZE;
+    net->events = malloc(net->size * sizeof(*net->events));
+
+    if (!net->events)
+    {
+        free(net);
+        return -1;
+    }
+
+    sw->priv = net;
+
+    return 0;
+}
+
+static int
+sim_sweep_send(struct sweep *sw, in_addr_t addr, in_port_t port)
+{
+    struct sim_net *net = sw->priv;
+    const struct sim_spec *spec = net->spec;
+    uint32_t host = ntohl(addr);
+    uint16_t hport = ntohs(port);
+    uint8_t scan_type = sw->sc->scan_type;
+    int ports = scan_type == SCAN_TYPE_CONNECT || scan_type == SCAN_TYPE_SYN;
+    struct sim_event ev = {0};
+
+    net->now += spec->send_ns;
+
+    if (sim_lost(spec, host, hport, sw->sc->pass))
+    {
+        return 0;
+    }
+
+    ev.addr = addr;
+    ev.port = port;
+
+    if (sim_host_up(spec, host))
+    {
+        /*
+         * Closed ports answer (with an RST or a refused connection) unless
+         * they are filtered
+         */
+        ev.up = 1;
+
+        if (ports && sim_port_open(spec, host, hport))
+        {
+            ev.state = PORT_OPEN;
+        }
+        else if (ports && sim_port_filtered(spec, host, hport))
+        {
+            return 0;
+        }
+        else if (ports)
+        {
+            ev.state = PORT_CLOSED;
+        }
+    }
+    else if (scan_type != SCAN_TYPE_ARP && sim_unreachable(spec, host))
+    {
+        ev.up = 0;
+        ev.state = ports ? PORT_FILTERED : PORT_STATE_NONE;
+    }
+    else
+    {
+        return 0;
+    }
+
+    ev.at = net->now + sim_rtt(spec, host, hport, sw->sc->pass);
+
+    return push(net, &ev);
+}
+
+static int
+sim_sweep_recv(struct sweep *sw, struct sweep_reply *reply)
+{
+    struct sim_net *net = sw->priv;
+    struct sim_event ev = {0};
+
+    if (!net->count || net->events[0].at > net->now)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    pop(net, &ev);
+
+    reply->addr = ev.addr;
+    reply->port = ev.port;
+    reply->state = ev.state;
+    reply->up = ev.up;
+
+    /*
+     * Hosts answering ARP requests get a locally administered address made
+     * from their IP address
+     */
+    if (sw->sc->scan_type == SCAN_TYPE_ARP)
+    {
+        reply->hwaddr[0] = 0x02;
+        memcpy(reply->hwaddr + 2, &ev.addr, sizeof(ev.addr));
+        reply->has_hwaddr = 1;
+    }
+
+    return 1;
+}
+
+static void
+sim_sweep_close(struct sweep *sw)
+{
+    struct sim_net *net = sw->priv;
+
+    if (net)
+    {
+        sw->sc->stats.sim_ns += net->now;
+        free(net->events);
+        free(net);
+        sw->priv = NULL;
+    }
+}
+
+static uint64_t
+sim_sweep_now(struct sweep *sw)
+{
+    return ((struct sim_net *) sw->priv)->now;
+}
+
+/*
+ * Moves the virtual clock to the first reply due within wait_ns, or wait_ns
+ * ahead if there is none
+ */
+static int
+sim_sweep_wait(struct sweep *sw, uint64_t wait_ns)
+{
+    struct sim_net *net = sw->priv;
+
+    if (net->count && net->events[0].at <= net->now + wait_ns)
+    {
+        if (net->events[0].at > net->now)
+        {
+            net->now = net->events[0].at;
+        }
+
+        return 1;
+    }
+
+    net->now += wait_ns;
+
+    return 0;
+}
+
+const struct sweep_method sim_sweep = {
+    sim_sweep_open,
+    sim_sweep_send,
+    sim_sweep_recv,
+    sim_sweep_close,
+    sim_sweep_now,
+    sim_sweep_wait,
+    NULL
+};
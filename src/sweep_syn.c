@@ -0,0 +1,252 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "packets.h"
+#include "socket_util.h"
+#include "sweep.h"
+#include "util.h"
+
+/*
+ * Large enough for any IP header plus a TCP header
+ */
+#define SYN_SWEEP_BUFLEN    128
+
+/*
+ * SYNs are sent from a source port in [SYN_SWEEP_PORT_BASE,
+ * SYN_SWEEP_PORT_BASE + SYN_SWEEP_PORT_RANGE) chosen from the sweep's key,
+ * above the usual ephemeral range so replies don't collide with real
+ * connections
+ */
+#define SYN_SWEEP_PORT_BASE     61000
+#define SYN_SWEEP_PORT_RANGE    4000
+
+/*
+ * Private state of a SYN sweep: the SYN stamped for each target, and for a
+ * sweep that sends in batches, one per probe of a batch and the batch sending
+ * them
+ */
+struct syn_sweep_priv
+{
+    struct tcp_syn_template syn;
+    struct tcp_syn_template *syns;
+    struct sweep_batch batch;
+};
+
+/*
+ * Returns the source port of the sweep's SYNs
+ */
+static uint16_t
+source_port(const struct sweep *sw)
+{
+    return (uint16_t) (SYN_SWEEP_PORT_BASE + sw->key % SYN_SWEEP_PORT_RANGE);
+}
+
+/*
+ * Returns the sequence number of the SYN sent to addr:port. A valid reply
+ * acknowledges this number plus one.
+ */
+static uint32_t
+cookie(const struct sweep *sw, in_addr_t addr, uint16_t port)
+{
+    return keyed_hash(sw->key, ntohl(addr), port);
+}
+
+/*
+ * Frees priv and everything it holds
+ */
+static void
+free_priv(struct syn_sweep_priv *priv)
+{
+    if (priv)
+    {
+        sweep_batch_free(&priv->batch);
+        free(priv->syns);
+        free(priv);
+    }
+}
+
+/*
+ * Sets up priv to send batches of up to size SYNs
+ */
+static int
+init_batch(struct syn_sweep_priv *priv, uint32_t size)
+{
+    uint32_t i = 0;
+
+    priv->syns = malloc(size * sizeof(*priv->syns));
+
+    if (!priv->syns || sweep_batch_init(&priv->batch, size, 1))
+    {
+        return -1;
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        priv->syns[i] = priv->syn;
+        priv->batch.iovs[i].iov_base = &priv->syns[i];
+        priv->batch.iovs[i].iov_len = TCP_SYN_LEN;
+    }
+
+    return 0;
+}
+
+static int
+syn_sweep_open(struct sweep *sw)
+{
+    int on = 1;
+    struct syn_sweep_priv *priv = NULL;
+
+    priv = zmalloc(sizeof(*priv));
+
+    if (!priv)
+    {
+        return -1;
+    }
+
+    tcp_syn_template(&priv->syn, sw->sc->dev->local.sin_addr.s_addr,
+                     source_port(sw));
+
+    if (sw->queue_size && init_batch(priv, sw->queue_size))
+    {
+        free_priv(priv);
+        return -1;
+    }
+
+    sw->fd = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
+
+    if (sw->fd == -1)
+    {
+        free_priv(priv);
+        return -1;
+    }
+
+    /*
+     * SYNs carry their own IP header so that the source address used in the
+     * TCP checksum is the one actually sent
+     */
+    if (setsockopt(sw->fd, IPPROTO_IP, IP_HDRINCL, &on, sizeof(on))
+        || toggle_sock_nonblock(sw->fd))
+    {
+        close_sock(sw->fd);
+        free_priv(priv);
+        return -1;
+    }
+
+    sweep_set_rcvbuf(sw->fd);
+
+    sw->priv = priv;
+
+    return 0;
+}
+
+static int
+syn_sweep_send(struct sweep *sw, in_addr_t addr, in_port_t port)
+{
+    struct syn_sweep_priv *priv = sw->priv;
+    struct sockaddr_in remote = {0};
+
+    remote.sin_family = AF_INET;
+    remote.sin_addr.s_addr = addr;
+
+    tcp_syn_stamp(&priv->syn, addr, ntohs(port),
+                  cookie(sw, addr, ntohs(port)));
+
+    return sendto(sw->fd, &priv->syn, TCP_SYN_LEN, 0,
+                  (struct sockaddr *) &remote, sizeof(remote)) == -1 ? -1 : 0;
+}
+
+static uint32_t
+syn_sweep_send_batch(struct sweep *sw, const struct sweep_probe *probes,
+                     uint32_t count)
+{
+    struct syn_sweep_priv *priv = sw->priv;
+    uint32_t i = 0;
+    uint16_t port = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        port = ntohs(probes[i].port);
+        tcp_syn_stamp(&priv->syns[i], probes[i].addr, port,
+                      cookie(sw, probes[i].addr, port));
+        priv->batch.remotes[i].sin_addr.s_addr = probes[i].addr;
+    }
+
+    return sweep_batch_send(sw->fd, &priv->batch, count);
+}
+
+static int
+syn_sweep_recv(struct sweep *sw, struct sweep_reply *reply)
+{
+    unsigned char buf[SYN_SWEEP_BUFLEN];
+    ssize_t n = 0;
+    size_t hlen = 0;
+    struct ipv4_header ip;
+    struct tcp_header tcp;
+
+    n = recv(sw->fd, buf, sizeof(buf), 0);
+
+    if (n == -1)
+    {
+        return -1;
+    }
+
+    if ((size_t) n < sizeof(ip))
+    {
+        return 0;
+    }
+
+    memcpy(&ip, buf, sizeof(ip));
+    hlen = (ip.ver_ihl & 0x0f) * 4;
+
+    if (ip.proto != IPPROTO_TCP || hlen < sizeof(ip)
+        || (size_t) n < hlen + sizeof(tcp))
+    {
+        return 0;
+    }
+
+    memcpy(&tcp, buf + hlen, sizeof(tcp));
+
+    /*
+     * A SYN-ACK means the port is open and a RST means it is closed; either
+     * way the host is up. Anything else, or anything that does not
+     * acknowledge the cookie sent to its source address and port, is
+     * unrelated traffic.
+     */
+    if (ntohs(tcp.dport) != source_port(sw)
+        || !(tcp.flags & (TCP_FLAG_SYN | TCP_FLAG_RST))
+        || !(tcp.flags & TCP_FLAG_ACK)
+        || ntohl(tcp.ack) - 1 != cookie(sw, ip.saddr, ntohs(tcp.sport)))
+    {
+        return 0;
+    }
+
+    reply->addr = ip.saddr;
+    reply->port = tcp.sport;
+    reply->state = tcp.flags & TCP_FLAG_RST ? PORT_CLOSED : PORT_OPEN;
+    reply->up = 1;
+
+    return 1;
+}
+
+static void
+syn_sweep_close(struct sweep *sw)
+{
+    close_sock(sw->fd);
+    free_priv(sw->priv);
+    sw->fd = -1;
+    sw->priv = NULL;
+}
+
+const struct sweep_method syn_sweep = {
+    syn_sweep_open,
+    syn_sweep_send,
+    syn_sweep_recv,
+    syn_sweep_close,
+    NULL,
+    NULL,
+    syn_sweep_send_batch
+};
@@ -0,0 +1,164 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "results.h"
+#include "test.h"
+
+/*
+ * Exercises checkpointing and resuming scans.
+ */
+
+static unsigned int ups = 0, downs = 0;
+
+static void
+count_up(struct scanner *sc)
+{
+    CHECK(sc->port_state == PORT_OPEN || sc->port_state == PORT_CLOSED);
+    ups++;
+}
+
+static void
+count_down(struct scanner *sc)
+{
+    CHECK(sc->port_state == PORT_FILTERED);
+    downs++;
+}
+
+/*
+ * Records a result for the probe of host (host byte order) on port
+ */
+static void
+record(struct checkpoint *cp, struct scanner *sc, uint32_t host,
+       uint16_t port, uint8_t state, uint8_t port_state)
+{
+    sc->target.sin_addr.s_addr = htonl(host);
+    sc->target.sin_port = htons(port);
+    sc->port_state = port_state;
+    checkpoint_record(cp, sc, state);
+}
+
+/*
+ * Returns the size of the file at path
+ */
+static off_t
+file_size(const char *path)
+{
+    struct stat st = {0};
+
+    CHECK(!stat(path, &st));
+
+    return st.st_size;
+}
+
+int
+main(void)
+{
+    char path[] = "/tmp/test_checkpoint_XXXXXX";
+    uint16_t ports[] = {22, 80}, other_ports[] = {22, 443};
+    uint64_t left = 0;
+    int fd = -1;
+    in_addr_t addr = 0;
+    in_port_t port = 0;
+    struct sockaddr_in bcast = {0};
+    struct device dev = {{0}};
+    struct scanner sc = {0};
+    struct checkpoint cp;
+
+    fd = mkstemp(path);
+    CHECK(fd != -1);
+    close(fd);
+
+    /*
+     * A /27 on two ports: 64 targets, less the local and broadcast addresses
+     * on the second port
+     */
+    dev.local.sin_addr.s_addr = htonl(0x0a000001);
+    bcast.sin_addr.s_addr = htonl(0x0a00001f);
+    dev.bcast = &bcast;
+
+    sc.dev = &dev;
+    sc.scan_type = SCAN_TYPE_CONNECT;
+    sc.ports = ports;
+    sc.nports = 2;
+    sc.start = htonl(0x0a000000);
+    sc.end = htonl(0x0a00001f);
+
+    /*
+     * Results are appended in the background
+     */
+    CHECK(!checkpoint_open(&cp, &sc, path, 0));
+    CHECK(!sc.skip);
+    CHECK(file_size(path) == sizeof(struct checkpoint_header));
+
+    record(&cp, &sc, 0x0a000005, 22, RESULT_UP, PORT_OPEN);
+    record(&cp, &sc, 0x0a000005, 80, RESULT_UP, PORT_CLOSED);
+    record(&cp, &sc, 0x0a000006, 80, RESULT_DOWN, PORT_FILTERED);
+    record(&cp, &sc, 0x0b000000, 80, RESULT_UP, PORT_OPEN);
+
+    usleep((CHECKPOINT_INTERVAL_MS + 300) * 1000);
+    CHECK(file_size(path) > (off_t) sizeof(struct checkpoint_header));
+
+    record(&cp, &sc, 0x0a000010, 22, RESULT_DOWN, PORT_FILTERED);
+    CHECK(!checkpoint_close(&cp, 0));
+
+    /*
+     * A crash may leave part of an entry behind
+     */
+    fd = open(path, O_WRONLY | O_APPEND);
+    CHECK(fd != -1);
+    CHECK(write(fd, "junk", 4) == 4);
+    close(fd);
+
+    /*
+     * Resuming skips the targets with results and reports them again
+     */
+    CHECK(!checkpoint_open(&cp, &sc, path, 1));
+    CHECK(sc.skip);
+
+    while (next_target(&sc, &addr, &port))
+    {
+        CHECK(!(addr == htonl(0x0a000005)));
+        CHECK(!(addr == htonl(0x0a000006) && port == htons(80)));
+        CHECK(!(addr == htonl(0x0a000010) && port == htons(22)));
+        left++;
+    }
+
+    CHECK(left == 62 - 4);
+
+    checkpoint_replay(&cp, &sc, count_up, count_down);
+    CHECK(ups == 2 && downs == 2);
+
+    sc.skip = NULL;
+    CHECK(!checkpoint_close(&cp, 0));
+
+    /*
+     * The file was compacted on resume and still resumes
+     */
+    CHECK(file_size(path) == sizeof(struct checkpoint_header)
+                             + 3 * sizeof(struct checkpoint_entry));
+    CHECK(!checkpoint_open(&cp, &sc, path, 1));
+    sc.skip = NULL;
+
+    /*
+     * A finished scan leaves nothing to resume
+     */
+    CHECK(!checkpoint_close(&cp, 1));
+    CHECK(access(path, F_OK) == -1 && errno == ENOENT);
+
+    /*
+     * Nor can a different scan resume a checkpoint
+     */
+    CHECK(!checkpoint_open(&cp, &sc, path, 0));
+    CHECK(!checkpoint_close(&cp, 0));
+    sc.ports = other_ports;
+    CHECK(checkpoint_open(&cp, &sc, path, 1) == -1 && errno == EINVAL);
+
+    unlink(path);
+
+    return 0;
+}
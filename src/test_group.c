@@ -0,0 +1,144 @@
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "group.h"
+#include "test.h"
+
+/*
+ * Splits overlapping subnets between the scanners of a group and checks that
+ * every address is probed, and reported, exactly once, with probes that
+ * don't touch the network.
+ */
+
+/*
+ * The widest subnet of the devices below, 10.0.0.0/22, which holds all the
+ * others
+ */
+#define TEST_FIRST  0x0a000000U
+#define TEST_COUNT  1024U
+
+/*
+ * An excluded address
+ */
+#define TEST_EXCLUDED   0x0a000203U
+
+static unsigned char visits[TEST_COUNT];
+static unsigned char reports[TEST_COUNT];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+fake_probe(struct scanner *sc)
+{
+    uint32_t offset = ntohl(sc->target.sin_addr.s_addr) - TEST_FIRST;
+
+    CHECK(offset < TEST_COUNT);
+
+    pthread_mutex_lock(&lock);
+    visits[offset]++;
+    pthread_mutex_unlock(&lock);
+
+    return offset % 2;
+}
+
+/*
+ * Not locked: only called with callbacks serialized
+ */
+static void
+count_report(struct scanner *sc)
+{
+    reports[ntohl(sc->target.sin_addr.s_addr) - TEST_FIRST]++;
+}
+
+/*
+ * Returns a device with address local (host byte order) in a subnet of
+ * prefix bits
+ */
+static struct device *
+new_device(uint32_t local, unsigned int prefix)
+{
+    struct device *dev = calloc(1, sizeof(*dev));
+
+    CHECK(dev);
+    dev->local.sin_family = AF_INET;
+    dev->local.sin_addr.s_addr = htonl(local);
+    dev->netmask.sin_family = AF_INET;
+    dev->netmask.sin_addr.s_addr = htonl(~0U << (32 - prefix));
+
+    return dev;
+}
+
+/*
+ * Runs a group over the devices, excluding TEST_EXCLUDED, and checks that
+ * it has count scanners and that every other address is probed and reported
+ * once
+ */
+static void
+check_group(struct device **devs, size_t ndevs, size_t count,
+            unsigned int threads)
+{
+    uint32_t i = 0;
+    struct scanner tmpl = {0};
+    struct scan_group group = {0};
+    struct interval_set exclude = {0};
+
+    memset(visits, 0, sizeof(visits));
+    memset(reports, 0, sizeof(reports));
+
+    tmpl.scan_type = SCAN_TYPE_CONNECT;
+    tmpl.probe = fake_probe;
+    tmpl.target.sin_family = AF_INET;
+    tmpl.threads = threads;
+    tmpl.serialize_callbacks = 1;
+
+    CHECK(!interval_set_add(&exclude, TEST_EXCLUDED, TEST_EXCLUDED));
+    CHECK(!interval_set_finish(&exclude));
+
+    CHECK(!scan_group_init_devices(&group, &tmpl, devs, ndevs, NULL,
+                                   &exclude));
+    CHECK(group.count == count);
+
+    for (i = 0; i < ndevs; i++)
+    {
+        CHECK(!devs[i]);
+    }
+
+    CHECK(!run_scan_group(&group, count_report, count_report, NULL));
+
+    for (i = 0; i < TEST_COUNT; i++)
+    {
+        CHECK(visits[i] == (TEST_FIRST + i != TEST_EXCLUDED));
+        CHECK(reports[i] == visits[i]);
+    }
+
+    scan_group_free(&group);
+    interval_set_free(&exclude);
+}
+
+int
+main(void)
+{
+    struct device *devs[4] = {NULL};
+
+    /*
+     * A /24 inside a /22, then a second address in the same /22 and a /23
+     * inside it, which have nothing left to scan
+     */
+    devs[0] = new_device(0x0a000105U, 24);
+    devs[1] = new_device(0x0a000001U, 22);
+    devs[2] = new_device(0x0a000309U, 22);
+    devs[3] = new_device(0x0a000011U, 23);
+    check_group(devs, 4, 2, 1);
+
+    /*
+     * Two halves of a /22 and the /22 itself, with workers sharing the
+     * group's callback lock
+     */
+    devs[0] = new_device(0x0a000001U, 23);
+    devs[1] = new_device(0x0a000201U, 23);
+    devs[2] = new_device(0x0a000301U, 22);
+    check_group(devs, 3, 2, 4);
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <arpa/inet.h>
+#include <stdlib.h>
+
+#include "inflight.h"
+#include "test.h"
+
+/*
+ * Exercises the send-order list and hash index of the in-flight table.
+ */
+
+/*
+ * Table size chosen so that buckets hold several addresses each when filled
+ * with addresses that share their low bits
+ */
+#define TEST_SIZE   257
+
+int
+main(void)
+{
+    struct inflight tbl = {0};
+    uint32_t i = 0, slot = 0, slots[TEST_SIZE];
+
+    CHECK(inflight_init(&tbl, 0) == -1);
+    CHECK(!inflight_init(&tbl, TEST_SIZE));
+    CHECK(tbl.count == 0 && tbl.head == INFLIGHT_NONE);
+    CHECK(inflight_find(&tbl, htonl(0x0a000001), 0) == INFLIGHT_NONE);
+
+    /*
+     * Fill the table with addresses 4096 apart so they collide in the
+     * low-order bits
+     */
+    for (i = 0; i < TEST_SIZE; i++)
+    {
+        slots[i] = inflight_add(&tbl, htonl(0x0a000000 + (i << 12)), 0, i);
+        CHECK(slots[i] != INFLIGHT_NONE);
+    }
+
+    CHECK(tbl.count == TEST_SIZE);
+    CHECK(inflight_add(&tbl, htonl(0x0b000000), 0, 0) == INFLIGHT_NONE);
+    CHECK(tbl.head == slots[0] && tbl.tail == slots[TEST_SIZE - 1]);
+
+    for (i = 0; i < TEST_SIZE; i++)
+    {
+        CHECK(inflight_find(&tbl, htonl(0x0a000000 + (i << 12)), 0)
+              == slots[i]);
+    }
+
+    /*
+     * Remove every other probe, including the oldest and the newest, and make
+     * sure the rest can still be found and stay in send order
+     */
+    for (i = 0; i < TEST_SIZE; i += 2)
+    {
+        inflight_remove(&tbl, slots[i]);
+    }
+
+    CHECK(tbl.count == TEST_SIZE / 2);
+    CHECK(tbl.head == slots[1] && tbl.tail == slots[TEST_SIZE - 2]);
+
+    for (i = 0; i < TEST_SIZE; i++)
+    {
+        slot = inflight_find(&tbl, htonl(0x0a000000 + (i << 12)), 0);
+        CHECK(i % 2 ? slot == slots[i] : slot == INFLIGHT_NONE);
+    }
+
+    for (i = 1, slot = tbl.head; slot != INFLIGHT_NONE;
+         i += 2, slot = tbl.slots[slot].next)
+    {
+        CHECK(tbl.slots[slot].sent == i);
+    }
+
+    CHECK(i == TEST_SIZE);
+
+    /*
+     * Freed slots are reused, and a re-added address is found again
+     */
+    slot = inflight_add(&tbl, htonl(0x0a000000), 0, 1000);
+    CHECK(slot != INFLIGHT_NONE && tbl.tail == slot);
+    CHECK(inflight_find(&tbl, htonl(0x0a000000), 0) == slot);
+
+    while (tbl.head != INFLIGHT_NONE)
+    {
+        inflight_remove(&tbl, tbl.head);
+    }
+
+    CHECK(tbl.count == 0 && tbl.tail == INFLIGHT_NONE);
+
+    for (i = 0; i < TEST_SIZE; i++)
+    {
+        CHECK(inflight_find(&tbl, htonl(0x0a000000 + (i << 12)), 0)
+              == INFLIGHT_NONE);
+    }
+
+    /*
+     * Probes of several ports of one host are told apart by port and counted
+     * together
+     */
+    for (i = 0; i < 8; i++)
+    {
+        slots[i] = inflight_add(&tbl, htonl(0x0a000001), htons(i + 1), i);
+    }
+
+    inflight_add(&tbl, htonl(0x0a000002), htons(1), 8);
+
+    CHECK(inflight_host_load(&tbl, htonl(0x0a000001)) == 8);
+    CHECK(inflight_host_load(&tbl, htonl(0x0a000002)) == 1);
+    CHECK(inflight_host_load(&tbl, htonl(0x0a000003)) == 0);
+
+    for (i = 0; i < 8; i++)
+    {
+        CHECK(inflight_find(&tbl, htonl(0x0a000001), htons(i + 1))
+              == slots[i]);
+    }
+
+    CHECK(inflight_find(&tbl, htonl(0x0a000001), htons(9)) == INFLIGHT_NONE);
+
+    inflight_remove(&tbl, slots[3]);
+    CHECK(inflight_host_load(&tbl, htonl(0x0a000001)) == 7);
+    CHECK(inflight_find(&tbl, htonl(0x0a000001), htons(4)) == INFLIGHT_NONE);
+
+    inflight_free(&tbl);
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include "intervals.h"
+#include "test.h"
+
+/*
+ * Exercises parsing, merging, subtraction and lookups of interval sets.
+ */
+
+/*
+ * Checks that the set holds exactly the intervals listed in expected, as
+ * {first, last} pairs
+ */
+static void
+check_intervals(const struct interval_set *set, const struct interval *expected,
+                size_t count)
+{
+    size_t i = 0;
+    uint64_t total = 0;
+
+    CHECK(set->count == count);
+
+    for (i = 0; i < count; i++)
+    {
+        CHECK(set->intervals[i].first == expected[i].first);
+        CHECK(set->intervals[i].last == expected[i].last);
+        CHECK(set->before[i] == total);
+        total += (uint64_t) expected[i].last - expected[i].first + 1;
+    }
+
+    CHECK(set->total == total);
+}
+
+static void
+test_parse_and_merge(void)
+{
+    uint64_t i = 0, rank = 0;
+    struct interval_set set = {0};
+    const struct interval expected[] = {
+        {0x0a000000, 0x0a0000ff},
+        {0x0a000200, 0x0a000205},
+        {0xc0a80101, 0xc0a80101},
+        {0xfffffff0, 0xffffffff}
+    };
+
+    CHECK(!interval_set_parse_list(&set, "10.0.0.128/25 10.0.0.0/25,"
+                                   "10.0.2.0-10.0.2.5 192.168.1.1 "
+                                   "10.0.2.3-10.0.2.4 255.255.255.240/28 "
+                                   "255.255.255.255"));
+    CHECK(!interval_set_finish(&set));
+    check_intervals(&set, expected, 4);
+
+    CHECK(interval_set_nth(&set, 0, NULL) == 0x0a000000);
+    CHECK(interval_set_nth(&set, 255, NULL) == 0x0a0000ff);
+    CHECK(interval_set_nth(&set, 256, NULL) == 0x0a000200);
+    CHECK(interval_set_nth(&set, 262, NULL) == 0xc0a80101);
+    CHECK(interval_set_nth(&set, set.total - 1, NULL) == 0xffffffff);
+
+    CHECK(interval_set_contains(&set, 0x0a000080));
+    CHECK(interval_set_contains(&set, 0xffffffff));
+    CHECK(!interval_set_contains(&set, 0x0a000100));
+    CHECK(!interval_set_contains(&set, 0x00000000));
+
+    CHECK(interval_set_rank(&set, 0x0a000200, &i) && i == 256);
+    CHECK(interval_set_rank(&set, 0xffffffff, &i) && i == set.total - 1);
+    CHECK(!interval_set_rank(&set, 0x0a000206, &i));
+
+    for (i = 0; i < set.total; i++)
+    {
+        CHECK(interval_set_rank(&set, interval_set_nth(&set, i, NULL), &rank)
+              && rank == i);
+    }
+
+    interval_set_free(&set);
+
+    /*
+     * The whole address space
+     */
+    CHECK(!interval_set_parse(&set, "1.2.3.4/0"));
+    CHECK(!interval_set_finish(&set));
+    CHECK(set.count == 1 && set.total == 1ULL << 32);
+    interval_set_free(&set);
+
+    errno = 0;
+    CHECK(interval_set_parse(&set, "10.0.0.0/33") == -1 && errno == EINVAL);
+    CHECK(interval_set_parse(&set, "10.0.0.0/") == -1);
+    CHECK(interval_set_parse(&set, "10.0.0.0/-1") == -1);
+    CHECK(interval_set_parse(&set, "10.0.0.9-10.0.0.1") == -1);
+    CHECK(interval_set_parse(&set, "10.0.0") == -1);
+    CHECK(interval_set_parse(&set, "10.0.0.1-") == -1);
+    CHECK(interval_set_parse(&set, "host.example") == -1);
+    CHECK(set.count == 0);
+    interval_set_free(&set);
+}
+
+static void
+test_subtract(void)
+{
+    struct interval_set set = {0}, exclude = {0};
+    const struct interval expected[] = {
+        {0x0a000001, 0x0a000009},
+        {0x0a00000b, 0x0a00000f},
+        {0x0a000030, 0x0a00003f},
+        {0x0a000041, 0x0a0000fe},
+        {0x0b000001, 0x0b0000ff}
+    };
+
+    CHECK(!interval_set_parse_list(&set, "10.0.0.0/24 11.0.0.0/24 "
+                                   "12.0.0.0/24"));
+    CHECK(!interval_set_parse_list(&exclude, "10.0.0.10 10.0.0.16-10.0.0.47 "
+                                   "9.0.0.0-10.0.0.0 10.0.0.64 "
+                                   "10.0.0.255-11.0.0.0 11.0.0.0 "
+                                   "12.0.0.0/24 11.0.1.0/24"));
+    CHECK(!interval_set_finish(&set));
+    CHECK(!interval_set_finish(&exclude));
+    CHECK(!interval_set_subtract(&set, &exclude));
+
+    check_intervals(&set, expected, 5);
+
+    interval_set_free(&set);
+    interval_set_free(&exclude);
+}
+
+/*
+ * Walks a set of many small intervals in order, with and without the hint,
+ * and checks every address against a direct computation
+ */
+static void
+test_walk(void)
+{
+    uint32_t i = 0, addr = 0;
+    uint64_t n = 0;
+    size_t hint = 0;
+    struct interval_set set = {0};
+
+    /*
+     * 1000 blocks of 3 addresses, 5 apart, added in reverse
+     */
+    for (i = 1000; i-- > 0;)
+    {
+        CHECK(!interval_set_add(&set, 0x0a000000 + 5 * i,
+                                0x0a000000 + 5 * i + 2));
+    }
+
+    CHECK(!interval_set_finish(&set));
+    CHECK(set.count == 1000 && set.total == 3000);
+
+    for (n = 0; n < set.total; n++)
+    {
+        addr = 0x0a000000 + 5 * (uint32_t) (n / 3) + (uint32_t) (n % 3);
+        CHECK(interval_set_nth(&set, n, &hint) == addr);
+        CHECK(interval_set_nth(&set, n, NULL) == addr);
+        CHECK(interval_set_contains(&set, addr));
+        CHECK(!interval_set_contains(&set, addr - (uint32_t) (n % 3) + 3));
+    }
+
+    /*
+     * A lookup far from the hint falls back on the search
+     */
+    CHECK(interval_set_nth(&set, 0, &hint) == 0x0a000000 && hint == 0);
+
+    interval_set_free(&set);
+}
+
+int
+main(void)
+{
+    test_parse_and_merge();
+    test_subtract();
+    test_walk();
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "test.h"
+#include "util.h"
+
+/*
+ * Exercises the per-thread probe counters.
+ */
+
+#define THREADS 4
+#define PROBES  1000
+
+/*
+ * Counts PROBES probes sent and answered, then exits
+ */
+static void *
+count(void *arg)
+{
+    int i = 0;
+
+    (void) arg;
+
+    for (i = 0; i < PROBES; i++)
+    {
+        metrics_sent();
+        metrics_reply(1000000);
+    }
+
+    return NULL;
+}
+
+int
+main(void)
+{
+    int i = 0;
+    pthread_t threads[THREADS];
+    struct metrics m;
+
+    /*
+     * Counters of the calling thread, in the right buckets, with errno left
+     * alone
+     */
+    errno = EINTR;
+    metrics_sent();
+    metrics_sent();
+    metrics_reply(0);
+    metrics_reply(1500);
+    metrics_reply(1ULL << 50);
+    metrics_timeout();
+    metrics_error(ECONNREFUSED);
+    metrics_error(METRICS_ERRNOS + 7);
+    metrics_syscall(monotonic_ns());
+    CHECK(errno == EINTR);
+
+    metrics_snapshot(&m);
+    CHECK(m.sent == 2 && m.replies == 3 && m.timeouts == 1);
+    CHECK(m.errors[ECONNREFUSED] == 1 && m.errors[METRICS_ERRNOS - 1] == 1);
+    CHECK(m.rtt[0] == 1 && m.rtt[10] == 1 && m.rtt[METRICS_BUCKETS - 1] == 1);
+
+    for (i = 0, m.sent = 0; i < METRICS_BUCKETS; i++)
+    {
+        m.sent += m.syscalls[i];
+    }
+
+    CHECK(m.sent == 1);
+
+    /*
+     * Counters of threads that exited are kept, and SIGUSR1 prints them
+     * rather than killing the process
+     */
+    CHECK(!metrics_watch());
+
+    for (i = 0; i < THREADS; i++)
+    {
+        CHECK(!pthread_create(&threads[i], NULL, count, NULL));
+    }
+
+    for (i = 0; i < THREADS; i++)
+    {
+        CHECK(!pthread_join(threads[i], NULL));
+    }
+
+    CHECK(!kill(getpid(), SIGUSR1));
+    metrics_unwatch();
+
+    metrics_snapshot(&m);
+    CHECK(m.sent == 2 + THREADS * PROBES);
+    CHECK(m.replies == 3 + THREADS * PROBES);
+    CHECK(m.rtt[19] == THREADS * PROBES);
+
+    return 0;
+}
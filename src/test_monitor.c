@@ -0,0 +1,126 @@
+#include <arpa/inet.h>
+#include <stdlib.h>
+
+#include "monitor.h"
+#include "results.h"
+#include "test.h"
+
+/*
+ * Exercises the schedule of continuous scans.
+ */
+
+#define INTERVAL    1000
+
+/*
+ * Records the host at offset i of the scan (a single port) in state
+ */
+static void
+record(struct monitor *mon, struct scanner *sc, uint32_t i, uint8_t state)
+{
+    sc->target.sin_addr.s_addr = htonl(ntohl(sc->start) + i);
+    monitor_record(mon, sc, state);
+}
+
+/*
+ * Returns 1 if the target at offset i is skipped on the current round
+ */
+static int
+skipped(const struct monitor *mon, uint64_t i)
+{
+    return mon->skip[i / 64] >> i % 64 & 1;
+}
+
+int
+main(void)
+{
+    uint32_t i = 0;
+    uint64_t now = 5000, wake = 0;
+    struct scanner sc = {0};
+    struct monitor mon;
+
+    sc.scan_type = SCAN_TYPE_ICMP;
+    sc.start = htonl(0x0a000000);
+    sc.end = htonl(0x0a00000f);
+
+    CHECK(!monitor_init(&mon, &sc, INTERVAL));
+    CHECK(mon.count == 16);
+
+    /*
+     * Everything is due on the first round
+     */
+    CHECK(monitor_schedule(&mon, now, &wake) == 16);
+
+    for (i = 0; i < 16; i++)
+    {
+        CHECK(!skipped(&mon, i));
+        record(&mon, &sc, i, i == 3 ? RESULT_UP : RESULT_DOWN);
+    }
+
+    /*
+     * Targets outside the scan are ignored
+     */
+    sc.target.sin_addr.s_addr = htonl(0x0b000000);
+    monitor_record(&mon, &sc, RESULT_UP);
+
+    /*
+     * Up hosts come back after the interval, the others after twice that
+     */
+    CHECK(!monitor_schedule(&mon, now + INTERVAL - 1, &wake));
+    CHECK(wake == now + INTERVAL);
+
+    now += INTERVAL;
+    CHECK(monitor_schedule(&mon, now, &wake) == 1);
+
+    for (i = 0; i < 16; i++)
+    {
+        CHECK(skipped(&mon, i) == (i != 3));
+    }
+
+    /*
+     * A host that went down is checked again as soon as one that is up
+     */
+    record(&mon, &sc, 3, RESULT_DOWN);
+    CHECK(mon.due[3] == now + INTERVAL);
+
+    now += INTERVAL;
+    CHECK(monitor_schedule(&mon, now, &wake) == 16);
+
+    /*
+     * Hosts that keep not answering back off, up to a limit; a target that
+     * is never reported is put off as far as it goes
+     */
+    for (i = 0; i < 16; i++)
+    {
+        if (i == 3 || i == 7)
+        {
+            record(&mon, &sc, i, RESULT_DOWN);
+        }
+        else if (i != 9)
+        {
+            record(&mon, &sc, i, RESULT_ERROR);
+        }
+    }
+
+    CHECK(mon.due[3] == now + 2 * INTERVAL);
+    CHECK(mon.due[7] == now + 4 * INTERVAL);
+    CHECK(mon.due[9] == now + (INTERVAL << MONITOR_MAX_BACKOFF));
+
+    for (i = 0; i < 2 * MONITOR_MAX_BACKOFF; i++)
+    {
+        record(&mon, &sc, 7, RESULT_DOWN);
+    }
+
+    CHECK(mon.due[7] == now + (INTERVAL << MONITOR_MAX_BACKOFF));
+
+    /*
+     * Coming back up resets the backoff
+     */
+    record(&mon, &sc, 7, RESULT_UP);
+    CHECK(mon.due[7] == now + INTERVAL);
+    CHECK(monitor_schedule(&mon, now + INTERVAL, &wake) == 1);
+    CHECK(!skipped(&mon, 7));
+
+    monitor_free(&mon);
+
+    return 0;
+}
@@ -0,0 +1,244 @@
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "results.h"
+#include "scanner.h"
+#include "test.h"
+
+/*
+ * Exercises the structured output formats and the buffered sink.
+ */
+
+/*
+ * Enough records to fill several blocks
+ */
+#define RECORDS 50000
+
+/*
+ * Checks that format_ipv4 agrees with inet_ntop on addr
+ */
+static void
+check_ipv4(in_addr_t addr)
+{
+    char want[INET_ADDRSTRLEN] = {0}, got[INET_ADDRSTRLEN] = {0};
+    size_t len = format_ipv4(addr, got);
+
+    CHECK(inet_ntop(AF_INET, &addr, want, sizeof(want)));
+    CHECK(!strcmp(got, want));
+    CHECK(len == strlen(want));
+}
+
+/*
+ * Returns a temporary file, already unlinked, to write output to
+ */
+static int
+temp_fd(void)
+{
+    char path[] = "/tmp/test_output_XXXXXX";
+    int fd = mkstemp(path);
+
+    CHECK(fd != -1);
+    unlink(path);
+
+    return fd;
+}
+
+/*
+ * Reads the whole of fd into a buffer, storing its length in len
+ */
+static char *
+slurp(int fd, size_t *len)
+{
+    off_t size = lseek(fd, 0, SEEK_END);
+    char *buf = malloc((size_t) size + 1);
+
+    CHECK(size >= 0 && buf);
+    CHECK(pread(fd, buf, (size_t) size, 0) == size);
+    buf[size] = '\0';
+    *len = (size_t) size;
+
+    return buf;
+}
+
+int
+main(void)
+{
+    int fd = -1, i = 0;
+    size_t len = 0, lines = 0;
+    char buf[OUTPUT_RECORD_MAX + 1] = {0}, *data = NULL, *p = NULL;
+    struct output *out = NULL;
+    struct output_record rec = {0};
+    const struct output_header *header = NULL;
+    const struct output_record *recs = NULL;
+
+    CHECK(parse_output_format("jsonl") == OUTPUT_JSONL);
+    CHECK(parse_output_format("bin") == OUTPUT_BINARY);
+    CHECK(parse_output_format("xml") == -1);
+
+    check_ipv4(htonl(0x00000000));
+    check_ipv4(htonl(0xffffffff));
+    check_ipv4(htonl(0x0a00640a));
+    check_ipv4(htonl(0x01096309));
+
+    for (i = 0; i < 10000; i++)
+    {
+        check_ipv4((in_addr_t) rand() ^ (in_addr_t) rand() << 16);
+    }
+
+    /*
+     * Fields that weren't measured are left out
+     */
+    rec.time = 1700000000123456789ULL;
+    rec.addr = htonl(0x0a4e0005);
+    rec.port = 443;
+    rec.scan_type = SCAN_TYPE_CONNECT;
+    rec.state = RESULT_UP;
+    rec.port_state = PORT_OPEN;
+    rec.rtt = 1234567;
+
+    len = format_record(OUTPUT_JSONL, &rec, buf);
+    buf[len] = '\0';
+    CHECK(!strcmp(buf, "{\"addr\":\"10.78.0.5\",\"state\":\"up\","
+                       "\"port_state\":\"open\",\"scan\":\"connect\","
+                       "\"port\":443,"
+                       "\"rtt_us\":1234.567,\"time\":1700000000.123456}\n"));
+
+    len = format_record(OUTPUT_CSV, &rec, buf);
+    buf[len] = '\0';
+    CHECK(!strcmp(buf, "10.78.0.5,up,open,connect,443,1234.567,"
+                       "1700000000.123456,,,,\n"));
+
+    rec.port = 0;
+    rec.rtt = 0;
+    rec.scan_type = SCAN_TYPE_ARP;
+    rec.port_state = PORT_STATE_NONE;
+    rec.has_hwaddr = 1;
+    memcpy(rec.hwaddr, "\x02\x00\x5e\x10\xab\x0f", sizeof(rec.hwaddr));
+
+    len = format_record(OUTPUT_JSONL, &rec, buf);
+    buf[len] = '\0';
+    CHECK(!strcmp(buf, "{\"addr\":\"10.78.0.5\",\"state\":\"up\","
+                       "\"scan\":\"arp\",\"time\":1700000000.123456,"
+                       "\"hwaddr\":\"02:00:5e:10:ab:0f\"}\n"));
+
+    rec.has_hwaddr = 0;
+    rec.state = RESULT_ERROR;
+    rec.err = 113;
+    rec.time = 5000;
+
+    len = format_record(OUTPUT_CSV, &rec, buf);
+    buf[len] = '\0';
+    CHECK(!strcmp(buf, "10.78.0.5,error,,arp,,,0.000005,,113,,\n"));
+
+    /*
+     * Changes since an earlier scan carry the previous state
+     */
+    rec.state = RESULT_UP;
+    rec.err = 0;
+    rec.changed = 1;
+    rec.prev_state = RESULT_UNKNOWN;
+
+    len = format_record(OUTPUT_JSONL, &rec, buf);
+    buf[len] = '\0';
+    CHECK(!strcmp(buf, "{\"addr\":\"10.78.0.5\",\"state\":\"up\","
+                       "\"scan\":\"arp\",\"time\":0.000005,"
+                       "\"previous\":\"unknown\"}\n"));
+
+    rec.state = RESULT_DOWN;
+    rec.prev_state = RESULT_UP;
+
+    len = format_record(OUTPUT_CSV, &rec, buf);
+    buf[len] = '\0';
+    CHECK(!strcmp(buf, "10.78.0.5,down,,arp,,,0.000005,,,up,\n"));
+    rec.changed = 0;
+
+    /*
+     * Results of several interfaces are tagged with the interface's name, or
+     * its index once it is gone
+     */
+    rec.ifindex = if_nametoindex("lo");
+    CHECK(rec.ifindex);
+
+    len = format_record(OUTPUT_JSONL, &rec, buf);
+    buf[len] = '\0';
+    CHECK(!strcmp(buf, "{\"addr\":\"10.78.0.5\",\"state\":\"down\","
+                       "\"scan\":\"arp\",\"time\":0.000005,"
+                       "\"interface\":\"lo\"}\n"));
+
+    rec.ifindex = 999999;
+
+    len = format_record(OUTPUT_CSV, &rec, buf);
+    buf[len] = '\0';
+    CHECK(!strcmp(buf, "10.78.0.5,down,,arp,,,0.000005,,,,999999\n"));
+    rec.ifindex = 0;
+
+    /*
+     * A sink writes every record, in order, after its header
+     */
+    fd = temp_fd();
+    out = output_new(fd, OUTPUT_CSV);
+    CHECK(out);
+
+    rec.state = RESULT_DOWN;
+    rec.err = 0;
+
+    for (i = 0; i < RECORDS; i++)
+    {
+        rec.addr = htonl(0x0a000000 + (uint32_t) i);
+        CHECK(!output_write(out, &rec));
+    }
+
+    CHECK(!output_close(out));
+
+    data = slurp(fd, &len);
+    CHECK(!strncmp(data, "addr,state,port_state,scan,port,rtt_us,time,"
+                   "hwaddr,errno,previous,interface\n10.0.0.0,down,", 90));
+
+    for (p = data; (p = strchr(p, '\n')); p++)
+    {
+        lines++;
+    }
+
+    CHECK(lines == RECORDS + 1);
+    CHECK(strstr(data, "\n10.0.195.79,down,"));
+    free(data);
+    close(fd);
+
+    fd = temp_fd();
+    out = output_new(fd, OUTPUT_BINARY);
+    CHECK(out);
+
+    for (i = 0; i < RECORDS; i++)
+    {
+        rec.addr = (uint32_t) i;
+        CHECK(!output_write(out, &rec));
+    }
+
+    CHECK(!output_close(out));
+
+    data = slurp(fd, &len);
+    header = (const struct output_header *) data;
+    recs = (const struct output_record *) (data + sizeof(*header));
+    CHECK(len == sizeof(*header) + RECORDS * sizeof(rec));
+    CHECK(!memcmp(header->magic, OUTPUT_MAGIC, sizeof(header->magic)));
+    CHECK(header->byte_order == OUTPUT_BYTE_ORDER);
+    CHECK(header->record_size == sizeof(rec));
+    CHECK(recs[0].addr == 0 && recs[RECORDS - 1].addr == RECORDS - 1);
+    CHECK(recs[RECORDS - 1].state == RESULT_DOWN);
+    free(data);
+    close(fd);
+
+    /*
+     * A failed write is reported when the sink is closed
+     */
+    out = output_new(-1, OUTPUT_JSONL);
+    CHECK(out);
+    CHECK(!output_write(out, &rec));
+    CHECK(output_close(out) == -1);
+
+    return 0;
+}
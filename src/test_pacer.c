@@ -0,0 +1,136 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pacer.h"
+#include "test.h"
+#include "util.h"
+
+/*
+ * Exercises the token bucket that rate limits probes.
+ */
+
+/*
+ * Takes n tokens from a pacer at rate per second and checks that it took no
+ * less than the rate allows. Returns 1 if it took no more than 5% longer, or
+ * 0 otherwise.
+ */
+static int
+run_rate(uint64_t rate, uint64_t burst, uint64_t n)
+{
+    uint64_t i = 0, start = monotonic_ns(), elapsed = 0, least = 0;
+    struct pacer *pc = pacer_new(rate, burst);
+
+    CHECK(pc);
+
+    for (i = 0; i < n; i++)
+    {
+        pacer_wait(pc);
+    }
+
+    elapsed = monotonic_ns() - start;
+    least = (n - pc->burst) * 1000000000ULL / rate;
+    pacer_free(pc);
+
+    CHECK(elapsed >= least);
+
+    return elapsed <= least + least / 20;
+}
+
+/*
+ * Checks that a pacer holds to rate within 5% in one of three runs, so that a
+ * host stalling the test for a few milliseconds doesn't fail it
+ */
+static void
+check_rate(uint64_t rate, uint64_t burst, uint64_t n)
+{
+    CHECK(run_rate(rate, burst, n) || run_rate(rate, burst, n)
+          || run_rate(rate, burst, n));
+}
+
+int
+main(void)
+{
+    uint64_t i = 0, delay = 0;
+    struct timespec pause = {0, 100000000};
+    struct pacer *pc = NULL;
+
+    /*
+     * Out of range rates and bursts are refused
+     */
+    errno = 0;
+    CHECK(!pacer_new(0, 1) && errno == EINVAL);
+    CHECK(!pacer_new(PACER_MAX_RATE + 1, 1) && errno == EINVAL);
+    CHECK(!pacer_new(1000, PACER_MAX_BURST + 1) && errno == EINVAL);
+
+    /*
+     * The default burst is a millisecond's worth, and at least one
+     */
+    pc = pacer_new(1000000, 0);
+    CHECK(pc && pc->burst == 1000);
+    pacer_free(pc);
+
+    pc = pacer_new(10, 0);
+    CHECK(pc && pc->burst == 1);
+    pacer_free(pc);
+
+    /*
+     * A new pacer hands out a full burst at once and then makes the caller
+     * wait about one interval for the next token
+     */
+    pc = pacer_new(10, 5);
+    CHECK(pc);
+
+    for (i = 0; i < 5; i++)
+    {
+        CHECK(!pacer_take(pc));
+    }
+
+    delay = pacer_take(pc);
+    CHECK(delay > 90000000ULL && delay <= 100000000ULL);
+
+    /*
+     * A token given back can be taken again at once
+     */
+    pacer_refund(pc);
+    CHECK(!pacer_take(pc) && pacer_take(pc));
+    pacer_free(pc);
+
+    /*
+     * Tokens that accrue while no sender waits overflow the bucket, but a
+     * sender kept waiting catches up on the ones it missed
+     */
+    pc = pacer_new(100, 2);
+    CHECK(pc);
+    CHECK(!pacer_take(pc) && !pacer_take(pc));
+    nanosleep(&pause, NULL);
+
+    for (i = 0; !pacer_take(pc); i++)
+    {
+    }
+
+    CHECK(i >= 2 && i <= 3);
+    nanosleep(&pause, NULL);
+
+    for (i = 0; !pacer_take(pc); i++)
+    {
+    }
+
+    CHECK(i >= 6);
+    pacer_free(pc);
+
+    CHECK(pacer_sleep_time(PACER_SPIN_NS) == 0);
+    CHECK(pacer_sleep_time(3 * PACER_SPIN_NS) == 2 * PACER_SPIN_NS);
+
+    /*
+     * Pacing holds to the rate across the range it is meant for
+     */
+    check_rate(200, 1, 40);
+    check_rate(1000, 0, 200);
+    check_rate(1500, 0, 300);
+    check_rate(1999, 0, 400);
+    check_rate(20000, 1, 4000);
+    check_rate(1000000, 0, 200000);
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packets.h"
+#include "test.h"
+
+/*
+ * Exercises packet construction and the IP checksum.
+ */
+
+/*
+ * Length of the buffer the checksum implementations are checked on: past a
+ * block of their accumulators, and all 0xff at first so that any lane that
+ * could overflow does
+ */
+#define CHECKSUM_LEN    (300 * 1024)
+
+/*
+ * Checks that every implementation of ip_checksum this CPU runs gives the same
+ * checksum as the reference, at every alignment and over a range of lengths
+ * of random data
+ */
+static void
+check_checksum_impls(void)
+{
+    const struct checksum_impl *impls = NULL;
+    size_t count = checksum_impls(&impls), i = 0, j = 0, off = 0, len = 0;
+    unsigned char *buf = malloc(CHECKSUM_LEN + 64);
+    uint16_t expected = 0;
+
+    CHECK(buf && count >= 2);
+    memset(buf, 0xff, CHECKSUM_LEN + 64);
+
+    for (j = 0; j < count; j++)
+    {
+        CHECK(impls[j].sum(buf, CHECKSUM_LEN)
+              == impls[0].sum(buf, CHECKSUM_LEN));
+        CHECK(impls[j].sum(buf + 1, CHECKSUM_LEN - 1)
+              == impls[0].sum(buf + 1, CHECKSUM_LEN - 1));
+        CHECK(impls[j].sum(NULL, 0) == 0 && impls[j].sum(buf, 0) == 0);
+    }
+
+    srand(1);
+
+    for (i = 0; i < CHECKSUM_LEN + 64; i++)
+    {
+        buf[i] = (unsigned char) rand();
+    }
+
+    for (i = 0; i < 2000; i++)
+    {
+        off = (size_t) rand() % 64;
+        len = i < 600 ? i : (size_t) rand() % (i < 1900 ? 4096 : CHECKSUM_LEN);
+        expected = impls[0].sum(buf + off, len);
+
+        for (j = 1; j < count; j++)
+        {
+            CHECK(impls[j].sum(buf + off, len) == expected);
+        }
+
+        CHECK(ip_checksum(buf + off, len) == expected);
+    }
+
+    free(buf);
+}
+
+int
+main(void)
+{
+    unsigned char buf[64];
+    uint8_t hwaddr[6] = {0x02, 0x00, 0x5e, 0x10, 0x20, 0x30};
+    uint32_t spa = htonl(0xc0a80101), tpa = htonl(0xc0a80102);
+    size_t len = 0;
+    unsigned char pseudo[12 + sizeof(struct tcp_header)];
+    uint16_t tcp_len = htons(sizeof(struct tcp_header));
+    uint16_t old_word = 0, new_word = 0;
+    uint32_t i = 0, x = 0, y = 0;
+    struct arp_frame frame;
+    struct icmp_echo_template echo;
+    struct tcp_syn_template syn;
+    const unsigned char *raw = (const unsigned char *) &frame;
+
+    /*
+     * A datagram with its checksum filled in sums to zero, including when
+     * its length is odd and the byte after it is not zero
+     */
+    memset(buf, 0xff, sizeof(buf));
+    len = write_icmp_echo(buf, 0x1234, 0x5678, "A", 1);
+    CHECK(len == sizeof(struct icmp_echo_header) + 1);
+    CHECK(buf[0] == ICMP_TYPE_ECHO_REQUEST && buf[4] == 0x12
+          && buf[7] == 0x78);
+    CHECK(ip_checksum(buf, len) == 0);
+
+    /*
+     * RFC 1071 example: words 0001 f203 f4f5 f6f7 sum to ddf2
+     */
+    memcpy(buf, "\x00\x01\xf2\x03\xf4\xf5\xf6\xf7", 8);
+    CHECK(ntohs(ip_checksum(buf, 8)) == (uint16_t) ~0xddf2);
+
+    /*
+     * ARP request matches the wire layout byte for byte
+     */
+    CHECK(sizeof(frame) == 42);
+    build_arp_request(&frame, hwaddr, spa, tpa);
+    CHECK(!memcmp(raw, "\xff\xff\xff\xff\xff\xff", 6));
+    CHECK(!memcmp(raw + 6, hwaddr, 6));
+    CHECK(!memcmp(raw + 12, "\x08\x06\x00\x01\x08\x00\x06\x04\x00\x01", 10));
+    CHECK(!memcmp(raw + 22, hwaddr, 6));
+    CHECK(!memcmp(raw + 28, "\xc0\xa8\x01\x01", 4));
+    CHECK(!memcmp(raw + 32, "\x00\x00\x00\x00\x00\x00", 6));
+    CHECK(!memcmp(raw + 38, "\xc0\xa8\x01\x02", 4));
+
+    /*
+     * Both checksums of a SYN verify, and the fields land where they belong
+     */
+    CHECK(build_tcp_syn(buf, spa, tpa, 61000, 22, 0xdeadbeef) == TCP_SYN_LEN);
+    CHECK(TCP_SYN_LEN == 40);
+    CHECK(buf[0] == 0x45 && buf[9] == IPPROTO_TCP);
+    CHECK(ip_checksum(buf, 20) == 0);
+    CHECK(!memcmp(buf + 20, "\xee\x48\x00\x16\xde\xad\xbe\xef", 8));
+    CHECK(buf[33] == TCP_FLAG_SYN);
+
+    memset(pseudo, 0, sizeof(pseudo));
+    memcpy(pseudo, &spa, 4);
+    memcpy(pseudo + 4, &tpa, 4);
+    pseudo[9] = IPPROTO_TCP;
+    memcpy(pseudo + 10, &tcp_len, 2);
+    memcpy(pseudo + 12, buf + 20, sizeof(struct tcp_header));
+    CHECK(ip_checksum(pseudo, sizeof(pseudo)) == 0);
+
+    /*
+     * RFC 1624 example: changing a word from 5555 to 3285 under a checksum
+     * of dd2f gives 0000, not ffff
+     */
+    old_word = htons(0x5555);
+    new_word = htons(0x3285);
+    CHECK(checksum_adjust(htons(0xdd2f), &old_word, &new_word, 2) == 0);
+
+    /*
+     * Stamped templates match datagrams built from scratch, however many
+     * times they are stamped
+     */
+    CHECK(icmp_echo_template(&echo, NULL, 1) && errno == EINVAL);
+    CHECK(icmp_echo_template(&echo, "A", ICMP_TEMPLATE_DLEN + 1)
+          && errno == EINVAL);
+    CHECK(!icmp_echo_template(&echo, "A", 1));
+    tcp_syn_template(&syn, spa, 61000);
+    CHECK(sizeof(syn) == TCP_SYN_LEN);
+
+    for (i = 0; i < 100000; i++)
+    {
+        x = i * 2654435761U;
+        y = x ^ (x >> 13) ^ 0xffff0000U;
+
+        icmp_echo_stamp(&echo, (uint16_t) (x >> 16), (uint16_t) y);
+        len = write_icmp_echo(buf, (uint16_t) (x >> 16), (uint16_t) y, "A",
+                              1);
+        CHECK(echo.len == len && !memcmp(&echo.header, buf, len));
+
+        tcp_syn_stamp(&syn, x, (uint16_t) y, y);
+        build_tcp_syn(buf, spa, x, 61000, (uint16_t) y, y);
+        CHECK(!memcmp(&syn, buf, TCP_SYN_LEN));
+    }
+
+    check_checksum_impls();
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "permute.h"
+#include "test.h"
+
+/*
+ * Exercises the pseudo-random permutation used to randomize target order.
+ */
+
+/*
+ * Checks that the permutation of [0, n) from seed hits every element exactly
+ * once, and returns the number of elements left in place.
+ */
+static uint64_t
+check_bijection(uint64_t n, uint64_t seed)
+{
+    uint64_t i = 0, x = 0, fixed = 0;
+    uint8_t *seen = calloc(n, 1);
+    struct permutation perm;
+
+    CHECK(seen);
+
+    permutation_init(&perm, n, seed);
+
+    for (i = 0; i < n; i++)
+    {
+        x = permutation_apply(&perm, i);
+        CHECK(x < n);
+        CHECK(!seen[x]);
+        seen[x] = 1;
+        fixed += x == i;
+    }
+
+    free(seen);
+
+    return fixed;
+}
+
+int
+main(void)
+{
+    uint64_t i = 0, same = 0;
+    const uint64_t sizes[] = {1, 2, 3, 4, 5, 255, 256, 257, 1000, 65536,
+                              65543, 1 << 20};
+    struct permutation a, b;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+    {
+        check_bijection(sizes[i], 1);
+        check_bijection(sizes[i], 0xdeadbeefcafef00dULL);
+    }
+
+    /*
+     * A large range is actually shuffled
+     */
+    CHECK(check_bijection(1 << 20, 42) < 64);
+
+    /*
+     * The same seed gives the same order, and different seeds give different
+     * orders
+     */
+    permutation_init(&a, 1 << 24, 7);
+    permutation_init(&b, 1 << 24, 7);
+
+    for (i = 0; i < 1000; i++)
+    {
+        CHECK(permutation_apply(&a, i) == permutation_apply(&b, i));
+    }
+
+    permutation_init(&b, 1 << 24, 8);
+
+    for (i = 0; i < 1000; i++)
+    {
+        same += permutation_apply(&a, i) == permutation_apply(&b, i);
+    }
+
+    CHECK(same < 10);
+
+    /*
+     * Ranges as large as a full /0 scanned on every port stay within bounds
+     */
+    permutation_init(&a, 65535ULL << 32, 3);
+
+    for (i = 0; i < 1000; i++)
+    {
+        CHECK(permutation_apply(&a, i) < 65535ULL << 32);
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include "ports.h"
+#include "test.h"
+
+/*
+ * Exercises parsing of port lists and ranges.
+ */
+
+/*
+ * Checks that spec is rejected
+ */
+static void
+check_invalid(const char *spec)
+{
+    uint16_t *ports = NULL;
+    uint32_t nports = 0;
+
+    errno = 0;
+    CHECK(parse_ports(spec, &ports, &nports) == -1 && errno == EINVAL);
+}
+
+int
+main(void)
+{
+    uint16_t *ports = NULL;
+    uint32_t nports = 0, i = 0;
+
+    CHECK(!parse_ports("443,22,80,8000-8100,80,8050", &ports, &nports));
+    CHECK(nports == 104);
+    CHECK(ports[0] == 22 && ports[1] == 80 && ports[2] == 443);
+
+    for (i = 3; i < nports; i++)
+    {
+        CHECK(ports[i] == 8000 + i - 3);
+    }
+
+    free(ports);
+
+    CHECK(!parse_ports("1-65535", &ports, &nports));
+    CHECK(nports == 65535 && ports[0] == 1 && ports[65534] == 65535);
+    free(ports);
+
+    CHECK(!parse_ports("7", &ports, &nports));
+    CHECK(nports == 1 && ports[0] == 7);
+    free(ports);
+
+    check_invalid("");
+    check_invalid("0");
+    check_invalid("65536");
+    check_invalid("22,");
+    check_invalid(",22");
+    check_invalid("22,,80");
+    check_invalid("80-22");
+    check_invalid("22-");
+    check_invalid("-22");
+    check_invalid("+22");
+    check_invalid(" 22");
+    check_invalid("22x");
+    check_invalid("22-80-90");
+
+    return 0;
+}
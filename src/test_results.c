@@ -0,0 +1,183 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "results.h"
+#include "test.h"
+
+/*
+ * Exercises the bitmap result store and its file format.
+ */
+
+/*
+ * 10.0.0.0, in host byte order
+ */
+#define BASE    0x0a000000U
+
+int
+main(void)
+{
+    uint64_t i = 0, n = 0;
+    char path[] = "/tmp/test_results_XXXXXX";
+    int fd = -1;
+    FILE *fp = NULL;
+    struct result_map map = {0}, loaded = {0}, next = {0}, other = {0};
+    struct result_map empty = {0};
+
+    CHECK(result_map_init(&map, BASE + 1, BASE) == -1 && errno == EINVAL);
+
+    /*
+     * 70 addresses, so that the last word is partly used
+     */
+    CHECK(!result_map_init(&map, BASE, BASE + 69));
+    CHECK(map.count == 70);
+    CHECK(result_map_count(&map, RESULT_UNKNOWN) == 70);
+    CHECK(!result_map_count(&map, RESULT_UP));
+
+    /*
+     * The first state sticks, except that up overrides the others; addresses
+     * outside the map are ignored
+     */
+    result_map_set(&map, BASE + 3, RESULT_DOWN);
+    result_map_set(&map, BASE + 3, RESULT_ERROR);
+    CHECK(result_map_get(&map, BASE + 3) == RESULT_DOWN);
+    result_map_set(&map, BASE + 3, RESULT_UP);
+    result_map_set(&map, BASE + 3, RESULT_DOWN);
+    CHECK(result_map_get(&map, BASE + 3) == RESULT_UP);
+
+    result_map_set(&map, BASE + 31, RESULT_ERROR);
+    result_map_set(&map, BASE + 32, RESULT_UP);
+    result_map_set(&map, BASE + 69, RESULT_UP);
+    result_map_set(&map, BASE + 70, RESULT_UP);
+    result_map_set(&map, BASE - 1, RESULT_UP);
+    CHECK(result_map_get(&map, BASE + 70) == RESULT_UNKNOWN);
+    CHECK(result_map_get(&map, BASE + 31) == RESULT_ERROR);
+
+    for (i = 40; i < 50; i++)
+    {
+        result_map_set(&map, BASE + (uint32_t) i, RESULT_DOWN);
+    }
+
+    CHECK(result_map_count(&map, RESULT_UP) == 3);
+    CHECK(result_map_count(&map, RESULT_DOWN) == 10);
+    CHECK(result_map_count(&map, RESULT_ERROR) == 1);
+    CHECK(result_map_count(&map, RESULT_UNKNOWN) == 56);
+
+    /*
+     * Iterating over up hosts visits them in order, across words
+     */
+    i = 0;
+    CHECK(result_map_next(&map, RESULT_UP, &i) && i == 3);
+    i++;
+    CHECK(result_map_next(&map, RESULT_UP, &i) && i == 32);
+    i++;
+    CHECK(result_map_next(&map, RESULT_UP, &i) && i == 69);
+    i++;
+    CHECK(!result_map_next(&map, RESULT_UP, &i));
+
+    for (i = 0, n = 0; result_map_next(&map, RESULT_UNKNOWN, &i); i++)
+    {
+        CHECK(i < map.count);
+        n++;
+    }
+
+    CHECK(n == 56);
+
+    /*
+     * A saved map loads back as it was
+     */
+    fd = mkstemp(path);
+    CHECK(fd != -1);
+    close(fd);
+
+    CHECK(!result_map_save(&map, path));
+    CHECK(!result_map_load(&loaded, path));
+    CHECK(loaded.first == BASE && loaded.count == 70);
+    CHECK(!memcmp(loaded.words, map.words, 3 * sizeof(*map.words)));
+    CHECK(result_map_count(&loaded, RESULT_UP) == 3);
+    CHECK(result_map_get(&loaded, BASE + 45) == RESULT_DOWN);
+    result_map_free(&loaded);
+
+    /*
+     * A later scan that didn't get to every host carries the earlier state of
+     * the rest over, and its changes can be walked
+     */
+    CHECK(!result_map_init(&next, BASE, BASE + 69));
+    result_map_set(&next, BASE + 3, RESULT_DOWN);
+    result_map_set(&next, BASE + 32, RESULT_UP);
+    result_map_set(&next, BASE + 40, RESULT_ERROR);
+    result_map_set(&next, BASE + 68, RESULT_UP);
+    result_map_merge(&next, &map);
+
+    CHECK(result_map_get(&next, BASE + 3) == RESULT_DOWN);
+    CHECK(result_map_get(&next, BASE + 31) == RESULT_ERROR);
+    CHECK(result_map_get(&next, BASE + 69) == RESULT_UP);
+    CHECK(result_map_get(&next, BASE + 41) == RESULT_DOWN);
+    CHECK(result_map_count(&next, RESULT_UNKNOWN) == 55);
+
+    i = 0;
+    CHECK(result_map_next_change(&next, &map, &i) && i == 3);
+    i++;
+    CHECK(result_map_next_change(&next, &map, &i) && i == 40);
+    i++;
+    CHECK(result_map_next_change(&next, &map, &i) && i == 68);
+    i++;
+    CHECK(!result_map_next_change(&next, &map, &i));
+
+    /*
+     * Maps that don't line up are compared address by address
+     */
+    CHECK(!result_map_init(&other, BASE + 1, BASE + 40));
+    result_map_merge(&other, &map);
+    CHECK(result_map_get(&other, BASE + 3) == RESULT_UP);
+    CHECK(result_map_get(&other, BASE + 40) == RESULT_DOWN);
+    result_map_set(&other, BASE + 5, RESULT_UP);
+
+    i = 0;
+    CHECK(result_map_next_change(&other, &map, &i) && i == 4);
+    i++;
+    CHECK(!result_map_next_change(&other, &map, &i));
+
+    /*
+     * Against nothing, every known host is a change
+     */
+    for (i = 0, n = 0; result_map_next_change(&next, &empty, &i); i++)
+    {
+        n++;
+    }
+
+    CHECK(n == 15);
+
+    /*
+     * A file of the same range is updated in place; any other is replaced
+     */
+    CHECK(!result_map_update(&next, path));
+    CHECK(!result_map_load(&loaded, path));
+    CHECK(!memcmp(loaded.words, next.words, 3 * sizeof(*next.words)));
+    result_map_free(&loaded);
+
+    CHECK(!result_map_update(&other, path));
+    CHECK(!result_map_load(&loaded, path));
+    CHECK(loaded.first == BASE + 1 && loaded.count == 40);
+    CHECK(result_map_get(&loaded, BASE + 5) == RESULT_UP);
+    result_map_free(&loaded);
+
+    result_map_free(&other);
+    result_map_free(&next);
+
+    /*
+     * Anything else is refused
+     */
+    fp = fopen(path, "w");
+    CHECK(fp);
+    fprintf(fp, "not a result map, but long enough to hold a header......\n");
+    fclose(fp);
+    CHECK(result_map_load(&loaded, path) == -1 && errno == EINVAL);
+
+    unlink(path);
+    result_map_free(&map);
+
+    return 0;
+}
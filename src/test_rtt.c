@@ -0,0 +1,83 @@
+#include <stdlib.h>
+
+#include "rtt.h"
+#include "test.h"
+
+/*
+ * Exercises the round-trip time estimator behind adaptive timeouts.
+ */
+
+#define MS  1000000ULL
+
+int
+main(void)
+{
+    int i = 0;
+    struct rtt_estimator rtt;
+
+    /*
+     * The timeout starts at the bound and follows the first sample
+     */
+    rtt_init(&rtt, 1000 * MS, 1);
+    CHECK(rtt.timeout == 1000 * MS);
+
+    rtt_sample(&rtt, 10 * MS);
+    CHECK(rtt.srtt == 10 * MS);
+    CHECK(rtt.rttvar == 5 * MS);
+    CHECK(rtt.timeout == 30 * MS);
+
+    /*
+     * Steady round-trip times shrink the deviation term toward the floor
+     */
+    for (i = 0; i < 100; i++)
+    {
+        rtt_sample(&rtt, 10 * MS);
+    }
+
+    CHECK(rtt.srtt == 10 * MS);
+    CHECK(rtt.timeout >= 10 * MS + RTT_GRANULARITY_NS);
+    CHECK(rtt.timeout < 11 * MS);
+
+    /*
+     * A slower path raises the timeout, which stays within the bound
+     */
+    for (i = 0; i < 100; i++)
+    {
+        rtt_sample(&rtt, 400 * MS);
+    }
+
+    CHECK(rtt.timeout > 400 * MS);
+    CHECK(rtt.timeout <= 1000 * MS);
+
+    for (i = 0; i < 10; i++)
+    {
+        rtt_sample(&rtt, 5000 * MS);
+    }
+
+    CHECK(rtt.timeout == 1000 * MS);
+
+    /*
+     * Tiny round-trip times are held up by the floor
+     */
+    rtt_init(&rtt, 1000 * MS, 1);
+
+    for (i = 0; i < 100; i++)
+    {
+        rtt_sample(&rtt, 1000);
+    }
+
+    CHECK(rtt.timeout == RTT_MIN_TIMEOUT_NS);
+
+    /*
+     * A fixed timeout ignores samples, and a bound below the floor wins
+     */
+    rtt_init(&rtt, 200 * MS, 0);
+    rtt_sample(&rtt, 1 * MS);
+    CHECK(rtt.timeout == 200 * MS);
+
+    rtt_init(&rtt, RTT_MIN_TIMEOUT_NS / 2, 1);
+    rtt_sample(&rtt, 1000);
+    CHECK(rtt.timeout == RTT_MIN_TIMEOUT_NS / 2);
+
+    return 0;
+}
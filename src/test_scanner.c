@@ -0,0 +1,161 @@
+#include <arpa/inet.h>
+#include <stdlib.h>
+
+#include "scanner.h"
+#include "test.h"
+
+/*
+ * Exercises the target walk shared by run_scan and the concurrent engines.
+ */
+
+/*
+ * Walks sc from the start of its range and checks that it hands out every
+ * address from first to last (host byte order) exactly once, in order.
+ */
+static void
+check_walk(struct scanner *sc, uint32_t first, uint32_t last)
+{
+    uint64_t count = 0;
+    in_addr_t addr = 0;
+    in_port_t port = 0;
+
+    sc->start = htonl(first);
+    sc->end = htonl(last);
+    sc->next = 0;
+
+    while (next_target(sc, &addr, &port))
+    {
+        CHECK(ntohl(addr) == first + count);
+        CHECK(ntohs(port) == sc->port);
+        count++;
+    }
+
+    CHECK(count == (uint64_t) last - first + 1);
+
+    /*
+     * Stays exhausted
+     */
+    CHECK(!next_target(sc, &addr, &port));
+}
+
+/*
+ * Walks a /29 on three ports and checks that hosts are interleaved on each
+ * port in turn and that the local and broadcast addresses are only handed
+ * out with the first port.
+ */
+static void
+check_port_walk(void)
+{
+    uint16_t ports[] = {22, 80, 443};
+    uint32_t i = 0, host = 0, seen = 0;
+    in_addr_t addr = 0;
+    in_port_t port = 0;
+    struct sockaddr_in bcast = {0};
+    struct device dev = {{0}};
+    struct scanner sc = {0};
+
+    dev.local.sin_addr.s_addr = htonl(0x0a000001);
+    bcast.sin_addr.s_addr = htonl(0x0a000007);
+    dev.bcast = &bcast;
+
+    sc.dev = &dev;
+    sc.scan_type = SCAN_TYPE_CONNECT;
+    sc.ports = ports;
+    sc.nports = 3;
+    sc.start = htonl(0x0a000000);
+    sc.end = htonl(0x0a000007);
+
+    CHECK(port_count(&sc) == 3);
+    CHECK(target_count(&sc) == 24);
+
+    for (i = 0; i < 3; i++)
+    {
+        for (host = 0; host < 8; host++)
+        {
+            if (i && (host == 1 || host == 7))
+            {
+                continue;
+            }
+
+            CHECK(next_target(&sc, &addr, &port));
+            CHECK(ntohl(addr) == 0x0a000000 + host);
+            CHECK(ntohs(port) == ports[i]);
+            seen++;
+        }
+    }
+
+    CHECK(seen == 20);
+    CHECK(!next_target(&sc, &addr, &port));
+
+    /*
+     * Scan types without ports ignore the list
+     */
+    sc.scan_type = SCAN_TYPE_ICMP;
+    sc.next = 0;
+
+    CHECK(port_count(&sc) == 1);
+    CHECK(target_count(&sc) == 8);
+}
+
+/*
+ * Walks a /20 in random order and checks that every address is handed out
+ * exactly once, and that the order is reproducible from the seed.
+ */
+static void
+check_random_walk(void)
+{
+    uint32_t i = 0, in_order = 0;
+    in_addr_t addr = 0, first = 0;
+    in_port_t port = 0;
+    uint8_t seen[4096] = {0};
+    struct scanner sc = {0};
+
+    sc.start = htonl(0x0a000000);
+    sc.end = htonl(0x0a000fff);
+    sc.randomize = 1;
+    sc.seed = 1234;
+    permutation_init(&sc.order, target_count(&sc), sc.seed);
+
+    for (i = 0; i < 4096; i++)
+    {
+        CHECK(next_target(&sc, &addr, &port));
+        CHECK(ntohl(addr) - 0x0a000000 < 4096);
+        CHECK(!seen[ntohl(addr) - 0x0a000000]);
+        seen[ntohl(addr) - 0x0a000000] = 1;
+        in_order += ntohl(addr) == 0x0a000000 + i;
+
+        if (!i)
+        {
+            first = addr;
+        }
+    }
+
+    CHECK(!next_target(&sc, &addr, &port));
+    CHECK(in_order < 16);
+
+    sc.next = 0;
+    CHECK(next_target(&sc, &addr, &port) && addr == first);
+}
+
+int
+main(void)
+{
+    struct scanner sc = {0};
+
+    check_walk(&sc, 0xc0a80100, 0xc0a801ff);
+    check_walk(&sc, 0x0a000001, 0x0a000001);
+
+    /*
+     * A range ending at 255.255.255.255 must not wrap around
+     */
+    check_walk(&sc, 0xffffff00, 0xffffffff);
+    check_walk(&sc, 0xffffffff, 0xffffffff);
+
+    sc.port = 8080;
+    check_walk(&sc, 0x0a000000, 0x0a0000ff);
+
+    check_port_walk();
+    check_random_walk();
+
+    return 0;
+}
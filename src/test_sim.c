@@ -0,0 +1,295 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scanner.h"
+#include "sim.h"
+#include "test.h"
+
+/*
+ * Exercises the simulated network and scans of it in virtual time.
+ */
+
+/*
+ * The simulated subnet: 10.9.0.0/16, scanned from 10.9.0.1 (at offset LOCAL)
+ */
+#define FIRST   0x0a090000U
+#define HOSTS   65536U
+#define LOCAL   1
+
+/*
+ * Hosts reported up (a bit per offset in the subnet) and the number of probes
+ * reported in each port state, split by callback
+ */
+static uint64_t up_map[HOSTS / 64];
+static uint64_t up_states[PORT_FILTERED + 1];
+static uint64_t down_states[PORT_FILTERED + 1];
+static uint64_t max_rtt;
+
+static void
+record_up(struct scanner *sc)
+{
+    uint32_t i = ntohl(sc->target.sin_addr.s_addr) - FIRST;
+
+    up_map[i / 64] |= 1ULL << i % 64;
+    up_states[sc->port_state]++;
+
+    if (sc->rtt > max_rtt)
+    {
+        max_rtt = sc->rtt;
+    }
+}
+
+static void
+record_down(struct scanner *sc)
+{
+    down_states[sc->port_state]++;
+}
+
+/*
+ * Returns a scanner of the simulated network described by the directives, of
+ * the given scan type, with a timeout of 200 ms
+ */
+static struct scanner *
+new_scanner(const char **directives, uint8_t scan_type)
+{
+    struct timeval timeout = {0, 200000};
+    struct sim_spec *spec = sim_new();
+    struct scanner *sc = NULL;
+
+    CHECK(spec);
+
+    for (; *directives; directives++)
+    {
+        CHECK(!sim_configure(spec, *directives));
+    }
+
+    CHECK(!sim_finish(spec));
+
+    sc = init_device_scanner(scan_type, sim_device(spec), &timeout, 80);
+    CHECK(sc);
+    sc->sim = spec;
+    sc->max_inflight = 4096;
+
+    return sc;
+}
+
+/*
+ * Runs a scan of sc, starting from clean records
+ */
+static void
+scan(struct scanner *sc)
+{
+    memset(up_map, 0, sizeof(up_map));
+    memset(up_states, 0, sizeof(up_states));
+    memset(down_states, 0, sizeof(down_states));
+    max_rtt = 0;
+
+    CHECK(!run_scan(sc, record_up, record_down, NULL));
+}
+
+/*
+ * Returns the number of hosts in the subnet that are up in the spec, counting
+ * the local and broadcast addresses, which are always reported up
+ */
+static uint64_t
+count_up(const struct sim_spec *spec)
+{
+    uint64_t i = 0, count = 2;
+
+    for (i = 0; i < HOSTS - 1; i++)
+    {
+        count += i != LOCAL && sim_host_up(spec, FIRST + (uint32_t) i);
+    }
+
+    return count;
+}
+
+/*
+ * Checks that malformed specs are turned down
+ */
+static void
+check_parse(void)
+{
+    struct sim_spec *spec = sim_new();
+
+    CHECK(spec);
+    CHECK(!sim_configure(spec, " \t\n"));
+    CHECK(!sim_configure(spec, "loss 0.25%"));
+    CHECK(spec->loss == 2500);
+    CHECK(!sim_configure(spec, "unreachable 100"));
+    CHECK(spec->unreachable == SIM_SHARE_ALL);
+
+    CHECK(sim_configure(spec, "loss 100.5%") && errno == EINVAL);
+    CHECK(sim_configure(spec, "loss 0.00001%") && errno == EINVAL);
+    CHECK(sim_configure(spec, "warp 9") && errno == EINVAL);
+    CHECK(sim_configure(spec, "local 10.0.0.1") && errno == EINVAL);
+    CHECK(sim_configure(spec, "local 10.0.0.1/33") && errno == EINVAL);
+    CHECK(sim_configure(spec, "rtt 5-1") && errno == EINVAL);
+    CHECK(sim_configure(spec, "up 10.0.0.0/8 5% more") && errno == EINVAL);
+    CHECK(sim_configure(spec, "open 0") && errno == EINVAL);
+
+    /*
+     * local is required
+     */
+    CHECK(sim_finish(spec) && errno == EINVAL);
+    CHECK(!sim_configure(spec, "local 10.0.0.1/8"));
+    CHECK(!sim_finish(spec));
+    CHECK(spec->netmask == 0xff000000U);
+    CHECK(spec->nrtt == 1 && spec->rtt_total == SIM_SHARE_ALL);
+
+    sim_free(spec);
+}
+
+/*
+ * Checks that an ICMP scan finds exactly the hosts that are up, on round
+ * trips from the spec, and how long it takes on the virtual clock
+ */
+static void
+check_sweep(void)
+{
+    const char *directives[] = {
+        "local 10.9.0.1/16",
+        "up 10.9.0.0/16 10%",
+        "rtt 1000-2000 90%",
+        "rtt 50000-100000 10%",
+        "seed 7",
+        NULL
+    };
+    uint64_t up = 0;
+    struct scanner *sc = new_scanner(directives, SCAN_TYPE_ICMP);
+
+    up = count_up(sc->sim);
+    CHECK(up > HOSTS / 20 && up < HOSTS / 5);
+
+    scan(sc);
+    CHECK(up_states[PORT_STATE_NONE] == up);
+    CHECK(down_states[PORT_STATE_NONE] == HOSTS - up);
+    CHECK(max_rtt >= 50000000ULL && max_rtt <= 100000000ULL);
+
+    /*
+     * Probes of down hosts hold their place in the window for the whole
+     * timeout, which is what bounds the pace of the scan
+     */
+    CHECK(sc->stats.sim_ns >= (HOSTS - up) * 200000000ULL / 4096);
+    CHECK(sc->stats.sim_ns < (HOSTS - up) * 200000000ULL / 4096
+                             + 400000000ULL);
+
+    free_scanner(sc);
+}
+
+/*
+ * Checks that retries make up for lost probes, and that the same scan of the
+ * same spec gives the same results every time
+ */
+static void
+check_loss(void)
+{
+    const char *directives[] = {
+        "local 10.9.0.1/16",
+        "up 10.9.0.0/16 10%",
+        "loss 30%",
+        "seed 11",
+        NULL
+    };
+    uint64_t up = 0, first[HOSTS / 64];
+    struct scanner *sc = new_scanner(directives, SCAN_TYPE_ICMP);
+
+    up = count_up(sc->sim);
+
+    scan(sc);
+    CHECK(up_states[PORT_STATE_NONE] < up);
+    CHECK(up_states[PORT_STATE_NONE] > up / 2);
+
+    sc->retries = 12;
+    sc->randomize = 1;
+    sc->seed = 3;
+    scan(sc);
+    CHECK(up_states[PORT_STATE_NONE] == up);
+    memcpy(first, up_map, sizeof(first));
+
+    sc->threads = 4;
+    sc->serialize_callbacks = 1;
+    scan(sc);
+    CHECK(up_states[PORT_STATE_NONE] == up);
+    CHECK(!memcmp(first, up_map, sizeof(first)));
+
+    free_scanner(sc);
+}
+
+/*
+ * Checks that a SYN scan of several ports sees open, closed and filtered
+ * ports as the spec has them, and unreachable hosts as filtered
+ */
+static void
+check_ports(void)
+{
+    const char *directives[] = {
+        "local 10.9.0.1/16",
+        "up 10.9.0.0/16 5%",
+        "open 22,80 50%",
+        "filtered 50%",
+        "unreachable 100%",
+        NULL
+    };
+    uint16_t ports[] = {22, 80, 443};
+    uint64_t i = 0, j = 0, open = 0, closed = 0, filtered = 0, down = 0;
+    uint32_t addr = 0;
+    struct scanner *sc = new_scanner(directives, SCAN_TYPE_SYN);
+
+    sc->ports = malloc(sizeof(ports));
+    CHECK(sc->ports);
+    memcpy(sc->ports, ports, sizeof(ports));
+    sc->nports = 3;
+
+    for (i = 0; i < HOSTS - 1; i++)
+    {
+        addr = FIRST + (uint32_t) i;
+
+        if (i == LOCAL)
+        {
+            continue;
+        }
+
+        for (j = 0; j < 3; j++)
+        {
+            if (!sim_host_up(sc->sim, addr))
+            {
+                down++;
+            }
+            else if (sim_port_open(sc->sim, addr, ports[j]))
+            {
+                open++;
+            }
+            else if (sim_port_filtered(sc->sim, addr, ports[j]))
+            {
+                filtered++;
+            }
+            else
+            {
+                closed++;
+            }
+        }
+    }
+
+    CHECK(open && closed && filtered);
+
+    scan(sc);
+    CHECK(up_states[PORT_OPEN] == open);
+    CHECK(up_states[PORT_CLOSED] == closed);
+    CHECK(down_states[PORT_FILTERED] == filtered + down);
+
+    free_scanner(sc);
+}
+
+int
+main(void)
+{
+    check_parse();
+    check_sweep();
+    check_loss();
+    check_ports();
+
+    return 0;
+}
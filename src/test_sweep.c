@@ -0,0 +1,419 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scanner.h"
+#include "sim.h"
+#include "sweep.h"
+#include "test.h"
+
+/*
+ * Exercises the batched sending of run_sweep with a method that sends
+ * nothing: it answers every probe it accepts, on a clock of its own, and
+ * turns probes down the way a busy or picky socket would.
+ */
+
+/*
+ * The swept subnet: 10.9.0.0/22, scanned from 10.9.0.1
+ */
+#define FIRST       0x0a090000U
+#define HOSTS       1024U
+
+/*
+ * Most probes a batch send accepts, and the targets (by offset) it fails
+ * with EHOSTUNREACH
+ */
+#define PARTIAL     5
+#define UNREACHABLE 13
+
+/*
+ * Timeout of the probes, in seconds
+ */
+#define TIMEOUT     1
+
+/*
+ * Ports probed on each host of 10.9.0.0/29 by the port sweep, and the most
+ * probes of a host it keeps outstanding
+ */
+#define PORTS       8
+#define PER_HOST    2
+
+/*
+ * Probes accepted and not yet answered, the fake clock, the calls to send and
+ * send_batch, and the largest batch seen
+ */
+static struct sweep_probe answers[HOSTS];
+static uint32_t answered, accepted;
+static uint64_t clock_ns;
+static uint64_t sends, batch_calls;
+static uint32_t largest;
+
+/*
+ * Number of times the method was opened
+ */
+static unsigned int opens;
+
+/*
+ * Whether every reply comes twice, and whether the replies to the first
+ * probes are held up until after they time out (and have been)
+ */
+static int duplicates, late, stalled;
+static int repeat;
+
+/*
+ * Number of times each target was reported, and how
+ */
+static uint32_t reports[HOSTS];
+static uint64_t ups, downs, errors;
+
+static int
+fake_open(struct sweep *sw)
+{
+    answered = accepted = 0;
+    clock_ns = 0;
+    stalled = repeat = 0;
+    sends = batch_calls = 0;
+    largest = 0;
+    opens++;
+    sw->fd = -1;
+
+    return 0;
+}
+
+/*
+ * Accepts a probe unless its target is unreachable
+ */
+static int
+accept_probe(in_addr_t addr, in_port_t port)
+{
+    if ((ntohl(addr) - FIRST) % UNREACHABLE == 0)
+    {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    answers[accepted % HOSTS].addr = addr;
+    answers[accepted++ % HOSTS].port = port;
+
+    return 0;
+}
+
+/*
+ * Checks that sending the first count probes leaves no host with more probes
+ * outstanding than the scanner allows
+ */
+static void
+check_per_host(struct sweep *sw, const struct sweep_probe *probes,
+               uint32_t count)
+{
+    uint32_t i = 0, j = 0, load = 0;
+
+    for (i = 0; sw->sc->max_per_host && i < count; i++)
+    {
+        load = inflight_host_load(&sw->tbl, probes[i].addr);
+
+        for (j = 0; j < count; j++)
+        {
+            load += probes[j].addr == probes[i].addr;
+        }
+
+        CHECK(load <= sw->sc->max_per_host);
+    }
+}
+
+static int
+fake_send(struct sweep *sw, in_addr_t addr, in_port_t port)
+{
+    struct sweep_probe probe = {addr, port};
+
+    sends++;
+    check_per_host(sw, &probe, 1);
+
+    return accept_probe(addr, port);
+}
+
+/*
+ * Every third call finds the buffer full; the others accept up to PARTIAL
+ * probes, as a send cut short would
+ */
+static uint32_t
+fake_send_batch(struct sweep *sw, const struct sweep_probe *probes,
+                uint32_t count)
+{
+    uint32_t i = 0;
+
+    largest = count > largest ? count : largest;
+    check_per_host(sw, probes, count);
+
+    if (++batch_calls % 3 == 0)
+    {
+        errno = ENOBUFS;
+        return 0;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (i == PARTIAL)
+        {
+            errno = EAGAIN;
+            return i;
+        }
+
+        if (accept_probe(probes[i].addr, probes[i].port))
+        {
+            return i;
+        }
+    }
+
+    return count;
+}
+
+static int
+fake_recv(struct sweep *sw, struct sweep_reply *reply)
+{
+    if (answered == accepted)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    reply->addr = answers[answered % HOSTS].addr;
+    reply->port = answers[answered % HOSTS].port;
+    reply->state = reply->port ? PORT_OPEN : PORT_STATE_NONE;
+    reply->up = 1;
+
+    if (!duplicates || (repeat = !repeat))
+    {
+        answered++;
+    }
+
+    return 1;
+}
+
+static void
+fake_close(struct sweep *sw)
+{
+}
+
+static uint64_t
+fake_now(struct sweep *sw)
+{
+    return clock_ns;
+}
+
+static int
+fake_wait(struct sweep *sw, uint64_t wait_ns)
+{
+    if (late && !stalled && accepted)
+    {
+        stalled = 1;
+        clock_ns += 2 * TIMEOUT * 1000000000ULL;
+        return 0;
+    }
+
+    clock_ns += 1000;
+
+    return answered < accepted;
+}
+
+static const struct sweep_method fake_sweep = {
+    fake_open,
+    fake_send,
+    fake_recv,
+    fake_close,
+    fake_now,
+    fake_wait,
+    fake_send_batch
+};
+
+static void
+record(struct scanner *sc, uint64_t *count)
+{
+    uint32_t i = ntohl(sc->target.sin_addr.s_addr) - FIRST;
+
+    CHECK(i < HOSTS);
+    reports[i]++;
+    (*count)++;
+}
+
+static void
+record_up(struct scanner *sc)
+{
+    record(sc, &ups);
+}
+
+static void
+record_down(struct scanner *sc)
+{
+    record(sc, &downs);
+}
+
+static void
+record_error(struct scanner *sc)
+{
+    record(sc, &errors);
+}
+
+/*
+ * Sweeps the subnet sending up to send_batch probes at a time, and checks
+ * that every target was reported exactly once, as up unless unreachable
+ */
+static void
+sweep(struct scanner *sc, unsigned int send_batch)
+{
+    uint32_t i = 0, unreachable = 0;
+
+    memset(reports, 0, sizeof(reports));
+    ups = downs = errors = 0;
+    sc->next = 0;
+    sc->send_batch = send_batch;
+    sc->stats.window_cuts = 0;
+
+    CHECK(!run_sweep(sc, &fake_sweep, record_up, record_down, record_error));
+
+    for (i = 0; i < HOSTS; i++)
+    {
+        CHECK(reports[i] == 1);
+        unreachable += i % UNREACHABLE == 0 && i != 1 && i != HOSTS - 1;
+    }
+
+    CHECK(errors == unreachable && ups + downs == HOSTS - unreachable);
+    CHECK(late || !downs);
+}
+
+/*
+ * Sweeps PORTS ports of every host of 10.9.0.0/29 sending up to send_batch
+ * probes at a time, no more than PER_HOST of them outstanding to a host
+ * (which check_per_host checks), and checks that every probe was reported
+ * exactly once
+ */
+static void
+sweep_ports(unsigned int send_batch)
+{
+    uint32_t i = 0;
+    struct timeval timeout = {TIMEOUT, 0};
+    struct sim_spec *spec = sim_new();
+    struct scanner *sc = NULL;
+
+    CHECK(spec);
+    CHECK(!sim_configure(spec, "local 10.9.0.1/29"));
+    CHECK(!sim_finish(spec));
+
+    sc = init_device_scanner(SCAN_TYPE_SYN, sim_device(spec), &timeout, 1);
+    CHECK(sc);
+    sc->ports = malloc(PORTS * sizeof(*sc->ports));
+    CHECK(sc->ports);
+
+    for (i = 0; i < PORTS; i++)
+    {
+        sc->ports[i] = (uint16_t) (i + 1);
+    }
+
+    sc->nports = PORTS;
+    sc->max_inflight = 256;
+    sc->max_per_host = PER_HOST;
+    sc->send_batch = send_batch;
+
+    memset(reports, 0, sizeof(reports));
+    ups = downs = errors = 0;
+
+    CHECK(!run_sweep(sc, &fake_sweep, record_up, record_down, record_error));
+
+    /*
+     * The local and broadcast addresses are reported once, without probes
+     */
+    for (i = 0; i < 8; i++)
+    {
+        CHECK(reports[i] == (i == 1 || i == 7 ? 1 : PORTS));
+    }
+
+    CHECK(errors == PORTS && !downs);
+
+    free_scanner(sc);
+    sim_free(spec);
+}
+
+int
+main(void)
+{
+    struct timeval timeout = {TIMEOUT, 0};
+    struct sim_spec *spec = sim_new();
+    struct scanner *sc = NULL;
+    struct sweep sw;
+
+    CHECK(spec);
+    CHECK(!sim_configure(spec, "local 10.9.0.1/22"));
+    CHECK(!sim_finish(spec));
+
+    sc = init_device_scanner(SCAN_TYPE_ICMP, sim_device(spec), &timeout, 0);
+    CHECK(sc);
+    sc->max_inflight = 256;
+
+    /*
+     * One probe at a time goes through send alone
+     */
+    sweep(sc, 1);
+    CHECK(sends && !batch_calls);
+
+    /*
+     * Batches go through send_batch alone, no larger than asked for, with
+     * nothing lost to short sends or a full buffer
+     */
+    sweep(sc, 16);
+    CHECK(!sends && batch_calls && largest == 16);
+
+    sc->max_inflight = MAX_INFLIGHT;
+    sweep(sc, MAX_SEND_BATCH * 2);
+    CHECK(!sends && largest == HOSTS - 2);
+
+    /*
+     * The window still holds with probes queued
+     */
+    sc->max_inflight = 3;
+    sweep(sc, 64);
+    CHECK(largest <= 3);
+
+    /*
+     * A sweep kept open for the scanner runs again from the scanner's
+     * position without being opened again
+     */
+    sc->max_inflight = 256;
+    sc->send_batch = 16;
+    opens = 0;
+    CHECK(!sweep_open(&sw, sc, &fake_sweep));
+    sc->sweep = &sw;
+    sweep(sc, 16);
+    sweep(sc, 16);
+    sc->sweep = NULL;
+    sweep_close(&sw);
+    CHECK(opens == 1 && largest == 16);
+
+    /*
+     * Duplicate replies leave the adaptive window alone, while replies to
+     * probes that already timed out cut it
+     */
+    sc->max_inflight = 256;
+    sc->adaptive_window = 1;
+    duplicates = 1;
+    sweep(sc, 1);
+    CHECK(!sc->stats.window_cuts);
+
+    duplicates = 0;
+    late = 1;
+    sweep(sc, 1);
+    CHECK(downs && sc->stats.window_cuts);
+
+    free_scanner(sc);
+    sim_free(spec);
+
+    /*
+     * Probes queued for a host count towards its cap
+     */
+    late = 0;
+    sweep_ports(1);
+    sweep_ports(16);
+    CHECK(batch_calls);
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scanner.h"
+#include "test.h"
+#include "threads.h"
+
+/*
+ * Exercises the threaded scan's range splitting and work stealing, and retry
+ * passes, with probes that don't touch the network.
+ */
+
+#define TEST_FIRST  0x0a000000
+#define TEST_COUNT  4096
+
+static unsigned char visits[TEST_COUNT];
+static unsigned int reported;
+static unsigned char ups[TEST_COUNT];
+static unsigned char downs[TEST_COUNT];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Counts a visit of the target; hosts in the first sixteenth of the range
+ * are slow so that the worker that owns them has to be helped out
+ */
+static int
+fake_probe(struct scanner *sc)
+{
+    uint32_t offset = ntohl(sc->target.sin_addr.s_addr) - TEST_FIRST;
+    struct timespec ts = {0, 200000};
+
+    if (offset < TEST_COUNT / 16)
+    {
+        nanosleep(&ts, NULL);
+    }
+
+    pthread_mutex_lock(&lock);
+    visits[offset]++;
+    pthread_mutex_unlock(&lock);
+
+    return offset % 2;
+}
+
+/*
+ * Not locked: only called with callbacks serialized
+ */
+static void
+count_report(struct scanner *sc)
+{
+    reported++;
+}
+
+/*
+ * Counts a visit of the target, which answers on its (offset % 4 + 1)th
+ * probe
+ */
+static int
+lossy_probe(struct scanner *sc)
+{
+    uint32_t offset = ntohl(sc->target.sin_addr.s_addr) - TEST_FIRST;
+    int up = 0;
+
+    pthread_mutex_lock(&lock);
+    up = ++visits[offset] > offset % 4;
+    pthread_mutex_unlock(&lock);
+
+    return up;
+}
+
+static void
+count_up(struct scanner *sc)
+{
+    ups[ntohl(sc->target.sin_addr.s_addr) - TEST_FIRST]++;
+}
+
+static void
+count_down(struct scanner *sc)
+{
+    downs[ntohl(sc->target.sin_addr.s_addr) - TEST_FIRST]++;
+}
+
+/*
+ * Scans with two retries and checks that only unanswered targets are probed
+ * again and that every target is reported exactly once, after its last probe
+ */
+static void
+check_retries(struct scanner *sc, unsigned int threads, int randomize)
+{
+    unsigned int i = 0;
+
+    memset(visits, 0, sizeof(visits));
+    memset(ups, 0, sizeof(ups));
+    memset(downs, 0, sizeof(downs));
+
+    sc->probe = lossy_probe;
+    sc->threads = threads;
+    sc->randomize = randomize;
+    sc->seed = 42;
+    sc->retries = 2;
+
+    CHECK(!run_scan(sc, count_up, count_down, NULL));
+
+    for (i = 0; i < TEST_COUNT; i++)
+    {
+        CHECK(visits[i] == (i % 4 < 3 ? i % 4 + 1 : 3));
+        CHECK(ups[i] == (i % 4 < 3));
+        CHECK(downs[i] == (i % 4 == 3));
+    }
+
+    CHECK(!sc->retry_map && !sc->retry_next);
+}
+
+int
+main(void)
+{
+    unsigned int i = 0, threads = 0;
+    struct scanner sc = {0};
+
+    sc.scan_type = SCAN_TYPE_CONNECT;
+    sc.probe = fake_probe;
+    sc.target.sin_family = AF_INET;
+    sc.start = htonl(TEST_FIRST);
+    sc.end = htonl(TEST_FIRST + TEST_COUNT - 1);
+    sc.serialize_callbacks = 1;
+
+    for (threads = 1; threads <= 8; threads *= 2)
+    {
+        memset(visits, 0, sizeof(visits));
+        reported = 0;
+
+        sc.threads = threads;
+        sc.next = 0;
+
+        CHECK(!run_threaded_scan(&sc, count_report, count_report, NULL));
+
+        /*
+         * Every address probed exactly once, and every result reported
+         */
+        for (i = 0; i < TEST_COUNT; i++)
+        {
+            CHECK(visits[i] == 1);
+        }
+
+        CHECK(reported == TEST_COUNT);
+        CHECK(sc.next == TEST_COUNT);
+    }
+
+    sc.threads = 0;
+    CHECK(run_threaded_scan(&sc, NULL, NULL, NULL) == -1);
+
+    check_retries(&sc, 1, 0);
+    check_retries(&sc, 4, 0);
+    check_retries(&sc, 4, 1);
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "scanner.h"
+#include "sim.h"
+#include "socket_util.h"
+#include "test.h"
+#include "uring.h"
+
+/*
+ * Runs the io_uring engine against a listener on loopback, where every
+ * address of 127.0.0.0/8 is local, and checks that every target is reported
+ * exactly once, also under a low file descriptor limit. Skipped
+ * if the kernel has no io_uring or no socket operation for it.
+ */
+
+/*
+ * Exit status telling the test harness that the test was skipped
+ */
+#define SKIP        77
+
+/*
+ * The swept subnet: 127.0.0.0/24, scanned from 127.0.0.1
+ */
+#define FIRST       0x7f000000U
+#define HOSTS       256U
+
+/*
+ * File descriptor limit of the second run, which registered files count
+ * against, leaving room for a window of only a few probes
+ */
+#define LOW_NOFILE  24
+
+/*
+ * Number of times each target was reported, and how
+ */
+static uint32_t reports[HOSTS];
+static uint64_t ups, downs, errors;
+
+static void
+record(struct scanner *sc, uint64_t *count)
+{
+    uint32_t i = ntohl(sc->target.sin_addr.s_addr) - FIRST;
+
+    CHECK(i < HOSTS);
+    reports[i]++;
+    (*count)++;
+}
+
+static void
+record_up(struct scanner *sc)
+{
+    record(sc, &ups);
+}
+
+static void
+record_down(struct scanner *sc)
+{
+    record(sc, &downs);
+}
+
+static void
+record_error(struct scanner *sc)
+{
+    record(sc, &errors);
+}
+
+/*
+ * Scans the subnet and checks that every target was reported exactly once,
+ * as up. Returns 0, or -1 with errno set to ENOSYS if io_uring is missing.
+ */
+static int
+scan(struct scanner *sc)
+{
+    uint32_t i = 0;
+
+    memset(reports, 0, sizeof(reports));
+    ups = downs = errors = 0;
+    sc->next = 0;
+
+    if (run_uring_engine(sc, record_up, record_down, record_error))
+    {
+        CHECK(errno == ENOSYS);
+        return -1;
+    }
+
+    for (i = 0; i < HOSTS; i++)
+    {
+        CHECK(reports[i] == 1);
+    }
+
+    CHECK(ups == HOSTS && !downs && !errors);
+
+    return 0;
+}
+
+int
+main(void)
+{
+    int listener = -1;
+    struct timeval timeout = {2, 0};
+    struct sockaddr_in addr = {0};
+    socklen_t len = sizeof(addr);
+    struct rlimit rl = {LOW_NOFILE, LOW_NOFILE};
+    struct sim_spec *spec = sim_new();
+    struct scanner *sc = NULL;
+
+    /*
+     * Connections are left in the listener's backlog rather than accepted
+     */
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    CHECK(listener != -1);
+    CHECK(!bind(listener, (struct sockaddr *) &addr, sizeof(addr)));
+    CHECK(!listen(listener, 2 * HOSTS));
+    CHECK(!getsockname(listener, (struct sockaddr *) &addr, &len));
+
+    CHECK(spec);
+    CHECK(!sim_configure(spec, "local 127.0.0.1/24"));
+    CHECK(!sim_finish(spec));
+
+    sc = init_device_scanner(SCAN_TYPE_CONNECT, sim_device(spec), &timeout,
+                             ntohs(addr.sin_port));
+    CHECK(sc);
+    sc->max_inflight = 128;
+
+    if (scan(sc))
+    {
+        free_scanner(sc);
+        sim_free(spec);
+        close_sock(listener);
+        return SKIP;
+    }
+
+    /*
+     * A low descriptor limit shrinks the window, and probes are recycled
+     * through the few slots left without being reported twice or lost
+     */
+    CHECK(!setrlimit(RLIMIT_NOFILE, &rl));
+    CHECK(!scan(sc));
+
+    free_scanner(sc);
+    sim_free(spec);
+    close_sock(listener);
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdlib.h>
+
+#include "test.h"
+#include "window.h"
+
+/*
+ * Exercises the AIMD controller behind adaptive windows.
+ */
+
+/*
+ * Completes a round of probes of which timeouts (out of the window) timed out.
+ */
+static void
+run_round(struct window_ctl *wc, uint32_t timeouts)
+{
+    uint32_t i = 0, n = wc->window;
+
+    for (i = 0; i < n; i++)
+    {
+        if (i < timeouts)
+        {
+            window_timeout(wc);
+        }
+        else
+        {
+            window_reply(wc);
+        }
+    }
+}
+
+int
+main(void)
+{
+    int i = 0;
+    struct window_ctl wc;
+
+    /*
+     * A fixed window never moves
+     */
+    window_init(&wc, 4096, 0);
+    CHECK(wc.window == 4096);
+    window_loss(&wc);
+    run_round(&wc, 0);
+    CHECK(wc.window == 4096 && !wc.cuts && !wc.raises);
+
+    /*
+     * An adaptive window starts small and doubles while rounds go well,
+     * until it hits the maximum
+     */
+    window_init(&wc, 4096, 1);
+    CHECK(wc.window == WINDOW_INITIAL);
+    run_round(&wc, 0);
+    CHECK(wc.window == 2 * WINDOW_INITIAL);
+
+    for (i = 0; i < 10; i++)
+    {
+        run_round(&wc, 0);
+    }
+
+    CHECK(wc.window == 4096 && wc.peak == 4096);
+
+    /*
+     * A loss halves it, only once per round, and growth is additive after
+     */
+    window_loss(&wc);
+    window_loss(&wc);
+    CHECK(wc.window == 2048 && wc.cuts == 1);
+    run_round(&wc, 0);
+    run_round(&wc, 0);
+    CHECK(wc.window == 2048 + 4096 / WINDOW_STEPS);
+
+    /*
+     * A sparse network that times out steadily is no sign of loss, but a
+     * rise in the share of timeouts is
+     */
+    window_init(&wc, 4096, 1);
+
+    for (i = 0; i < 8; i++)
+    {
+        run_round(&wc, wc.window * 9 / 10);
+    }
+
+    CHECK(wc.window == 4096 && !wc.cuts);
+
+    window_init(&wc, 4096, 1);
+
+    for (i = 0; i < 4; i++)
+    {
+        run_round(&wc, wc.window / 10);
+    }
+
+    CHECK(wc.window == 1024 && !wc.cuts);
+    run_round(&wc, wc.window / 2);
+    CHECK(wc.window == 512 && wc.cuts == 1);
+
+    /*
+     * Cuts stop at the minimum
+     */
+    for (i = 0; i < 20; i++)
+    {
+        window_loss(&wc);
+        run_round(&wc, 0);
+    }
+
+    CHECK(wc.window >= WINDOW_MIN);
+
+    window_init(&wc, 4096, 1);
+
+    for (i = 0; i < 10; i++)
+    {
+        window_loss(&wc);
+        wc.cut = 0;
+    }
+
+    CHECK(wc.window == WINDOW_MIN);
+
+    return 0;
+}
@@ -0,0 +1,364 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "threads.h"
+#include "util.h"
+
+/*
+ * Largest number of offsets a worker claims at a time. Smaller chunks are
+ * used for small ranges so that every worker gets a share.
+ */
+#define THREAD_MAX_CHUNK    1024
+
+/*
+ * Chunks per worker aimed for when sizing chunks for small ranges
+ */
+#define THREAD_CHUNKS_PER_WORKER    16
+
+struct pool;
+
+/*
+ * A worker thread and the block of offsets it owns.
+ *
+ * lo and hi bound the offsets not yet claimed by anyone; the owner claims
+ * chunks from lo and thieves take from hi, both under lock.
+ */
+struct worker
+{
+    struct scanner sc;
+    struct pool *pool;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    uint64_t lo;
+    uint64_t hi;
+    int ret;
+    int err;
+};
+
+/*
+ * State shared by every worker of a scan
+ */
+struct pool
+{
+    struct worker *workers;
+    unsigned int nworkers;
+    uint64_t chunk;
+    struct serial_callbacks serial;
+    probe_callback_t up_callback;
+    probe_callback_t down_callback;
+    probe_callback_t error_callback;
+};
+
+/*
+ * Claims up to one chunk from the front of w's block into its scanner.
+ *
+ * Returns 1 if anything was claimed, or 0 if the block is empty.
+ */
+static int
+claim(struct worker *w)
+{
+    uint64_t n = 0;
+
+    pthread_mutex_lock(&w->lock);
+
+    if (w->lo < w->hi)
+    {
+        n = w->hi - w->lo < w->pool->chunk ? w->hi - w->lo : w->pool->chunk;
+        w->sc.next = w->lo;
+        w->sc.stop = w->lo + n;
+        w->lo += n;
+    }
+
+    pthread_mutex_unlock(&w->lock);
+
+    return n ? 1 : 0;
+}
+
+/*
+ * Moves the back half of the largest block left among the other workers into
+ * w's block.
+ *
+ * Returns 1 if anything was stolen, or 0 if every other block is empty.
+ */
+static int
+steal(struct worker *w)
+{
+    unsigned int i = 0;
+    uint64_t left = 0, most = 0, take = 0, from = 0;
+    struct worker *v = NULL, *victim = NULL;
+
+    while (!take)
+    {
+        most = 0;
+        victim = NULL;
+
+        for (i = 0; i < w->pool->nworkers; i++)
+        {
+            v = &w->pool->workers[i];
+
+            if (v == w)
+            {
+                continue;
+            }
+
+            pthread_mutex_lock(&v->lock);
+            left = v->hi - v->lo;
+            pthread_mutex_unlock(&v->lock);
+
+            if (left > most)
+            {
+                most = left;
+                victim = v;
+            }
+        }
+
+        if (!victim)
+        {
+            return 0;
+        }
+
+        /*
+         * The victim may have shrunk since it was sized; if someone else
+         * emptied it first, look again
+         */
+        pthread_mutex_lock(&victim->lock);
+
+        if (victim->lo < victim->hi)
+        {
+            take = (victim->hi - victim->lo + 1) / 2;
+            victim->hi -= take;
+            from = victim->hi;
+        }
+
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->lo = from;
+    w->hi = from + take;
+    pthread_mutex_unlock(&w->lock);
+
+    return 1;
+}
+
+/*
+ * Refill hook of every worker's scanner
+ */
+static int
+refill(struct scanner *sc)
+{
+    struct worker *w = sc->worker;
+
+    while (!claim(w))
+    {
+        if (!steal(w))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Callback wrappers used when callbacks are serialized
+ */
+
+static void
+serial_up(struct scanner *sc)
+{
+    pthread_mutex_lock(&sc->serial->lock);
+    sc->serial->up_callback(sc);
+    pthread_mutex_unlock(&sc->serial->lock);
+}
+
+static void
+serial_down(struct scanner *sc)
+{
+    pthread_mutex_lock(&sc->serial->lock);
+    sc->serial->down_callback(sc);
+    pthread_mutex_unlock(&sc->serial->lock);
+}
+
+static void
+serial_error(struct scanner *sc)
+{
+    int err = errno;
+
+    pthread_mutex_lock(&sc->serial->lock);
+    errno = err;
+    sc->serial->error_callback(sc);
+    pthread_mutex_unlock(&sc->serial->lock);
+}
+
+void
+wrap_serial_callbacks(struct serial_callbacks *serial,
+                      probe_callback_t *up_callback,
+                      probe_callback_t *down_callback,
+                      probe_callback_t *error_callback)
+{
+    serial->up_callback = *up_callback;
+    serial->down_callback = *down_callback;
+    serial->error_callback = *error_callback;
+
+    *up_callback = *up_callback ? serial_up : NULL;
+    *down_callback = *down_callback ? serial_down : NULL;
+    *error_callback = *error_callback ? serial_error : NULL;
+}
+
+static void *
+work(void *arg)
+{
+    struct worker *w = arg;
+    struct pool *pool = w->pool;
+
+    w->ret = scan_targets(&w->sc, pool->up_callback, pool->down_callback,
+                          pool->error_callback);
+    w->err = errno;
+
+    return NULL;
+}
+
+int
+run_threaded_scan(struct scanner *sc, probe_callback_t up_callback,
+                  probe_callback_t down_callback,
+                  probe_callback_t error_callback)
+{
+    int ret = 0, err = 0;
+    unsigned int i = 0, started = 0, window = 0;
+    uint64_t count = 0, share = 0, longest = 0;
+    struct pool pool = {0};
+    struct worker *w = NULL;
+    struct serial_callbacks *serial = NULL;
+
+    if (!sc || !sc->threads || sc->threads > MAX_THREADS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    count = target_count(sc) - sc->next;
+    pool.nworkers = sc->threads;
+    pool.up_callback = up_callback;
+    pool.down_callback = down_callback;
+    pool.error_callback = error_callback;
+
+    pool.chunk = count / ((uint64_t) pool.nworkers * THREAD_CHUNKS_PER_WORKER);
+    pool.chunk = pool.chunk > THREAD_MAX_CHUNK ? THREAD_MAX_CHUNK
+                 : pool.chunk ? pool.chunk : 1;
+
+    /*
+     * Split the window so the scan as a whole stays within it
+     */
+    window = sc->max_inflight / pool.nworkers;
+    window = sc->max_inflight && !window ? 1 : window;
+
+    pool.workers = zmalloc(pool.nworkers * sizeof(*pool.workers));
+
+    if (!pool.workers)
+    {
+        return -1;
+    }
+
+    pthread_mutex_init(&pool.serial.lock, NULL);
+
+    /*
+     * Callbacks already serialized (e.g. across the scans of a group) are
+     * left as they are, and the workers share the same lock
+     */
+    serial = sc->serial;
+
+    if (sc->serialize_callbacks && !serial)
+    {
+        wrap_serial_callbacks(&pool.serial, &pool.up_callback,
+                              &pool.down_callback, &pool.error_callback);
+        serial = &pool.serial;
+    }
+
+    /*
+     * Hand each worker an equal block of what is left of the range
+     */
+    share = count / pool.nworkers;
+
+    for (i = 0; i < pool.nworkers; i++)
+    {
+        w = &pool.workers[i];
+        w->sc = *sc;
+        w->sc.fd = -1;
+        w->sc.max_inflight = window;
+        w->sc.threads = 1;
+        w->sc.refill = refill;
+        w->sc.worker = w;
+        w->sc.serial = serial;
+        w->sc.next = 0;
+        w->sc.stop = 0;
+        memset(&w->sc.stats, 0, sizeof(w->sc.stats));
+        w->pool = &pool;
+        w->lo = sc->next + i * share;
+        w->hi = i + 1 < pool.nworkers ? w->lo + share : sc->next + count;
+        pthread_mutex_init(&w->lock, NULL);
+    }
+
+    for (started = 0; started < pool.nworkers; started++)
+    {
+        w = &pool.workers[started];
+        ret = pthread_create(&w->thread, NULL, work, w);
+
+        if (ret)
+        {
+            /*
+             * Workers already started steal the blocks of those that never
+             * will
+             */
+            err = ret;
+            break;
+        }
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        w = &pool.workers[i];
+        pthread_join(w->thread, NULL);
+
+        if (w->ret && !err)
+        {
+            err = w->err;
+        }
+
+        sc->stats.window_raises += w->sc.stats.window_raises;
+        sc->stats.window_cuts += w->sc.stats.window_cuts;
+        sc->stats.window_peak += w->sc.stats.window_peak;
+        sc->stats.window_final += w->sc.stats.window_final;
+
+        if (w->sc.stats.sim_ns > longest)
+        {
+            longest = w->sc.stats.sim_ns;
+        }
+    }
+
+    sc->stats.sim_ns += longest;
+
+    for (i = 0; i < pool.nworkers; i++)
+    {
+        pthread_mutex_destroy(&pool.workers[i].lock);
+    }
+
+    pthread_mutex_destroy(&pool.serial.lock);
+    free(pool.workers);
+
+    /*
+     * Leave the caller's scanner at the end of the range, like a
+     * single-threaded scan
+     */
+    sc->next = target_count(sc);
+
+    if (err || !started)
+    {
+        errno = err ? err : EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
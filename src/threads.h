@@ -0,0 +1,64 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <pthread.h>
+
+#include "scanner.h"
+
+/*
+ * Upper bound on the number of worker threads
+ */
+#define MAX_THREADS     256
+
+/*
+ * Callbacks called one at a time from several threads, and the lock
+ * serializing them
+ */
+struct serial_callbacks
+{
+    pthread_mutex_t lock;
+    probe_callback_t up_callback;
+    probe_callback_t down_callback;
+    probe_callback_t error_callback;
+};
+
+/*
+ * Stores the callbacks in serial, and replaces each of them that is not NULL
+ * with a wrapper that calls it under serial's lock (which must be initialized
+ * already). The wrappers call the callbacks of the scanner's serial member,
+ * which must point at serial for every scanner they are called with.
+ */
+void
+wrap_serial_callbacks(struct serial_callbacks *serial,
+                      probe_callback_t *up_callback,
+                      probe_callback_t *down_callback,
+                      probe_callback_t *error_callback);
+
+/*
+ * Runs a scan of the scanner's range on sc->threads worker threads.
+ *
+ * The range is split into one contiguous block of offsets per worker. Each
+ * worker probes its block a chunk at a time on a private copy of the scanner
+ * (so it has its own sockets and probe state), and a worker that runs out of
+ * work steals the back half of the largest block left. Workers only take a
+ * lock when they claim a chunk, never per probe.
+ *
+ * sc->max_inflight is split evenly between the workers, so the scan as a
+ * whole keeps no more probes outstanding than a single-threaded one.
+ *
+ * Callbacks are called as described for run_scan, with the worker's copy of
+ * the scanner. If sc->serialize_callbacks is set, no two callbacks run at
+ * the same time; otherwise they run concurrently on the workers' threads. If
+ * sc->serial is set, the callbacks are serialized by it already (see
+ * wrap_serial_callbacks), and are not wrapped again.
+ *
+ * Returns 0 once every host has been probed or a signal has been caught;
+ * returns -1 and sets errno if a worker could not be started or its engine
+ * failed.
+ */
+int
+run_threaded_scan(struct scanner *sc, probe_callback_t up_callback,
+                  probe_callback_t down_callback,
+                  probe_callback_t error_callback);
+
+#endif /* THREADS_H */
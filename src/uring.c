@@ -0,0 +1,872 @@
+#include <errno.h>
+
+#include "uring.h"
+
+#if defined(__linux__) && HAVE_DECL_IORING_OP_SOCKET
+
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "handle_signals.h"
+#include "inflight.h"
+#include "metrics.h"
+#include "rtt.h"
+#include "util.h"
+
+/*
+ * Largest window the engine runs with. Each probe has at most three
+ * completions due at once, so this keeps every completion within the largest
+ * completion queue the kernel allows.
+ */
+#define URING_MAX_WINDOW    16384
+
+/*
+ * Number of submission queue entries; three are used per probe
+ */
+#define URING_SQ_ENTRIES    4096
+
+/*
+ * Submission queue entries used by the chain of a single probe
+ */
+#define URING_CHAIN_LEN     3
+
+/*
+ * Operation a completion belongs to, kept in the low bits of its user_data
+ * (the slot of the probe is kept in the rest)
+ */
+#define URING_SOCKET        0
+#define URING_CONNECT       1
+#define URING_TIMEOUT       2
+#define URING_CLOSE         3
+
+#define URING_OP_BITS       2
+#define URING_OP_MASK       ((1 << URING_OP_BITS) - 1)
+
+/*
+ * An io_uring instance and its mapped submission and completion rings.
+ *
+ * queued is the number of entries added to the submission queue but not yet
+ * submitted to the kernel.
+ */
+struct ring
+{
+    int fd;
+    void *sq_ptr;
+    size_t sq_len;
+    void *cq_ptr;
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_array;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    struct io_uring_cqe *cqes;
+    unsigned int cq_mask;
+    unsigned int queued;
+};
+
+/*
+ * State of the probe in a slot of the in-flight table; the slot is also the
+ * index of the probe's socket in the ring's registered files.
+ *
+ * cqes is the number of completions still due for the probe. Once the chain
+ * has completed, closing is set while the socket is closed, and retry is set
+ * if the probe has to be sent again because the system was out of sockets or
+ * local ports.
+ */
+struct uring_probe
+{
+    struct sockaddr_in remote;
+    int socket_res;
+    int connect_res;
+    int timed_out;
+    int cqes;
+    int closing;
+    int retry;
+};
+
+/*
+ * State of a single run of the engine
+ */
+struct uring_engine
+{
+    struct scanner *sc;
+    struct ring ring;
+    struct inflight tbl;
+    struct uring_probe *probes;
+    uint32_t *retries;
+    uint32_t nretries;
+    struct rtt_estimator rtt;
+    struct window_ctl window;
+    struct __kernel_timespec timeout;
+    probe_callback_t callbacks[2];
+    probe_callback_t error_callback;
+};
+
+static int
+uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+            unsigned int flags, void *arg, size_t argsz)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                         flags, arg, argsz);
+}
+
+static int
+uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * Returns 1 if the kernel supports every operation the engine submits, or 0
+ * otherwise.
+ */
+static int
+ops_supported(int fd)
+{
+    int ret = 0;
+    size_t i = 0;
+    struct io_uring_probe *probe = NULL;
+    const uint8_t ops[] = {IORING_OP_SOCKET, IORING_OP_CONNECT,
+                           IORING_OP_LINK_TIMEOUT, IORING_OP_CLOSE};
+
+    probe = zmalloc(sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+
+    if (!probe)
+    {
+        return 0;
+    }
+
+    if (!uring_register(fd, IORING_REGISTER_PROBE, probe, 256))
+    {
+        ret = 1;
+
+        for (i = 0; i < sizeof(ops); i++)
+        {
+            if (ops[i] > probe->last_op
+                || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+            {
+                ret = 0;
+            }
+        }
+    }
+
+    free(probe);
+
+    return ret;
+}
+
+static void
+ring_close(struct ring *ring)
+{
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+
+    if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED
+        && ring->cq_ptr != ring->sq_ptr)
+    {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+
+    if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+    {
+        munmap(ring->sq_ptr, ring->sq_len);
+    }
+
+    if (ring->fd != -1)
+    {
+        close(ring->fd);
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/*
+ * Sets up an io_uring with room for the completions of window probes and
+ * window registered (initially empty) file slots.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error, with errno set
+ * to ENOSYS if io_uring or an operation the engine needs is unavailable.
+ */
+static int
+ring_open(struct ring *ring, uint32_t window)
+{
+    int err = 0;
+    uint32_t i = 0;
+    int *files = NULL;
+    uint8_t *cq = NULL;
+    struct io_uring_params params = {0};
+
+    memset(ring, 0, sizeof(*ring));
+
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP
+                   | IORING_SETUP_SUBMIT_ALL;
+
+    /*
+     * The completion queue may not be smaller than the submission queue
+     */
+    params.cq_entries = URING_CHAIN_LEN * window > URING_SQ_ENTRIES
+                        ? URING_CHAIN_LEN * window : URING_SQ_ENTRIES;
+
+    ring->fd = uring_setup(URING_SQ_ENTRIES, &params);
+
+    if (ring->fd == -1)
+    {
+        /*
+         * Not built into the kernel, disabled by sysctl, or filtered out by
+         * seccomp
+         */
+        if (errno == ENOSYS || errno == EPERM || errno == EINVAL)
+        {
+            errno = ENOSYS;
+        }
+
+        return -1;
+    }
+
+    if (!ops_supported(ring->fd))
+    {
+        close(ring->fd);
+        ring->fd = -1;
+        errno = ENOSYS;
+        return -1;
+    }
+
+    ring->sq_len = params.sq_off.array
+                   + params.sq_entries * sizeof(unsigned int);
+    ring->cq_len = params.cq_off.cqes
+                   + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_len > ring->sq_len)
+        {
+            ring->sq_len = ring->cq_len;
+        }
+
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+
+    if (ring->sq_ptr == MAP_FAILED)
+    {
+        goto fail;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+
+        if (ring->cq_ptr == MAP_FAILED)
+        {
+            goto fail;
+        }
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sqes == MAP_FAILED)
+    {
+        goto fail;
+    }
+
+    ring->sq_head = (unsigned int *) ((uint8_t *) ring->sq_ptr
+                                      + params.sq_off.head);
+    ring->sq_tail = (unsigned int *) ((uint8_t *) ring->sq_ptr
+                                      + params.sq_off.tail);
+    ring->sq_array = (unsigned int *) ((uint8_t *) ring->sq_ptr
+                                       + params.sq_off.array);
+    ring->sq_mask = *(unsigned int *) ((uint8_t *) ring->sq_ptr
+                                       + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+
+    cq = ring->cq_ptr;
+    ring->cq_head = (unsigned int *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned int *) (cq + params.cq_off.tail);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    ring->cq_mask = *(unsigned int *) (cq + params.cq_off.ring_mask);
+
+    /*
+     * Sockets are created straight into registered file slots, so they
+     * never take up descriptors in the process's file table
+     */
+    files = malloc(window * sizeof(*files));
+
+    if (!files)
+    {
+        goto fail;
+    }
+
+    for (i = 0; i < window; i++)
+    {
+        files[i] = -1;
+    }
+
+    if (uring_register(ring->fd, IORING_REGISTER_FILES, files, window))
+    {
+        free(files);
+        goto fail;
+    }
+
+    free(files);
+
+    return 0;
+
+fail:
+    err = errno;
+    ring_close(ring);
+    errno = err;
+    return -1;
+}
+
+/*
+ * Submits every queued entry and, if wait is nonzero, waits for at least one
+ * completion, giving up after wait_ns nanoseconds unless wait_ns is 0.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error (ETIME if the
+ * wait ran out with nothing submitted).
+ */
+static int
+ring_submit(struct ring *ring, unsigned int wait, uint64_t wait_ns)
+{
+    int ret = 0;
+    struct __kernel_timespec ts = {0};
+    struct io_uring_getevents_arg arg = {0};
+
+    if (wait && wait_ns)
+    {
+        ts.tv_sec = (long long) (wait_ns / 1000000000ULL);
+        ts.tv_nsec = (long long) (wait_ns % 1000000000ULL);
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+        ret = uring_enter(ring->fd, ring->queued, wait,
+                          IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                          sizeof(arg));
+    }
+    else
+    {
+        ret = uring_enter(ring->fd, ring->queued, wait,
+                          wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    }
+
+    if (ret == -1)
+    {
+        return -1;
+    }
+
+    ring->queued -= (unsigned int) ret;
+
+    return 0;
+}
+
+/*
+ * Makes sure there is room for n more entries in the submission queue,
+ * submitting the queued ones if there isn't, so that the entries of a linked
+ * chain are always submitted together.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+static int
+ring_reserve(struct ring *ring, unsigned int n)
+{
+    unsigned int head = 0;
+
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    while (ring->sq_entries - (*ring->sq_tail - head) < n)
+    {
+        if (ring_submit(ring, 0, 0) && errno != EINTR)
+        {
+            return -1;
+        }
+
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    }
+
+    return 0;
+}
+
+/*
+ * Returns the next free submission queue entry, zeroed and tagged with the
+ * slot and operation, and adds it to the queue. The caller must have reserved
+ * room for it with ring_reserve.
+ */
+static struct io_uring_sqe *
+ring_push(struct ring *ring, uint32_t slot, int op)
+{
+    unsigned int tail = *ring->sq_tail;
+    unsigned int index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = ((uint64_t) slot << URING_OP_BITS) | (uint64_t) op;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+
+    return sqe;
+}
+
+/*
+ * Queues the chain of the probe in slot: creating its socket in the slot's
+ * registered file, connecting it, and timing out the connect.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+static int
+launch(struct uring_engine *eng, uint32_t slot)
+{
+    struct io_uring_sqe *sqe = NULL;
+    struct uring_probe *probe = &eng->probes[slot];
+
+    if (ring_reserve(&eng->ring, URING_CHAIN_LEN))
+    {
+        return -1;
+    }
+
+    probe->remote = eng->sc->target;
+    probe->remote.sin_addr.s_addr = eng->tbl.slots[slot].addr;
+    probe->remote.sin_port = eng->tbl.slots[slot].port;
+    probe->socket_res = 0;
+    probe->connect_res = 0;
+    probe->timed_out = 0;
+    probe->cqes = URING_CHAIN_LEN;
+    probe->closing = 0;
+    probe->retry = 0;
+
+    sqe = ring_push(&eng->ring, slot, URING_SOCKET);
+    sqe->opcode = IORING_OP_SOCKET;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->fd = AF_INET;
+    sqe->off = SOCK_STREAM;
+    sqe->len = IPPROTO_TCP;
+    sqe->file_index = slot + 1;
+
+    sqe = ring_push(&eng->ring, slot, URING_CONNECT);
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+    sqe->fd = (int32_t) slot;
+    sqe->addr = (uint64_t) (uintptr_t) &probe->remote;
+    sqe->off = sizeof(probe->remote);
+
+    sqe = ring_push(&eng->ring, slot, URING_TIMEOUT);
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) (uintptr_t) &eng->timeout;
+    sqe->len = 1;
+
+    metrics_sent();
+
+    return 0;
+}
+
+/*
+ * Queues the close of the registered socket of the probe in slot.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+static int
+retire(struct uring_engine *eng, uint32_t slot)
+{
+    struct io_uring_sqe *sqe = NULL;
+
+    if (ring_reserve(&eng->ring, 1))
+    {
+        return -1;
+    }
+
+    eng->probes[slot].closing = 1;
+    eng->probes[slot].cqes = 1;
+
+    sqe = ring_push(&eng->ring, slot, URING_CLOSE);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = slot + 1;
+
+    return 0;
+}
+
+/*
+ * Releases the slot of a probe whose socket is closed, or keeps it for
+ * another try if the probe ran out of resources.
+ */
+static void
+release(struct uring_engine *eng, uint32_t slot)
+{
+    if (eng->probes[slot].retry)
+    {
+        eng->retries[eng->nretries++] = slot;
+    }
+    else
+    {
+        inflight_remove(&eng->tbl, slot);
+    }
+}
+
+/*
+ * Updates the timeout given to probes launched from now on with the
+ * round-trip time of an answered probe. The kernel reads the timeout when the
+ * probe is submitted, so probes already submitted keep theirs.
+ */
+static void
+set_timeout(struct uring_engine *eng, uint64_t rtt)
+{
+    rtt_sample(&eng->rtt, rtt);
+    eng->timeout.tv_sec = (long long) (eng->rtt.timeout / 1000000000ULL);
+    eng->timeout.tv_nsec = (long long) (eng->rtt.timeout % 1000000000ULL);
+}
+
+/*
+ * Handles a single completion, reporting the probe once its whole chain has
+ * completed.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+static int
+complete(struct uring_engine *eng, uint64_t user_data, int res)
+{
+    int err = 0;
+    uint32_t slot = (uint32_t) (user_data >> URING_OP_BITS);
+    struct uring_probe *probe = &eng->probes[slot];
+    in_addr_t addr = eng->tbl.slots[slot].addr;
+    in_port_t port = eng->tbl.slots[slot].port;
+
+    switch (user_data & URING_OP_MASK)
+    {
+        case URING_SOCKET:
+            probe->socket_res = res;
+            break;
+        case URING_CONNECT:
+            probe->connect_res = res;
+            break;
+        case URING_TIMEOUT:
+            probe->timed_out = res == -ETIME;
+            break;
+        default:    // URING_CLOSE
+            break;
+    }
+
+    if (--probe->cqes)
+    {
+        return 0;
+    }
+
+    if (probe->closing)
+    {
+        release(eng, slot);
+        return 0;
+    }
+
+    err = probe->socket_res < 0 ? -probe->socket_res : -probe->connect_res;
+
+    if (probe->socket_res >= 0 && probe->timed_out)
+    {
+        window_timeout(&eng->window);
+        report_timeout(eng->sc, eng->callbacks[0], addr, port, PORT_FILTERED);
+    }
+    else if (out_of_resources(err))
+    {
+        metrics_error(err);
+
+        /*
+         * Keep the address for another try instead of reporting it, cutting
+         * the window if buffers ran out
+         */
+        if (err == ENOBUFS)
+        {
+            window_loss(&eng->window);
+        }
+
+        /*
+         * Nothing went out, so the probe's token goes back to the pacer
+         * for the retry to take
+         */
+        if (eng->sc->pacer)
+        {
+            pacer_refund(eng->sc->pacer);
+        }
+
+        probe->retry = 1;
+    }
+    else if (probe->socket_res < 0)
+    {
+        metrics_error(err);
+        report_probe(eng->sc, eng->error_callback, addr, port,
+                     PORT_STATE_NONE, err);
+    }
+    else
+    {
+        eng->sc->rtt = monotonic_ns() - eng->tbl.slots[slot].sent;
+        metrics_reply(eng->sc->rtt);
+
+        if (connect_result(err))
+        {
+            set_timeout(eng, eng->sc->rtt);
+        }
+
+        window_reply(&eng->window);
+
+        report_probe(eng->sc, eng->callbacks[connect_result(err)], addr, port,
+                     connect_state(err), 0);
+    }
+
+    if (probe->socket_res >= 0)
+    {
+        return retire(eng, slot);
+    }
+
+    release(eng, slot);
+
+    return 0;
+}
+
+/*
+ * Handles every completion in the completion queue.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+static int
+reap(struct uring_engine *eng)
+{
+    int ret = 0;
+    unsigned int head = *eng->ring.cq_head;
+    unsigned int tail = __atomic_load_n(eng->ring.cq_tail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe *cqe = NULL;
+
+    while (!ret && head != tail)
+    {
+        cqe = &eng->ring.cqes[head & eng->ring.cq_mask];
+        ret = complete(eng, cqe->user_data, cqe->res);
+        head++;
+    }
+
+    __atomic_store_n(eng->ring.cq_head, head, __ATOMIC_RELEASE);
+
+    return ret;
+}
+
+int
+run_uring_engine(struct scanner *sc, probe_callback_t up_callback,
+                 probe_callback_t down_callback,
+                 probe_callback_t error_callback)
+{
+    int ret = 0, err = 0, exhausted = 0, starved = 0, pending = 0;
+    uint32_t window = 0, slot = 0;
+    uint64_t delay = 0, sleep = 0;
+    in_addr_t addr = 0;
+    in_port_t port = 0;
+    struct uring_engine eng = {0};
+    struct timespec backoff = {0, ENGINE_BACKOFF_MS * 1000000L};
+
+    if (!sc || !sc->max_inflight || sc->max_inflight > MAX_INFLIGHT)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    window = sc->max_inflight < URING_MAX_WINDOW ? sc->max_inflight
+                                                 : URING_MAX_WINDOW;
+
+    /*
+     * Registered files count against the file descriptor limit even though
+     * they don't use up descriptors
+     */
+    window = fit_window(window);
+
+    eng.sc = sc;
+    eng.timeout.tv_sec = sc->timeout.tv_sec;
+    eng.timeout.tv_nsec = (long long) sc->timeout.tv_usec * 1000LL;
+    rtt_init(&eng.rtt, timeval_ns(&sc->timeout), sc->adaptive_timeout);
+    eng.callbacks[0] = down_callback;
+    eng.callbacks[1] = up_callback;
+    eng.error_callback = error_callback;
+
+    if (ring_open(&eng.ring, window))
+    {
+        return -1;
+    }
+
+    eng.probes = zmalloc(window * sizeof(*eng.probes));
+    eng.retries = malloc(window * sizeof(*eng.retries));
+
+    if (!eng.probes || !eng.retries || inflight_init(&eng.tbl, window))
+    {
+        err = errno;
+        free(eng.probes);
+        free(eng.retries);
+        ring_close(&eng.ring);
+        errno = err;
+        return -1;
+    }
+
+    window_init(&eng.window, window, sc->adaptive_window);
+
+    while (!signal_flag)
+    {
+        /*
+         * Send probes that ran out of sockets or local ports again first,
+         * paced like new ones and timed from their new start, backing off if
+         * nothing else is outstanding whose completion could free some up,
+         * and don't start new ones on the same pass
+         */
+        starved = eng.nretries > 0;
+        delay = 0;
+
+        if (starved && eng.nretries == eng.tbl.count)
+        {
+            nanosleep(&backoff, NULL);
+        }
+
+        while (!ret && eng.nretries)
+        {
+            if (sc->pacer && (delay = pacer_take(sc->pacer)))
+            {
+                break;
+            }
+
+            slot = eng.retries[--eng.nretries];
+            eng.tbl.slots[slot].sent = monotonic_ns();
+            ret = launch(&eng, slot);
+        }
+
+        while (!ret && !starved && !exhausted
+               && eng.tbl.count < eng.window.window)
+        {
+            if (!pending && !next_target(sc, &addr, &port))
+            {
+                exhausted = 1;
+                break;
+            }
+
+            pending = 0;
+
+            /*
+             * Host is up for local address or broadcast address
+             */
+            if (is_self_or_bcast(sc, addr))
+            {
+                report_probe(sc, up_callback, addr, port, PORT_STATE_NONE, 0);
+                continue;
+            }
+
+            /*
+             * Keep the probe for a later pass if its host already has as many
+             * probes outstanding as it may
+             */
+            if (sc->max_per_host
+                && inflight_host_load(&eng.tbl, addr) >= sc->max_per_host)
+            {
+                pending = 1;
+                break;
+            }
+
+            /*
+             * Likewise if the pacer has no token left
+             */
+            if (sc->pacer && (delay = pacer_take(sc->pacer)))
+            {
+                pending = 1;
+                break;
+            }
+
+            slot = inflight_add(&eng.tbl, addr, port, monotonic_ns());
+            ret = launch(&eng, slot);
+        }
+
+        if (ret || (!eng.tbl.count && exhausted))
+        {
+            break;
+        }
+
+        /*
+         * Submit everything queued on this pass and wait for at least one
+         * completion in the same call, or, if the pacer ran out of tokens,
+         * for no longer than it takes to get one
+         */
+        sleep = delay ? pacer_sleep_time(delay) : 0;
+
+        if (ring_submit(&eng.ring, delay ? sleep > 0 : eng.tbl.count > 0,
+                        sleep))
+        {
+            if (errno == EINTR || errno == EBUSY || errno == EAGAIN
+                || errno == ETIME)
+            {
+                ret = reap(&eng);
+                continue;
+            }
+
+            ret = -1;
+            break;
+        }
+
+        ret = reap(&eng);
+
+        if (ret)
+        {
+            break;
+        }
+    }
+
+    /*
+     * Closing the ring cancels any probes still outstanding after an
+     * interruption or error and closes their sockets
+     */
+    err = errno;
+
+    ring_close(&eng.ring);
+    inflight_free(&eng.tbl);
+    free(eng.probes);
+    free(eng.retries);
+    record_window(sc, &eng.window);
+
+    if (ret)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+#else
+
+int
+run_uring_engine(struct scanner *sc, probe_callback_t up_callback,
+                 probe_callback_t down_callback,
+                 probe_callback_t error_callback)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* __linux__ && HAVE_DECL_IORING_OP_SOCKET */
@@ -0,0 +1,27 @@
+#ifndef URING_H
+#define URING_H
+
+#include "scanner.h"
+
+/*
+ * Runs a TCP connect scan like run_connect_engine, but drives every probe
+ * through an io_uring instead of making system calls per probe.
+ *
+ * Each probe is submitted as a single linked chain -- socket creation into a
+ * registered file slot, the connect, and a timeout of sc->timeout on the
+ * connect -- and the socket is closed through the ring once the chain has
+ * completed, so a single io_uring_enter call submits and reaps hundreds of
+ * probes. Callbacks are called as described for run_scan.
+ *
+ * Returns 0 once every host has been probed or a signal has been caught;
+ * returns -1 and sets errno if the engine could not be set up. If io_uring
+ * (or one of the operations it needs) is not available on the running
+ * kernel, returns -1 and sets errno to ENOSYS before probing any host, so the
+ * caller can fall back to run_connect_engine.
+ */
+int
+run_uring_engine(struct scanner *sc, probe_callback_t up_callback,
+                 probe_callback_t down_callback,
+                 probe_callback_t error_callback);
+
+#endif /* URING_H */
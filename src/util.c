@@ -1,6 +1,11 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "util.h"
 
@@ -11,6 +16,77 @@ zmalloc(size_t size)
     return ptr ? memset(ptr, 0, size) : NULL;
 }
 
+int
+write_all(int fd, const void *data, size_t len)
+{
+    ssize_t ret = 0;
+    const char *p = data;
+
+    while (len)
+    {
+        ret = write(fd, p, len);
+
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        p += ret;
+        len -= (size_t) ret;
+    }
+
+    return 0;
+}
+
+int
+open_tmpfile(const char *path, int flags, char **tmp)
+{
+    int fd = -1;
+
+    *tmp = malloc(strlen(path) + sizeof(".tmp"));
+
+    if (!*tmp)
+    {
+        return -1;
+    }
+
+    sprintf(*tmp, "%s.tmp", path);
+
+    fd = open(*tmp, O_WRONLY | O_CREAT | O_TRUNC | flags, 0644);
+
+    if (fd == -1)
+    {
+        free(*tmp);
+        *tmp = NULL;
+    }
+
+    return fd;
+}
+
+int
+finish_tmpfile(char *tmp, const char *path, int failed)
+{
+    int err = 0;
+
+    if (failed || rename(tmp, path))
+    {
+        err = errno;
+        unlink(tmp);
+        free(tmp);
+        errno = err;
+        return -1;
+    }
+
+    free(tmp);
+
+    return 0;
+}
+
 uint32_t
 nanorand(void)
 {
@@ -26,3 +102,125 @@ nanorand(void)
     return (uint32_t) rand();
 }
 
+
+uint64_t
+monotonic_ns(void)
+{
+    struct timespec ts = {0};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t
+realtime_ns(void)
+{
+    struct timespec ts = {0};
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void
+sleep_until_ns(uint64_t wake_ns)
+{
+#ifdef HAVE_CLOCK_NANOSLEEP
+    struct timespec ts = {0};
+
+    ts.tv_sec = (time_t) (wake_ns / 1000000000ULL);
+    ts.tv_nsec = (long) (wake_ns % 1000000000ULL);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+#else
+    struct timespec ts = {0};
+    uint64_t now = monotonic_ns();
+
+    /*
+     * Without absolute sleeps (e.g. on macOS), sleep for what is left
+     */
+    if (wake_ns > now)
+    {
+        ts.tv_sec = (time_t) ((wake_ns - now) / 1000000000ULL);
+        ts.tv_nsec = (long) ((wake_ns - now) % 1000000000ULL);
+        nanosleep(&ts, NULL);
+    }
+#endif /* HAVE_CLOCK_NANOSLEEP */
+}
+
+int
+cond_init(pthread_cond_t *cond)
+{
+#ifdef HAVE_PTHREAD_CONDATTR_SETCLOCK
+    int ret = 0;
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, COND_CLOCK);
+    ret = pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    return ret;
+#else
+    return pthread_cond_init(cond, NULL);
+#endif /* HAVE_PTHREAD_CONDATTR_SETCLOCK */
+}
+
+void
+cond_deadline(struct timespec *deadline, uint64_t ms)
+{
+    clock_gettime(COND_CLOCK, deadline);
+    deadline->tv_sec += (time_t) (ms / 1000);
+    deadline->tv_nsec += (long) (ms % 1000) * 1000000L;
+
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+uint64_t
+timeval_ns(const struct timeval *tv)
+{
+    return (uint64_t) tv->tv_sec * 1000000000ULL
+           + (uint64_t) tv->tv_usec * 1000ULL;
+}
+
+uint64_t
+random_key(void)
+{
+    uint64_t key = 0;
+    FILE *fp = fopen("/dev/urandom", "rb");
+
+    if (!fp || fread(&key, sizeof(key), 1, fp) != 1)
+    {
+        key = (uint64_t) nanorand() << 32 ^ nanorand() ^ monotonic_ns();
+    }
+
+    if (fp)
+    {
+        fclose(fp);
+    }
+
+    return key;
+}
+
+uint32_t
+keyed_hash(uint64_t key, uint32_t a, uint32_t b)
+{
+    uint64_t x = ((uint64_t) a << 32 | b) ^ key;
+
+    /*
+     * Two rounds of the MurmurHash3 64-bit finalizer, with the key folded in
+     * again between them
+     */
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x ^= key >> 32 | key << 32;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+
+    return (uint32_t) (x ^ x >> 32);
+}
@@ -1,8 +1,23 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+
+/*
+ * Clock the deadlines of timed waits on condition variables set up by
+ * cond_init are on: the monotonic clock where condition variables can be set
+ * to use it, or the real-time clock they use by default elsewhere (e.g. on
+ * macOS)
+ */
+#ifdef HAVE_PTHREAD_CONDATTR_SETCLOCK
+#define COND_CLOCK  CLOCK_MONOTONIC
+#else
+#define COND_CLOCK  CLOCK_REALTIME
+#endif /* HAVE_PTHREAD_CONDATTR_SETCLOCK */
 
 /*
  * Same as malloc but zeroes the data before returning.
@@ -10,6 +25,35 @@
 void *
 zmalloc(size_t size);
 
+/*
+ * Writes len bytes of data to fd, resuming short writes.
+ *
+ * Returns 0 on success; returns -1 and sets errno upon error.
+ */
+int
+write_all(int fd, const void *data, size_t len);
+
+/*
+ * Opens a temporary file next to path for writing, with any extra open flags
+ * provided, and stores its newly allocated name in *tmp. Once it has been
+ * written, finish_tmpfile moves it over path, so that a reader never sees a
+ * partly written file.
+ *
+ * Returns the file's descriptor; returns -1 and sets errno upon error.
+ */
+int
+open_tmpfile(const char *path, int flags, char **tmp);
+
+/*
+ * Renames tmp, opened by open_tmpfile, over path, or removes it instead if
+ * failed is set, and frees tmp.
+ *
+ * Returns 0 on success; returns -1 and sets errno if failed was set (leaving
+ * errno as it was) or the rename failed.
+ */
+int
+finish_tmpfile(char *tmp, const char *path, int failed);
+
 /*
  * Returns a random unsigned integer with much lower probability of repeats
  * than most ways of seeding and using the standard library's random number
@@ -18,5 +62,64 @@ zmalloc(size_t size);
 uint32_t
 nanorand(void);
 
+/*
+ * Returns the current time of the monotonic clock in nanoseconds.
+ */
+uint64_t
+monotonic_ns(void);
+
+/*
+ * Returns the current time of the real-time clock in nanoseconds since the
+ * Epoch.
+ */
+uint64_t
+realtime_ns(void);
+
+/*
+ * Sleeps until the monotonic clock reaches wake_ns, or a signal is caught.
+ */
+void
+sleep_until_ns(uint64_t wake_ns);
+
+/*
+ * Initializes cond, with timed waits on it taking deadlines on COND_CLOCK.
+ *
+ * Returns 0 on success; upon error, returns an error number.
+ */
+int
+cond_init(pthread_cond_t *cond);
+
+/*
+ * Stores the time on COND_CLOCK ms milliseconds from now in deadline, for a
+ * timed wait on a condition variable set up by cond_init.
+ */
+void
+cond_deadline(struct timespec *deadline, uint64_t ms);
+
+/*
+ * Returns the length of time in tv in nanoseconds.
+ */
+uint64_t
+timeval_ns(const struct timeval *tv);
+
+/*
+ * Returns a 64-bit key suitable for keyed_hash, read from the system's
+ * random source (falling back on nanorand if it is unavailable).
+ */
+uint64_t
+random_key(void);
+
+/*
+ * Returns a 32-bit hash of a and b under the provided key.
+ *
+ * Probes are stamped with keyed hashes of their targets so that replies can
+ * be told apart from unrelated traffic. For the SYN sweep the stamp is the
+ * sequence number, so a reply is validated from its own contents and the key
+ * alone, without looking up any per-probe state. This is a fast mixing
+ * function, not a cryptographic MAC.
+ */
+uint32_t
+keyed_hash(uint64_t key, uint32_t a, uint32_t b);
+
 #endif /* UTIL_H */
 
@@ -0,0 +1,105 @@
+#include "window.h"
+
+void
+window_init(struct window_ctl *wc, uint32_t max, int adaptive)
+{
+    wc->max = max;
+    wc->min = max < WINDOW_MIN ? max : WINDOW_MIN;
+    wc->window = adaptive && max > WINDOW_INITIAL ? WINDOW_INITIAL : max;
+    wc->ssthresh = max;
+    wc->completed = 0;
+    wc->timeouts = 0;
+    wc->baseline = 0;
+    wc->has_baseline = 0;
+    wc->cut = 0;
+    wc->adaptive = adaptive;
+    wc->raises = 0;
+    wc->cuts = 0;
+    wc->peak = wc->window;
+}
+
+/*
+ * Ends the current round, cutting the window if its share of timeouts rose
+ * and growing it otherwise.
+ */
+static void
+end_round(struct window_ctl *wc)
+{
+    uint32_t share = (uint32_t) ((uint64_t) wc->timeouts * 1000
+                                 / wc->completed);
+    uint32_t step = 0;
+    int rose = wc->has_baseline && share >= wc->baseline + WINDOW_TIMEOUT_RISE;
+
+    /*
+     * The average is only updated from rounds taken as normal, so that a run
+     * of lossy rounds doesn't come to look normal
+     */
+    if (!wc->has_baseline)
+    {
+        wc->baseline = share;
+        wc->has_baseline = 1;
+    }
+    else if (!rose)
+    {
+        wc->baseline = (3 * wc->baseline + share) / 4;
+    }
+
+    if (rose)
+    {
+        window_loss(wc);
+    }
+    else if (!wc->cut && wc->window < wc->max)
+    {
+        step = wc->window < wc->ssthresh ? wc->window
+               : wc->max / WINDOW_STEPS ? wc->max / WINDOW_STEPS : 1;
+        wc->window = wc->max - wc->window > step ? wc->window + step
+                                                  : wc->max;
+        wc->raises++;
+
+        if (wc->window > wc->peak)
+        {
+            wc->peak = wc->window;
+        }
+    }
+
+    wc->completed = 0;
+    wc->timeouts = 0;
+    wc->cut = 0;
+}
+
+void
+window_reply(struct window_ctl *wc)
+{
+    if (wc->adaptive && ++wc->completed >= wc->window)
+    {
+        end_round(wc);
+    }
+}
+
+void
+window_timeout(struct window_ctl *wc)
+{
+    if (wc->adaptive)
+    {
+        wc->timeouts++;
+
+        if (++wc->completed >= wc->window)
+        {
+            end_round(wc);
+        }
+    }
+}
+
+void
+window_loss(struct window_ctl *wc)
+{
+    if (!wc->adaptive || wc->cut)
+    {
+        return;
+    }
+
+    wc->window = wc->window / 2 > wc->min ? wc->window / 2 : wc->min;
+    wc->ssthresh = wc->window;
+    wc->cut = 1;
+    wc->cuts++;
+}
@@ -0,0 +1,92 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <stdint.h>
+
+/*
+ * Number of probes an adaptive window starts out with
+ */
+#define WINDOW_INITIAL      64
+
+/*
+ * Smallest an adaptive window is ever cut to
+ */
+#define WINDOW_MIN          8
+
+/*
+ * Number of additive increases it takes to grow from nothing to the largest
+ * window, so that growth past the first loss keeps pace with large windows
+ */
+#define WINDOW_STEPS        64
+
+/*
+ * Rise (in thousandths of the probes completed) in the share of probes timing
+ * out from one round to the next that is taken as a sign of loss rather than
+ * of a sparser part of the network
+ */
+#define WINDOW_TIMEOUT_RISE 100
+
+/*
+ * Controller adapting the number of probes kept outstanding to the network,
+ * AIMD style.
+ *
+ * window is the number of probes that may be outstanding, between min and
+ * max. A round lasts until as many probes as the window held at its start
+ * have completed. After a round without loss, the window doubles until it
+ * reaches ssthresh (or the first loss) and then grows by max / WINDOW_STEPS
+ * per round. A loss halves it and sets ssthresh to the new size; further
+ * losses within the same round are ignored, since they are most likely
+ * caused by the same congestion.
+ *
+ * Losses are reported by the engines (a full send buffer or a reply that
+ * came after its probe timed out) or detected at the end of a round, if the
+ * share of its probes that timed out rose by WINDOW_TIMEOUT_RISE or more over
+ * the average of earlier rounds. Most probes of a sparse network time out
+ * however fast it is scanned, so it is a rise that counts, not the share.
+ *
+ * raises, cuts and peak record the controller's decisions. If the window is
+ * not adaptive, it stays at max.
+ */
+struct window_ctl
+{
+    uint32_t window;
+    uint32_t min;
+    uint32_t max;
+    uint32_t ssthresh;
+    uint32_t completed;
+    uint32_t timeouts;
+    uint32_t baseline;
+    int has_baseline;
+    int cut;
+    int adaptive;
+    uint64_t raises;
+    uint64_t cuts;
+    uint32_t peak;
+};
+
+/*
+ * Sets up a controller for a window of at most max probes.
+ */
+void
+window_init(struct window_ctl *wc, uint32_t max, int adaptive);
+
+/*
+ * Records that an outstanding probe was answered in time.
+ */
+void
+window_reply(struct window_ctl *wc);
+
+/*
+ * Records that an outstanding probe timed out.
+ */
+void
+window_timeout(struct window_ctl *wc);
+
+/*
+ * Records a sign of loss, cutting the window unless it was already cut this
+ * round.
+ */
+void
+window_loss(struct window_ctl *wc);
+
+#endif /* WINDOW_H */